@@ -1,208 +1,655 @@
 
 #include "include/fastpath.h"
 
-#define BRIDGE_HASH_ENTRIES     (64 * 1024)
-
 #define BRIDGE_FDB_FLAG_DYNAMIC 0x01
 #define BRIDGE_FDB_FLAG_STATIC  0x02
 #define BRIDGE_FDB_FLAG_LOCAL   0x10
 
-#define BRIDGE_MAX_PORTS        16
-#define BRIDGE_INVALID_PORT     0xFF
+#define BRIDGE_INVALID_PORT     0xFFFF
+
+/*
+ * One FDB is shared by all bridges, keyed by bridge VID and MAC, so a
+ * bridge costs nothing until it learns and only its MAC limit bounds what
+ * it takes. It is a pool of preallocated entries indexed from a table of
+ * cache line sized buckets, a key sitting in one of two buckets.
+ * Lookups, and the refresh of a known source (last seen time, port move),
+ * are plain loads and stores from any lcore. Everything else is done by a
+ * single writer, the exception lcore: new MACs reach it through a learn
+ * ring per datapath lcore, and it ages entries out a few buckets at a time.
+ * An aged entry is unlinked at once but reused only BRIDGE_FDB_GRACE
+ * seconds later, when no lookup can still be reading it.
+ */
+#define BRIDGE_FDB_BUCKET_ENTRIES   8
+#define BRIDGE_FDB_GRACE            2
 
 struct bridge_fdb_entry {
-    uint8_t port;
+    uint64_t key;           /* bridge VID << 48 | MAC */
+    uint32_t seen;          /* bridge_fdb_clock when last seen as source */
+    uint16_t port;
     uint8_t flag;
 };
 
+/* idx 0 is an empty slot, entry 0 is never used */
+struct bridge_fdb_bucket {
+    uint16_t sig[BRIDGE_FDB_BUCKET_ENTRIES];
+    uint32_t idx[BRIDGE_FDB_BUCKET_ENTRIES];
+} __rte_cache_aligned;
+
+struct bridge_fdb {
+    struct bridge_fdb_bucket *buckets;
+    struct bridge_fdb_entry *entries;
+    uint32_t bucket_mask;
+    uint32_t size;
+    uint32_t aging;
+
+    /* writer only, free entries in the order they may be reused */
+    uint32_t *free_fifo;
+    uint32_t free_head;
+    uint32_t n_free;
+    uint32_t sweep_bucket;
+
+    /* stats */
+    uint64_t learned;
+    uint64_t aged;
+    uint64_t full;
+    uint64_t learn_ops;     /* inserts timed in learn_cycles, refreshes too */
+    uint64_t learn_cycles;
+};
+
 struct bridge_private {
     uint16_t vid;
-    uint16_t port_num;
     struct module *upper;
-    struct module *port[BRIDGE_MAX_PORTS];
-    rte_spinlock_t lock[FASTPATH_MAX_SOCKETS];
-    struct rte_hash *bridge_hash_tbl[FASTPATH_MAX_SOCKETS];
-    struct bridge_fdb_entry *bridge_fdb[BRIDGE_HASH_ENTRIES];
+
+    /* grown as ports connect, up to BRIDGE_MAX_PORTS */
+    struct module **port;
+    uint16_t max_ports;
+
+    /* connected ports, flooding goes through these only */
+    uint16_t *flood;
+    uint16_t n_flood;
+    uint32_t flags;             /* BRIDGE_F_ */
+
+    /* FDB entries of the bridge, writer only */
+    uint32_t n_macs;
+    uint32_t mac_limit;
+    uint64_t limited;
 };
 
+/* a source MAC a datapath lcore did not find */
+struct bridge_learn {
+    struct module *br;
+    struct ether_addr mac;
+    uint16_t port;
+};
+
+struct bridge_learn_queue {
+    struct rte_ring *ring;
+    uint64_t drops;
+} __rte_cache_aligned;
+
 struct module *bridge_dev[VLAN_VID_MAX];
 
-static uint8_t bridge_get_port(struct module *br, struct module *port);
-static void bridge_flood(struct rte_mbuf *m, struct module *br, uint8_t input);
-static struct bridge_fdb_entry * bridge_fdb_lookup(struct module *br, struct ether_addr* ea);
-static struct bridge_fdb_entry * bridge_fdb_create(uint8_t port, uint8_t flag);
-static int bridge_fdb_update(struct module *br, struct ether_addr *addr, uint8_t index);
-static void bridge_fdb_init(struct module *br);
+static struct bridge_fdb bridge_fdb;
 
-static uint8_t bridge_get_port(struct module *br, struct module *port)
+static struct rte_mempool *bridge_learn_pool;
+static struct bridge_learn_queue bridge_learn_queues[FASTPATH_MAX_LCORES];
+static uint32_t bridge_learn_producers[FASTPATH_MAX_LCORES];
+static uint32_t n_bridge_learn_producers;
+static uint32_t bridge_learn_lcore = (uint32_t) -1;
+
+/* seconds, advanced by the writer */
+static volatile uint32_t bridge_fdb_clock;
+static struct fastpath_timer bridge_fdb_timer;
+
+static uint16_t bridge_get_port(struct module *br, struct module *port);
+static void bridge_flood(struct rte_mbuf *m, struct module *br, uint16_t input,
+    const struct snoop_ports *members);
+static void bridge_fdb_learn_bulk(uint32_t lcore, struct module **brs,
+    struct ether_addr **macs, uint16_t *ports, uint32_t n_learn);
+static int bridge_fdb_insert(struct bridge_fdb *fdb, struct bridge_private *private,
+    const struct ether_addr *ea, uint16_t port, uint8_t flag);
+
+/* The port remembers its index, bridge_connect */
+static inline uint16_t bridge_get_port(struct module *br, struct module *port)
 {
-    uint32_t i;
     struct bridge_private *private = (struct bridge_private *)br->private;
+    uint16_t i = port->upper_port;
 
-    for (i = 0; i < BRIDGE_MAX_PORTS; i++) {
-        if (private->port[i] == port) {
-            return i;
-        }
+    if (likely(i < private->max_ports && private->port[i] == port)) {
+        return i;
     }
 
     return BRIDGE_INVALID_PORT;
 }
 
+static inline uint64_t
+bridge_fdb_key(uint16_t vid, const struct ether_addr *ea)
+{
+    uint64_t key = 0;
+
+    memcpy(&key, ea, sizeof(struct ether_addr));
+    return key | ((uint64_t) vid << 48);
+}
+
+static inline uint32_t
+bridge_fdb_hash(uint64_t key)
+{
+    return rte_hash_crc_4byte((uint32_t)(key >> 32), rte_hash_crc_4byte((uint32_t) key, 0));
+}
+
+static inline uint32_t
+bridge_fdb_bucket_alt(const struct bridge_fdb *fdb, uint32_t hash)
+{
+    return (hash ^ ((hash >> 16) * 0x5bd1e995)) & fdb->bucket_mask;
+}
+
+/* Any lcore, lock free */
+static inline struct bridge_fdb_entry *
+bridge_fdb_lookup(const struct bridge_fdb *fdb, uint64_t key)
+{
+    uint32_t hash = bridge_fdb_hash(key);
+    uint32_t b[2] = {hash & fdb->bucket_mask, bridge_fdb_bucket_alt(fdb, hash)};
+    uint16_t sig = (uint16_t)(hash >> 16);
+    uint32_t i, j, idx;
+
+    for (j = 0; j < 2; j++) {
+        const struct bridge_fdb_bucket *bucket = &fdb->buckets[b[j]];
+
+        for (i = 0; i < BRIDGE_FDB_BUCKET_ENTRIES; i++) {
+            if (bucket->sig[i] != sig || (idx = bucket->idx[i]) == 0) {
+                continue;
+            }
+
+            if (fdb->entries[idx].key == key) {
+                return &fdb->entries[idx];
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Packets reaching the bridge are gathered per lcore and handled when the
+ * burst they came in is done, or FASTPATH_BRIDGE_BURST of them are
+ * waiting: source and destination keys of the whole batch are looked up
+ * together, prefetching the buckets then the entries, and the new
+ * sources are handed to the writer in one go.
+ */
+struct bridge_batch {
+    struct rte_mbuf *pkts[FASTPATH_BRIDGE_BURST];
+    struct module *br[FASTPATH_BRIDGE_BURST];
+    struct module *peer[FASTPATH_BRIDGE_BURST];
+    uint32_t n_pkts;
+
+    /* stats */
+    uint64_t pkts_done;
+    uint64_t cycles;
+    uint64_t flood_nombuf;
+    uint64_t suppressed;
+    uint64_t mcast_filtered;
+} __rte_cache_aligned;
+
+static struct bridge_batch bridge_batches[FASTPATH_MAX_LCORES];
+
+/*
+ * Copy of a flooded packet: a header mbuf of its own holding the L2
+ * header, which the lower modules may tag, chained to the payload all
+ * the copies share.
+ */
 static inline struct rte_mbuf *
-bridge_out_pkt(struct rte_mbuf *pkt, int use_clone)
+bridge_out_pkt(struct rte_mbuf *payload, const struct ether_hdr *eth_hdr,
+    const struct fastpath_pkt_metadata *c, struct rte_mempool *mp)
 {
-    int socketid;
     struct rte_mbuf *hdr;
-    struct rte_mempool *mp;
-
-    socketid = rte_socket_id();
-    mp = fastpath.indirect_pools[socketid];
+    struct fastpath_pkt_metadata *hc;
 
     /* Create new mbuf for the header. */
     if (unlikely ((hdr = rte_pktmbuf_alloc(mp)) == NULL))
         return (NULL);
 
-    /* If requested, then make a new clone packet. */
-    if (use_clone != 0 &&
-        unlikely ((pkt = rte_pktmbuf_clone(pkt, mp)) == NULL)) {
-        rte_pktmbuf_free(hdr);
-        return (NULL);
-    }
+    rte_memcpy(rte_pktmbuf_append(hdr, (uint16_t)sizeof(struct ether_hdr)),
+        eth_hdr, sizeof(struct ether_hdr));
 
     /* prepend new header */
-    hdr->next = pkt;
+    hdr->next = payload;
 
     /* update header's fields */
-    hdr->pkt_len = (uint16_t)(hdr->data_len + pkt->pkt_len);
-    hdr->nb_segs = (uint8_t)(pkt->nb_segs + 1);
+    hdr->pkt_len = hdr->data_len + payload->pkt_len;
+    hdr->nb_segs = (uint8_t)(payload->nb_segs + 1);
 
     /* copy metadata from source packet*/
-    hdr->port = pkt->port;
-    hdr->vlan_tci = pkt->vlan_tci;
-    hdr->tx_offload = pkt->tx_offload;
-    hdr->hash = pkt->hash;
+    hdr->port = payload->port;
+    hdr->vlan_tci = payload->vlan_tci;
+    hdr->tx_offload = payload->tx_offload;
+    hdr->hash = payload->hash;
 
-    hdr->ol_flags = pkt->ol_flags;
+    hdr->ol_flags = payload->ol_flags;
+
+    hc = (struct fastpath_pkt_metadata *)RTE_MBUF_METADATA_UINT8_PTR(hdr, 0);
+    *hc = *c;
+    hc->l2_off = hdr->data_off;
 
     __rte_mbuf_sanity_check(hdr, 1);
     return (hdr);
 }
 
-static void bridge_flood(struct rte_mbuf *m, struct module *br, uint8_t input)
+/* Every port but input, or with members only these */
+static void bridge_flood(struct rte_mbuf *m, struct module *br, uint16_t input,
+    const struct snoop_ports *members)
 {
     int socketid;
-    uint32_t i, pkt_num;
-    struct rte_mbuf *mc;
-    struct rte_mempool *mp;
+    uint32_t i, n_ports, n_out;
+    uint16_t ports[BRIDGE_MAX_PORTS];
+    struct rte_mbuf *out[BRIDGE_MAX_PORTS];
+    struct rte_mbuf *payload, *seg;
+    struct ether_hdr *eth_hdr;
     struct bridge_private *private = (struct bridge_private *)br->private;
+    struct fastpath_pkt_metadata *c =
+        (struct fastpath_pkt_metadata *)RTE_MBUF_METADATA_UINT8_PTR(m, 0);
+
+    n_ports = 0;
+    for (i = 0; i < private->n_flood; i++) {
+        if (private->flood[i] != input &&
+            (members == NULL || snoop_port_is_set(members, private->flood[i]))) {
+            ports[n_ports++] = private->flood[i];
+        }
+    }
+
+    if (n_ports == 0) {
+        if (input != BRIDGE_MAX_PORTS) {
+            SEND_PKT_DIRECT(m, br, private->upper, PKT_DIR_RECV,
+                MODULE_TYPE_INTERFACE, interface_receive);
+        } else {
+            fastpath_log_debug("bridge %s has no port to flood to, drop\n", br->name);
+            rte_pktmbuf_free(m);
+        }
+        return;
+    }
 
     socketid = rte_socket_id();
-    mp = fastpath.indirect_pools[socketid];
-    pkt_num = private->port_num;
-
-    for (i = 0; i < BRIDGE_MAX_PORTS && pkt_num > 0; i++) {
-        if (i != input && private->port[i] != NULL) {
-            if (pkt_num > 1) {
-                mc = rte_pktmbuf_clone(m, mp);
-                if (likely(mc != NULL)) {
-                    rte_pktmbuf_prepend(mc, (uint16_t)sizeof(struct ether_hdr));
-                    SEND_PKT(mc, br, private->port[i], PKT_DIR_XMIT);
-                }
-            } else {
-                /* last pkt */
-                rte_pktmbuf_prepend(m, (uint16_t)sizeof(struct ether_hdr));
-                SEND_PKT(m, br, private->port[i], PKT_DIR_XMIT);
+    eth_hdr = (struct ether_hdr *)FASTPATH_PKT_HDR(m, c->l2_off);
+
+    /* the copies share the network header, finish its checksum once */
+    if (m->ol_flags & PKT_TX_IP_CKSUM) {
+        struct ipv4_hdr *ipv4_hdr = rte_pktmbuf_mtod(m, struct ipv4_hdr *);
+
+        ipv4_hdr->hdr_checksum = 0;
+        ipv4_hdr->hdr_checksum = rte_ipv4_cksum(ipv4_hdr);
+        m->ol_flags &= ~(PKT_TX_IP_CKSUM | PKT_TX_IPV4);
+    }
 
-                return;
+    /* a packet going up as well is left to the interface, the ports share a clone */
+    if (input != BRIDGE_MAX_PORTS) {
+        payload = rte_pktmbuf_clone(m, fastpath.indirect_pools[socketid]);
+    } else {
+        payload = m;
+    }
+
+    n_out = 0;
+    if (likely(payload != NULL)) {
+        for (i = 0; i < n_ports; i++) {
+            out[n_out] = bridge_out_pkt(payload, eth_hdr, c, fastpath.header_pools[socketid]);
+            if (unlikely(out[n_out] == NULL)) {
+                break;
+            }
+            n_out++;
+        }
+
+        /* one reference per copy, before any of them may be freed */
+        if (n_out == 0) {
+            rte_pktmbuf_free(payload);
+        } else {
+            for (seg = payload; seg != NULL; seg = seg->next) {
+                rte_mbuf_refcnt_update(seg, (int16_t)(n_out - 1));
             }
-            
-            pkt_num--;
         }
     }
 
-    if (pkt_num == 1 && input != BRIDGE_MAX_PORTS) {
-        SEND_PKT(m, br, private->upper, PKT_DIR_RECV);
-    } else {
-        fastpath_log_error("bridge_flood: error occured pkt num %d input %d", pkt_num, input);
-        rte_pktmbuf_free(m);
+    if (unlikely(n_out < n_ports)) {
+        fastpath_log_debug("bridge %s flood to %u of %u ports, no mbuf\n",
+            br->name, n_out, n_ports);
+        if (rte_lcore_id() < FASTPATH_MAX_LCORES) {
+            bridge_batches[rte_lcore_id()].flood_nombuf += n_ports - n_out;
+        }
+    }
+
+    for (i = 0; i < n_out; i++) {
+        SEND_PKT(out[i], br, private->port[ports[i]], PKT_DIR_XMIT);
+    }
+
+    if (input != BRIDGE_MAX_PORTS) {
+        SEND_PKT_DIRECT(m, br, private->upper, PKT_DIR_RECV,
+            MODULE_TYPE_INTERFACE, interface_receive);
     }
 
     return;
 }
 
-void bridge_receive(struct rte_mbuf *m, 
-    struct module *peer, struct module *br)
+/* Any lcore, lock free, keys[i] found in entries[i] or NULL */
+static void
+bridge_fdb_lookup_bulk(const struct bridge_fdb *fdb, const uint64_t *keys,
+    uint32_t n_keys, struct bridge_fdb_entry **entries)
 {
-    uint8_t port;
-    struct ether_hdr *eth_hdr;
-    struct bridge_fdb_entry *entry;
+    uint32_t hash[2 * FASTPATH_BRIDGE_BURST];
+    uint32_t cand[2 * FASTPATH_BRIDGE_BURST];
+    uint32_t i, j, k;
+
+    for (k = 0; k < n_keys; k++) {
+        hash[k] = bridge_fdb_hash(keys[k]);
+        rte_prefetch0(&fdb->buckets[hash[k] & fdb->bucket_mask]);
+        rte_prefetch0(&fdb->buckets[bridge_fdb_bucket_alt(fdb, hash[k])]);
+    }
+
+    /* the first slot with the signature, its entry is likely the one */
+    for (k = 0; k < n_keys; k++) {
+        uint32_t b[2] = {hash[k] & fdb->bucket_mask, bridge_fdb_bucket_alt(fdb, hash[k])};
+        uint16_t sig = (uint16_t)(hash[k] >> 16);
+
+        cand[k] = 0;
+        for (j = 0; j < 2 && cand[k] == 0; j++) {
+            const struct bridge_fdb_bucket *bucket = &fdb->buckets[b[j]];
+
+            for (i = 0; i < BRIDGE_FDB_BUCKET_ENTRIES; i++) {
+                if (bucket->sig[i] == sig && bucket->idx[i] != 0) {
+                    cand[k] = bucket->idx[i];
+                    rte_prefetch0(&fdb->entries[cand[k]]);
+                    break;
+                }
+            }
+        }
+    }
+
+    for (k = 0; k < n_keys; k++) {
+        if (cand[k] == 0) {
+            entries[k] = NULL;
+        } else if (likely(fdb->entries[cand[k]].key == keys[k])) {
+            entries[k] = &fdb->entries[cand[k]];
+        } else {
+            /* signature collision, look at every slot */
+            entries[k] = bridge_fdb_lookup(fdb, keys[k]);
+        }
+    }
+}
+
+/* An answer goes back out the port the question came from */
+static inline void
+bridge_reply(struct rte_mbuf *m, struct module *br, uint16_t input)
+{
+    struct bridge_private *private = (struct bridge_private *)br->private;
+
+    rte_pktmbuf_prepend(m, (uint16_t)sizeof(struct ether_hdr));
+    SEND_PKT(m, br, private->port[input], PKT_DIR_XMIT);
+}
+
+/*
+ * ARP is for the kernel, unless the bridge suppressing it answers; a
+ * solicitation may be answered the same way, and with snooping a
+ * multicast packet goes to the ports of its group only. 1 when the
+ * packet was taken care of.
+ */
+static int
+bridge_snoop(struct rte_mbuf *m, struct module *br, uint16_t input, uint32_t now,
+    uint32_t lcore)
+{
+    struct snoop_ports members;
     struct bridge_private *private = (struct bridge_private *)br->private;
     struct fastpath_pkt_metadata *c =
         (struct fastpath_pkt_metadata *)RTE_MBUF_METADATA_UINT8_PTR(m, 0);
+    struct ether_hdr *eth_hdr = (struct ether_hdr *)FASTPATH_PKT_HDR(m, c->l2_off);
 
-    eth_hdr = (struct ether_hdr *)c->mac_header;
+    RTE_SET_USED(lcore);
 
-    port = bridge_get_port(br, peer);
-    if (port == BRIDGE_INVALID_PORT) {
-        fastpath_log_error("dev %s doest not participate in bridge %s\n", 
-            peer->name, br->name);
-        rte_pktmbuf_free(m);
-        return;
+    if (c->pkt_type == FASTPATH_PKT_ARP) {
+        if ((private->flags & BRIDGE_F_ARP_SUPPRESS) && c->protocol == ETHER_TYPE_ARP &&
+            snoop_arp(m, eth_hdr, private->vid, now)) {
+            bridge_reply(m, br, input);
+#if FASTPATH_STATS
+            if (lcore < FASTPATH_MAX_LCORES) {
+                bridge_batches[lcore].suppressed++;
+            }
+#endif
+        } else {
+            rte_pktmbuf_prepend(m, c->l3_off - c->l2_off);
+            kni_ingress(m);
+        }
+        return 1;
     }
 
-    fastpath_log_debug("bridge %s receive packet "MAC_FMT" ==> "MAC_FMT" from port %d\n",
-        br->name, MAC_ARG(&eth_hdr->s_addr), MAC_ARG(&eth_hdr->d_addr), port);
-    
-    if (!is_valid_assigned_ether_addr(&eth_hdr->s_addr)) {
-        fastpath_log_error("bridge %s receive invalid packet, drop\n", br->name);
-        rte_pktmbuf_free(m);
-        return;
+    if (!is_multicast_ether_addr(&eth_hdr->d_addr)) {
+        return 0;
     }
 
-    if (bridge_fdb_update(br, &eth_hdr->s_addr, port) < 0) {
-        fastpath_log_error("bridge %s update source address failed\n", br->name);
-        rte_pktmbuf_free(m);
-        return;
+    if ((private->flags & BRIDGE_F_ARP_SUPPRESS) && c->protocol == ETHER_TYPE_IPv6 &&
+        snoop_nd(m, eth_hdr, private->vid, now)) {
+        bridge_reply(m, br, input);
+#if FASTPATH_STATS
+        if (lcore < FASTPATH_MAX_LCORES) {
+            bridge_batches[lcore].suppressed++;
+        }
+#endif
+        return 1;
     }
 
-    entry = bridge_fdb_lookup(br, &eth_hdr->d_addr);
-    if (entry == NULL) {
-        bridge_flood(m, br, port);
-    } else {
-        if (entry->flag & BRIDGE_FDB_FLAG_LOCAL) {
-            SEND_PKT(m, br, private->upper, PKT_DIR_RECV);
-        } else {
-            if (entry->port == port) {
-                fastpath_log_debug("source destination port are same, drop packet\n", br->name);
-                rte_pktmbuf_free(m);
-                return;
+    if ((private->flags & BRIDGE_F_MCAST_SNOOPING) &&
+        snoop_mcast(m, c->protocol, private->vid, input, now, &members) == SNOOP_FILTER) {
+        bridge_flood(m, br, input, &members);
+#if FASTPATH_STATS
+        if (lcore < FASTPATH_MAX_LCORES) {
+            bridge_batches[lcore].mcast_filtered++;
+        }
+#endif
+        return 1;
+    }
+
+    return 0;
+}
+
+static void
+bridge_receive_bulk(struct rte_mbuf **pkts, struct module **brs,
+    struct module **peers, uint32_t n_pkts, uint32_t lcore)
+{
+    uint64_t keys[2 * FASTPATH_BRIDGE_BURST];
+    struct bridge_fdb_entry *entries[2 * FASTPATH_BRIDGE_BURST];
+    uint16_t ports[FASTPATH_BRIDGE_BURST];
+    struct module *learn_br[FASTPATH_BRIDGE_BURST];
+    struct ether_addr *learn_mac[FASTPATH_BRIDGE_BURST];
+    uint16_t learn_port[FASTPATH_BRIDGE_BURST];
+    uint32_t learn_key[FASTPATH_BRIDGE_BURST];
+    uint32_t i, k, n_learn = 0, now = bridge_fdb_clock;
+
+    for (i = 0; i < n_pkts; i++) {
+        struct rte_mbuf *m = pkts[i];
+        struct module *br = brs[i];
+        struct bridge_private *private = (struct bridge_private *)br->private;
+        struct fastpath_pkt_metadata *c =
+            (struct fastpath_pkt_metadata *)RTE_MBUF_METADATA_UINT8_PTR(m, 0);
+        struct ether_hdr *eth_hdr = (struct ether_hdr *)FASTPATH_PKT_HDR(m, c->l2_off);
+
+        /* a dropped packet keeps looking up the all zero key, never learned */
+        keys[2 * i] = 0;
+        keys[2 * i + 1] = 0;
+
+        ports[i] = bridge_get_port(br, peers[i]);
+        if (ports[i] == BRIDGE_INVALID_PORT) {
+            fastpath_log_error("dev %s doest not participate in bridge %s\n", 
+                peers[i]->name, br->name);
+            rte_pktmbuf_free(m);
+            pkts[i] = NULL;
+            continue;
+        }
+
+        fastpath_log_debug("bridge %s receive packet "MAC_FMT" ==> "MAC_FMT" from port %d\n",
+            br->name, MAC_ARG(&eth_hdr->s_addr), MAC_ARG(&eth_hdr->d_addr), ports[i]);
+
+        if (!is_valid_assigned_ether_addr(&eth_hdr->s_addr)) {
+            fastpath_log_error("bridge %s receive invalid packet, drop\n", br->name);
+            rte_pktmbuf_free(m);
+            pkts[i] = NULL;
+            continue;
+        }
+
+        keys[2 * i] = bridge_fdb_key(private->vid, &eth_hdr->s_addr);
+        keys[2 * i + 1] = bridge_fdb_key(private->vid, &eth_hdr->d_addr);
+    }
+
+    bridge_fdb_lookup_bulk(&bridge_fdb, keys, 2 * n_pkts, entries);
+
+    /* refresh known sources in place, leave new ones to the writer */
+    for (i = 0; i < n_pkts; i++) {
+        struct bridge_fdb_entry *entry = entries[2 * i];
+        struct fastpath_pkt_metadata *c;
+        struct ether_hdr *eth_hdr;
+
+        if (pkts[i] == NULL) {
+            continue;
+        }
+
+        c = (struct fastpath_pkt_metadata *)RTE_MBUF_METADATA_UINT8_PTR(pkts[i], 0);
+        eth_hdr = (struct ether_hdr *)FASTPATH_PKT_HDR(pkts[i], c->l2_off);
+
+        if (likely(entry != NULL)) {
+            if (unlikely(entry->port != ports[i]) && (entry->flag & BRIDGE_FDB_FLAG_DYNAMIC)) {
+                fastpath_log_debug("update "MAC_FMT" port to %d old %d\n",
+                    MAC_ARG(&eth_hdr->s_addr), ports[i], entry->port);
+                entry->port = ports[i];
+            }
+
+            if (unlikely(entry->seen != now)) {
+                entry->seen = now;
+            }
+            continue;
+        }
+
+        /* a new source sending several packets of the burst is learned once */
+        for (k = 0; k < n_learn; k++) {
+            if (keys[learn_key[k]] == keys[2 * i]) {
+                break;
             }
+        }
+
+        if (k == n_learn) {
+            learn_br[n_learn] = brs[i];
+            learn_mac[n_learn] = &eth_hdr->s_addr;
+            learn_port[n_learn] = ports[i];
+            learn_key[n_learn] = 2 * i;
+            n_learn++;
+        }
+    }
+
+    /* before forwarding, which may release the source addresses */
+    if (n_learn != 0) {
+        bridge_fdb_learn_bulk(lcore, learn_br, learn_mac, learn_port, n_learn);
+    }
+
+    for (i = 0; i < n_pkts; i++) {
+        struct rte_mbuf *m = pkts[i];
+        struct module *br = brs[i];
+        struct bridge_private *private = (struct bridge_private *)br->private;
+        struct bridge_fdb_entry *entry = entries[2 * i + 1];
+        struct fastpath_pkt_metadata *c;
+
+        if (m == NULL) {
+            continue;
+        }
+
+        c = (struct fastpath_pkt_metadata *)RTE_MBUF_METADATA_UINT8_PTR(m, 0);
+        if ((unlikely(c->pkt_type == FASTPATH_PKT_ARP) || (entry == NULL && private->flags != 0)) &&
+            bridge_snoop(m, br, ports[i], now, lcore)) {
+            continue;
+        }
+
+        if (entry == NULL) {
+            bridge_flood(m, br, ports[i], NULL);
+        } else if (entry->flag & BRIDGE_FDB_FLAG_LOCAL) {
+            SEND_PKT_DIRECT(m, br, private->upper, PKT_DIR_RECV,
+                MODULE_TYPE_INTERFACE, interface_receive);
+        } else if (entry->port == ports[i]) {
+            fastpath_log_debug("source destination port are same, drop packet\n", br->name);
+            rte_pktmbuf_free(m);
+        } else {
             rte_pktmbuf_prepend(m, (uint16_t)sizeof(struct ether_hdr));
             SEND_PKT(m, br, private->port[entry->port], PKT_DIR_XMIT);
         }
     }
 }
 
+void bridge_receive(struct rte_mbuf *m, 
+    struct module *peer, struct module *br)
+{
+    uint32_t lcore = rte_lcore_id();
+    struct bridge_batch *batch;
+
+    /* not a datapath lcore, nothing would flush a batch */
+    if (unlikely(lcore >= FASTPATH_MAX_LCORES)) {
+        bridge_receive_bulk(&m, &br, &peer, 1, lcore);
+        return;
+    }
+
+    batch = &bridge_batches[lcore];
+    batch->pkts[batch->n_pkts] = m;
+    batch->br[batch->n_pkts] = br;
+    batch->peer[batch->n_pkts] = peer;
+    if (++batch->n_pkts == FASTPATH_BRIDGE_BURST) {
+        bridge_flush(lcore);
+    }
+}
+
+/**
+ * Handle what the bridges gathered on the lcore, at the end of a burst
+ */
+void bridge_flush(uint32_t lcore)
+{
+    struct bridge_batch *batch = &bridge_batches[lcore];
+    uint32_t n_pkts = batch->n_pkts;
+#if FASTPATH_STATS
+    uint64_t start;
+#endif
+
+    if (n_pkts == 0) {
+        return;
+    }
+
+#if FASTPATH_STATS
+    start = rte_rdtsc();
+#endif
+
+    batch->n_pkts = 0;
+    bridge_receive_bulk(batch->pkts, batch->br, batch->peer, n_pkts, lcore);
+
+#if FASTPATH_STATS
+    batch->cycles += rte_rdtsc() - start;
+    batch->pkts_done += n_pkts;
+#endif
+}
+
 void bridge_xmit(struct rte_mbuf *m, struct module *peer, struct module *br)
 {
     struct bridge_fdb_entry *entry;
     struct ether_hdr *eth_hdr;
+    struct snoop_ports members;
     struct bridge_private *private = (struct bridge_private *)br->private;
     struct fastpath_pkt_metadata *c =
         (struct fastpath_pkt_metadata *)RTE_MBUF_METADATA_UINT8_PTR(m, 0);
 
     RTE_SET_USED(peer);
 
-    eth_hdr = (struct ether_hdr *)c->mac_header;
+    eth_hdr = (struct ether_hdr *)FASTPATH_PKT_HDR(m, c->l2_off);
 
     fastpath_log_debug("bridge %s forward "MAC_FMT"\n", br->name, MAC_ARG(&eth_hdr->d_addr));
 
     if (is_multicast_ether_addr(&eth_hdr->d_addr)) {
-        bridge_flood(m, br, BRIDGE_MAX_PORTS);
+        if ((private->flags & BRIDGE_F_MCAST_SNOOPING) &&
+            snoop_mcast(m, c->protocol, private->vid, BRIDGE_MAX_PORTS,
+                bridge_fdb_clock, &members) == SNOOP_FILTER) {
+            bridge_flood(m, br, BRIDGE_MAX_PORTS, &members);
+        } else {
+            bridge_flood(m, br, BRIDGE_MAX_PORTS, NULL);
+        }
     } else {
-        entry = bridge_fdb_lookup(br, &eth_hdr->d_addr);
+        entry = bridge_fdb_lookup(&bridge_fdb, bridge_fdb_key(private->vid, &eth_hdr->d_addr));
         if (entry == NULL) {
-            bridge_flood(m, br, BRIDGE_MAX_PORTS);
+            bridge_flood(m, br, BRIDGE_MAX_PORTS, NULL);
             return;
         }
 
@@ -211,121 +658,421 @@ void bridge_xmit(struct rte_mbuf *m, struct module *peer, struct module *br)
     }
 }
 
-struct bridge_fdb_entry * bridge_fdb_lookup(struct module *br, struct ether_addr* ea)
+/* Writer only, the next free entry unless it may still be read */
+static uint32_t
+bridge_fdb_alloc(struct bridge_fdb *fdb)
 {
-    int ret;
-    int socketid;
-    struct bridge_private *private = (struct bridge_private *)br->private;
+    struct bridge_fdb_entry *entry;
+    uint32_t idx;
 
-    socketid = rte_socket_id();
-    ret = rte_hash_lookup(private->bridge_hash_tbl[socketid], (const void *)ea);
-    if (ret < 0) {
-        return NULL;
+    if (fdb->n_free == 0) {
+        return 0;
     }
-    
-    return private->bridge_fdb[ret];
+
+    idx = fdb->free_fifo[fdb->free_head];
+    entry = &fdb->entries[idx];
+    if (entry->flag != 0 && bridge_fdb_clock - entry->seen < BRIDGE_FDB_GRACE) {
+        return 0;
+    }
+
+    fdb->free_head = (fdb->free_head + 1) % fdb->size;
+    fdb->n_free--;
+
+    return idx;
+}
+
+static void
+bridge_fdb_free(struct bridge_fdb *fdb, uint32_t idx)
+{
+    fdb->entries[idx].seen = bridge_fdb_clock;
+    fdb->free_fifo[(fdb->free_head + fdb->n_free) % fdb->size] = idx;
+    fdb->n_free++;
 }
 
-struct bridge_fdb_entry * bridge_fdb_create(uint8_t port, uint8_t flag)
+/* Writer only */
+static int
+bridge_fdb_insert(struct bridge_fdb *fdb, struct bridge_private *private,
+    const struct ether_addr *ea, uint16_t port, uint8_t flag)
 {
+    uint64_t key = bridge_fdb_key(private->vid, ea);
+    uint32_t hash = bridge_fdb_hash(key);
+    uint32_t b[2] = {hash & fdb->bucket_mask, bridge_fdb_bucket_alt(fdb, hash)};
+    struct bridge_fdb_bucket *bucket = NULL;
     struct bridge_fdb_entry *entry;
+    uint32_t i, j, idx;
 
-    entry = rte_zmalloc(NULL, sizeof(struct bridge_fdb_entry), 0);
-    if (entry == NULL) {
-        fastpath_log_error("bridge_fdb_create: malloc failed\n");
-        return NULL;
+    /* learned twice, or by another lcore in the meantime */
+    entry = bridge_fdb_lookup(fdb, key);
+    if (entry != NULL) {
+        if (entry->flag & BRIDGE_FDB_FLAG_DYNAMIC) {
+            entry->port = port;
+        }
+        entry->seen = bridge_fdb_clock;
+        return 0;
     }
 
-    entry->flag = flag;
+    if (private->n_macs >= private->mac_limit) {
+        private->limited++;
+        return -ENOSPC;
+    }
+
+    for (j = 0; j < 2 && bucket == NULL; j++) {
+        for (i = 0; i < BRIDGE_FDB_BUCKET_ENTRIES; i++) {
+            if (fdb->buckets[b[j]].idx[i] == 0) {
+                bucket = &fdb->buckets[b[j]];
+                break;
+            }
+        }
+    }
+
+    if (bucket == NULL || (idx = bridge_fdb_alloc(fdb)) == 0) {
+        fdb->full++;
+        return -ENOSPC;
+    }
+
+    entry = &fdb->entries[idx];
+    entry->key = key;
     entry->port = port;
+    entry->flag = flag;
+    entry->seen = bridge_fdb_clock;
 
-    return entry;
+    /* the entry is complete before a lookup can reach it */
+    bucket->sig[i] = (uint16_t)(hash >> 16);
+    rte_wmb();
+    bucket->idx[i] = idx;
+
+    private->n_macs++;
+    fdb->learned++;
+
+    return 0;
 }
 
-int bridge_fdb_update(struct module *br, 
-    struct ether_addr *addr, uint8_t port)
+/* Writer only, unlink the dynamic entries not seen for the aging time */
+static void
+bridge_fdb_sweep(struct bridge_fdb *fdb, uint32_t n_buckets)
 {
-    int ret;
-    int socketid;
-    struct bridge_fdb_entry *entry;
-    struct bridge_private *private = (struct bridge_private *)br->private;
+    uint32_t i, n, idx;
 
-    entry = bridge_fdb_lookup(br, addr);
-    if (entry != NULL) {
-        if (entry->port != port) {
-            fastpath_log_debug("update "MAC_FMT" port to %d old %d\n",
-                MAC_ARG(addr), port, entry->port);
-            entry->port = port;
+    for (n = 0; n < n_buckets; n++) {
+        struct bridge_fdb_bucket *bucket = &fdb->buckets[fdb->sweep_bucket];
+
+        for (i = 0; i < BRIDGE_FDB_BUCKET_ENTRIES; i++) {
+            struct bridge_fdb_entry *entry;
+
+            idx = bucket->idx[i];
+            if (idx == 0) {
+                continue;
+            }
+
+            entry = &fdb->entries[idx];
+            if ((entry->flag & BRIDGE_FDB_FLAG_DYNAMIC) &&
+                bridge_fdb_clock - entry->seen >= fdb->aging) {
+                struct module *br = bridge_dev[entry->key >> 48];
+
+                bucket->idx[i] = 0;
+                bridge_fdb_free(fdb, idx);
+                fdb->aged++;
+                if (br != NULL) {
+                    ((struct bridge_private *)br->private)->n_macs--;
+                }
+            }
         }
 
-        return 0;
+        fdb->sweep_bucket = (fdb->sweep_bucket + 1) & fdb->bucket_mask;
     }
+}
 
-    entry = bridge_fdb_create(port, BRIDGE_FDB_FLAG_DYNAMIC);
-    if (entry == NULL) {
-        return -ENOMEM;
+/* Datapath, hand new sources to the writer */
+static void
+bridge_fdb_learn_bulk(uint32_t lcore, struct module **brs, struct ether_addr **macs,
+    uint16_t *ports, uint32_t n_learn)
+{
+    struct bridge_learn *learn[FASTPATH_BRIDGE_BURST];
+    struct bridge_learn_queue *queue;
+    uint32_t k, n_sent;
+
+    if (lcore == bridge_learn_lcore) {
+#if FASTPATH_STATS
+        uint64_t start = rte_rdtsc();
+#endif
+
+        for (k = 0; k < n_learn; k++) {
+            bridge_fdb_insert(&bridge_fdb, (struct bridge_private *)brs[k]->private,
+                macs[k], ports[k], BRIDGE_FDB_FLAG_DYNAMIC);
+        }
+
+#if FASTPATH_STATS
+        bridge_fdb.learn_cycles += rte_rdtsc() - start;
+        bridge_fdb.learn_ops += n_learn;
+#endif
+        return;
     }
 
-    socketid = rte_socket_id();
-    rte_spinlock_lock(&private->lock[socketid]);
-    ret = rte_hash_add_key(private->bridge_hash_tbl[socketid], (void *)addr);
-    if (ret < 0) {
-        rte_spinlock_unlock(&private->lock[socketid]);
-        fastpath_log_error("bridge_fdb_update: add key failed\n");
-        return ret;
+    if (unlikely(lcore >= FASTPATH_MAX_LCORES || bridge_learn_queues[lcore].ring == NULL)) {
+        return;
     }
 
-    if (private->bridge_fdb[ret] == NULL) {
-        private->bridge_fdb[ret] = entry;
-    } else {
-        rte_free(entry);
-        entry = private->bridge_fdb[ret];
-        entry->port = port;
+    /* a full ring only delays learning, the next packet asks again */
+    queue = &bridge_learn_queues[lcore];
+    if (rte_mempool_get_bulk(bridge_learn_pool, (void **) learn, n_learn) < 0) {
+        queue->drops += n_learn;
+        return;
     }
 
-    rte_spinlock_unlock(&private->lock[socketid]);
+    for (k = 0; k < n_learn; k++) {
+        learn[k]->br = brs[k];
+        ether_addr_copy(macs[k], &learn[k]->mac);
+        learn[k]->port = ports[k];
+    }
 
-    return 0;
+    n_sent = rte_ring_sp_enqueue_burst(queue->ring, (void **) learn, n_learn);
+    if (unlikely(n_sent < n_learn)) {
+        rte_mempool_put_bulk(bridge_learn_pool, (void **) &learn[n_sent], n_learn - n_sent);
+        queue->drops += n_learn - n_sent;
+    }
 }
 
-void bridge_fdb_init(struct module *br)
+static int
+bridge_lcore_is_learner(uint32_t lcore)
 {
-    char s[64];
-    int socketid;
-    struct bridge_private *private = (struct bridge_private *)br->private;
+    enum fastpath_lcore_type type = fastpath.lcore_params[lcore].type;
 
-    struct rte_hash_parameters bridge_hash_params = {
-        .name = NULL,
-        .entries = BRIDGE_HASH_ENTRIES,
-        .bucket_entries = 8,
-        .key_len = sizeof(struct ether_addr),
-        .hash_func_init_val = 0,
-    };
-    
-    for (socketid = 0; socketid < FASTPATH_MAX_SOCKETS; socketid++) {
-        if (fastpath_is_socket_used(socketid) == 0) {
+    return (type == e_FASTPATH_LCORE_WORKER ||
+            type == e_FASTPATH_LCORE_RX_WORKER ||
+            type == e_FASTPATH_LCORE_STAGE);
+}
+
+static void
+bridge_fdb_init(struct bridge_fdb *fdb, uint32_t size, uint32_t aging)
+{
+    uint32_t i, n_buckets;
+
+    /* buckets at most half full, so two candidates rarely both are full */
+    n_buckets = rte_align32pow2((2 * size + BRIDGE_FDB_BUCKET_ENTRIES - 1) /
+        BRIDGE_FDB_BUCKET_ENTRIES);
+
+    fdb->buckets = rte_zmalloc(NULL, n_buckets * sizeof(struct bridge_fdb_bucket),
+        RTE_CACHE_LINE_SIZE);
+    fdb->entries = rte_zmalloc(NULL, (size + 1) * sizeof(struct bridge_fdb_entry),
+        RTE_CACHE_LINE_SIZE);
+    fdb->free_fifo = rte_zmalloc(NULL, size * sizeof(uint32_t), 0);
+    if (fdb->buckets == NULL || fdb->entries == NULL || fdb->free_fifo == NULL) {
+        rte_panic("Cannot allocate bridge fdb of %u entries\n", size);
+    }
+
+    for (i = 0; i < size; i++) {
+        fdb->free_fifo[i] = i + 1;
+    }
+
+    fdb->bucket_mask = n_buckets - 1;
+    fdb->size = size;
+    fdb->n_free = size;
+    fdb->aging = aging;
+
+    printf("Bridge fdb: %u entries, %u buckets, aging %u s\n",
+        size, n_buckets, aging);
+}
+
+void bridge_init_learning(void)
+{
+    uint32_t lcore;
+
+    bridge_fdb_init(&bridge_fdb, fastpath.fdb_size, fastpath.fdb_aging);
+    snoop_init(FASTPATH_BRIDGE_NEIGH_SIZE, FASTPATH_BRIDGE_MCAST_GROUPS);
+
+    bridge_learn_lcore = exception_get_lcore();
+
+    bridge_learn_pool = rte_mempool_create(
+        "bridge_learn_pool",
+        FASTPATH_BRIDGE_LEARN_POOL_SIZE,
+        sizeof(struct bridge_learn),
+        FASTPATH_BRIDGE_LEARN_BURST,
+        0,
+        NULL, NULL,
+        NULL, NULL,
+        rte_lcore_to_socket_id(bridge_learn_lcore),
+        0);
+    if (bridge_learn_pool == NULL) {
+        rte_panic("Cannot create bridge learn pool\n");
+    }
+
+    for (lcore = 0; lcore < FASTPATH_MAX_LCORES; lcore++) {
+        char name[32];
+
+        if (lcore == bridge_learn_lcore || !bridge_lcore_is_learner(lcore)) {
             continue;
         }
 
-        if (private->bridge_hash_tbl[socketid] != NULL) {
+        snprintf(name, sizeof(name), "fastpath_learn_l%u", lcore);
+        bridge_learn_queues[lcore].ring = rte_ring_create(
+            name,
+            FASTPATH_BRIDGE_LEARN_RING_SIZE,
+            rte_lcore_to_socket_id(bridge_learn_lcore),
+            RING_F_SP_ENQ | RING_F_SC_DEQ);
+        if (bridge_learn_queues[lcore].ring == NULL) {
+            rte_panic("Cannot create learn ring for lcore %u\n", lcore);
+        }
+
+        bridge_learn_producers[n_bridge_learn_producers++] = lcore;
+    }
+}
+
+/* Each millisecond on the writer lcore: advance the clock, age a slice */
+static void
+bridge_fdb_tick(struct fastpath_timer *timer, void *arg)
+{
+    RTE_SET_USED(arg);
+
+    bridge_fdb_clock = (uint32_t)(fastpath_clock() / rte_get_tsc_hz());
+    bridge_fdb_sweep(&bridge_fdb, FASTPATH_BRIDGE_FDB_SWEEP_BUCKETS);
+
+    fastpath_timer_add(timer, US_PER_S / MS_PER_S);
+}
+
+/**
+ * The FDB writer, run by the exception lcore: insert what the datapath
+ * learned, aging runs off a timer of the same lcore
+ */
+void bridge_fdb_poll(void)
+{
+    struct bridge_learn *learn[FASTPATH_BRIDGE_LEARN_BURST];
+    uint32_t i, k, n;
+#if FASTPATH_STATS
+    uint64_t start;
+#endif
+
+    if (unlikely(!fastpath_timer_pending(&bridge_fdb_timer))) {
+        fastpath_timer_init(&bridge_fdb_timer, bridge_fdb_tick, NULL);
+        bridge_fdb_tick(&bridge_fdb_timer, NULL);
+    }
+
+    for (i = 0; i < n_bridge_learn_producers; i++) {
+        n = rte_ring_sc_dequeue_burst(
+            bridge_learn_queues[bridge_learn_producers[i]].ring,
+            (void **) learn,
+            FASTPATH_BRIDGE_LEARN_BURST);
+        if (n == 0) {
             continue;
         }
 
-        snprintf(s, sizeof(s), "br%d_hash_%d", private->vid, socketid);
-        bridge_hash_params.name = s;
-        bridge_hash_params.socket_id = socketid;
+#if FASTPATH_STATS
+        start = rte_rdtsc();
+#endif
 
-        rte_spinlock_init(&private->lock[socketid]);
-        private->bridge_hash_tbl[socketid] = rte_hash_create(&bridge_hash_params);
-        if (private->bridge_hash_tbl[socketid] == NULL) {
-            rte_panic("bridge_fdb_init: malloc %s failed\n", bridge_hash_params.name);
-            return;
+        for (k = 0; k < n; k++) {
+            struct bridge_private *private = (struct bridge_private *)learn[k]->br->private;
+
+            bridge_fdb_insert(&bridge_fdb, private, &learn[k]->mac, learn[k]->port,
+                BRIDGE_FDB_FLAG_DYNAMIC);
         }
 
-        fastpath_log_info("bridge %s create hash table %s\n", br->name, bridge_hash_params.name);
+#if FASTPATH_STATS
+        bridge_fdb.learn_cycles += rte_rdtsc() - start;
+        bridge_fdb.learn_ops += n;
+#endif
+
+        rte_mempool_put_bulk(bridge_learn_pool, (void **) learn, n);
     }
+}
 
-    return;
+void bridge_print_stats(void)
+{
+    struct bridge_fdb *fdb = &bridge_fdb;
+    uint64_t drops = 0, limited = 0, pkts = 0, cycles = 0, flood_nombuf = 0;
+    uint64_t suppressed = 0, mcast_filtered = 0;
+    uint32_t i, n_bridges = 0, n_limited = 0;
+
+    for (i = 0; i < n_bridge_learn_producers; i++) {
+        drops += bridge_learn_queues[bridge_learn_producers[i]].drops;
+    }
+
+    for (i = 0; i < FASTPATH_MAX_LCORES; i++) {
+        pkts += bridge_batches[i].pkts_done;
+        cycles += bridge_batches[i].cycles;
+        flood_nombuf += bridge_batches[i].flood_nombuf;
+        suppressed += bridge_batches[i].suppressed;
+        mcast_filtered += bridge_batches[i].mcast_filtered;
+    }
+
+    for (i = 0; i < VLAN_VID_MAX; i++) {
+        struct bridge_private *private;
+
+        if (bridge_dev[i] == NULL) {
+            continue;
+        }
+
+        private = (struct bridge_private *)bridge_dev[i]->private;
+        n_bridges++;
+        limited += private->limited;
+        if (private->n_macs >= private->mac_limit) {
+            n_limited++;
+        }
+    }
+
+    /* the learning rate the writer could sustain, from its cost per MAC */
+    printf("Bridge FDB: entries = %u/%u learned = %"PRIu64" aged = %"PRIu64
+        " full = %"PRIu64" %.0f cycles/learn (%.2f M learns/s)\n",
+        fdb->size - fdb->n_free,
+        fdb->size,
+        fdb->learned,
+        fdb->aged,
+        fdb->full,
+        fdb->learn_ops ? ((double) fdb->learn_cycles) / fdb->learn_ops : 0.0,
+        fdb->learn_cycles ?
+            ((double) rte_get_tsc_hz()) * fdb->learn_ops / fdb->learn_cycles / 1e6 : 0.0);
+
+    printf("Bridge FDB: %u bridges, %u at their MAC limit, %"PRIu64" MACs over limit,"
+        " learn requests dropped = %"PRIu64"\n",
+        n_bridges,
+        n_limited,
+        limited,
+        drops);
+
+    /* lookups, learning and forwarding decision, for a given fdb-size */
+    printf("Bridge FDB: %"PRIu64" packets received, %.1f cycles/pkt,"
+        " flood copies without mbuf = %"PRIu64"\n",
+        pkts,
+        pkts ? ((double) cycles) / pkts : 0.0,
+        flood_nombuf);
+
+    printf("Bridge FDB: ARP/ND answered = %"PRIu64" multicast sent to group ports = %"PRIu64"\n",
+        suppressed,
+        mcast_filtered);
+    snoop_print_stats();
+}
+
+/* Room for port, the tables are replaced: ports connect before the datapath runs */
+static int bridge_grow_ports(struct bridge_private *private, uint16_t port)
+{
+    struct module **ports;
+    uint16_t *flood;
+    uint32_t n = private->max_ports ? private->max_ports : 4;
+
+    while (n <= port) {
+        n *= 2;
+    }
+    n = RTE_MIN(n, (uint32_t)BRIDGE_MAX_PORTS);
+
+    ports = rte_zmalloc(NULL, n * sizeof(struct module *), RTE_CACHE_LINE_SIZE);
+    flood = rte_zmalloc(NULL, n * sizeof(uint16_t), RTE_CACHE_LINE_SIZE);
+    if (ports == NULL || flood == NULL) {
+        rte_free(ports);
+        rte_free(flood);
+        return -ENOMEM;
+    }
+
+    if (private->max_ports != 0) {
+        memcpy(ports, private->port, private->max_ports * sizeof(struct module *));
+        memcpy(flood, private->flood, private->n_flood * sizeof(uint16_t));
+        rte_free(private->port);
+        rte_free(private->flood);
+    }
+
+    private->port = ports;
+    private->flood = flood;
+    private->max_ports = n;
+
+    return 0;
 }
 
 int bridge_connect(struct module *local, struct module *peer, void *param)
@@ -353,9 +1100,17 @@ int bridge_connect(struct module *local, struct module *peer, void *param)
 
         fastpath_log_info("bridge_connect: bridge %s add port %d %s\n", 
             local->name, port, peer->name);
-        
+
+        if (port >= private->max_ports && bridge_grow_ports(private, port) < 0) {
+            fastpath_log_error("bridge_connect: malloc ports failed\n");
+            return -ENOMEM;
+        }
+
+        if (private->port[port] == NULL) {
+            private->flood[private->n_flood++] = port;
+        }
         private->port[port] = peer;
-        private->port_num += 1;
+        peer->upper_port = port;
 
         peer->connect(peer, local, NULL);
     } else {
@@ -366,7 +1121,7 @@ int bridge_connect(struct module *local, struct module *peer, void *param)
     return 0;
 }
 
-struct module * bridge_init(uint16_t vid)
+struct module * bridge_init(uint16_t vid, uint32_t mac_limit, uint32_t flags)
 {
     struct module *br;
     struct bridge_private *private;
@@ -399,11 +1154,12 @@ struct module * bridge_init(uint16_t vid)
     snprintf(br->name, sizeof(br->name), "br%d", vid);
     
     private->vid = vid;
-    private->port_num = 0;
+    private->n_flood = 0;
         
     br->private = (void *)private;
 
-    bridge_fdb_init(br);
+    private->mac_limit = mac_limit;
+    private->flags = flags;
 
     bridge_dev[vid] = br;
 
@@ -64,6 +64,15 @@ static const char usage[] =
 "           the I/O RX lcores to identify the worker lcore for the current      \n"
 "           packet (default value is %u)                                        \n"
 "    --no-numa: optional, disable numa awareness                                \n"
+"    --tx-drop tail|head : Packets dropped when a software TX backlog is full,  \n"
+"           the new ones (tail, default) or the oldest ones (head)             \n"
+"    --ctrl \"CPU, ...\" : Run the control plane on its own thread pinned to    \n"
+"           these housekeeping cpus instead of the master lcore, which is then \n"
+"           free for --rx/--w                                                   \n"
+"    --exc LCORE : Dedicated lcore for the exception path to the kernel (KNI), \n"
+"           by default the first worker lcore also runs it                      \n"
+"    --mtu \"(PORT, MTU), ...\" : MTU of the NIC ports, up to %u (default value  \n"
+"           is %u); jumbo frames are received as chained mbufs                  \n"
 "    --l \"Log file\" : fastpath log file name                                  \n";
 
 void
@@ -77,7 +86,9 @@ fastpath_print_usage(void)
         FASTPATH_DEFAULT_BURST_SIZE_RX_WRITE,
         FASTPATH_DEFAULT_BURST_SIZE_WORKER_READ,
         FASTPATH_DEFAULT_BURST_SIZE_WORKER_WRITE,
-        FASTPATH_DEFAULT_IO_RX_LB_POS
+        FASTPATH_DEFAULT_IO_RX_LB_POS,
+        FASTPATH_MAX_MTU,
+        ETHER_MTU
     );
 }
 
@@ -375,11 +386,125 @@ parse_arg_pos_lb(const char *arg)
     return 0;
 }
 
+static int
+parse_arg_mtu(const char *arg)
+{
+    const char *p0 = arg, *p = arg;
+    uint32_t n_tuples;
+
+    if (strnlen(arg, FASTPATH_ARG_RX_MAX_CHARS + 1) == FASTPATH_ARG_RX_MAX_CHARS + 1) {
+        return -1;
+    }
+
+    n_tuples = 0;
+    while ((p = strchr(p0,'(')) != NULL) {
+        uint32_t port, mtu;
+
+        p0 = strchr(p++, ')');
+        if ((p0 == NULL) ||
+            (str_to_unsigned_vals(p, p0 - p, ',', 2, &port, &mtu) !=  2)) {
+            return -2;
+        }
+
+        if (port >= FASTPATH_MAX_NIC_PORTS) {
+            return -3;
+        }
+
+        if ((mtu < ETHER_MIN_MTU) || (mtu > FASTPATH_MAX_MTU)) {
+            return -4;
+        }
+
+        fastpath.port_mtu[port] = (uint16_t) mtu;
+        n_tuples ++;
+    }
+
+    if (n_tuples == 0) {
+        return -5;
+    }
+
+    return 0;
+}
+
+static int
+parse_arg_exc(const char *arg, uint32_t *lcore)
+{
+    uint32_t x;
+    char *endpt;
+
+    if (strnlen(arg, FASTPATH_ARG_NUMERICAL_SIZE_CHARS + 1) == FASTPATH_ARG_NUMERICAL_SIZE_CHARS + 1) {
+        return -1;
+    }
+
+    errno = 0;
+    x = strtoul(arg, &endpt, 10);
+    if (errno != 0 || endpt == arg || *endpt != '\0'){
+        return -2;
+    }
+
+    /* claimed once all the options are in, see fastpath_parse_args */
+    if (x >= FASTPATH_MAX_LCORES) {
+        return -3;
+    }
+    *lcore = x;
+
+    return 0;
+}
+
+#ifndef FASTPATH_ARG_CTRL_MAX_CHARS
+#define FASTPATH_ARG_CTRL_MAX_CHARS     256
+#endif
+
+static int
+parse_arg_ctrl(const char *arg)
+{
+    const char *p = arg;
+
+    if (strnlen(arg, FASTPATH_ARG_CTRL_MAX_CHARS + 1) == FASTPATH_ARG_CTRL_MAX_CHARS + 1) {
+        return -1;
+    }
+
+    fastpath.n_ctrl_cpus = 0;
+    while (*p != 0) {
+        uint32_t cpu;
+        char *endptr;
+
+        errno = 0;
+        cpu = strtoul(p, &endptr, 0);
+        if ((errno != 0) || (endptr == p)) {
+            return -2;
+        }
+
+        if (cpu >= RTE_MAX_LCORE) {
+            return -3;
+        }
+
+        if (fastpath.n_ctrl_cpus >= FASTPATH_MAX_CTRL_CPUS) {
+            return -4;
+        }
+        fastpath.ctrl_cpus[fastpath.n_ctrl_cpus ++] = cpu;
+
+        p = strchr(p, ',');
+        if (p == NULL) {
+            break;
+        }
+        p ++;
+    }
+
+    if (fastpath.n_ctrl_cpus == 0) {
+        return -5;
+    }
+
+    fastpath.ctrl_thread = 1;
+
+    return 0;
+}
+
 /* Parse the argument given in the command line of the application */
 int
 fastpath_parse_args(int argc, char **argv)
 {
     int opt, ret;
+    uint32_t i;
     char **argvopt;
     int option_index;
     char *prgname = argv[0];
@@ -391,6 +516,10 @@ fastpath_parse_args(int argc, char **argv)
         {"pos-lb", 1, 0, 0},
         {"no-numa", 0, 0, 0},
         {"l", 1, 0, 0},
+        {"ctrl", 1, 0, 0},
+        {"tx-drop", 1, 0, 0},
+        {"mtu", 1, 0, 0},
+        {"exc", 1, 0, 0},
         {NULL, 0, 0, 0}
     };
     uint32_t arg_w = 0;
@@ -399,6 +528,8 @@ fastpath_parse_args(int argc, char **argv)
     uint32_t arg_bsz = 0;
     uint32_t arg_pos_lb = 0;
     uint32_t arg_no_numa = 0;
+    uint32_t arg_exc = 0;
+    uint32_t exc_lcore = 0;
 
     argvopt = argv;
 
@@ -455,6 +586,38 @@ fastpath_parse_args(int argc, char **argv)
             if (!strcmp(lgopts[option_index].name, "l")) {
                 fastpath_log_set_file(optarg);
             }
+            if (!strcmp(lgopts[option_index].name, "tx-drop")) {
+                if (!strcmp(optarg, "tail")) {
+                    fastpath.tx_drop = e_FASTPATH_TX_DROP_TAIL;
+                } else if (!strcmp(optarg, "head")) {
+                    fastpath.tx_drop = e_FASTPATH_TX_DROP_HEAD;
+                } else {
+                    printf("Incorrect value for --tx-drop argument (%s)\n", optarg);
+                    return -1;
+                }
+            }
+            if (!strcmp(lgopts[option_index].name, "exc")) {
+                arg_exc = 1;
+                ret = parse_arg_exc(optarg, &exc_lcore);
+                if (ret) {
+                    printf("Incorrect value for --exc argument (%d)\n", ret);
+                    return -1;
+                }
+            }
+            if (!strcmp(lgopts[option_index].name, "mtu")) {
+                ret = parse_arg_mtu(optarg);
+                if (ret) {
+                    printf("Incorrect value for --mtu argument (%d)\n", ret);
+                    return -1;
+                }
+            }
+            if (!strcmp(lgopts[option_index].name, "ctrl")) {
+                ret = parse_arg_ctrl(optarg);
+                if (ret) {
+                    printf("Incorrect value for --ctrl argument (%d)\n", ret);
+                    return -1;
+                }
+            }
             break;
 
         default:
@@ -468,6 +631,24 @@ fastpath_parse_args(int argc, char **argv)
         return -1;
     }
 
+    /* After --rx and --w, which would retype the lcore whatever their order */
+    if (arg_exc) {
+        ret = exception_set_lcore(exc_lcore);
+        if (ret < 0) {
+            printf("Incorrect value for --exc argument, lcore %u %s\n", exc_lcore,
+                ret == -EBUSY ? "already in use by --rx or --w" : "not enabled");
+            return -1;
+        }
+    }
+
+    /* Without --ctrl the master lcore never leaves the control plane loop */
+    if ((fastpath.ctrl_thread == 0) &&
+        (fastpath.lcore_params[rte_get_master_lcore()].type != e_FASTPATH_LCORE_DISABLED)) {
+        printf("Master lcore %u runs the control plane, use --ctrl to give it to the datapath\n",
+            rte_get_master_lcore());
+        return -1;
+    }
+
     /* Assign default values for the optional arguments not provided */
     if (arg_rsz == 0) {
         fastpath.nic_rx_ring_size = FASTPATH_DEFAULT_NIC_RX_RING_SIZE;
@@ -489,6 +670,12 @@ fastpath_parse_args(int argc, char **argv)
     if (arg_no_numa == 0) {
         fastpath.numa_on = FASTPATH_DEFAULT_NUMA_ON;
     }
+
+    for (i = 0; i < FASTPATH_MAX_NIC_PORTS; i ++) {
+        if (fastpath.port_mtu[i] == 0) {
+            fastpath.port_mtu[i] = ETHER_MTU;
+        }
+    }
     
     if (optind >= 0)
         argv[optind - 1] = prgname;
@@ -531,7 +718,8 @@ fastpath_get_nic_tx_queues_per_port(uint8_t port)
         struct fastpath_params_worker *lp = &fastpath.lcore_params[lcore].worker;
 
         if (fastpath.lcore_params[lcore].type != e_FASTPATH_LCORE_WORKER &&
-            fastpath.lcore_params[lcore].type != e_FASTPATH_LCORE_RX_WORKER) {
+            fastpath.lcore_params[lcore].type != e_FASTPATH_LCORE_RX_WORKER &&
+            fastpath.lcore_params[lcore].type != e_FASTPATH_LCORE_STAGE) {
             continue;
         }
 
@@ -637,7 +825,8 @@ fastpath_get_lcores_rx_worker(void)
     count = 0;
     for (lcore = 0; lcore < FASTPATH_MAX_LCORES; lcore ++) {
         if (fastpath.lcore_params[lcore].type != e_FASTPATH_LCORE_WORKER &&
-            fastpath.lcore_params[lcore].type != e_FASTPATH_LCORE_RX_WORKER) {
+            fastpath.lcore_params[lcore].type != e_FASTPATH_LCORE_RX_WORKER &&
+            fastpath.lcore_params[lcore].type != e_FASTPATH_LCORE_STAGE) {
             continue;
         }
 
@@ -655,7 +844,7 @@ fastpath_get_lcores_rx_worker(void)
 void
 fastpath_print_params(void)
 {
-    unsigned port, queue, lcore, i;
+    unsigned port, queue, lcore, i, j;
 
     /* Print NIC RX configuration */
     printf("NIC RX ports: ");
@@ -701,7 +890,8 @@ fastpath_print_params(void)
         struct fastpath_params_worker *lp_worker = &fastpath.lcore_params[lcore].worker;
 
         if ((fastpath.lcore_params[lcore].type != e_FASTPATH_LCORE_WORKER &&
-             fastpath.lcore_params[lcore].type != e_FASTPATH_LCORE_RX_WORKER)) {
+             fastpath.lcore_params[lcore].type != e_FASTPATH_LCORE_RX_WORKER &&
+             fastpath.lcore_params[lcore].type != e_FASTPATH_LCORE_STAGE)) {
             continue;
         }
         
@@ -728,7 +918,9 @@ fastpath_print_params(void)
 
         printf("Output rings  ");
         for (i = 0; i < lp_rx->n_rings; i ++) {
-            printf("%p  ", lp_rx->rings[i]);
+            for (j = 0; j < fastpath.n_ring_classes; j ++) {
+                printf("%p  ", lp_rx->rings[j][i]);
+            }
         }
 
         printf(";\n");
@@ -749,12 +941,30 @@ fastpath_print_params(void)
 
         printf("Input rings  ");
         for (i = 0; i < lp->n_rings; i ++) {
-            printf("%p  ", lp->rings[i]);
+            for (j = 0; j < fastpath.n_ring_classes; j ++) {
+                printf("%p  ", lp->rings[j][i]);
+            }
         }
 
         printf(";\n");
     }
 
+    /* Per-lcore runtime state, each block must start its own cache line */
+    for (lcore = 0; lcore < FASTPATH_MAX_LCORES; lcore ++) {
+        struct fastpath_lcore_runtime *rt = fastpath.runtime[lcore];
+
+        if (rt == NULL) {
+            continue;
+        }
+
+        printf("Lcore %u runtime state %p (socket %u, %u bytes)%s;\n",
+            lcore,
+            rt,
+            rte_lcore_to_socket_id(lcore),
+            (unsigned) sizeof(struct fastpath_lcore_runtime),
+            ((uintptr_t) rt & (RTE_CACHE_LINE_SIZE - 1)) ? " NOT cache aligned" : "");
+    }
+
     printf("\n");
 
     /* Rings */
@@ -763,6 +973,15 @@ fastpath_print_params(void)
         (unsigned) fastpath.ring_size,
         (unsigned) fastpath.nic_tx_ring_size);
 
+    /* Ring classes */
+    printf("Ring classes: %u (%s); weights ",
+        (unsigned) fastpath.n_ring_classes,
+        (fastpath.ring_sched == e_FASTPATH_RING_SCHED_WRR) ? "wrr" : "strict");
+    for (i = 0; i < fastpath.n_ring_classes; i ++) {
+        printf("%u  ", (unsigned) fastpath.ring_weight[i]);
+    }
+    printf(";\n");
+
     /* Bursts */
     printf("Burst sizes: I/O RX (rd = %u, wr = %u); Worker (rd = %u, wr = %u);\n",
         (unsigned) fastpath.burst_size_rx_read,
@@ -770,5 +989,20 @@ fastpath_print_params(void)
         (unsigned) fastpath.burst_size_worker_read,
         (unsigned) fastpath.burst_size_worker_write);
 
+    /* TX backlog */
+    printf("TX backlog: %u packets per port and lcore, %s drop, %u retries;\n",
+        (unsigned) FASTPATH_TX_QUEUE_SIZE,
+        (fastpath.tx_drop == e_FASTPATH_TX_DROP_HEAD) ? "head" : "tail",
+        (unsigned) FASTPATH_TX_RETRY);
+
+    /* MTU */
+    printf("MTU: ");
+    for (port = 0; port < FASTPATH_MAX_NIC_PORTS; port ++) {
+        if (fastpath_get_nic_rx_queues_per_port((uint8_t) port) > 0) {
+            printf("port %u = %u  ", port, (unsigned) fastpath.port_mtu[port]);
+        }
+    }
+    printf(";\n");
+
     printf("log level %d\n", LOG_LEVEL);
 }
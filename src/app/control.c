@@ -0,0 +1,199 @@
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <pthread.h>
+#include <sched.h>
+
+#include "include/fastpath.h"
+
+extern struct thread_master *mgr_master;
+
+/*
+ * The control plane (netlink, manager socket, conntrack) runs the
+ * thread_master loop either on the master lcore or, with --ctrl, on a
+ * plain pthread pinned to housekeeping cpus so that every EAL lcore is
+ * left to the datapath. Work that has to happen on a datapath lcore is
+ * handed over as a command through a bounded SP/SC ring per lcore, the
+ * control plane being the only producer.
+ */
+struct control_cmd {
+    control_cmd_fn fn;
+    void *arg;
+};
+
+static struct rte_mempool *control_cmd_pool;
+static pthread_t control_thread;
+
+static int
+control_lcore_is_datapath(unsigned lcore)
+{
+    enum fastpath_lcore_type type = fastpath.lcore_params[lcore].type;
+
+    return (type == e_FASTPATH_LCORE_RX ||
+            type == e_FASTPATH_LCORE_WORKER ||
+            type == e_FASTPATH_LCORE_RX_WORKER ||
+            type == e_FASTPATH_LCORE_STAGE);
+}
+
+void control_init_rings(void)
+{
+    unsigned lcore;
+
+    control_cmd_pool = rte_mempool_create(
+        "control_cmd_pool",
+        FASTPATH_CMD_POOL_SIZE,
+        sizeof(struct control_cmd),
+        0,
+        0,
+        NULL, NULL,
+        NULL, NULL,
+        rte_socket_id(),
+        0);
+    if (control_cmd_pool == NULL) {
+        rte_panic("Cannot create control command pool\n");
+    }
+
+    for (lcore = 0; lcore < FASTPATH_MAX_LCORES; lcore ++) {
+        char name[32];
+
+        if (!control_lcore_is_datapath(lcore) || fastpath.runtime[lcore] == NULL) {
+            continue;
+        }
+
+        snprintf(name, sizeof(name), "fastpath_cmd_l%u", lcore);
+        fastpath.runtime[lcore]->cmd_ring = rte_ring_create(
+            name,
+            FASTPATH_CMD_RING_SIZE,
+            rte_lcore_to_socket_id(lcore),
+            RING_F_SP_ENQ | RING_F_SC_DEQ);
+        if (fastpath.runtime[lcore]->cmd_ring == NULL) {
+            rte_panic("Cannot create command ring for lcore %u\n", lcore);
+        }
+    }
+}
+
+int control_cmd_post(unsigned lcore, control_cmd_fn fn, void *arg)
+{
+    struct control_cmd *cmd;
+    struct rte_ring *ring;
+
+    if (lcore >= FASTPATH_MAX_LCORES || fastpath.runtime[lcore] == NULL ||
+        fastpath.runtime[lcore]->cmd_ring == NULL) {
+        return -EINVAL;
+    }
+
+    ring = fastpath.runtime[lcore]->cmd_ring;
+
+    if (rte_mempool_get(control_cmd_pool, (void **) &cmd) < 0) {
+        fastpath_log_error("control_cmd_post: no command buffer for lcore %u\n", lcore);
+        return -ENOBUFS;
+    }
+
+    cmd->fn = fn;
+    cmd->arg = arg;
+
+    if (rte_ring_sp_enqueue(ring, cmd) == -ENOBUFS) {
+        rte_mempool_put(control_cmd_pool, cmd);
+        fastpath_log_error("control_cmd_post: command ring of lcore %u full\n", lcore);
+        return -ENOBUFS;
+    }
+
+    return 0;
+}
+
+int control_cmd_post_all(control_cmd_fn fn, void *arg)
+{
+    unsigned lcore;
+    int ret, n_posted = 0;
+
+    for (lcore = 0; lcore < FASTPATH_MAX_LCORES; lcore ++) {
+        if (!control_lcore_is_datapath(lcore)) {
+            continue;
+        }
+
+        ret = control_cmd_post(lcore, fn, arg);
+        if (ret < 0) {
+            return ret;
+        }
+
+        n_posted ++;
+    }
+
+    return n_posted;
+}
+
+uint32_t control_cmd_poll(unsigned lcore)
+{
+    struct control_cmd *cmds[FASTPATH_CMD_BURST_SIZE];
+    struct rte_ring *ring = fastpath.runtime[lcore]->cmd_ring;
+    uint32_t i, n_cmds;
+
+    n_cmds = rte_ring_sc_dequeue_burst(ring, (void **) cmds, FASTPATH_CMD_BURST_SIZE);
+    for (i = 0; i < n_cmds; i ++) {
+        cmds[i]->fn(cmds[i]->arg, lcore);
+        rte_mempool_put(control_cmd_pool, cmds[i]);
+    }
+
+    return n_cmds;
+}
+
+void control_main_loop(void)
+{
+    struct thread thread;
+
+    fastpath_init_stack();
+    
+    while (thread_fetch(mgr_master, &thread)) {
+        thread_call(&thread);
+    }
+}
+
+static void *
+control_thread_main(__rte_unused void *arg)
+{
+    /* not an EAL lcore, per-lcore state must not be touched from here */
+    RTE_PER_LCORE(_lcore_id) = LCORE_ID_ANY;
+
+    control_main_loop();
+
+    return NULL;
+}
+
+int control_thread_start(void)
+{
+    pthread_attr_t attr;
+    cpu_set_t cpuset;
+    uint32_t i;
+    int ret;
+
+    pthread_attr_init(&attr);
+
+    /* pin before the thread runs so it never lands on a datapath lcore */
+    if (fastpath.n_ctrl_cpus > 0) {
+        CPU_ZERO(&cpuset);
+        for (i = 0; i < fastpath.n_ctrl_cpus; i ++) {
+            CPU_SET(fastpath.ctrl_cpus[i], &cpuset);
+        }
+
+        ret = pthread_attr_setaffinity_np(&attr, sizeof(cpuset), &cpuset);
+        if (ret != 0) {
+            pthread_attr_destroy(&attr);
+            fastpath_log_error("control_thread_start: set affinity failed (%d)\n", ret);
+            return -ret;
+        }
+    }
+
+    ret = pthread_create(&control_thread, &attr, control_thread_main, NULL);
+    pthread_attr_destroy(&attr);
+    if (ret != 0) {
+        fastpath_log_error("control_thread_start: create thread failed (%d)\n", ret);
+        return -ret;
+    }
+
+    pthread_setname_np(control_thread, "fastpath-ctrl");
+
+    fastpath_log_info("control plane thread started on %u cpus\n", fastpath.n_ctrl_cpus);
+
+    return 0;
+}
@@ -6,18 +6,13 @@ struct ethernet_private {
     uint16_t mode;
     uint16_t native;
     uint16_t state;
-    struct module *vlan[VLAN_VID_MAX];
+    struct vlan_demux *vlans;
     struct module *bridge;
 };
 
 struct module *ethernet_modules[FASTPATH_MAX_NIC_PORTS];
 
 static struct module * find_ethernet(uint32_t port);
-static uint64_t flowkey_hash(
-    void *key,
-    __attribute__((unused)) uint32_t key_size,
-    __attribute__((unused)) uint64_t seed);
-
 static struct module * find_ethernet(uint32_t port)
 {    
     if (port >= FASTPATH_MAX_NIC_PORTS) {
@@ -28,62 +23,102 @@ static struct module * find_ethernet(uint32_t port)
     return ethernet_modules[port];
 }
 
-uint64_t flowkey_hash(
-    void *key,
-    __attribute__((unused)) uint32_t key_size,
-    __attribute__((unused)) uint64_t seed)
-{
-    struct fastpath_flow_key *flow_key = (struct fastpath_flow_key *) key;
-    uint32_t ip_dst = rte_be_to_cpu_32(flow_key->ip_dst);
-    uint64_t signature = (ip_dst & 0x00FFFFFFLLU) >> 2;
-
-    return signature;
-}
-
+/*
+ * Parse the headers once when the packet enters the stack. When the NIC
+ * provides the RSS hash and classifies an IPv4 packet without options,
+ * only the L2 header is read.
+ */
 static inline void
-fastpath_pkt_metadata_fill(struct rte_mbuf *m)
+fastpath_pkt_parse(struct rte_mbuf *m)
 {
     struct fastpath_pkt_metadata *c =
         (struct fastpath_pkt_metadata *)RTE_MBUF_METADATA_UINT8_PTR(m, 0);
     struct ether_hdr *eth_hdr;
-    struct ipv4_hdr *ip_hdr;
-    uint64_t *ipv4_hdr_slab;
-
-#if 0
-    uint8_t *m_data = rte_pktmbuf_mtod(m, uint8_t *);
+    struct ipv4_hdr *ipv4_hdr;
+    struct ipv6_hdr *ipv6_hdr;
+    uint16_t l3_off;
 
-    if (m->ol_flags & (PKT_RX_VLAN_PKT)) {
-        ip_hdr = (struct ipv4_hdr *) 
-            &m_data[sizeof(struct ether_hdr) + sizeof(struct vlan_hdr)];
-    } else {
-        ip_hdr = (struct ipv4_hdr *) &m_data[sizeof(struct ether_hdr)];
+    /* PKT_RX_VLAN_PKT means the tag is gone and vlan_tci holds it */
+    if (!(fastpath.rx_offload[m->port] & DEV_RX_OFFLOAD_VLAN_STRIP)) {
+        m->ol_flags &= ~PKT_RX_VLAN_PKT;
     }
-#endif
 
-    eth_hdr = rte_pktmbuf_mtod(m, struct ether_hdr*);
+    eth_hdr = rte_pktmbuf_mtod(m, struct ether_hdr *);
 
-    c->mac_header = (uint8_t *)eth_hdr;
+    c->flags = 0;
+    c->vlan_id = 0;
+    c->l2_off = m->data_off;
     c->protocol = rte_be_to_cpu_16(eth_hdr->ether_type);
+    l3_off = m->data_off + sizeof(struct ether_hdr);
+
+    if (m->ol_flags & PKT_RX_VLAN_PKT) {
+        c->vlan_id = m->vlan_tci & VLAN_VID_MASK;
+        c->flags |= FASTPATH_PKT_F_VLAN;
+    } else if (c->protocol == ETHER_TYPE_VLAN || c->protocol == ETHER_TYPE_QINQ) {
+        struct vlan_hdr *vlan_hdr = (struct vlan_hdr *)(eth_hdr + 1);
+
+        m->vlan_tci = rte_be_to_cpu_16(vlan_hdr->vlan_tci);
+        c->vlan_id = m->vlan_tci & VLAN_VID_MASK;
+        c->protocol = rte_be_to_cpu_16(vlan_hdr->eth_proto);
+        c->flags |= FASTPATH_PKT_F_VLAN;
+        l3_off += sizeof(struct vlan_hdr);
+    }
+
+    /* a second tag is the C-tag of a QinQ frame */
+    if ((c->flags & FASTPATH_PKT_F_VLAN) && c->protocol == ETHER_TYPE_VLAN) {
+        struct vlan_hdr *vlan_hdr = (struct vlan_hdr *)FASTPATH_PKT_HDR(m, l3_off);
 
-    if (c->protocol == ETHER_TYPE_VLAN) {
-        ip_hdr = (struct ipv4_hdr *)((uint8_t *)eth_hdr + sizeof(struct vlan_hdr));
+        c->inner_vlan_tci = rte_be_to_cpu_16(vlan_hdr->vlan_tci);
+        c->protocol = rte_be_to_cpu_16(vlan_hdr->eth_proto);
+        c->flags |= FASTPATH_PKT_F_QINQ;
+        l3_off += sizeof(struct vlan_hdr);
+    }
+
+    c->l3_off = l3_off;
+    c->l4_off = l3_off;
+
+    switch (c->protocol) {
+    case ETHER_TYPE_IPv4:
+        c->pkt_type = FASTPATH_PKT_IPV4;
+        if ((m->ol_flags & (PKT_RX_IPV4_HDR | PKT_RX_IPV4_HDR_EXT)) == PKT_RX_IPV4_HDR) {
+            c->l4_off = l3_off + sizeof(struct ipv4_hdr);
+        } else {
+            ipv4_hdr = (struct ipv4_hdr *)FASTPATH_PKT_HDR(m, l3_off);
+            c->l4_off = l3_off + (ipv4_hdr->version_ihl & 0xf) * 4;
+        }
+        break;
+    case ETHER_TYPE_IPv6:
+        /* extension headers are not walked */
+        c->pkt_type = FASTPATH_PKT_IPV6;
+        c->l4_off = l3_off + sizeof(struct ipv6_hdr);
+        break;
+    case ETHER_TYPE_ARP:
+    case ETHER_TYPE_RARP:
+        c->pkt_type = FASTPATH_PKT_ARP;
+        break;
+    default:
+        c->pkt_type = FASTPATH_PKT_OTHER;
+        break;
+    }
+
+    if (m->ol_flags & PKT_RX_RSS_HASH) {
+        c->flow_hash = m->hash.rss;
+    } else if (c->pkt_type == FASTPATH_PKT_IPV4) {
+        ipv4_hdr = (struct ipv4_hdr *)FASTPATH_PKT_HDR(m, l3_off);
+        c->flow_hash = rte_hash_crc(&ipv4_hdr->src_addr,
+            2 * sizeof(uint32_t), ipv4_hdr->next_proto_id);
+    } else if (c->pkt_type == FASTPATH_PKT_IPV6) {
+        ipv6_hdr = (struct ipv6_hdr *)FASTPATH_PKT_HDR(m, l3_off);
+        c->flow_hash = rte_hash_crc(ipv6_hdr->src_addr,
+            2 * sizeof(ipv6_hdr->src_addr), ipv6_hdr->proto);
     } else {
-        ip_hdr = (struct ipv4_hdr *)(eth_hdr + 1);
+        c->flow_hash = 0;
     }
-    
-    ipv4_hdr_slab = (uint64_t *)ip_hdr;
-    
-    /* TTL and Header Checksum are set to 0 */
-    c->flow_key.slab0 = ipv4_hdr_slab[1] & 0xFFFFFFFF0000FF00LLU;
-    c->flow_key.slab1 = ipv4_hdr_slab[2];
-    c->signature = flowkey_hash((void *) &c->flow_key, 0, 0);
 }
 
 void ethernet_input(struct rte_mbuf *m)
 {
     struct module *eth;
-    struct fastpath_pkt_metadata *c =
-        (struct fastpath_pkt_metadata *)RTE_MBUF_METADATA_UINT8_PTR(m, 0);
 
     eth = find_ethernet(m->port);
     if (eth == NULL) {
@@ -93,12 +128,8 @@ void ethernet_input(struct rte_mbuf *m)
         return;
     }
 
-    fastpath_pkt_metadata_fill(m);
-
-    if (c->protocol == ETHER_TYPE_ARP || c->protocol == ETHER_TYPE_RARP) {
-        kni_ingress(m);
-        return;
-    }
+    /* ARP goes to the bridge too, which may answer it or hands it to the kernel */
+    fastpath_pkt_parse(m);
 
     ethernet_receive(m, NULL, eth);
 
@@ -108,9 +139,10 @@ void ethernet_input(struct rte_mbuf *m)
 void ethernet_receive(struct rte_mbuf *m, struct module *peer, struct module *eth)
 {
     uint32_t vid;
-    struct ether_hdr *eth_hdr;
-    struct vlan_hdr  *vlan_hdr;
+    struct module *sub;
     struct ethernet_private *private = (struct ethernet_private *)eth->private;
+    struct fastpath_pkt_metadata *c =
+        (struct fastpath_pkt_metadata *)RTE_MBUF_METADATA_UINT8_PTR(m, 0);
 
     RTE_SET_USED(peer);
 
@@ -121,14 +153,11 @@ void ethernet_receive(struct rte_mbuf *m, struct module *peer, struct module *et
     rte_pktmbuf_dump(stdout, m, 128);
 #endif
 
-    eth_hdr = rte_pktmbuf_mtod(m, struct ether_hdr *);
     rte_pktmbuf_adj(m, (uint16_t)sizeof(struct ether_hdr));
 
-    if (ntohs(eth_hdr->ether_type) == ETHER_TYPE_VLAN) {
-        vlan_hdr = rte_pktmbuf_mtod(m, struct vlan_hdr *);
-        
-        vid = ntohs(vlan_hdr->vlan_tci);
-        
+    if (c->flags & FASTPATH_PKT_F_VLAN) {
+        vid = c->vlan_id;
+
         if (private->mode == VLAN_MODE_ACCESS) {
             fastpath_log_error("access port %s receive packet vid %x, drop\n", 
                 eth->name, vid);
@@ -137,7 +166,15 @@ void ethernet_receive(struct rte_mbuf *m, struct module *peer, struct module *et
         } else {
             fastpath_log_debug("trunk port %s receive packet vid %x\n", eth->name, vid);
 
-            SEND_PKT(m, eth, private->vlan[vid], PKT_DIR_RECV);
+            if (c->flags & FASTPATH_PKT_F_QINQ) {
+                sub = vlan_demux_lookup_qinq(private->vlans, vid,
+                    c->inner_vlan_tci & VLAN_VID_MASK);
+            } else {
+                sub = vlan_demux_lookup(private->vlans, vid);
+            }
+
+            SEND_PKT_DIRECT(m, eth, sub, PKT_DIR_RECV,
+                MODULE_TYPE_VLAN, vlan_receive);
         }
     } else {
         if (private->mode == VLAN_MODE_ACCESS) {
@@ -147,7 +184,8 @@ void ethernet_receive(struct rte_mbuf *m, struct module *peer, struct module *et
             fastpath_log_debug("trunk port %s receive untagged packet, send to %d\n",
                 eth->name, private->native);
         }
-        SEND_PKT(m, eth, private->bridge, PKT_DIR_RECV);
+        SEND_PKT_DIRECT(m, eth, private->bridge, PKT_DIR_RECV,
+            MODULE_TYPE_BRIDGE, bridge_receive);
     }
 
     return;
@@ -155,13 +193,33 @@ void ethernet_receive(struct rte_mbuf *m, struct module *peer, struct module *et
 
 void ethernet_xmit(struct rte_mbuf *m, __rte_unused struct module *peer, struct module *eth)
 {
-    uint32_t n_mbufs, n_pkts, port;
+    uint32_t n_mbufs, port;
     unsigned lcore = rte_lcore_id();
     struct ethernet_private *private = (struct ethernet_private *)eth->private;
     struct fastpath_params_worker *lp = &fastpath.lcore_params[lcore].worker;
+    struct mbuf_array *mbuf_out;
 
     port = private->port;
 
+    /* Bridged from a port with a larger MTU, the NIC would truncate it */
+    if (unlikely(m->pkt_len > FASTPATH_MTU_TO_FRAME_LEN(fastpath.port_mtu[port]))) {
+        fastpath_log_debug("ethernet %s drop %u bytes packet, mtu %u\n",
+            eth->name, m->pkt_len, fastpath.port_mtu[port]);
+        rte_pktmbuf_free(m);
+        return;
+    }
+
+    /* Finish the IPv4 header checksum in software if the port can't */
+    if ((m->ol_flags & PKT_TX_IP_CKSUM) &&
+        !(fastpath.tx_offload[port] & DEV_TX_OFFLOAD_IPV4_CKSUM)) {
+        struct ipv4_hdr *ipv4_hdr =
+            (struct ipv4_hdr *)(rte_pktmbuf_mtod(m, char *) + m->l2_len);
+
+        ipv4_hdr->hdr_checksum = 0;
+        ipv4_hdr->hdr_checksum = rte_ipv4_cksum(ipv4_hdr);
+        m->ol_flags &= ~(PKT_TX_IP_CKSUM | PKT_TX_IPV4);
+    }
+
     fastpath_log_debug("ethernet %s prepare to send packet to port %d %d pkt len %d\n",
         eth->name, port, lp->tx_queue_id[port], m->pkt_len);
 
@@ -175,30 +233,20 @@ void ethernet_xmit(struct rte_mbuf *m, __rte_unused struct module *peer, struct
     rte_pktmbuf_dump(stdout, m, 128);
 #endif
 
-    n_mbufs = lp->mbuf_out[port].n_mbufs;
-    lp->mbuf_out[port].array[n_mbufs] = m;
+    mbuf_out = lp->mbuf_out[port];
+    if (unlikely(mbuf_out == NULL)) {
+        fastpath_log_debug("ethernet %s no tx buffer on lcore %u\n", eth->name, lcore);
+        rte_pktmbuf_free(m);
+        return;
+    }
+
+    n_mbufs = mbuf_out->n_mbufs;
+    mbuf_out->array[n_mbufs] = m;
     n_mbufs += 1;
 
-    if (n_mbufs < fastpath.burst_size_worker_write) {
-        lp->mbuf_out[port].n_mbufs = n_mbufs;
-    } else {
-        n_pkts = rte_eth_tx_burst(
-                port,
-                lp->tx_queue_id[port],
-                lp->mbuf_out[port].array,
-                (uint16_t) n_mbufs);
-
-        if (unlikely(n_pkts < n_mbufs)) {
-            uint32_t k;
-            fastpath_log_error("ethernet_xmit: send pkt failed, success %d expected %d",
-                n_pkts, n_mbufs);
-            for (k = n_pkts; k < n_mbufs; k ++) {
-                struct rte_mbuf *pkt_to_free = lp->mbuf_out[port].array[k];
-                rte_pktmbuf_free(pkt_to_free);
-            }
-        }
-        
-        lp->mbuf_out[port].n_mbufs = 0;
+    mbuf_out->n_mbufs = n_mbufs;
+    if (n_mbufs >= fastpath.burst_size_worker_write) {
+        fastpath_tx_send(lp, (uint8_t) port);
         lp->mbuf_out_flush[port] = 0;
     }
 
@@ -233,6 +281,7 @@ int ethernet_handle_msg(struct module *eth,
 int ethernet_connect(struct module *local, struct module *peer, void *param)
 {
     struct ethernet_private *private;
+    RTE_SET_USED(param);
 
     if (local == NULL || peer == NULL) {
         fastpath_log_error("ethernet_connect: invalid local %p peer %p\n", 
@@ -245,13 +294,16 @@ int ethernet_connect(struct module *local, struct module *peer, void *param)
     private = local->private;
     
     if (peer->type == MODULE_TYPE_VLAN) {
-        uint16_t vid = *(uint16_t *)param;
-        if (vid > VLAN_VID_MASK) {
-            fastpath_log_error("ethernet_connect: invalid vid %d\n", vid);
-            return -EINVAL;
+        uint16_t vid, inner_vid;
+        int ret;
+
+        vlan_get_key(peer, &vid, &inner_vid);
+        ret = vlan_demux_add(private->vlans, vid, inner_vid, peer);
+        if (ret < 0) {
+            fastpath_log_error("ethernet_connect: add vid %d.%d failed (%d)\n",
+                vid, inner_vid, ret);
+            return ret;
         }
-
-        private->vlan[vid] = peer;
     } else if (peer->type == MODULE_TYPE_BRIDGE) {
         private->bridge = peer;
     } else {
@@ -292,6 +344,15 @@ struct module * ethernet_init(uint32_t port, uint16_t mode, uint16_t native)
         return NULL;
     }
 
+    private->vlans = vlan_demux_create(rte_eth_dev_socket_id(port));
+    if (private->vlans == NULL) {
+        rte_free(private);
+        rte_free(eth);
+
+        fastpath_log_error("ethernet_init: malloc vlan table failed\n");
+        return NULL;
+    }
+
     eth->receive = ethernet_receive;
     eth->transmit = ethernet_xmit;
     eth->connect = ethernet_connect;
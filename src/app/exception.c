@@ -0,0 +1,512 @@
+
+#include "include/fastpath.h"
+
+/*
+ * The exception path is the only lcore touching the kernel interfaces,
+ * KNI or TAP per port. Packets punted to the kernel are buffered per
+ * producer lcore and handed over in bursts through one SP/SC ring per
+ * producer, so a punt flood fills rings instead of serializing workers on
+ * a lock. What the kernel sends back leaves on a TX queue of its own on
+ * every port.
+ *
+ * Without --exc the first worker lcore runs the exception path from its
+ * main loop.
+ */
+#define EXCEPTION_LCORE_NONE    ((uint32_t) -1)
+
+struct exception_path {
+    uint32_t lcore;
+    uint32_t dedicated;
+    uint16_t tx_queue;
+
+    /* one ring per producer lcore */
+    struct rte_ring *rings[FASTPATH_MAX_LCORES];
+    uint32_t producers[FASTPATH_MAX_LCORES];
+    uint32_t n_producers;
+
+    /* stats, cycles spent writing to the kernel per interface type */
+    uint64_t pkts;
+    uint64_t kernel_cycles[2];
+    uint64_t kernel_pkts[2];
+} __rte_cache_aligned;
+
+static struct exception_path exception = {
+    .lcore = EXCEPTION_LCORE_NONE,
+};
+
+static int
+exception_lcore_is_producer(uint32_t lcore)
+{
+    enum fastpath_lcore_type type = fastpath.lcore_params[lcore].type;
+
+    return (type == e_FASTPATH_LCORE_RX ||
+            type == e_FASTPATH_LCORE_WORKER ||
+            type == e_FASTPATH_LCORE_RX_WORKER ||
+            type == e_FASTPATH_LCORE_STAGE);
+}
+
+int exception_set_lcore(uint32_t lcore)
+{
+    if (lcore >= FASTPATH_MAX_LCORES || !rte_lcore_is_enabled(lcore)) {
+        return -EINVAL;
+    }
+
+    if (fastpath.lcore_params[lcore].type != e_FASTPATH_LCORE_DISABLED) {
+        return -EBUSY;
+    }
+
+    fastpath.lcore_params[lcore].type = e_FASTPATH_LCORE_EXCEPTION;
+    exception.lcore = lcore;
+    exception.dedicated = 1;
+
+    return 0;
+}
+
+uint32_t exception_get_lcore(void)
+{
+    return exception.lcore;
+}
+
+uint16_t exception_get_tx_queue(void)
+{
+    return exception.tx_queue;
+}
+
+void exception_init_rings(void)
+{
+    uint32_t lcore;
+    unsigned socket;
+
+    if (exception.lcore == EXCEPTION_LCORE_NONE) {
+        for (lcore = 0; lcore < FASTPATH_MAX_LCORES; lcore ++) {
+            if (exception_lcore_is_producer(lcore) &&
+                fastpath.lcore_params[lcore].type != e_FASTPATH_LCORE_RX) {
+                exception.lcore = lcore;
+                break;
+            }
+        }
+
+        if (exception.lcore == EXCEPTION_LCORE_NONE) {
+            rte_panic("No lcore available for the exception path\n");
+        }
+    }
+
+    /* after the queues of the workers, see fastpath_assign_worker_ids */
+    exception.tx_queue = (uint16_t) fastpath_get_lcores_rx_worker();
+    socket = rte_lcore_to_socket_id(exception.lcore);
+
+    printf("Exception path on lcore %u (%s), TX queue %u\n",
+        exception.lcore,
+        exception.dedicated ? "dedicated" : "shared with the datapath",
+        (unsigned) exception.tx_queue);
+
+    for (lcore = 0; lcore < FASTPATH_MAX_LCORES; lcore ++) {
+        struct fastpath_lcore_runtime *rt = fastpath.runtime[lcore];
+        char name[32];
+
+        if (lcore == exception.lcore || !exception_lcore_is_producer(lcore)) {
+            continue;
+        }
+
+        printf("Creating ring to connect lcore %u with exception lcore %u ...\n",
+            lcore,
+            exception.lcore);
+        snprintf(name, sizeof(name), "fastpath_exc_l%u", lcore);
+        exception.rings[lcore] = rte_ring_create(
+            name,
+            fastpath.ring_size,
+            socket,
+            RING_F_SP_ENQ | RING_F_SC_DEQ);
+        if (exception.rings[lcore] == NULL) {
+            rte_panic("Cannot create ring to connect lcore %u with exception lcore\n",
+                lcore);
+        }
+
+        rt->exc_mbuf_out = rte_zmalloc_socket(NULL,
+            sizeof(struct mbuf_array), RTE_CACHE_LINE_SIZE,
+            rte_lcore_to_socket_id(lcore));
+        if (rt->exc_mbuf_out == NULL) {
+            rte_panic("Cannot allocate exception buffer for lcore %u\n", lcore);
+        }
+
+        exception.producers[exception.n_producers++] = lcore;
+    }
+}
+
+/*
+ * KNI hands only the first segment of a chain to the kernel, so chains
+ * (jumbo frames, reassembled packets) are copied into a single mbuf when
+ * they fit and dropped otherwise.
+ */
+static struct rte_mbuf *
+kni_pkt_linearize(struct rte_mbuf *m)
+{
+    struct rte_mbuf *n, *seg;
+    char *dst;
+
+    n = rte_pktmbuf_alloc(fastpath.lcore_params[rte_lcore_id()].pktbuf_pool);
+    if (unlikely(n == NULL)) {
+        rte_pktmbuf_free(m);
+        return NULL;
+    }
+
+    if (unlikely(m->pkt_len > rte_pktmbuf_tailroom(n))) {
+        fastpath_log_debug("kni: drop %u bytes chained packet\n", m->pkt_len);
+        rte_pktmbuf_free(n);
+        rte_pktmbuf_free(m);
+        return NULL;
+    }
+
+    dst = rte_pktmbuf_append(n, (uint16_t) m->pkt_len);
+    for (seg = m; seg != NULL; seg = seg->next) {
+        rte_memcpy(dst, rte_pktmbuf_mtod(seg, char *), seg->data_len);
+        dst += seg->data_len;
+    }
+
+    n->port = m->port;
+    n->vlan_tci = m->vlan_tci;
+    n->ol_flags = m->ol_flags;
+    rte_pktmbuf_free(m);
+
+    return n;
+}
+
+/* Exception lcore only */
+static void
+exception_tap_tx(uint32_t port_id, struct rte_mbuf **pkts, uint32_t n_pkts)
+{
+    uint32_t k, n_sent = 0;
+
+    /* the tap consumes every packet, written or not */
+    if (likely(tap_is_open((uint8_t) port_id))) {
+        n_sent = tap_tx_burst((uint8_t) port_id, pkts, n_pkts);
+    } else {
+        for (k = 0; k < n_pkts; k ++) {
+            rte_pktmbuf_free(pkts[k]);
+        }
+    }
+
+    if (unlikely(n_sent < n_pkts)) {
+        fastpath_log_debug("kni_ingress: send pkt failed, success %u expected %u\n",
+            n_sent, n_pkts);
+        fastpath.runtime[exception.lcore]->kni_stats[port_id].rx_dropped += n_pkts - n_sent;
+    }
+}
+
+static void
+exception_kernel_tx(uint32_t port_id, struct rte_mbuf **pkts, uint32_t n_pkts)
+{
+    enum fastpath_exc_type type = fastpath.exc_type[port_id];
+    struct rte_mbuf *gro_pkts[2 * FASTPATH_DEFAULT_BURST_SIZE_EXCEPTION];
+    struct rte_kni *kni = fastpath.kni[port_id];
+    uint32_t k, n_sent = 0;
+#if FASTPATH_STATS
+    uint64_t start = rte_rdtsc();
+
+    exception.kernel_pkts[type] += n_pkts;
+#endif
+
+    if (type == e_FASTPATH_EXC_TAP) {
+        if (gro_is_enabled((uint8_t) port_id)) {
+            n_pkts = gro_receive((uint8_t) port_id, pkts, n_pkts, gro_pkts);
+            pkts = gro_pkts;
+        }
+
+        exception_tap_tx(port_id, pkts, n_pkts);
+    } else {
+        if (likely(kni != NULL)) {
+            n_sent = rte_kni_tx_burst(kni, pkts, (uint16_t) n_pkts);
+        }
+
+        if (unlikely(n_sent < n_pkts)) {
+            fastpath_log_debug("kni_ingress: send pkt failed, success %u expected %u\n",
+                n_sent, n_pkts);
+            for (k = n_sent; k < n_pkts; k ++) {
+                rte_pktmbuf_free(pkts[k]);
+            }
+
+            fastpath.runtime[exception.lcore]->kni_stats[port_id].rx_dropped += n_pkts - n_sent;
+        }
+    }
+
+#if FASTPATH_STATS
+    exception.kernel_cycles[type] += rte_rdtsc() - start;
+#endif
+}
+
+static void
+exception_send(uint32_t lcore)
+{
+    struct fastpath_lcore_runtime *rt = fastpath.runtime[lcore];
+    struct mbuf_array *mbuf_out = rt->exc_mbuf_out;
+    uint32_t k, n_sent;
+
+    n_sent = rte_ring_sp_enqueue_burst(
+        exception.rings[lcore],
+        (void **) mbuf_out->array,
+        mbuf_out->n_mbufs);
+
+    /* the exception lcore is behind, drop rather than wait for it */
+    for (k = n_sent; k < mbuf_out->n_mbufs; k ++) {
+        struct rte_mbuf *pkt_to_free = mbuf_out->array[k];
+
+        rt->kni_stats[pkt_to_free->port].rx_dropped += 1;
+        rte_pktmbuf_free(pkt_to_free);
+    }
+
+    mbuf_out->n_mbufs = 0;
+}
+
+static inline void
+exception_enqueue(struct rte_mbuf *m)
+{
+    uint32_t lcore = rte_lcore_id();
+    struct fastpath_lcore_runtime *rt = fastpath.runtime[lcore];
+    struct mbuf_array *mbuf_out;
+    uint32_t port_id = m->port;
+
+    /* a tap writes chains as they are */
+    if (unlikely(m->nb_segs > 1) && fastpath.exc_type[port_id] == e_FASTPATH_EXC_KNI &&
+        (m = kni_pkt_linearize(m)) == NULL) {
+        rt->kni_stats[port_id].rx_dropped += 1;
+        return;
+    }
+
+    rt->kni_stats[port_id].rx_packets += 1;
+
+    if (lcore == exception.lcore) {
+        exception_kernel_tx(port_id, &m, 1);
+        return;
+    }
+
+    mbuf_out = rt->exc_mbuf_out;
+    if (unlikely(mbuf_out == NULL)) {
+        rt->kni_stats[port_id].rx_dropped += 1;
+        rte_pktmbuf_free(m);
+        return;
+    }
+
+    mbuf_out->array[mbuf_out->n_mbufs++] = m;
+    if (mbuf_out->n_mbufs >= FASTPATH_DEFAULT_BURST_SIZE_EXCEPTION) {
+        exception_send(lcore);
+        rt->exc_mbuf_out_flush = 0;
+    }
+}
+
+/**
+ * Punt a packet to the kernel, the L2 header is in front again
+ */
+void kni_ingress(struct rte_mbuf *m)
+{
+    if (m->port >= FASTPATH_MAX_NIC_PORTS) {
+        fastpath_log_error("kni_ingress: invalid port %d\n", m->port);
+        rte_pktmbuf_free(m);
+        return;
+    }
+
+    if (unlikely(vlan_tag_restore(m) < 0)) {
+        rte_pktmbuf_free(m);
+        return;
+    }
+
+    exception_enqueue(m);
+}
+
+/**
+ * Punt a batch of packets fresh from the NIC to the kernel
+ */
+void kni_ingress_burst(uint32_t port_id, struct rte_mbuf **pkts, uint32_t n_pkts)
+{
+    uint32_t k;
+
+    if (port_id >= FASTPATH_MAX_NIC_PORTS) {
+        fastpath_log_error("kni_ingress_burst: invalid port %d\n", port_id);
+        for (k = 0; k < n_pkts; k ++) {
+            rte_pktmbuf_free(pkts[k]);
+        }
+        return;
+    }
+
+    for (k = 0; k < n_pkts; k ++) {
+        exception_enqueue(pkts[k]);
+    }
+}
+
+void exception_flush(uint32_t lcore)
+{
+    struct fastpath_lcore_runtime *rt = fastpath.runtime[lcore];
+
+    if (rt->exc_mbuf_out == NULL) {
+        return;
+    }
+
+    if (likely((rt->exc_mbuf_out_flush == 0) ||
+               (rt->exc_mbuf_out->n_mbufs == 0))) {
+        rt->exc_mbuf_out_flush = 1;
+        return;
+    }
+
+    exception_send(lcore);
+    rt->exc_mbuf_out_flush = 1;
+}
+
+/* Send what is buffered now, for protocol traffic that must not wait */
+void exception_flush_now(uint32_t lcore)
+{
+    struct fastpath_lcore_runtime *rt = fastpath.runtime[lcore];
+
+    if (rt->exc_mbuf_out == NULL || rt->exc_mbuf_out->n_mbufs == 0) {
+        return;
+    }
+
+    exception_send(lcore);
+}
+
+/* Send packets from the kernel on the exception TX queue of the port */
+static void
+exception_nic_tx(uint32_t port_id, struct rte_mbuf **pkts, uint32_t n_pkts)
+{
+    struct fastpath_lcore_runtime *rt = fastpath.runtime[exception.lcore];
+    uint32_t k, n_sent;
+
+    n_sent = rte_eth_tx_burst((uint8_t) port_id, exception.tx_queue,
+        pkts, (uint16_t) n_pkts);
+    rt->kni_stats[port_id].tx_packets += n_sent;
+
+    if (unlikely(n_sent < n_pkts)) {
+        for (k = n_sent; k < n_pkts; k ++) {
+            rte_pktmbuf_free(pkts[k]);
+        }
+
+        rt->kni_stats[port_id].tx_dropped += n_pkts - n_sent;
+    }
+}
+
+/**
+ * Send what the kernel transmitted on the port and serve its requests
+ */
+static void
+kni_egress(uint32_t port_id)
+{
+    struct rte_mbuf *pkts_burst[FASTPATH_DEFAULT_BURST_SIZE_EXCEPTION];
+    struct rte_kni *kni = fastpath.kni[port_id];
+    uint32_t n_pkts;
+
+    n_pkts = rte_kni_rx_burst(kni, pkts_burst, FASTPATH_DEFAULT_BURST_SIZE_EXCEPTION);
+    if (n_pkts != 0) {
+        exception_nic_tx(port_id, pkts_burst, n_pkts);
+    }
+
+    rte_kni_handle_request(kni);
+}
+
+static void
+tap_egress(uint32_t port_id)
+{
+    struct rte_mbuf *pkts_burst[FASTPATH_DEFAULT_BURST_SIZE_EXCEPTION];
+    uint32_t n_pkts;
+
+    n_pkts = tap_rx_burst((uint8_t) port_id, pkts_burst,
+        FASTPATH_DEFAULT_BURST_SIZE_EXCEPTION,
+        fastpath.lcore_params[exception.lcore].pktbuf_pool);
+    if (n_pkts != 0) {
+        exception_nic_tx(port_id, pkts_burst, n_pkts);
+    }
+}
+
+/**
+ * One round of the exception path: drain the producer rings into KNI,
+ * then the KNI queues towards the NICs, then the bridge learn rings
+ */
+uint32_t exception_poll(void)
+{
+    struct rte_mbuf *pkts[FASTPATH_DEFAULT_BURST_SIZE_EXCEPTION];
+    uint32_t i, j, k, port, n_pkts = 0;
+
+    for (i = 0; i < exception.n_producers; i ++) {
+        uint32_t n_mbufs;
+
+        n_mbufs = rte_ring_sc_dequeue_burst(
+            exception.rings[exception.producers[i]],
+            (void **) pkts,
+            FASTPATH_DEFAULT_BURST_SIZE_EXCEPTION);
+        if (n_mbufs == 0) {
+            continue;
+        }
+
+        /* runs of packets for the same port go to KNI in one burst */
+        for (j = 0, k = 1; k <= n_mbufs; k ++) {
+            if (k == n_mbufs || pkts[k]->port != pkts[j]->port) {
+                exception_kernel_tx(pkts[j]->port, &pkts[j], k - j);
+                j = k;
+            }
+        }
+
+        n_pkts += n_mbufs;
+    }
+
+    for (port = 0; port < FASTPATH_MAX_NIC_PORTS; port ++) {
+        if (fastpath.kni[port] != NULL) {
+            kni_egress(port);
+        } else if (tap_is_open((uint8_t) port)) {
+            /* segments the sender did not follow up on in time */
+            if (gro_is_enabled((uint8_t) port)) {
+                k = gro_flush((uint8_t) port, pkts, FASTPATH_DEFAULT_BURST_SIZE_EXCEPTION);
+                if (k != 0) {
+                    exception_tap_tx(port, pkts, k);
+                }
+            }
+
+            tap_egress(port);
+        }
+    }
+
+    /* the exception lcore is the only writer of the bridge FDBs */
+    bridge_fdb_poll();
+
+    exception.pkts += n_pkts;
+
+    return n_pkts;
+}
+
+void exception_print_stats(void)
+{
+    uint32_t lcore, port;
+    uint64_t to_kni = 0, dropped = 0, from_kni = 0;
+
+    for (lcore = 0; lcore < FASTPATH_MAX_LCORES; lcore ++) {
+        struct fastpath_lcore_runtime *rt = fastpath.runtime[lcore];
+
+        if (rt == NULL) {
+            continue;
+        }
+
+        for (port = 0; port < FASTPATH_MAX_NIC_PORTS; port ++) {
+            to_kni += rt->kni_stats[port].rx_packets;
+            dropped += rt->kni_stats[port].rx_dropped;
+            from_kni += rt->kni_stats[port].tx_packets;
+        }
+    }
+
+    printf("Exception lcore %u: ring pkts = %"PRIu64" to kni = %"PRIu64
+        " dropped = %"PRIu64" from kni = %"PRIu64"\n",
+        exception.lcore,
+        exception.pkts,
+        to_kni,
+        dropped,
+        from_kni);
+
+    /* the punt cost of each kernel interface, to compare kni and tap */
+    printf("Exception lcore %u: %.2f cycles/pkt to kni, %.2f cycles/pkt to tap\n",
+        exception.lcore,
+        exception.kernel_pkts[e_FASTPATH_EXC_KNI] ?
+            ((double) exception.kernel_cycles[e_FASTPATH_EXC_KNI]) /
+            ((double) exception.kernel_pkts[e_FASTPATH_EXC_KNI]) : 0.0,
+        exception.kernel_pkts[e_FASTPATH_EXC_TAP] ?
+            ((double) exception.kernel_cycles[e_FASTPATH_EXC_TAP]) /
+            ((double) exception.kernel_pkts[e_FASTPATH_EXC_TAP]) : 0.0);
+
+    for (port = 0; port < FASTPATH_MAX_NIC_PORTS; port ++) {
+        gro_print_stats((uint8_t) port);
+    }
+}
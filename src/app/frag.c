@@ -0,0 +1,324 @@
+
+#include "include/fastpath.h"
+
+/*
+ * IPv4 fragmentation without copying the payload. A fragment is a
+ * header mbuf from the header pool, holding the IP header with the L2
+ * header in its headroom, chained to indirect mbufs pointing into the
+ * segments of the original packet, which then only needs freeing.
+ * Fragments leave with the metadata of the original, so the lower
+ * modules see them like any transmitted packet. IPv6 is not fragmented
+ * in transit (RFC 8200), its sender gets a Packet Too Big instead.
+ */
+#define FRAG_ICMP_DEST_UNREACH  3
+#define FRAG_ICMP_FRAG_NEEDED   4
+#define FRAG_ICMP_TTL           64
+
+#define FRAG_ICMP6_PKT_TOO_BIG  2
+#define FRAG_IPV6_MIN_MTU       1280
+
+/* ICMPv6 Packet Too Big header, RFC 4443 */
+struct frag_icmp6_hdr {
+    uint8_t type;
+    uint8_t code;
+    uint16_t cksum;
+    uint32_t mtu;
+} __attribute__((__packed__));
+
+static const uint8_t frag_ipv6_unspec[16];
+
+struct frag_cursor {
+    struct rte_mbuf *seg;
+    uint32_t off;           /* in the data of seg */
+};
+
+/* Header mbuf of a fragment with the headers of m, len bytes of L3 header */
+static struct rte_mbuf *
+frag_header(struct rte_mbuf *m, const struct fastpath_pkt_metadata *c, uint32_t len,
+    struct rte_mempool *mp)
+{
+    struct rte_mbuf *hdr;
+    struct fastpath_pkt_metadata *hc;
+
+    hdr = rte_pktmbuf_alloc(mp);
+    if (unlikely(hdr == NULL)) {
+        return NULL;
+    }
+
+    rte_memcpy(rte_pktmbuf_append(hdr, (uint16_t)len), rte_pktmbuf_mtod(m, void *), len);
+
+    hdr->port = m->port;
+    hdr->vlan_tci = m->vlan_tci;
+    hdr->hash = m->hash;
+    hdr->ol_flags = m->ol_flags;
+
+    hc = (struct fastpath_pkt_metadata *)RTE_MBUF_METADATA_UINT8_PTR(hdr, 0);
+    *hc = *c;
+    hc->l3_off = hdr->data_off;
+    hc->l2_off = hdr->data_off - sizeof(struct ether_hdr);
+    rte_memcpy(FASTPATH_PKT_HDR(hdr, hc->l2_off), FASTPATH_PKT_HDR(m, c->l2_off),
+        sizeof(struct ether_hdr));
+
+    return hdr;
+}
+
+/* Chain len bytes of payload from the cursor on, without copying them */
+static int
+frag_attach(struct rte_mbuf *hdr, struct frag_cursor *cur, uint32_t len,
+    struct rte_mempool *mp)
+{
+    struct rte_mbuf **tail = &hdr->next;
+    struct rte_mbuf *seg, *ind;
+    uint32_t n;
+
+    while (len > 0) {
+        seg = cur->seg;
+        if (cur->off == seg->data_len) {
+            if (seg->next == NULL) {
+                return -EINVAL;
+            }
+            cur->seg = seg->next;
+            cur->off = 0;
+            continue;
+        }
+
+        ind = rte_pktmbuf_alloc(mp);
+        if (unlikely(ind == NULL)) {
+            return -ENOMEM;
+        }
+
+        /* the buffer owner, seg may be indirect itself */
+        rte_pktmbuf_attach(ind, RTE_MBUF_FROM_BADDR(seg->buf_addr));
+        n = RTE_MIN(len, (uint32_t)(seg->data_len - cur->off));
+        ind->data_off = seg->data_off + cur->off;
+        ind->data_len = n;
+        ind->pkt_len = n;
+
+        *tail = ind;
+        tail = &ind->next;
+        hdr->nb_segs++;
+        hdr->pkt_len += n;
+
+        cur->off += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/* The payload of m starts after the first hdr_len bytes of its data */
+static inline void
+frag_cursor_init(struct frag_cursor *cur, struct rte_mbuf *m, uint32_t hdr_len)
+{
+    cur->seg = m;
+    cur->off = hdr_len;
+}
+
+static void
+frag_free(struct rte_mbuf **pkts, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        rte_pktmbuf_free(pkts[i]);
+    }
+}
+
+/*
+ * Fragments of m, IP header at its data, for mtu; the number of them or
+ * a negative errno. m is left to the caller, the fragments hold it.
+ */
+int frag_ipv4(struct rte_mbuf *m, struct rte_mbuf **pkts_out, uint32_t n_max, uint16_t mtu,
+    struct rte_mempool *header_pool, struct rte_mempool *indirect_pool)
+{
+    struct ipv4_hdr *ipv4_hdr = rte_pktmbuf_mtod(m, struct ipv4_hdr *);
+    struct fastpath_pkt_metadata *c =
+        (struct fastpath_pkt_metadata *)RTE_MBUF_METADATA_UINT8_PTR(m, 0);
+    struct frag_cursor cur;
+    uint32_t ihl, frag_size, payload, off, len, n;
+    uint16_t flag_offset, base, more;
+
+    ihl = (ipv4_hdr->version_ihl & 0xf) * 4;
+    if (unlikely(mtu <= ihl || m->data_len < ihl || m->pkt_len <= ihl)) {
+        return -EINVAL;
+    }
+
+    frag_size = (mtu - ihl) & ~(IPV4_HDR_OFFSET_UNITS - 1);
+    payload = m->pkt_len - ihl;
+    if (unlikely(frag_size == 0 || (payload + frag_size - 1) / frag_size > n_max)) {
+        return -EINVAL;
+    }
+
+    /* m may be a fragment already */
+    flag_offset = rte_be_to_cpu_16(ipv4_hdr->fragment_offset);
+    base = flag_offset & IPV4_HDR_OFFSET_MASK;
+    more = flag_offset & IPV4_HDR_MF_FLAG;
+
+    frag_cursor_init(&cur, m, ihl);
+    for (n = 0, off = 0; off < payload; n++, off += len) {
+        struct rte_mbuf *hdr;
+        struct ipv4_hdr *frag_hdr;
+
+        len = RTE_MIN(frag_size, payload - off);
+
+        hdr = frag_header(m, c, ihl, header_pool);
+        if (unlikely(hdr == NULL)) {
+            frag_free(pkts_out, n);
+            return -ENOMEM;
+        }
+        pkts_out[n] = hdr;
+
+        if (unlikely(frag_attach(hdr, &cur, len, indirect_pool) < 0)) {
+            frag_free(pkts_out, n + 1);
+            return -ENOMEM;
+        }
+
+        frag_hdr = rte_pktmbuf_mtod(hdr, struct ipv4_hdr *);
+        frag_hdr->total_length = rte_cpu_to_be_16(ihl + len);
+        frag_hdr->fragment_offset = rte_cpu_to_be_16(
+            (base + off / IPV4_HDR_OFFSET_UNITS) |
+            (off + len < payload ? IPV4_HDR_MF_FLAG : more));
+        frag_hdr->hdr_checksum = 0;
+
+        /* the header checksum is finished on TX */
+        hdr->ol_flags |= PKT_TX_IPV4 | PKT_TX_IP_CKSUM;
+        hdr->l2_len = sizeof(struct ether_hdr);
+        hdr->l3_len = ihl;
+    }
+
+    return n;
+}
+
+/*
+ * ICMP fragmentation needed for m, which had DF set, from src (network
+ * order) to its sender: a new packet at its IP header, to be routed.
+ */
+struct rte_mbuf *frag_icmp_need_frag(struct rte_mbuf *m, uint32_t src, uint16_t mtu,
+    struct rte_mempool *mp)
+{
+    struct ipv4_hdr *orig = rte_pktmbuf_mtod(m, struct ipv4_hdr *);
+    struct fastpath_pkt_metadata *c =
+        (struct fastpath_pkt_metadata *)RTE_MBUF_METADATA_UINT8_PTR(m, 0);
+    struct fastpath_pkt_metadata *rc;
+    struct rte_mbuf *r;
+    struct ipv4_hdr *ipv4_hdr;
+    struct icmp_hdr *icmp_hdr;
+    uint32_t quote;
+
+    /* the header and 64 bits of the datagram, RFC 792 */
+    quote = RTE_MIN((uint32_t)((orig->version_ihl & 0xf) * 4 + 8), (uint32_t)m->data_len);
+
+    r = rte_pktmbuf_alloc(mp);
+    if (unlikely(r == NULL)) {
+        return NULL;
+    }
+
+    ipv4_hdr = (struct ipv4_hdr *)rte_pktmbuf_append(r,
+        sizeof(struct ipv4_hdr) + sizeof(struct icmp_hdr) + quote);
+    if (unlikely(ipv4_hdr == NULL)) {
+        rte_pktmbuf_free(r);
+        return NULL;
+    }
+    icmp_hdr = (struct icmp_hdr *)(ipv4_hdr + 1);
+
+    rte_memcpy(icmp_hdr + 1, orig, quote);
+    icmp_hdr->icmp_type = FRAG_ICMP_DEST_UNREACH;
+    icmp_hdr->icmp_code = FRAG_ICMP_FRAG_NEEDED;
+    icmp_hdr->icmp_cksum = 0;
+    icmp_hdr->icmp_ident = 0;
+    icmp_hdr->icmp_seq_nb = rte_cpu_to_be_16(mtu);
+    icmp_hdr->icmp_cksum = ~rte_raw_cksum(icmp_hdr, sizeof(struct icmp_hdr) + quote);
+
+    ipv4_hdr->version_ihl = 0x45;
+    ipv4_hdr->type_of_service = 0xc0;
+    ipv4_hdr->total_length = rte_cpu_to_be_16(r->pkt_len);
+    ipv4_hdr->packet_id = 0;
+    ipv4_hdr->fragment_offset = 0;
+    ipv4_hdr->time_to_live = FRAG_ICMP_TTL;
+    ipv4_hdr->next_proto_id = IPPROTO_ICMP;
+    ipv4_hdr->src_addr = src;
+    ipv4_hdr->dst_addr = orig->src_addr;
+    ipv4_hdr->hdr_checksum = 0;
+    ipv4_hdr->hdr_checksum = rte_ipv4_cksum(ipv4_hdr);
+
+    r->port = m->port;
+
+    rc = (struct fastpath_pkt_metadata *)RTE_MBUF_METADATA_UINT8_PTR(r, 0);
+    memset(rc, 0, sizeof(*rc));
+    rc->protocol = ETHER_TYPE_IPv4;
+    rc->pkt_type = FASTPATH_PKT_IPV4;
+    rc->vlan_id = c->vlan_id;
+    rc->l3_off = r->data_off;
+    rc->l2_off = r->data_off - sizeof(struct ether_hdr);
+    rc->l4_off = r->data_off + sizeof(struct ipv4_hdr);
+
+    return r;
+}
+
+/*
+ * ICMPv6 Packet Too Big for m from src to its sender, quoting as much of
+ * m as fits in the minimum IPv6 MTU: a new packet at its IP header, to
+ * be routed.
+ */
+struct rte_mbuf *frag_icmp6_too_big(struct rte_mbuf *m, const uint8_t *src, uint16_t mtu,
+    struct rte_mempool *mp)
+{
+    struct ipv6_hdr *orig = rte_pktmbuf_mtod(m, struct ipv6_hdr *);
+    struct fastpath_pkt_metadata *c =
+        (struct fastpath_pkt_metadata *)RTE_MBUF_METADATA_UINT8_PTR(m, 0);
+    struct fastpath_pkt_metadata *rc;
+    struct rte_mbuf *r;
+    struct ipv6_hdr *ipv6_hdr;
+    struct frag_icmp6_hdr *icmp_hdr;
+    uint32_t quote;
+
+    /* never to a multicast or unspecified source, RFC 4443 2.4 */
+    if (unlikely(m->data_len < sizeof(struct ipv6_hdr) || orig->src_addr[0] == 0xff ||
+        memcmp(orig->src_addr, frag_ipv6_unspec, sizeof(frag_ipv6_unspec)) == 0)) {
+        return NULL;
+    }
+
+    quote = RTE_MIN((uint32_t)(FRAG_IPV6_MIN_MTU - sizeof(struct ipv6_hdr) -
+        sizeof(struct frag_icmp6_hdr)), (uint32_t)m->data_len);
+
+    r = rte_pktmbuf_alloc(mp);
+    if (unlikely(r == NULL)) {
+        return NULL;
+    }
+
+    ipv6_hdr = (struct ipv6_hdr *)rte_pktmbuf_append(r,
+        sizeof(struct ipv6_hdr) + sizeof(struct frag_icmp6_hdr) + quote);
+    if (unlikely(ipv6_hdr == NULL)) {
+        rte_pktmbuf_free(r);
+        return NULL;
+    }
+    icmp_hdr = (struct frag_icmp6_hdr *)(ipv6_hdr + 1);
+
+    rte_memcpy(icmp_hdr + 1, orig, quote);
+
+    ipv6_hdr->vtc_flow = rte_cpu_to_be_32(6 << 28);
+    ipv6_hdr->payload_len = rte_cpu_to_be_16(sizeof(struct frag_icmp6_hdr) + quote);
+    ipv6_hdr->proto = IPPROTO_ICMPV6;
+    ipv6_hdr->hop_limits = FRAG_ICMP_TTL;
+    rte_memcpy(ipv6_hdr->src_addr, src, sizeof(ipv6_hdr->src_addr));
+    rte_memcpy(ipv6_hdr->dst_addr, orig->src_addr, sizeof(ipv6_hdr->dst_addr));
+
+    icmp_hdr->type = FRAG_ICMP6_PKT_TOO_BIG;
+    icmp_hdr->code = 0;
+    icmp_hdr->cksum = 0;
+    icmp_hdr->mtu = rte_cpu_to_be_32(mtu);
+    icmp_hdr->cksum = rte_ipv6_udptcp_cksum(ipv6_hdr, icmp_hdr);
+
+    r->port = m->port;
+
+    rc = (struct fastpath_pkt_metadata *)RTE_MBUF_METADATA_UINT8_PTR(r, 0);
+    memset(rc, 0, sizeof(*rc));
+    rc->protocol = ETHER_TYPE_IPv6;
+    rc->pkt_type = FASTPATH_PKT_IPV6;
+    rc->vlan_id = c->vlan_id;
+    rc->l3_off = r->data_off;
+    rc->l2_off = r->data_off - sizeof(struct ether_hdr);
+    rc->l4_off = r->data_off + sizeof(struct ipv6_hdr);
+
+    return r;
+}
@@ -0,0 +1,428 @@
+
+#include "include/fastpath.h"
+
+/*
+ * Receive side coalescing of TCP punted to a tap. In-order segments of a
+ * flow are chained behind the first one, which keeps its headers, and the
+ * tap hands the chain to the kernel as one GSO packet, so a bulk transfer
+ * to the host costs the kernel one pass per chain instead of per segment.
+ *
+ * A flow is flushed when a segment does not extend it, on PSH, when it is
+ * full and FASTPATH_GRO_FLUSH_US after its first segment. Like the kernel,
+ * only plain ACK segments with identical options are merged. The tap reads
+ * the chain without copying; KNI would copy the first segment only, so KNI
+ * ports are not coalesced. Exception lcore only.
+ */
+#define GRO_TCP_FLAG_PSH    0x08
+#define GRO_TCP_FLAG_ACK    0x10
+
+/* the IPv4 fragment offset field without DF, a fragment when not zero */
+#define GRO_IPV4_FRAG_MASK  0xBFFF
+
+/* an IP packet may not grow beyond this */
+#define GRO_MAX_IP_LEN      0xFFFF
+
+struct gro_pkt {
+    struct tcp_hdr *tcp;
+    uint16_t l3_off;
+    uint16_t l4_off;
+    uint16_t hdr_len;       /* L2 header to the end of the TCP options */
+    uint16_t payload;
+    uint8_t ipv6;
+};
+
+struct gro_flow {
+    struct rte_mbuf *head;
+    struct rte_mbuf *tail;  /* last segment of the chain */
+    uint64_t start;         /* tsc when the first segment arrived */
+    uint32_t next_seq;
+    uint16_t mss;           /* payload of the first segment */
+    uint16_t n_segs;
+    struct gro_pkt pkt;     /* headers of the first segment */
+};
+
+/* flows are kept in arrival order, the oldest first */
+struct gro_table {
+    struct gro_flow flows[FASTPATH_GRO_MAX_FLOWS];
+    uint32_t n_flows;
+
+    /* stats */
+    uint64_t segs;
+    uint64_t pkts;
+};
+
+static struct gro_table *gro_tables[FASTPATH_MAX_NIC_PORTS];
+static uint64_t gro_timeout;
+
+int gro_enable(uint8_t port)
+{
+    if (port >= FASTPATH_MAX_NIC_PORTS || gro_tables[port] != NULL) {
+        return -EINVAL;
+    }
+
+    gro_tables[port] = rte_zmalloc(NULL, sizeof(struct gro_table), RTE_CACHE_LINE_SIZE);
+    if (gro_tables[port] == NULL) {
+        return -ENOMEM;
+    }
+
+    gro_timeout = rte_get_tsc_hz() * FASTPATH_GRO_FLUSH_US / 1000000;
+    fastpath_log_info("gro_enable: port %u, %d flows, flush after %d us\n",
+        port, FASTPATH_GRO_MAX_FLOWS, FASTPATH_GRO_FLUSH_US);
+
+    return 0;
+}
+
+void gro_disable(uint8_t port)
+{
+    struct gro_table *table;
+    uint32_t i;
+
+    if (port >= FASTPATH_MAX_NIC_PORTS || gro_tables[port] == NULL) {
+        return;
+    }
+
+    table = gro_tables[port];
+    gro_tables[port] = NULL;
+
+    for (i = 0; i < table->n_flows; i++) {
+        rte_pktmbuf_free(table->flows[i].head);
+    }
+
+    rte_free(table);
+}
+
+int gro_is_enabled(uint8_t port)
+{
+    return port < FASTPATH_MAX_NIC_PORTS && gro_tables[port] != NULL;
+}
+
+/* Find the TCP header of an IPv4 or IPv6 packet, 0 when there is one */
+static int
+gro_parse(struct rte_mbuf *m, struct gro_pkt *pkt)
+{
+    char *data = rte_pktmbuf_mtod(m, char *);
+    struct ether_hdr *eth_hdr = (struct ether_hdr *) data;
+    uint16_t ether_type = rte_be_to_cpu_16(eth_hdr->ether_type);
+    uint32_t off = sizeof(struct ether_hdr), l3_len, l4_len, ip_len;
+
+    while ((ether_type == ETHER_TYPE_VLAN || ether_type == ETHER_TYPE_QINQ) &&
+           off + sizeof(struct vlan_hdr) <= m->data_len) {
+        struct vlan_hdr *vlan_hdr = (struct vlan_hdr *)(data + off);
+
+        ether_type = rte_be_to_cpu_16(vlan_hdr->eth_proto);
+        off += sizeof(struct vlan_hdr);
+    }
+
+    if (ether_type == ETHER_TYPE_IPv4) {
+        struct ipv4_hdr *ipv4_hdr = (struct ipv4_hdr *)(data + off);
+
+        if (off + sizeof(struct ipv4_hdr) > m->data_len ||
+            ipv4_hdr->version_ihl != 0x45 ||
+            ipv4_hdr->next_proto_id != IPPROTO_TCP ||
+            (rte_be_to_cpu_16(ipv4_hdr->fragment_offset) & GRO_IPV4_FRAG_MASK) != 0) {
+            return -1;
+        }
+
+        l3_len = sizeof(struct ipv4_hdr);
+        ip_len = rte_be_to_cpu_16(ipv4_hdr->total_length);
+        pkt->ipv6 = 0;
+    } else if (ether_type == ETHER_TYPE_IPv6) {
+        struct ipv6_hdr *ipv6_hdr = (struct ipv6_hdr *)(data + off);
+
+        /* no extension headers */
+        if (off + sizeof(struct ipv6_hdr) > m->data_len ||
+            ipv6_hdr->proto != IPPROTO_TCP) {
+            return -1;
+        }
+
+        l3_len = sizeof(struct ipv6_hdr);
+        ip_len = l3_len + rte_be_to_cpu_16(ipv6_hdr->payload_len);
+        pkt->ipv6 = 1;
+    } else {
+        return -1;
+    }
+
+    if (off + l3_len + sizeof(struct tcp_hdr) > m->data_len) {
+        return -1;
+    }
+
+    pkt->tcp = (struct tcp_hdr *)(data + off + l3_len);
+    l4_len = (pkt->tcp->data_off >> 4) << 2;
+    if (l4_len < sizeof(struct tcp_hdr) || off + l3_len + l4_len > m->data_len ||
+        l3_len + l4_len > ip_len) {
+        return -1;
+    }
+
+    pkt->l3_off = (uint16_t) off;
+    pkt->l4_off = (uint16_t)(off + l3_len);
+    pkt->hdr_len = (uint16_t)(off + l3_len + l4_len);
+    pkt->payload = (uint16_t)(ip_len - l3_len - l4_len);
+
+    return 0;
+}
+
+/* Same L2 header, addresses and ports */
+static int
+gro_same_flow(const struct gro_flow *flow, struct rte_mbuf *m, const struct gro_pkt *pkt)
+{
+    const char *a = rte_pktmbuf_mtod(flow->head, const char *);
+    const char *b = rte_pktmbuf_mtod(m, const char *);
+
+    if (flow->pkt.l3_off != pkt->l3_off || flow->pkt.ipv6 != pkt->ipv6 ||
+        memcmp(a, b, pkt->l3_off) != 0 ||
+        memcmp(&flow->pkt.tcp->src_port, &pkt->tcp->src_port, 2 * sizeof(uint16_t)) != 0) {
+        return 0;
+    }
+
+    a += pkt->l3_off;
+    b += pkt->l3_off;
+    if (pkt->ipv6) {
+        return memcmp(&((const struct ipv6_hdr *) a)->src_addr,
+                      &((const struct ipv6_hdr *) b)->src_addr, 32) == 0;
+    }
+
+    return memcmp(&((const struct ipv4_hdr *) a)->src_addr,
+                  &((const struct ipv4_hdr *) b)->src_addr, 2 * sizeof(uint32_t)) == 0;
+}
+
+/* The kernel gets the chain with CHECKSUM_PARTIAL, so verify before holding */
+static int
+gro_cksum_valid(struct rte_mbuf *m, const struct gro_pkt *pkt)
+{
+    void *l3_hdr = rte_pktmbuf_mtod(m, char *) + pkt->l3_off;
+
+    if (fastpath.rx_offload[m->port] & DEV_RX_OFFLOAD_TCP_CKSUM) {
+        return !(m->ol_flags & PKT_RX_L4_CKSUM_BAD);
+    }
+
+    /* over a correct checksum the complemented sum is 0, returned as 0xffff */
+    if (pkt->ipv6) {
+        return rte_ipv6_udptcp_cksum((struct ipv6_hdr *) l3_hdr, pkt->tcp) == 0xffff;
+    }
+
+    return rte_ipv4_udptcp_cksum((struct ipv4_hdr *) l3_hdr, pkt->tcp) == 0xffff;
+}
+
+/* A data segment, alone in its mbuf without padding, that may be held */
+static int
+gro_can_hold(struct rte_mbuf *m, const struct gro_pkt *pkt)
+{
+    return m->nb_segs == 1 &&
+           pkt->payload != 0 &&
+           m->pkt_len == (uint32_t) pkt->hdr_len + pkt->payload &&
+           (pkt->tcp->tcp_flags & ~GRO_TCP_FLAG_PSH) == GRO_TCP_FLAG_ACK &&
+           gro_cksum_valid(m, pkt);
+}
+
+/* Chain the payload of m behind the flow, 0 when merged */
+static int
+gro_flow_merge(struct gro_flow *flow, struct rte_mbuf *m, const struct gro_pkt *pkt)
+{
+    const char *a = rte_pktmbuf_mtod(flow->head, const char *) + pkt->l3_off;
+    const char *b = rte_pktmbuf_mtod(m, const char *) + pkt->l3_off;
+    struct tcp_hdr *tcp = flow->pkt.tcp;
+
+    if (pkt->hdr_len != flow->pkt.hdr_len ||
+        pkt->payload > flow->mss ||
+        rte_be_to_cpu_32(pkt->tcp->sent_seq) != flow->next_seq ||
+        pkt->tcp->recv_ack != tcp->recv_ack ||
+        flow->head->nb_segs + 1 >= TAP_MAX_IOV ||
+        flow->head->pkt_len - pkt->l3_off + pkt->payload > GRO_MAX_IP_LEN) {
+        return -1;
+    }
+
+    /* options, timestamps included, must not differ */
+    if (memcmp(tcp + 1, pkt->tcp + 1, pkt->hdr_len - pkt->l4_off - sizeof(struct tcp_hdr)) != 0) {
+        return -1;
+    }
+
+    if (pkt->ipv6) {
+        const struct ipv6_hdr *ha = (const struct ipv6_hdr *) a;
+        const struct ipv6_hdr *hb = (const struct ipv6_hdr *) b;
+
+        if (ha->vtc_flow != hb->vtc_flow || ha->hop_limits != hb->hop_limits) {
+            return -1;
+        }
+    } else {
+        const struct ipv4_hdr *ha = (const struct ipv4_hdr *) a;
+        const struct ipv4_hdr *hb = (const struct ipv4_hdr *) b;
+
+        if (ha->type_of_service != hb->type_of_service ||
+            ha->time_to_live != hb->time_to_live ||
+            ha->fragment_offset != hb->fragment_offset) {
+            return -1;
+        }
+    }
+
+    /* the latest window and PSH are what the receiver should see */
+    tcp->rx_win = pkt->tcp->rx_win;
+    tcp->tcp_flags |= pkt->tcp->tcp_flags;
+
+    rte_pktmbuf_adj(m, pkt->hdr_len);
+    flow->tail->next = m;
+    flow->tail = m;
+    flow->head->nb_segs++;
+    flow->head->pkt_len += pkt->payload;
+    flow->next_seq += pkt->payload;
+    flow->n_segs++;
+
+    return 0;
+}
+
+/* Fix the headers of the chain and mark it for segmentation */
+static struct rte_mbuf *
+gro_flow_close(struct gro_table *table, struct gro_flow *flow)
+{
+    struct rte_mbuf *m = flow->head;
+    char *l3_hdr = rte_pktmbuf_mtod(m, char *) + flow->pkt.l3_off;
+    struct tcp_hdr *tcp = flow->pkt.tcp;
+
+    table->segs += flow->n_segs;
+    table->pkts += 1;
+
+    if (flow->n_segs == 1) {
+        return m;
+    }
+
+    /* the checksum field takes the pseudo header sum over the whole length */
+    if (flow->pkt.ipv6) {
+        struct ipv6_hdr *ipv6_hdr = (struct ipv6_hdr *) l3_hdr;
+
+        ipv6_hdr->payload_len = rte_cpu_to_be_16((uint16_t)(m->pkt_len - flow->pkt.l4_off));
+        tcp->cksum = rte_ipv6_phdr_cksum(ipv6_hdr, 0);
+        m->ol_flags |= PKT_TX_IPV6;
+    } else {
+        struct ipv4_hdr *ipv4_hdr = (struct ipv4_hdr *) l3_hdr;
+
+        ipv4_hdr->total_length = rte_cpu_to_be_16((uint16_t)(m->pkt_len - flow->pkt.l3_off));
+        ipv4_hdr->hdr_checksum = 0;
+        ipv4_hdr->hdr_checksum = rte_ipv4_cksum(ipv4_hdr);
+        tcp->cksum = rte_ipv4_phdr_cksum(ipv4_hdr, 0);
+        m->ol_flags |= PKT_TX_IPV4;
+    }
+
+    m->ol_flags |= PKT_TX_TCP_SEG;
+    m->l2_len = flow->pkt.l3_off;
+    m->l3_len = flow->pkt.l4_off - flow->pkt.l3_off;
+    m->l4_len = flow->pkt.hdr_len - flow->pkt.l4_off;
+    m->tso_segsz = flow->mss;
+
+    return m;
+}
+
+static struct rte_mbuf *
+gro_flow_flush(struct gro_table *table, uint32_t i)
+{
+    struct rte_mbuf *m = gro_flow_close(table, &table->flows[i]);
+
+    table->n_flows--;
+    memmove(&table->flows[i], &table->flows[i + 1],
+        (table->n_flows - i) * sizeof(struct gro_flow));
+
+    return m;
+}
+
+static void
+gro_flow_start(struct gro_table *table, struct rte_mbuf *m, const struct gro_pkt *pkt)
+{
+    struct gro_flow *flow = &table->flows[table->n_flows++];
+
+    flow->head = m;
+    flow->tail = m;
+    flow->start = fastpath_clock();
+    flow->next_seq = rte_be_to_cpu_32(pkt->tcp->sent_seq) + pkt->payload;
+    flow->mss = pkt->payload;
+    flow->n_segs = 1;
+    flow->pkt = *pkt;
+}
+
+/**
+ * Coalesce a burst of packets for the kernel. What leaves, in order per
+ * flow, is stored in out, which must have room for 2 * n_pkts packets.
+ */
+uint32_t gro_receive(uint8_t port, struct rte_mbuf **pkts, uint32_t n_pkts,
+    struct rte_mbuf **out)
+{
+    struct gro_table *table = gro_tables[port];
+    uint32_t i, k, n_out = 0;
+
+    for (k = 0; k < n_pkts; k++) {
+        struct rte_mbuf *m = pkts[k];
+        struct gro_pkt pkt;
+        int hold;
+
+        if (gro_parse(m, &pkt) < 0) {
+            out[n_out++] = m;
+            continue;
+        }
+
+        hold = gro_can_hold(m, &pkt);
+
+        for (i = 0; i < table->n_flows; i++) {
+            if (gro_same_flow(&table->flows[i], m, &pkt)) {
+                break;
+            }
+        }
+
+        if (i < table->n_flows) {
+            struct gro_flow *flow = &table->flows[i];
+
+            if (hold && gro_flow_merge(flow, m, &pkt) == 0) {
+                /* a short segment or PSH ends the burst of the sender */
+                if (pkt.payload < flow->mss ||
+                    (flow->pkt.tcp->tcp_flags & GRO_TCP_FLAG_PSH)) {
+                    out[n_out++] = gro_flow_flush(table, i);
+                }
+                continue;
+            }
+
+            /* what follows may not overtake the held segments */
+            out[n_out++] = gro_flow_flush(table, i);
+        }
+
+        if (!hold || (pkt.tcp->tcp_flags & GRO_TCP_FLAG_PSH)) {
+            out[n_out++] = m;
+            continue;
+        }
+
+        if (table->n_flows == FASTPATH_GRO_MAX_FLOWS) {
+            out[n_out++] = gro_flow_flush(table, 0);
+        }
+
+        gro_flow_start(table, m, &pkt);
+    }
+
+    return n_out;
+}
+
+/**
+ * Release the flows held longer than FASTPATH_GRO_FLUSH_US, at most n_out
+ */
+uint32_t gro_flush(uint8_t port, struct rte_mbuf **out, uint32_t n_out)
+{
+    struct gro_table *table = gro_tables[port];
+    uint64_t now = fastpath_clock();
+    uint32_t n = 0;
+
+    while (n < n_out && table->n_flows > 0 &&
+           now - table->flows[0].start >= gro_timeout) {
+        out[n++] = gro_flow_flush(table, 0);
+    }
+
+    return n;
+}
+
+void gro_print_stats(uint8_t port)
+{
+    struct gro_table *table = gro_tables[port];
+
+    if (table == NULL) {
+        return;
+    }
+
+    printf("GRO port %u: %"PRIu64" segments in %"PRIu64" packets, %.2f per packet\n",
+        port,
+        table->segs,
+        table->pkts,
+        table->pkts ? ((double) table->segs) / ((double) table->pkts) : 0.0);
+}
@@ -2,11 +2,21 @@
 #ifndef __BRIDGE_H__
 #define __BRIDGE_H__
 
+#define BRIDGE_MAX_PORTS        FASTPATH_BRIDGE_MAX_PORTS
+
+/* per bridge features, bridge_init */
+#define BRIDGE_F_ARP_SUPPRESS   0x01    /* answer ARP and ND from the snooped neighbours */
+#define BRIDGE_F_MCAST_SNOOPING 0x02    /* IGMP/MLD snooping, groups go to their ports only */
+
 void bridge_receive(struct rte_mbuf *m, struct module *peer, struct module *br);
 void bridge_xmit(struct rte_mbuf *m, struct module *peer, struct module *br);
+void bridge_flush(uint32_t lcore);
 int bridge_connect(struct module *local, struct module *peer, void *param);
-struct module * bridge_init(uint16_t vid);
+struct module * bridge_init(uint16_t vid, uint32_t mac_limit, uint32_t flags);
 int bridge_fini(void);
+void bridge_init_learning(void);
+void bridge_fdb_poll(void);
+void bridge_print_stats(void);
 
 #endif
 
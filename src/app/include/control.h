@@ -0,0 +1,14 @@
+
+#ifndef __CONTROL_H__
+#define __CONTROL_H__
+
+typedef void (*control_cmd_fn)(void *arg, unsigned lcore);
+
+void control_init_rings(void);
+int control_cmd_post(unsigned lcore, control_cmd_fn fn, void *arg);
+int control_cmd_post_all(control_cmd_fn fn, void *arg);
+uint32_t control_cmd_poll(unsigned lcore);
+void control_main_loop(void);
+int control_thread_start(void);
+
+#endif
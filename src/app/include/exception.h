@@ -0,0 +1,17 @@
+
+#ifndef __EXCEPTION_H__
+#define __EXCEPTION_H__
+
+int exception_set_lcore(uint32_t lcore);
+uint32_t exception_get_lcore(void);
+uint16_t exception_get_tx_queue(void);
+void exception_init_rings(void);
+void exception_flush(uint32_t lcore);
+void exception_flush_now(uint32_t lcore);
+uint32_t exception_poll(void);
+void exception_print_stats(void);
+
+void kni_ingress(struct rte_mbuf *m);
+void kni_ingress_burst(uint32_t port_id, struct rte_mbuf **pkts, uint32_t n_pkts);
+
+#endif
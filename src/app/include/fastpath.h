@@ -22,6 +22,7 @@
 #include <sys/ioctl.h>
 #include <sys/queue.h>
 #include <net/if.h>
+#include <arpa/inet.h>
 #include <linux/if_tun.h>
 #include <poll.h>
 #include <assert.h>
@@ -61,6 +62,8 @@
 #include <rte_hash_crc.h>
 #include <rte_ip_frag.h>
 #include <rte_ip.h>
+#include <rte_arp.h>
+#include <rte_icmp.h>
 #include <rte_tcp.h>
 #include <rte_lpm.h>
 #include <rte_lpm6.h>
@@ -79,10 +82,12 @@
 #include "thread.h"
 
 #include "manager.h"
+#include "mgmt.h"
 #include "main.h"
 #include "log.h"
 #include "utils.h"
 #include "stack.h"
+#include "timer.h"
 
 #define MAC_FMT "%02x:%02x:%02x:%02x:%02x:%02x"
 #define MAC_ARG(x) ((uint8_t*)(x))[0],((uint8_t*)(x))[1],((uint8_t*)(x))[2], \
@@ -121,6 +126,7 @@ enum {
     MODULE_TYPE_ACL,
     MODULE_TYPE_TCM,
     MODULE_TYPE_ROUTE,
+    MODULE_TYPE_MAX,
 };
 
 #define FASTPATH_MSG_FAILED     0xFF
@@ -139,11 +145,31 @@ struct module {
     uint16_t type;
     int (*connect)(struct module *local, struct module *peer, void *param);
     int (*message)(struct module *local, struct msg_hdr *req, struct msg_hdr *resp);
+    /* optional, the request reverting req, see mgmt.c */
+    int (*undo)(struct module *local, struct msg_hdr *req, struct msg_hdr *undo);
+    /* optional, 0 when req is well formed, before it is applied or undone */
+    int (*check)(struct module *local, struct msg_hdr *req);
     void (*receive)(struct rte_mbuf *m, struct module *peer, struct module *local);
     void (*transmit)(struct rte_mbuf *m, struct module *peer, struct module *local);
     void *private;
+    /* index among the ports of the upper module, set when it connects */
+    uint16_t upper_port;
+    /* per-lcore state, see module_lcore_private_alloc */
+    void *lcore_private[FASTPATH_MAX_LCORES];
 };
 
+/* State of the module owned by the calling lcore, never shared */
+static inline void *
+module_lcore_private(struct module *module)
+{
+    return module->lcore_private[rte_lcore_id()];
+}
+
+/* Control plane iterator over the per-lcore state, for aggregation */
+#define MODULE_FOREACH_LCORE_PRIVATE(module, lcore, priv) \
+    for ((lcore) = 0; (lcore) < FASTPATH_MAX_LCORES; (lcore)++) \
+        if (((priv) = (module)->lcore_private[(lcore)]) == NULL) {} else
+
 enum {
     PKT_DIR_RECV,
     PKT_DIR_XMIT,
@@ -172,55 +198,66 @@ enum {
         } \
     } while (0)
 
-struct fastpath_flow_key {
-    union {
-        struct {
-            uint8_t ttl; /* needs to be set to 0 */
-            uint8_t proto;
-            uint16_t header_checksum; /* needs to be set to 0 */
-            uint32_t ip_src;
-        };
-        uint64_t slab0;
-    };
-
-    union {
-        struct {
-            uint32_t ip_dst;
-            uint16_t port_src;
-            uint16_t port_dst;
-        };
-        uint64_t slab1;
-    };
-} __attribute__((__packed__));
-
-struct fastpath_arp_key {
-    uint32_t nh_ip;
-    uint32_t nh_iface;
-} __attribute__((__packed__));
+/*
+ * Hop whose peer type fastpath_compile_stack() proved to be fixed and
+ * served by its stock handler: call it directly instead of through the
+ * peer, SEND_PKT stays the fallback for any other graph.
+ */
+#define STACK_DIRECT_BIT(type, dir)     (1U << ((type) * 2 + (dir)))
 
-struct fastpath_pkt_metadata {
-    uint32_t signature;
-    uint16_t protocol;
-    uint8_t reserved1[10];
+#define SEND_PKT_DIRECT(m, local, peer, dir, type, fn) do { \
+        if (likely(fastpath.stack_direct & STACK_DIRECT_BIT(type, dir)) && \
+            likely((peer) != NULL)) { \
+            fn((m), (local), (peer)); \
+        } else { \
+            SEND_PKT(m, local, peer, dir); \
+        } \
+    } while (0)
 
-    uint8_t *mac_header;
-    uint8_t *network_header;
+enum fastpath_pkt_type {
+    FASTPATH_PKT_OTHER,
+    FASTPATH_PKT_ARP,
+    FASTPATH_PKT_IPV4,
+    FASTPATH_PKT_IPV6,
+};
 
-    struct fastpath_flow_key flow_key;
+#define FASTPATH_PKT_F_VLAN     0x01    /* tagged, vlan_id is valid */
+#define FASTPATH_PKT_F_QINQ     0x02    /* double tagged, inner_vlan_tci is valid */
+#define FASTPATH_PKT_F_STRIPPED 0x04    /* tags removed from the frame by vlan_receive */
 
-    struct fastpath_arp_key arp_key;
-    struct ether_addr nh_arp;
+/*
+ * Filled once by fastpath_pkt_parse when the packet enters the stack.
+ * Offsets are relative to buf_addr, so they survive adj/prepend and
+ * compare directly with data_off.
+ */
+struct fastpath_pkt_metadata {
+    uint32_t flow_hash;     /* RSS hash, or computed from the L3 addresses */
+    uint16_t protocol;      /* ether type of the network header */
+    uint16_t vlan_id;       /* outer VID */
+    uint16_t inner_vlan_tci;
+    uint16_t l2_off;
+    uint16_t l3_off;
+    uint16_t l4_off;
+    uint8_t pkt_type;       /* enum fastpath_pkt_type */
+    uint8_t flags;
+};
 
-    uint8_t reserved3[2];
-} __attribute__((__packed__));
+#define FASTPATH_PKT_HDR(m, off)    ((uint8_t *)(m)->buf_addr + (off))
 
 #include "ethernet.h"
 #include "vlan.h"
 #include "bridge.h"
+#include "snoop.h"
+#include "frag.h"
 #include "interface.h"
 #include "acl.h"
 #include "tcm.h"
 #include "route.h"
+#include "pipeline.h"
+#include "control.h"
+#include "exception.h"
+#include "tap.h"
+#include "gro.h"
 
 #endif /* __FASTPATH_H__ */
 
@@ -0,0 +1,12 @@
+
+#ifndef __FRAG_H__
+#define __FRAG_H__
+
+int frag_ipv4(struct rte_mbuf *m, struct rte_mbuf **pkts_out, uint32_t n_max, uint16_t mtu,
+    struct rte_mempool *header_pool, struct rte_mempool *indirect_pool);
+struct rte_mbuf *frag_icmp_need_frag(struct rte_mbuf *m, uint32_t src, uint16_t mtu,
+    struct rte_mempool *mp);
+struct rte_mbuf *frag_icmp6_too_big(struct rte_mbuf *m, const uint8_t *src, uint16_t mtu,
+    struct rte_mempool *mp);
+
+#endif
@@ -0,0 +1,13 @@
+
+#ifndef __GRO_H__
+#define __GRO_H__
+
+int gro_enable(uint8_t port);
+void gro_disable(uint8_t port);
+int gro_is_enabled(uint8_t port);
+uint32_t gro_receive(uint8_t port, struct rte_mbuf **pkts, uint32_t n_pkts,
+    struct rte_mbuf **out);
+uint32_t gro_flush(uint8_t port, struct rte_mbuf **out, uint32_t n_out);
+void gro_print_stats(uint8_t port);
+
+#endif
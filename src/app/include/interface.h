@@ -6,6 +6,9 @@ void interface_receive(struct rte_mbuf *m, struct module *peer, struct module *d
 void interface_xmit(struct rte_mbuf *m, struct module *peer, struct module *dev);
 int interface_connect(struct module *local, struct module *peer, void *param);
 struct module * interface_init(uint16_t ifidx);
+int interface_set_mtu(uint32_t ifidx, uint16_t mtu);
+int interface_set_addr(uint32_t ifidx, uint32_t addr, int del);
+int interface_set_addr6(uint32_t ifidx, const uint8_t *addr, int del);
 
 #endif
 
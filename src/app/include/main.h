@@ -83,6 +83,11 @@
 #define FASTPATH_DEFAULT_INDIRECT_MBUF_SIZE (sizeof(struct rte_mbuf) + sizeof(struct fastpath_pkt_metadata))
 #endif
 
+/* Private L2 header of a replicated packet, the headroom holds the metadata and tags */
+#ifndef FASTPATH_DEFAULT_HEADER_MBUF_SIZE
+#define FASTPATH_DEFAULT_HEADER_MBUF_SIZE (sizeof(struct rte_mbuf) + RTE_PKTMBUF_HEADROOM + 64)
+#endif
+
 #ifndef FASTPATH_DEFAULT_MEMPOOL_BUFFERS
 #define FASTPATH_DEFAULT_MEMPOOL_BUFFERS   8192 * 4
 #endif
@@ -91,22 +96,27 @@
 #define FASTPATH_DEFAULT_MEMPOOL_CACHE_SIZE  256
 #endif
 
-/* Neigh Tables */
+/* Neigh Tables, a local neighbour per interface and room for peers */
 #ifndef FASTPATH_NEIGH_HASH_ENTRIES
-#define FASTPATH_NEIGH_HASH_ENTRIES 1024*2*1
+#define FASTPATH_NEIGH_HASH_ENTRIES (4 * FASTPATH_MAX_INTERFACES)
 #endif 
 
-/* LPM Tables */
+/*
+ * LPM Tables, a full routing table. The DPDK 1.8 rte_lpm, created with
+ * rte_lpm_create(name, socket, max_rules, flags), keeps 8 bytes per rule;
+ * its tbl8 groups are fixed at RTE_LPM_TBL8_NUM_GROUPS (256), which bounds
+ * the /24s holding longer prefixes, not the number of /24 or shorter.
+ */
 #ifndef FASTPATH_MAX_LPM_RULES
-#define FASTPATH_MAX_LPM_RULES (4*1024)
+#define FASTPATH_MAX_LPM_RULES (1 << 20)
 #endif
 
 #ifndef FASTPATH_MAX_LPM6_RULES
-#define FASTPATH_MAX_LPM6_RULES (4*1024)
+#define FASTPATH_MAX_LPM6_RULES (64*1024)
 #endif
 
 #ifndef FASTPATH_LPM6_NUMBER_TBL8S
-#define FASTPATH_LPM6_NUMBER_TBL8S (1 << 10)
+#define FASTPATH_LPM6_NUMBER_TBL8S (1 << 16)
 #endif
 
 /* NIC RX */
@@ -236,14 +246,42 @@
 #define	IPV6_MTU_DEFAULT        ETHER_MTU
 #endif
 
+/* Loop iterations between stats reports, 0 compiles the stats out */
+#ifndef FASTPATH_STATS
+#define FASTPATH_STATS          1000000
+#endif
+
+/* Tick of the per-lcore timer wheels, see timer.c */
+#ifndef FASTPATH_TIMER_TICK_US
+#define FASTPATH_TIMER_TICK_US  100
+#endif
+
+/* ICMP fragmentation needed an lcore may send per interface, per second and at once */
+#ifndef FASTPATH_ICMP_RATE
+#define FASTPATH_ICMP_RATE      100
+#endif
+
+#ifndef FASTPATH_ICMP_BURST
+#define FASTPATH_ICMP_BURST     10
+#endif
+
 #ifndef IP_FRAG_TBL_BUCKET_ENTRIES
 #define IP_FRAG_TBL_BUCKET_ENTRIES    16
 #endif
 
+/*
+ * Distinct (gateway, interface) next hops per address family. The LPM
+ * tables of this DPDK return an 8-bit next hop, so this also bounds the
+ * interfaces that can hold routes at once, whatever FASTPATH_MAX_INTERFACES.
+ */
 #ifndef FASTPATH_LPM_MAX_NEXT_HOPS
 #define FASTPATH_LPM_MAX_NEXT_HOPS     256
 #endif
 
+#if FASTPATH_LPM_MAX_NEXT_HOPS > 256
+#error "rte_lpm next hops are 8-bit, FASTPATH_LPM_MAX_NEXT_HOPS can not exceed 256"
+#endif
+
 #define MAX_FLOW_NUM    UINT16_MAX
 #define MIN_FLOW_NUM    1
 #define DEF_FLOW_NUM    0x1000
@@ -255,16 +293,287 @@
 
 #define MAX_FRAG_NUM    RTE_LIBRTE_IP_FRAG_MAX_FRAG
 
+/* Control traffic steering */
+#ifndef FASTPATH_MAX_CTRL_FILTERS
+#define FASTPATH_MAX_CTRL_FILTERS       32
+#endif
+
+#ifndef FASTPATH_DEFAULT_BURST_SIZE_CTRL_READ
+#define FASTPATH_DEFAULT_BURST_SIZE_CTRL_READ  32
+#endif
+#if (FASTPATH_DEFAULT_BURST_SIZE_CTRL_READ > FASTPATH_MBUF_ARRAY_SIZE)
+#error "FASTPATH_DEFAULT_BURST_SIZE_CTRL_READ is too big"
+#endif
+
+#define FASTPATH_CTRL_QUEUE_NONE        0xFF
+
+/* Traffic classes on the RX to worker rings, class 0 has the highest priority */
+#ifndef FASTPATH_MAX_RING_CLASSES
+#define FASTPATH_MAX_RING_CLASSES       2
+#endif
+
+#ifndef FASTPATH_DEFAULT_RING_WEIGHT
+#define FASTPATH_DEFAULT_RING_WEIGHT    1
+#endif
+
+#define FASTPATH_RING_CLASS_NONE        0xFF
+
+/* Pipeline stages */
+#ifndef FASTPATH_MAX_STAGES
+#define FASTPATH_MAX_STAGES             8
+#endif
+
+#ifndef FASTPATH_DEFAULT_BURST_SIZE_STAGE
+#define FASTPATH_DEFAULT_BURST_SIZE_STAGE  32
+#endif
+#if (FASTPATH_DEFAULT_BURST_SIZE_STAGE > FASTPATH_MBUF_ARRAY_SIZE)
+#error "FASTPATH_DEFAULT_BURST_SIZE_STAGE is too big"
+#endif
+
+/* Queues of a TAP exception interface */
+#ifndef FASTPATH_TAP_MAX_QUEUES
+#define FASTPATH_TAP_MAX_QUEUES                8
+#endif
+
+/* Bridge FDB shared by all bridges, entries preallocated, <fdb-size> */
+#ifndef FASTPATH_BRIDGE_FDB_SIZE
+#define FASTPATH_BRIDGE_FDB_SIZE        (64 * 1024)
+#endif
+
+#ifndef FASTPATH_BRIDGE_FDB_MAX_SIZE
+#define FASTPATH_BRIDGE_FDB_MAX_SIZE    (1024 * 1024)
+#endif
+
+/* seconds, <fdb-aging> */
+#ifndef FASTPATH_BRIDGE_FDB_AGING
+#define FASTPATH_BRIDGE_FDB_AGING       300
+#endif
+
+/* Ports of a bridge, and L3 interfaces (eifN) of the stack */
+#ifndef FASTPATH_BRIDGE_MAX_PORTS
+#define FASTPATH_BRIDGE_MAX_PORTS       256
+#endif
+
+#ifndef FASTPATH_MAX_INTERFACES
+#define FASTPATH_MAX_INTERFACES         4096
+#endif
+
+/* Modules of the stack, found by name */
+#ifndef FASTPATH_MAX_MODULES
+#define FASTPATH_MAX_MODULES            (4 * FASTPATH_MAX_INTERFACES)
+#endif
+
+/* MACs a bridge may learn, <mac-limit> in the bridge list */
+#ifndef FASTPATH_BRIDGE_MAC_LIMIT
+#define FASTPATH_BRIDGE_MAC_LIMIT       4096
+#endif
+
+/* buckets aged per table and millisecond */
+#ifndef FASTPATH_BRIDGE_FDB_SWEEP_BUCKETS
+#define FASTPATH_BRIDGE_FDB_SWEEP_BUCKETS  64
+#endif
+
+#ifndef FASTPATH_BRIDGE_LEARN_RING_SIZE
+#define FASTPATH_BRIDGE_LEARN_RING_SIZE 1024
+#endif
+
+#ifndef FASTPATH_BRIDGE_LEARN_POOL_SIZE
+#define FASTPATH_BRIDGE_LEARN_POOL_SIZE 8191
+#endif
+
+#ifndef FASTPATH_BRIDGE_LEARN_BURST
+#define FASTPATH_BRIDGE_LEARN_BURST     32
+#endif
+
+/* ARP/ND suppression and IGMP/MLD snooping, shared by all bridges */
+#ifndef FASTPATH_BRIDGE_NEIGH_SIZE
+#define FASTPATH_BRIDGE_NEIGH_SIZE      (16 * 1024)
+#endif
+
+#ifndef FASTPATH_BRIDGE_NEIGH_AGING
+#define FASTPATH_BRIDGE_NEIGH_AGING     300
+#endif
+
+#ifndef FASTPATH_BRIDGE_MCAST_GROUPS
+#define FASTPATH_BRIDGE_MCAST_GROUPS    4096
+#endif
+
+/* group membership interval of IGMPv2, and other querier present interval */
+#ifndef FASTPATH_BRIDGE_MCAST_AGING
+#define FASTPATH_BRIDGE_MCAST_AGING     260
+#endif
+
+#ifndef FASTPATH_BRIDGE_MROUTER_AGING
+#define FASTPATH_BRIDGE_MROUTER_AGING   255
+#endif
+
+/* Bridged packets looked up together, per lcore */
+#ifndef FASTPATH_BRIDGE_BURST
+#define FASTPATH_BRIDGE_BURST           32
+#endif
+
+/* TCP coalescing towards a TAP exception interface, per port */
+#ifndef FASTPATH_GRO_MAX_FLOWS
+#define FASTPATH_GRO_MAX_FLOWS          32
+#endif
+
+#ifndef FASTPATH_GRO_FLUSH_US
+#define FASTPATH_GRO_FLUSH_US           100
+#endif
+
+#ifndef FASTPATH_DEFAULT_BURST_SIZE_EXCEPTION
+#define FASTPATH_DEFAULT_BURST_SIZE_EXCEPTION  32
+#endif
+#if (FASTPATH_DEFAULT_BURST_SIZE_EXCEPTION > FASTPATH_MBUF_ARRAY_SIZE)
+#error "FASTPATH_DEFAULT_BURST_SIZE_EXCEPTION is too big"
+#endif
+
+#ifndef FASTPATH_STAGE_ENQUEUE_RETRY
+#define FASTPATH_STAGE_ENQUEUE_RETRY    16
+#endif
+
+/* Software TX queues holding what the NIC did not take, per lcore and port */
+#ifndef FASTPATH_TX_QUEUE_SIZE
+#define FASTPATH_TX_QUEUE_SIZE          1024
+#endif
+#if (FASTPATH_TX_QUEUE_SIZE & (FASTPATH_TX_QUEUE_SIZE - 1)) != 0
+#error "FASTPATH_TX_QUEUE_SIZE must be a power of 2"
+#endif
+#if (FASTPATH_TX_QUEUE_SIZE < FASTPATH_MBUF_ARRAY_SIZE)
+#error "FASTPATH_TX_QUEUE_SIZE is too small"
+#endif
+
+#ifndef FASTPATH_TX_RETRY
+#define FASTPATH_TX_RETRY               4
+#endif
+
+/* NIC offloads used when the port reports them, software otherwise */
+#ifndef FASTPATH_RX_OFFLOADS
+#define FASTPATH_RX_OFFLOADS    (DEV_RX_OFFLOAD_VLAN_STRIP | DEV_RX_OFFLOAD_IPV4_CKSUM | \
+                                 DEV_RX_OFFLOAD_TCP_CKSUM)
+#endif
+
+#ifndef FASTPATH_TX_OFFLOADS
+#define FASTPATH_TX_OFFLOADS    (DEV_TX_OFFLOAD_VLAN_INSERT | DEV_TX_OFFLOAD_IPV4_CKSUM | \
+                                 DEV_TX_OFFLOAD_TCP_CKSUM | DEV_TX_OFFLOAD_UDP_CKSUM)
+#endif
+
+/* Jumbo frames: frames above the mbuf data room are received as chains */
+#ifndef FASTPATH_MAX_MTU
+#define FASTPATH_MAX_MTU                9000
+#endif
+
+/* Largest frame for an MTU, room is left for a QinQ tag pair */
+#define FASTPATH_MTU_TO_FRAME_LEN(mtu) \
+    ((uint32_t)(mtu) + ETHER_HDR_LEN + 2 * sizeof(struct vlan_hdr))
+
+/* Control plane thread and its command rings to the datapath lcores */
+#ifndef FASTPATH_MAX_CTRL_CPUS
+#define FASTPATH_MAX_CTRL_CPUS          16
+#endif
+
+#ifndef FASTPATH_CMD_RING_SIZE
+#define FASTPATH_CMD_RING_SIZE          256
+#endif
+
+#ifndef FASTPATH_CMD_POOL_SIZE
+#define FASTPATH_CMD_POOL_SIZE          4095
+#endif
+
+#ifndef FASTPATH_CMD_BURST_SIZE
+#define FASTPATH_CMD_BURST_SIZE         8
+#endif
+
+enum fastpath_ring_sched {
+    e_FASTPATH_RING_SCHED_STRICT = 0,
+    e_FASTPATH_RING_SCHED_WRR,
+};
+
+enum fastpath_ctrl_filter_type {
+    e_FASTPATH_CTRL_FILTER_ETHERTYPE = 0,
+    e_FASTPATH_CTRL_FILTER_TCPV4,
+    e_FASTPATH_CTRL_FILTER_UDPV4,
+    e_FASTPATH_CTRL_FILTER_IPV4,
+};
+
+enum fastpath_tx_drop {
+    e_FASTPATH_TX_DROP_TAIL = 0,
+    e_FASTPATH_TX_DROP_HEAD,
+};
+
+struct fastpath_ctrl_filter {
+    enum fastpath_ctrl_filter_type type;
+    uint16_t ether_type;    /* ethertype filter */
+    uint16_t dst_port;      /* tcp/udp destination port, host order */
+    uint16_t src_port;      /* tcp/udp source port, host order */
+    uint32_t dst_ip;        /* ipv4 destination address, host order */
+};
+
 struct mbuf_array {
     struct rte_mbuf *array[FASTPATH_MBUF_ARRAY_SIZE];
     uint32_t n_mbufs;
 };
 
+/* Backlog of one NIC TX queue, head and tail run free */
+struct fastpath_tx_queue {
+    struct rte_mbuf *array[FASTPATH_TX_QUEUE_SIZE];
+    uint32_t head;
+    uint32_t tail;
+
+    /* Stats */
+    uint32_t max_occupancy;
+    uint32_t iters;
+    uint64_t enqueued;
+    uint64_t retries;
+    uint64_t drops;
+};
+
+/* Structure type for recording kni interface specific stats */
+struct kni_interface_stats {
+    /* number of pkts received from NIC, and sent to KNI */
+    uint64_t rx_packets;
+
+    /* number of pkts received from NIC, but failed to send to KNI */
+    uint64_t rx_dropped;
+
+    /* number of pkts received from KNI, and sent to NIC */
+    uint64_t tx_packets;
+
+    /* number of pkts received from KNI, but failed to send to NIC */
+    uint64_t tx_dropped;
+};
+
+/*
+ * State only ever written by its own lcore, allocated on the lcore's
+ * socket so that no two lcores share a cache line.
+ */
+struct fastpath_lcore_runtime {
+    /* fragments to free once the burst is done */
+    struct rte_ip_frag_death_row death_row;
+
+    /* commands from the control plane, see control.c */
+    struct rte_ring *cmd_ring;
+
+    /* packets punted to the exception lcore, see exception.c */
+    struct mbuf_array *exc_mbuf_out;
+    uint8_t exc_mbuf_out_flush;
+
+    /* Stats */
+    struct kni_interface_stats kni_stats[FASTPATH_MAX_NIC_PORTS];
+} __rte_cache_aligned;
+
+enum fastpath_exc_type {
+    e_FASTPATH_EXC_KNI = 0,
+    e_FASTPATH_EXC_TAP
+};
+
 enum fastpath_lcore_type {
     e_FASTPATH_LCORE_DISABLED = 0,
     e_FASTPATH_LCORE_RX,
     e_FASTPATH_LCORE_WORKER,
-    e_FASTPATH_LCORE_RX_WORKER
+    e_FASTPATH_LCORE_RX_WORKER,
+    e_FASTPATH_LCORE_STAGE,
+    e_FASTPATH_LCORE_EXCEPTION
 };
 
 struct fastpath_params_rx {
@@ -275,38 +584,54 @@ struct fastpath_params_rx {
     } nic_queues[FASTPATH_MAX_NIC_RX_QUEUES_PER_LCORE];
     uint32_t n_nic_queues;
 
-    /* Rings */
-    struct rte_ring *rings[FASTPATH_MAX_WORKER_LCORES];
+    /* NIC control queues, polled with strict priority */
+    struct {
+        uint8_t port;
+        uint8_t queue;
+    } ctrl_queues[FASTPATH_MAX_NIC_RX_QUEUES_PER_LCORE];
+    uint32_t n_ctrl_queues;
+
+    /* Rings, one per class and worker */
+    struct rte_ring *rings[FASTPATH_MAX_RING_CLASSES][FASTPATH_MAX_WORKER_LCORES];
     uint32_t n_rings;
 
-    /* Internal buffers */
-    struct mbuf_array mbuf_in;
-    struct mbuf_array mbuf_out[FASTPATH_MAX_WORKER_LCORES];
-    uint8_t mbuf_out_flush[FASTPATH_MAX_WORKER_LCORES];
+    /* Internal buffers, allocated for the classes and rings in use */
+    struct mbuf_array *mbuf_in;
+    struct mbuf_array *mbuf_out[FASTPATH_MAX_RING_CLASSES][FASTPATH_MAX_WORKER_LCORES];
+    uint8_t mbuf_out_flush[FASTPATH_MAX_RING_CLASSES][FASTPATH_MAX_WORKER_LCORES];
 
     /* Stats */
     uint32_t nic_queues_count[FASTPATH_MAX_NIC_RX_QUEUES_PER_LCORE];
     uint32_t nic_queues_iters[FASTPATH_MAX_NIC_RX_QUEUES_PER_LCORE];
-    uint32_t rings_count[FASTPATH_MAX_WORKER_LCORES];
-    uint32_t rings_iters[FASTPATH_MAX_WORKER_LCORES];
+    uint32_t rings_count[FASTPATH_MAX_RING_CLASSES][FASTPATH_MAX_WORKER_LCORES];
+    uint32_t rings_iters[FASTPATH_MAX_RING_CLASSES][FASTPATH_MAX_WORKER_LCORES];
+    uint64_t rings_drops[FASTPATH_MAX_RING_CLASSES][FASTPATH_MAX_WORKER_LCORES];
+    uint64_t ctrl_queues_count[FASTPATH_MAX_NIC_RX_QUEUES_PER_LCORE];
 };
 
 struct fastpath_params_worker {
     /* NIC */
     uint16_t tx_queue_id[FASTPATH_MAX_NIC_PORTS];
     
-    /* Rings */
-    struct rte_ring *rings[FASTPATH_MAX_RX_LCORES];
+    /* Rings, one per class and RX lcore */
+    struct rte_ring *rings[FASTPATH_MAX_RING_CLASSES][FASTPATH_MAX_RX_LCORES];
     uint32_t n_rings;
 
     /* LPM table */
     struct rte_lpm *lpm_table;
     uint32_t worker_id;
 
-    /* Internal buffers */
-    struct mbuf_array mbuf_in;
-    struct mbuf_array mbuf_out[FASTPATH_MAX_NIC_PORTS];
+    /* Internal buffers, allocated for the ports in use */
+    struct mbuf_array *mbuf_in;
+    struct mbuf_array *mbuf_out[FASTPATH_MAX_NIC_PORTS];
     uint8_t mbuf_out_flush[FASTPATH_MAX_NIC_PORTS];
+    struct fastpath_tx_queue *txq[FASTPATH_MAX_NIC_PORTS];
+    uint32_t n_tx_backlog;
+
+    /* Stats */
+    uint64_t proc_cycles;
+    uint64_t proc_pkts;
+    uint32_t proc_iters;
 };
 
 struct fastpath_lcore_params {
@@ -315,52 +640,82 @@ struct fastpath_lcore_params {
     enum fastpath_lcore_type type;
     struct rte_mempool *pktbuf_pool;
     struct rte_mempool *indirect_pool;
+    struct rte_mempool *header_pool;
 } __rte_cache_aligned;
 
-struct fastpath_lpm_rule {
-    uint32_t ip;
-    uint8_t depth;
-    uint8_t if_out;
-};
-
 struct fastpath_params {
     /* lcore */
     struct fastpath_lcore_params lcore_params[FASTPATH_MAX_LCORES];
+    struct fastpath_lcore_runtime *runtime[FASTPATH_MAX_LCORES];
 
     /* NIC */
     uint8_t nic_rx_queue_mask[FASTPATH_MAX_NIC_PORTS][FASTPATH_MAX_RX_QUEUES_PER_NIC_PORT];
 
+    /* control traffic steering */
+    struct fastpath_ctrl_filter ctrl_filters[FASTPATH_MAX_CTRL_FILTERS];
+    uint32_t n_ctrl_filters;
+    uint8_t ctrl_queue[FASTPATH_MAX_NIC_PORTS];
+
+    /* offloads enabled per port, subsets of FASTPATH_RX/TX_OFFLOADS */
+    uint32_t rx_offload[FASTPATH_MAX_NIC_PORTS];
+    uint32_t tx_offload[FASTPATH_MAX_NIC_PORTS];
+
+    /* MTU per port, ETHER_MTU unless set with --mtu */
+    uint16_t port_mtu[FASTPATH_MAX_NIC_PORTS];
+
     /* mbuf pools */
     struct rte_mempool *pktbuf_pools[FASTPATH_MAX_SOCKETS];
     struct rte_mempool *indirect_pools[FASTPATH_MAX_SOCKETS];
+    struct rte_mempool *header_pools[FASTPATH_MAX_SOCKETS];
     struct rte_ip_frag_tbl *frag_tbl;
-    struct rte_ip_frag_death_row death_row[FASTPATH_MAX_LCORES];
 
     /* LPM tables */
     struct rte_lpm *lpm_tables[FASTPATH_MAX_SOCKETS];
-    struct fastpath_lpm_rule lpm_rules[FASTPATH_MAX_LPM_RULES];
-    uint32_t n_lpm_rules;
 
     /* rings */
     uint32_t nic_rx_ring_size;
     uint32_t nic_tx_ring_size;
     uint32_t ring_size;
 
+    /* ring classes */
+    uint32_t n_ring_classes;
+    enum fastpath_ring_sched ring_sched;
+    uint32_t ring_weight[FASTPATH_MAX_RING_CLASSES];
+    uint8_t dscp_class[64];
+    uint8_t pcp_class[8];
+
     /* burst size */
     uint32_t burst_size_rx_read;
     uint32_t burst_size_rx_write;
     uint32_t burst_size_worker_read;
     uint32_t burst_size_worker_write;
 
+    /* what to drop when a TX backlog is full */
+    enum fastpath_tx_drop tx_drop;
+
+    /* module hops dispatched directly, see fastpath_compile_stack */
+    uint32_t stack_direct;
+
     /* load balancing */
     uint8_t pos_lb;
     uint8_t numa_on;
 
-    /* kni params */
-    rte_spinlock_t kni_lock[FASTPATH_MAX_NIC_PORTS];
+    /* control plane thread, runs on the master lcore when not set */
+    uint8_t ctrl_thread;
+    uint32_t ctrl_cpus[FASTPATH_MAX_CTRL_CPUS];
+    uint32_t n_ctrl_cpus;
+
+    /* exception interface per port, <exception> in the port list */
+    enum fastpath_exc_type exc_type[FASTPATH_MAX_NIC_PORTS];
+    uint32_t exc_queues[FASTPATH_MAX_NIC_PORTS];
+    uint8_t exc_gro[FASTPATH_MAX_NIC_PORTS];
+
+    /* bridge FDB, <fdb-size> and <fdb-aging> */
+    uint32_t fdb_size;
+    uint32_t fdb_aging;
+
+    /* kni params, used by the exception lcore only */
     struct rte_kni *kni[FASTPATH_MAX_NIC_PORTS];
-    struct mbuf_array kni_mbuf_out[FASTPATH_MAX_LCORES][FASTPATH_MAX_NIC_PORTS];
-    uint8_t kni_mbuf_out_flush[FASTPATH_MAX_LCORES][FASTPATH_MAX_NIC_PORTS];
 } __rte_cache_aligned;
 
 extern struct fastpath_params fastpath;
@@ -380,8 +735,7 @@ uint32_t fastpath_get_lcores_rx(void);
 uint32_t fastpath_get_lcores_worker(void);
 uint32_t fastpath_get_lcores_rx_worker(void);
 void fastpath_print_params(void);
-void kni_ingress(struct rte_mbuf *m);
-void kni_egress(uint32_t port_id);
+void fastpath_tx_send(struct fastpath_params_worker *lp, uint8_t port);
 
 
 #endif /* _MAIN_H_ */
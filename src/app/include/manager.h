@@ -4,6 +4,7 @@
 
 int manager_thread_add(void);
 int route_thread_add(void);
+int mgmt_thread_add(void);
 
 #endif
 
@@ -0,0 +1,57 @@
+
+#ifndef __MGMT_H__
+#define __MGMT_H__
+
+#include <stdint.h>
+
+/*
+ * Bulk management protocol, on the stream socket MGMT_SOCKET_PATH.
+ *
+ * A message is a mgmt_hdr then count operations, each a mgmt_tlv and
+ * len bytes of value padded to MGMT_TLV_ALIGN. The value of MGMT_TLV_MSG
+ * is a module request, the msg_hdr of the UDP manager on port 4567.
+ * The fastpath answers each batch with a mgmt_ack of the same seq once
+ * it is applied; a client may keep sending batches without waiting for
+ * them. A batch with MGMT_F_ATOMIC is applied all or nothing, it only
+ * takes requests of modules that can revert them.
+ *
+ * mgmt_hdr, mgmt_tlv and mgmt_ack fields are in network order, the
+ * module requests keep their own.
+ */
+#define MGMT_SOCKET_PATH    "/var/run/fastpath.sock"
+#define MGMT_MAX_MSG        (16 << 20)
+
+enum {
+    MGMT_MSG_BATCH = 1,
+    MGMT_MSG_ACK,
+};
+
+#define MGMT_F_ATOMIC       0x0001
+
+struct mgmt_hdr {
+    uint32_t len;           /* of the message, this header included */
+    uint32_t seq;
+    uint16_t type;
+    uint16_t flags;
+    uint32_t count;         /* TLVs that follow */
+};
+
+enum {
+    MGMT_TLV_MSG = 1,
+};
+
+struct mgmt_tlv {
+    uint16_t type;
+    uint16_t len;           /* of the value */
+};
+
+#define MGMT_TLV_ALIGN(len) (((len) + 3) & ~3U)
+
+struct mgmt_ack {
+    struct mgmt_hdr hdr;    /* MGMT_MSG_ACK, seq of the batch, no TLV */
+    int32_t status;         /* 0, or -errno of the first failed operation */
+    uint32_t applied;       /* operations in effect */
+    uint32_t failed;        /* index of the first failed operation */
+};
+
+#endif
@@ -0,0 +1,14 @@
+
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+int pipeline_stage_add(const char *name, uint32_t lcore);
+void pipeline_init_rings(void);
+void pipeline_bind_stages(void);
+void pipeline_stage_receive(struct rte_mbuf *m, struct module *peer, struct module *local);
+void pipeline_flush(uint32_t lcore);
+uint32_t pipeline_stage_poll(uint32_t lcore);
+void pipeline_print_stats(uint32_t lcore);
+uint32_t pipeline_get_stages(void);
+
+#endif
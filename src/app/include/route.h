@@ -2,7 +2,7 @@
 #ifndef __ROUTE_H__
 #define __ROUTE_H__
 
-#define ROUTE_MAX_LINK  16
+#define ROUTE_MAX_LINK  FASTPATH_MAX_INTERFACES
 
 enum {
     ROUTE_MSG_ADD_NEIGH,
@@ -17,6 +17,10 @@ enum {
 #define NEIGH_TYPE_REACHABLE    2
 #define NEIGH_TYPE_UNRESOLVED   3
 
+/*
+ * A neighbour add or delete may be followed by the ether_addr to put back
+ * as the interface address, how an undo reverts a LOCAL add.
+ */
 struct arp_add {
     uint32_t nh_ip;
     uint32_t nh_iface;
@@ -56,8 +60,11 @@ struct route6_del {
 void route_receive(struct rte_mbuf *m, struct module *peer, struct module *ipfwd);
 void route_xmit(struct rte_mbuf *m, struct module *peer, struct module *ipfwd);
 int route_connect(struct module *local, struct module *peer, void *param);
+int route_check_msg(struct module *route, struct msg_hdr *req);
 int route_handle_msg(struct module *route, 
     struct msg_hdr *req, struct msg_hdr *resp);
+int route_undo_msg(struct module *route,
+    struct msg_hdr *req, struct msg_hdr *undo);
 struct module * route_init(void);
 
 #endif
@@ -0,0 +1,28 @@
+
+#ifndef __SNOOP_H__
+#define __SNOOP_H__
+
+/* what snoop_mcast decided for a multicast packet */
+#define SNOOP_FLOOD     0
+#define SNOOP_FILTER    1
+
+#define SNOOP_PORT_WORDS    ((BRIDGE_MAX_PORTS + 31) / 32)
+
+struct snoop_ports {
+    uint32_t bits[SNOOP_PORT_WORDS];
+};
+
+static inline int
+snoop_port_is_set(const struct snoop_ports *ports, uint32_t port)
+{
+    return (ports->bits[port / 32] >> (port % 32)) & 1;
+}
+
+void snoop_init(uint32_t n_neighs, uint32_t n_groups);
+int snoop_arp(struct rte_mbuf *m, struct ether_hdr *eth_hdr, uint16_t vid, uint32_t now);
+int snoop_nd(struct rte_mbuf *m, struct ether_hdr *eth_hdr, uint16_t vid, uint32_t now);
+int snoop_mcast(struct rte_mbuf *m, uint16_t protocol, uint16_t vid, uint32_t port,
+    uint32_t now, struct snoop_ports *ports);
+void snoop_print_stats(void);
+
+#endif
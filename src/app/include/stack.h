@@ -8,9 +8,18 @@ xmlXPathObjectPtr xml_get_nodeset(xmlXPathContextPtr context, const char *path);
 xmlNodePtr xml_get_node(xmlXPathContextPtr context, const char *path, int *dup);
 
 struct module *module_get_by_name(const char *name);
+int module_lcore_private_alloc(struct module *module, size_t size,
+    void (*init)(struct module *module, void *priv, unsigned lcore));
+void module_lcore_private_free(struct module *module);
 
 uint32_t get_port_map(uint32_t ifidx);
 
+void fastpath_load_ctrl_filters(void);
+void fastpath_load_ring_classes(void);
+void fastpath_load_pipeline(void);
+void fastpath_load_exception(void);
+void fastpath_load_fdb(void);
+void fastpath_compile_stack(int enable);
 void fastpath_init_stack(void);
 void fastpath_cleanup_stack(void);
 
@@ -0,0 +1,15 @@
+
+#ifndef __TAP_H__
+#define __TAP_H__
+
+/* longer chains towards the kernel are dropped */
+#define TAP_MAX_IOV         32
+
+int tap_open(uint8_t port, const char *name, uint32_t n_queues);
+void tap_close(uint8_t port);
+int tap_is_open(uint8_t port);
+uint32_t tap_tx_burst(uint8_t port, struct rte_mbuf **pkts, uint32_t n_pkts);
+uint32_t tap_rx_burst(uint8_t port, struct rte_mbuf **pkts, uint32_t n_pkts,
+    struct rte_mempool *mp);
+
+#endif
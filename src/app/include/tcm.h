@@ -2,6 +2,18 @@
 #ifndef __TCM_H__
 #define __TCM_H__
 
+enum {
+    TCM_MSG_GET_STATS,
+    TCM_MSG_CLEAR_STATS,
+};
+
+struct tcm_stats {
+    uint64_t green;
+    uint64_t yellow;
+    uint64_t red;
+    uint64_t drop;
+};
+
 void tcm_receive(struct rte_mbuf *m, struct module *peer, struct module *tcm);
 void tcm_xmit(struct rte_mbuf *m, struct module *peer, struct module *tcm);
 int tcm_handle_msg(struct module *route, 
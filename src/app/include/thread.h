@@ -22,6 +22,8 @@
 #ifndef _ZEBRA_THREAD_H
 #define _ZEBRA_THREAD_H
 
+/* Define THREAD_PROFILE to measure each callback and report CPU hogs. */
+#ifdef THREAD_PROFILE
 #ifdef HAVE_RUSAGE
 #define RUSAGE_T        struct rusage
 #define GETRUSAGE(X)    getrusage (RUSAGE_SELF, X);
@@ -29,6 +31,16 @@
 #define RUSAGE_T        struct timeval
 #define GETRUSAGE(X)    gettimeofday (X, NULL);
 #endif /* HAVE_RUSAGE */
+#endif /* THREAD_PROFILE */
+
+/* Timer wheel: levels of slots, each level ticking slots times slower. */
+#define THREAD_TIMER_TICK_MS       100
+#define THREAD_WHEEL_BITS          6
+#define THREAD_WHEEL_SLOTS         (1 << THREAD_WHEEL_BITS)
+#define THREAD_WHEEL_LEVELS        4
+
+/* Events taken from epoll per wait. */
+#define THREAD_EPOLL_EVENTS        64
 
 /* Linked list of thread. */
 struct thread_list
@@ -38,18 +50,30 @@ struct thread_list
   int count;
 };
 
+/* Threads waiting on a file descriptor. */
+struct thread_fd
+{
+  struct thread *read;
+  struct thread *write;
+  unsigned int events;		/* registered in the epoll set */
+  int dirty;			/* events to sync before the next wait */
+};
+
 /* Master of the theads. */
 struct thread_master
 {
-  struct thread_list read;
-  struct thread_list write;
-  struct thread_list timer;
   struct thread_list event;
   struct thread_list ready;
   struct thread_list unuse;
-  fd_set readfd;
-  fd_set writefd;
-  fd_set exceptfd;
+  struct thread_list wheel[THREAD_WHEEL_LEVELS][THREAD_WHEEL_SLOTS];
+  unsigned long timers;		/* pending in the wheel */
+  unsigned long long tick;	/* next wheel tick to run */
+  unsigned long long base;	/* monotonic ms of tick 0 */
+  int epfd;
+  struct thread_fd *fds;	/* indexed by fd */
+  int *dirty;			/* fds with dirty set */
+  int n_fds;
+  int n_dirty;
   unsigned long alloc;
 };
 
@@ -67,7 +91,12 @@ struct thread
     int fd;			/* file descriptor in case of read/write. */
     struct timeval sands;	/* rest of time sands value. */
   } u;
+  struct thread_list *slot;	/* wheel slot of a timer */
+  unsigned long long expire;	/* wheel tick of a timer */
+  unsigned long long start;	/* monotonic ms when called */
+#ifdef THREAD_PROFILE
   RUSAGE_T ru;			/* Indepth usage info.  */
+#endif /* THREAD_PROFILE */
 };
 
 /* Thread types. */
@@ -0,0 +1,54 @@
+
+#ifndef __TIMER_H__
+#define __TIMER_H__
+
+/*
+ * Per-lcore clock and timers. Each datapath lcore reads the TSC once per
+ * loop into its clock, so the stack gets a timestamp without rte_rdtsc
+ * per packet, and runs its own timer wheel: a timer is added, deleted
+ * and fired on one lcore, in O(1).
+ */
+struct fastpath_timer;
+
+typedef void (*fastpath_timer_fn)(struct fastpath_timer *timer, void *arg);
+
+struct fastpath_timer {
+    LIST_ENTRY(fastpath_timer) entry;
+    uint64_t expire;        /* in ticks of the wheel */
+    fastpath_timer_fn fn;
+    void *arg;
+    uint8_t pending;
+};
+
+struct fastpath_clock {
+    uint64_t now;           /* TSC at the start of the loop */
+} __rte_cache_aligned;
+
+extern struct fastpath_clock fastpath_clocks[FASTPATH_MAX_LCORES];
+
+/* TSC of the current loop of the calling lcore, read now off the datapath */
+static inline uint64_t
+fastpath_clock(void)
+{
+    unsigned lcore = rte_lcore_id();
+
+    if (unlikely(lcore >= FASTPATH_MAX_LCORES)) {
+        return rte_rdtsc();
+    }
+
+    return fastpath_clocks[lcore].now;
+}
+
+static inline int
+fastpath_timer_pending(const struct fastpath_timer *timer)
+{
+    return timer->pending;
+}
+
+void fastpath_timer_init_lcores(void);
+void fastpath_timer_init(struct fastpath_timer *timer, fastpath_timer_fn fn, void *arg);
+void fastpath_timer_add(struct fastpath_timer *timer, uint64_t us);
+void fastpath_timer_del(struct fastpath_timer *timer);
+void fastpath_timer_manage(unsigned lcore);
+
+#endif
@@ -5,10 +5,75 @@
 #define VLAN_VID_MAX    4096
 #define VLAN_VID_MASK	0xFFF
 
+#ifndef ETHER_TYPE_QINQ
+#define ETHER_TYPE_QINQ 0x88A8
+#endif
+
+/*
+ * Per-port (VID[, inner VID]) -> sub-interface demux. The VID space is
+ * split into blocks allocated on first use, so a port only pays for the
+ * ranges it has sub-interfaces in and a lookup is two dependent loads.
+ * A QinQ S-VID points at a nested table of C-VIDs.
+ */
+#define VLAN_DEMUX_BLOCK_BITS   6
+#define VLAN_DEMUX_BLOCK_SIZE   (1 << VLAN_DEMUX_BLOCK_BITS)
+#define VLAN_DEMUX_BLOCKS       (VLAN_VID_MAX >> VLAN_DEMUX_BLOCK_BITS)
+
+struct vlan_demux;
+
+struct vlan_demux_block {
+    struct module *sub[VLAN_DEMUX_BLOCK_SIZE];
+    struct vlan_demux *inner[VLAN_DEMUX_BLOCK_SIZE];
+} __rte_cache_aligned;
+
+struct vlan_demux {
+    struct vlan_demux_block *blocks[VLAN_DEMUX_BLOCKS];
+    int socket;
+} __rte_cache_aligned;
+
+static inline struct module *
+vlan_demux_lookup(const struct vlan_demux *demux, uint16_t vid)
+{
+    const struct vlan_demux_block *block;
+
+    block = demux->blocks[vid >> VLAN_DEMUX_BLOCK_BITS];
+    if (unlikely(block == NULL)) {
+        return NULL;
+    }
+
+    return block->sub[vid & (VLAN_DEMUX_BLOCK_SIZE - 1)];
+}
+
+static inline struct module *
+vlan_demux_lookup_qinq(const struct vlan_demux *demux, uint16_t vid, uint16_t inner_vid)
+{
+    const struct vlan_demux_block *block;
+    const struct vlan_demux *inner;
+
+    block = demux->blocks[vid >> VLAN_DEMUX_BLOCK_BITS];
+    if (unlikely(block == NULL)) {
+        return NULL;
+    }
+
+    inner = block->inner[vid & (VLAN_DEMUX_BLOCK_SIZE - 1)];
+    if (unlikely(inner == NULL)) {
+        return NULL;
+    }
+
+    return vlan_demux_lookup(inner, inner_vid);
+}
+
+struct vlan_demux *vlan_demux_create(int socket);
+int vlan_demux_add(struct vlan_demux *demux, uint16_t vid, uint16_t inner_vid,
+    struct module *sub);
+
 void vlan_receive(struct rte_mbuf *m, struct module *peer, struct module *vlan);
 void vlan_xmit(struct rte_mbuf *m, struct module *peer, struct module *vlan);
 int vlan_connect(struct module *local, struct module *peer, void *param);
-struct module * vlan_init(uint16_t port, uint16_t vid);
+int vlan_tag_insert(struct rte_mbuf *m, uint16_t tci);
+int vlan_tag_restore(struct rte_mbuf *m);
+void vlan_get_key(struct module *vlan, uint16_t *vid, uint16_t *inner_vid);
+struct module * vlan_init(uint16_t port, uint16_t vid, uint16_t inner_vid);
 
 #endif
 
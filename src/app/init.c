@@ -36,12 +36,6 @@
 /* Max size of a single packet */
 #define MAX_PACKET_SZ           2048
 
-/* Total octets in ethernet header */
-#define KNI_ENET_HEADER_SIZE    14
-
-/* Total octets in the FCS */
-#define KNI_ENET_FCS_SIZE       4
-
 extern struct thread_master *mgr_master;
 
 static struct rte_eth_conf port_conf = {
@@ -76,7 +70,8 @@ fastpath_assign_worker_ids(void)
         struct fastpath_params_worker *lp_worker = &fastpath.lcore_params[lcore].worker;
 
         if (fastpath.lcore_params[lcore].type != e_FASTPATH_LCORE_WORKER &&
-            fastpath.lcore_params[lcore].type != e_FASTPATH_LCORE_RX_WORKER) {
+            fastpath.lcore_params[lcore].type != e_FASTPATH_LCORE_RX_WORKER &&
+            fastpath.lcore_params[lcore].type != e_FASTPATH_LCORE_STAGE) {
             continue;
         }
 
@@ -177,6 +172,45 @@ fastpath_init_indirect_mbuf_pools(void)
     }
 }
 
+static void
+fastpath_init_header_mbuf_pools(void)
+{
+    unsigned socket, lcore;
+
+    /* Init the buffer pools */
+    for (socket = 0; socket < FASTPATH_MAX_SOCKETS; socket ++) {
+        char name[32];
+        if (fastpath_is_socket_used(socket) == 0) {
+            continue;
+        }
+
+        snprintf(name, sizeof(name), "header_mbuf_pool_%u", socket);
+        printf("Creating the header mbuf pool for socket %u ...\n", socket);
+        fastpath.header_pools[socket] = rte_mempool_create(
+            name,
+            FASTPATH_DEFAULT_MEMPOOL_BUFFERS,
+            FASTPATH_DEFAULT_HEADER_MBUF_SIZE,
+            32,
+            0,
+            NULL, NULL,
+            rte_pktmbuf_init, NULL,
+            socket,
+            0);
+        if (fastpath.header_pools[socket] == NULL) {
+            rte_panic("Cannot create mbuf pool on socket %u\n", socket);
+        }
+    }
+
+    for (lcore = 0; lcore < FASTPATH_MAX_LCORES; lcore ++) {
+        if (fastpath.lcore_params[lcore].type == e_FASTPATH_LCORE_DISABLED) {
+            continue;
+        }
+
+        socket = rte_lcore_to_socket_id(lcore);
+        fastpath.lcore_params[lcore].header_pool = fastpath.header_pools[socket];
+    }
+}
+
 static void
 fastpath_init_rings(void)
 {
@@ -198,34 +232,40 @@ fastpath_init_rings(void)
             char name[32];
             struct fastpath_params_worker *lp_worker = &fastpath.lcore_params[lcore_worker].worker;
             struct rte_ring *ring = NULL;
+            uint32_t class;
 
             if (fastpath.lcore_params[lcore_worker].type != e_FASTPATH_LCORE_WORKER) {
                 continue;
             }
 
-            printf("Creating ring to connect I/O lcore %u (socket %u) with worker lcore %u ...\n",
-                lcore,
-                socket_rx,
-                lcore_worker);
-            snprintf(name, sizeof(name), "fastpath_ring_rx_s%u_io%u_w%u",
-                socket_rx,
-                lcore,
-                lcore_worker);
-            ring = rte_ring_create(
-                name,
-                fastpath.ring_size,
-                socket_rx,
-                RING_F_SP_ENQ | RING_F_SC_DEQ);
-            if (ring == NULL) {
-                rte_panic("Cannot create ring to connect I/O core %u with worker core %u\n",
+            for (class = 0; class < fastpath.n_ring_classes; class ++) {
+                printf("Creating ring to connect I/O lcore %u (socket %u) with worker lcore %u class %u ...\n",
+                    lcore,
+                    socket_rx,
+                    lcore_worker,
+                    class);
+                snprintf(name, sizeof(name), "fastpath_ring_s%u_io%u_w%u_c%u",
+                    socket_rx,
                     lcore,
-                    lcore_worker);
+                    lcore_worker,
+                    class);
+                ring = rte_ring_create(
+                    name,
+                    fastpath.ring_size,
+                    socket_rx,
+                    RING_F_SP_ENQ | RING_F_SC_DEQ);
+                if (ring == NULL) {
+                    rte_panic("Cannot create ring to connect I/O core %u with worker core %u class %u\n",
+                        lcore,
+                        lcore_worker,
+                        class);
+                }
+
+                lp_rx->rings[class][lp_rx->n_rings] = ring;
+                lp_worker->rings[class][lp_worker->n_rings] = ring;
             }
 
-            lp_rx->rings[lp_rx->n_rings] = ring;
             lp_rx->n_rings ++;
-
-            lp_worker->rings[lp_worker->n_rings] = ring;
             lp_worker->n_rings ++;
         }
     }
@@ -256,6 +296,79 @@ fastpath_init_rings(void)
     }
 }
 
+static struct mbuf_array *
+fastpath_alloc_mbuf_array(unsigned lcore)
+{
+    struct mbuf_array *array;
+
+    array = rte_zmalloc_socket(NULL, sizeof(struct mbuf_array),
+        RTE_CACHE_LINE_SIZE, rte_lcore_to_socket_id(lcore));
+    if (array == NULL) {
+        rte_panic("Cannot allocate mbuf array for lcore %u\n", lcore);
+    }
+
+    return array;
+}
+
+static void
+fastpath_init_lcore_runtime(void)
+{
+    uint32_t lcore, port, class, worker;
+
+    for (lcore = 0; lcore < FASTPATH_MAX_LCORES; lcore ++) {
+        struct fastpath_lcore_params *lp = &fastpath.lcore_params[lcore];
+        struct fastpath_lcore_runtime *rt;
+
+        if (lp->type == e_FASTPATH_LCORE_DISABLED) {
+            continue;
+        }
+
+        rt = rte_zmalloc_socket(NULL, sizeof(struct fastpath_lcore_runtime),
+            RTE_CACHE_LINE_SIZE, rte_lcore_to_socket_id(lcore));
+        if (rt == NULL) {
+            rte_panic("Cannot allocate runtime state for lcore %u\n", lcore);
+        }
+        fastpath.runtime[lcore] = rt;
+
+        /* RX side: the input burst and one buffer per class and worker ring */
+        if (lp->type == e_FASTPATH_LCORE_RX ||
+            lp->type == e_FASTPATH_LCORE_RX_WORKER) {
+            lp->rx.mbuf_in = fastpath_alloc_mbuf_array(lcore);
+
+            for (class = 0; class < fastpath.n_ring_classes; class ++) {
+                for (worker = 0; worker < lp->rx.n_rings; worker ++) {
+                    lp->rx.mbuf_out[class][worker] = fastpath_alloc_mbuf_array(lcore);
+                }
+            }
+        }
+
+        if (lp->type == e_FASTPATH_LCORE_RX ||
+            lp->type == e_FASTPATH_LCORE_EXCEPTION) {
+            continue;
+        }
+
+        /* Worker side: the ring input burst, tx and tx backlog per port in use */
+        if (lp->type == e_FASTPATH_LCORE_WORKER) {
+            lp->worker.mbuf_in = fastpath_alloc_mbuf_array(lcore);
+        }
+
+        for (port = 0; port < FASTPATH_MAX_NIC_PORTS; port ++) {
+            if (fastpath_get_nic_rx_queues_per_port(port) == 0) {
+                continue;
+            }
+
+            lp->worker.mbuf_out[port] = fastpath_alloc_mbuf_array(lcore);
+            lp->worker.txq[port] = rte_zmalloc_socket(NULL,
+                sizeof(struct fastpath_tx_queue), RTE_CACHE_LINE_SIZE,
+                rte_lcore_to_socket_id(lcore));
+            if (lp->worker.txq[port] == NULL) {
+                rte_panic("Cannot allocate TX queue of port %u for lcore %u\n",
+                    port, lcore);
+            }
+        }
+    }
+}
+
 /* Check the link status of all ports in up to 9s, and print them finally */
 static void
 check_all_ports_link_status(uint8_t port_num, uint32_t port_mask)
@@ -316,6 +429,306 @@ check_all_ports_link_status(uint8_t port_num, uint32_t port_mask)
     }
 }
 
+static int
+fastpath_ctrl_filter_has_type(int fdir)
+{
+    uint32_t i;
+
+    for (i = 0; i < fastpath.n_ctrl_filters; i++) {
+        if ((fastpath.ctrl_filters[i].type != e_FASTPATH_CTRL_FILTER_ETHERTYPE) == fdir) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Flow director through the legacy perfect filter calls, the only way
+ * to ixgbe in this DPDK; the filter API one is i40e.
+ */
+static int
+fastpath_ctrl_fdir_legacy(uint8_t port)
+{
+    return rte_eth_dev_filter_supported(port, RTE_ETH_FILTER_FDIR) != 0 &&
+        rte_eth_devices[port].dev_ops->fdir_add_perfect_filter != NULL;
+}
+
+/*
+ * The filter API flow director (i40e) has no input masks in this DPDK,
+ * an unset field is matched as zero; a ctrl filter always leaves the
+ * source address open, so those go to the 5-tuple filters instead.
+ */
+static int
+fastpath_ctrl_5tuple_supported(uint8_t port)
+{
+    return rte_eth_devices[port].dev_ops->add_5tuple_filter != NULL;
+}
+
+static int
+fastpath_ctrl_filter_supported(uint8_t port)
+{
+    if (fastpath_ctrl_filter_has_type(0) &&
+        rte_eth_dev_filter_supported(port, RTE_ETH_FILTER_ETHERTYPE) == 0) {
+        return 1;
+    }
+
+    if (fastpath_ctrl_filter_has_type(1) &&
+        (fastpath_ctrl_fdir_legacy(port) || fastpath_ctrl_5tuple_supported(port))) {
+        return 1;
+    }
+
+    return 0;
+}
+
+static void
+fastpath_init_ctrl_queues(void)
+{
+    uint32_t lcore;
+    uint8_t port;
+
+    for (port = 0; port < FASTPATH_MAX_NIC_PORTS; port ++) {
+        struct fastpath_params_rx *lp;
+        int n_rx_queues;
+
+        fastpath.ctrl_queue[port] = FASTPATH_CTRL_QUEUE_NONE;
+
+        n_rx_queues = fastpath_get_nic_rx_queues_per_port(port);
+        if (n_rx_queues <= 0 || fastpath.n_ctrl_filters == 0) {
+            continue;
+        }
+
+        if (port >= rte_eth_dev_count() || fastpath_ctrl_filter_supported(port) == 0) {
+            printf("NIC port %u has no ctrl filter support, ctrl traffic stays on RSS queues\n",
+                (unsigned) port);
+            continue;
+        }
+
+        if (n_rx_queues >= FASTPATH_MAX_RX_QUEUES_PER_NIC_PORT) {
+            rte_panic("No free RX queue for ctrl traffic on port %u\n", (unsigned) port);
+        }
+
+        /* The ctrl queue is polled by the lcore that handles queue 0 */
+        if (fastpath_get_lcore_for_nic_rx(port, 0, &lcore) < 0) {
+            rte_panic("NIC port %u RX queue 0 is not assigned\n", (unsigned) port);
+        }
+
+        lp = &fastpath.lcore_params[lcore].rx;
+        if (lp->n_ctrl_queues >= FASTPATH_MAX_NIC_RX_QUEUES_PER_LCORE) {
+            rte_panic("Too many ctrl queues on lcore %u\n", lcore);
+        }
+
+        lp->ctrl_queues[lp->n_ctrl_queues].port = port;
+        lp->ctrl_queues[lp->n_ctrl_queues].queue = (uint8_t) n_rx_queues;
+        lp->n_ctrl_queues ++;
+
+        fastpath.ctrl_queue[port] = (uint8_t) n_rx_queues;
+    }
+}
+
+/*
+ * The legacy flow director has one input mask per port: a field is
+ * compared when a filter sets it, the source address never is. Filters
+ * leaving out a compared field would only match it zero, they go to the
+ * 5-tuple filters, which mask per filter.
+ */
+static void
+fastpath_ctrl_fdir_masks(struct rte_fdir_masks *masks)
+{
+    struct fastpath_ctrl_filter *filter;
+    uint32_t i;
+
+    memset(masks, 0, sizeof(struct rte_fdir_masks));
+    masks->only_ip_flow = 1;
+
+    for (i = 0; i < fastpath.n_ctrl_filters; i++) {
+        filter = &fastpath.ctrl_filters[i];
+        if (filter->type == e_FASTPATH_CTRL_FILTER_ETHERTYPE) {
+            continue;
+        }
+
+        if (filter->type != e_FASTPATH_CTRL_FILTER_IPV4) {
+            masks->only_ip_flow = 0;
+        }
+        if (filter->dst_ip != 0) {
+            masks->dst_ipv4_mask = 0xFFFFFFFF;
+        }
+        if (filter->dst_port != 0) {
+            masks->dst_port_mask = 0xFFFF;
+        }
+        if (filter->src_port != 0) {
+            masks->src_port_mask = 0xFFFF;
+        }
+    }
+}
+
+static int
+fastpath_ctrl_fdir_fits(struct rte_fdir_masks *masks, struct fastpath_ctrl_filter *filter)
+{
+    if ((masks->dst_ipv4_mask != 0) != (filter->dst_ip != 0)) {
+        return 0;
+    }
+
+    /* ports are zero in the input of other protocols */
+    if (filter->type == e_FASTPATH_CTRL_FILTER_IPV4) {
+        return 1;
+    }
+
+    return (masks->dst_port_mask != 0) == (filter->dst_port != 0) &&
+        (masks->src_port_mask != 0) == (filter->src_port != 0);
+}
+
+static int
+fastpath_add_ctrl_5tuple(uint8_t port, uint16_t index, struct fastpath_ctrl_filter *filter)
+{
+    struct rte_5tuple_filter tuple;
+
+    memset(&tuple, 0, sizeof(tuple));
+    tuple.dst_ip = rte_cpu_to_be_32(filter->dst_ip);
+    tuple.dst_port = rte_cpu_to_be_16(filter->dst_port);
+    tuple.src_port = rte_cpu_to_be_16(filter->src_port);
+    tuple.protocol = filter->type == e_FASTPATH_CTRL_FILTER_TCPV4 ? IPPROTO_TCP : IPPROTO_UDP;
+    tuple.protocol_mask = filter->type == e_FASTPATH_CTRL_FILTER_IPV4;
+    tuple.priority = 1;
+    tuple.src_ip_mask = 1;
+    tuple.dst_ip_mask = filter->dst_ip == 0;
+    tuple.dst_port_mask = filter->dst_port == 0;
+    tuple.src_port_mask = filter->src_port == 0;
+
+    return rte_eth_dev_add_5tuple_filter(port, index, &tuple, fastpath.ctrl_queue[port]);
+}
+
+static int
+fastpath_add_ctrl_fdir_legacy(uint8_t port, uint32_t id, struct rte_fdir_masks *masks,
+    struct fastpath_ctrl_filter *filter)
+{
+    struct rte_fdir_filter fdir_filter;
+
+    if (!fastpath_ctrl_fdir_fits(masks, filter)) {
+        return fastpath_add_ctrl_5tuple(port, (uint16_t) id, filter);
+    }
+
+    memset(&fdir_filter, 0, sizeof(fdir_filter));
+    fdir_filter.iptype = RTE_FDIR_IPTYPE_IPV4;
+    fdir_filter.ip_dst.ipv4_addr = rte_cpu_to_be_32(filter->dst_ip);
+
+    switch (filter->type) {
+    case e_FASTPATH_CTRL_FILTER_TCPV4:
+        fdir_filter.l4type = RTE_FDIR_L4TYPE_TCP;
+        break;
+    case e_FASTPATH_CTRL_FILTER_UDPV4:
+        fdir_filter.l4type = RTE_FDIR_L4TYPE_UDP;
+        break;
+    default:
+        fdir_filter.l4type = RTE_FDIR_L4TYPE_NONE;
+        break;
+    }
+
+    if (fdir_filter.l4type != RTE_FDIR_L4TYPE_NONE) {
+        fdir_filter.port_dst = rte_cpu_to_be_16(filter->dst_port);
+        fdir_filter.port_src = rte_cpu_to_be_16(filter->src_port);
+    }
+
+    return rte_eth_dev_fdir_add_perfect_filter(port, &fdir_filter, (uint16_t) id,
+        fastpath.ctrl_queue[port], 0);
+}
+
+static int
+fastpath_add_ctrl_filter(uint8_t port, uint32_t id, struct fastpath_ctrl_filter *filter)
+{
+    uint8_t queue = fastpath.ctrl_queue[port];
+
+    if (filter->type == e_FASTPATH_CTRL_FILTER_ETHERTYPE) {
+        struct rte_eth_ethertype_filter ethertype_filter;
+
+        if (rte_eth_dev_filter_supported(port, RTE_ETH_FILTER_ETHERTYPE) != 0) {
+            return -ENOTSUP;
+        }
+
+        memset(&ethertype_filter, 0, sizeof(ethertype_filter));
+        ethertype_filter.ether_type = filter->ether_type;
+        ethertype_filter.queue = queue;
+
+        return rte_eth_dev_filter_ctrl(port, RTE_ETH_FILTER_ETHERTYPE,
+            RTE_ETH_FILTER_ADD, &ethertype_filter);
+    }
+
+    return fastpath_add_ctrl_5tuple(port, (uint16_t) id, filter);
+}
+
+static void
+fastpath_init_ctrl_filters(uint8_t port, uint32_t n_rx_queues)
+{
+    uint32_t i;
+    int ret, legacy;
+    struct rte_fdir_masks masks;
+    struct rte_eth_dev_info dev_info;
+    struct rte_eth_rss_reta_entry64 reta_conf[ETH_RSS_RETA_SIZE_512 / RTE_RETA_GROUP_SIZE];
+
+    if (fastpath.ctrl_queue[port] == FASTPATH_CTRL_QUEUE_NONE) {
+        return;
+    }
+
+    legacy = fastpath_ctrl_filter_has_type(1) && fastpath_ctrl_fdir_legacy(port);
+    if (legacy) {
+        fastpath_ctrl_fdir_masks(&masks);
+        ret = rte_eth_dev_fdir_set_masks(port, &masks);
+        if (ret < 0) {
+            printf("NIC port %u flow director masks not set (%d)\n", (unsigned) port, ret);
+        }
+    }
+
+    for (i = 0; i < fastpath.n_ctrl_filters; i++) {
+        if (legacy && fastpath.ctrl_filters[i].type != e_FASTPATH_CTRL_FILTER_ETHERTYPE) {
+            ret = fastpath_add_ctrl_fdir_legacy(port, i, &masks, &fastpath.ctrl_filters[i]);
+        } else {
+            ret = fastpath_add_ctrl_filter(port, i, &fastpath.ctrl_filters[i]);
+        }
+        if (ret < 0) {
+            printf("NIC port %u ctrl filter %u not installed (%d)\n", 
+                (unsigned) port, i, ret);
+        }
+    }
+
+    /* Keep RSS off the ctrl queue, it only receives filtered traffic */
+    memset(&dev_info, 0, sizeof(dev_info));
+    rte_eth_dev_info_get(port, &dev_info);
+    if (dev_info.reta_size == 0 || dev_info.reta_size > ETH_RSS_RETA_SIZE_512) {
+        return;
+    }
+
+    memset(reta_conf, 0, sizeof(reta_conf));
+    for (i = 0; i < dev_info.reta_size; i++) {
+        reta_conf[i / RTE_RETA_GROUP_SIZE].mask |= 1ULL << (i % RTE_RETA_GROUP_SIZE);
+        reta_conf[i / RTE_RETA_GROUP_SIZE].reta[i % RTE_RETA_GROUP_SIZE] = i % n_rx_queues;
+    }
+
+    ret = rte_eth_dev_rss_reta_update(port, reta_conf, dev_info.reta_size);
+    if (ret < 0) {
+        printf("NIC port %u RSS redirection update failed (%d)\n", (unsigned) port, ret);
+    }
+}
+
+/* Frame bytes an RX mbuf holds, its data room less the headroom */
+static uint32_t
+fastpath_mbuf_frame_room(void)
+{
+    struct rte_pktmbuf_pool_private *priv;
+    uint32_t socket;
+
+    for (socket = 0; socket < FASTPATH_MAX_SOCKETS; socket++) {
+        if (fastpath.pktbuf_pools[socket] == NULL) {
+            continue;
+        }
+
+        priv = (struct rte_pktmbuf_pool_private *)
+            rte_mempool_get_priv(fastpath.pktbuf_pools[socket]);
+        return priv->mbuf_data_room_size - RTE_PKTMBUF_HEADROOM;
+    }
+
+    return 0;
+}
+
 static void
 fastpath_init_nics(void)
 {
@@ -328,22 +741,78 @@ fastpath_init_nics(void)
     /* Init NIC ports and queues, then start the ports */
     for (port = 0; port < FASTPATH_MAX_NIC_PORTS; port ++) {
         struct rte_mempool *pool;
+        struct rte_eth_conf conf;
+        struct rte_eth_dev_info dev_info;
+        struct rte_eth_txconf txconf;
+        uint32_t n_ctrl_queues;
 
         n_rx_queues = fastpath_get_nic_rx_queues_per_port(port);
-        n_tx_queues = fastpath_get_lcores_rx_worker();
+        /* one TX queue per worker, plus the exception path one */
+        n_tx_queues = fastpath_get_lcores_rx_worker() + 1;
 
         if (n_rx_queues == 0) {
             continue;
         }
 
+        memcpy(&conf, &port_conf, sizeof(conf));
+        n_ctrl_queues = 0;
+        if (fastpath.ctrl_queue[port] != FASTPATH_CTRL_QUEUE_NONE) {
+            n_ctrl_queues = 1;
+            if (fastpath_ctrl_filter_has_type(1) && fastpath_ctrl_fdir_legacy(port)) {
+                conf.fdir_conf.mode = RTE_FDIR_MODE_PERFECT;
+            }
+        }
+
+        /* Probe offloads, the datapath falls back to software for the rest */
+        memset(&dev_info, 0, sizeof(dev_info));
+        rte_eth_dev_info_get(port, &dev_info);
+        fastpath.rx_offload[port] = dev_info.rx_offload_capa & FASTPATH_RX_OFFLOADS;
+        fastpath.tx_offload[port] = dev_info.tx_offload_capa & FASTPATH_TX_OFFLOADS;
+
+        conf.rxmode.hw_ip_checksum =
+            (fastpath.rx_offload[port] &
+                (DEV_RX_OFFLOAD_IPV4_CKSUM | DEV_RX_OFFLOAD_TCP_CKSUM)) ? 1 : 0;
+        conf.rxmode.hw_vlan_strip =
+            (fastpath.rx_offload[port] & DEV_RX_OFFLOAD_VLAN_STRIP) ? 1 : 0;
+
+        /* the default TX queue config may select a path without offloads */
+        txconf = dev_info.default_txconf;
+        if (fastpath.tx_offload[port] != 0) {
+            txconf.txq_flags &= ~ETH_TXQ_FLAGS_NOOFFLOADS;
+        }
+
+        printf("NIC port %u offloads rx 0x%x tx 0x%x\n",
+            (unsigned) port,
+            fastpath.rx_offload[port],
+            fastpath.tx_offload[port]);
+
+        /* Jumbo above the standard MTU, chains only for frames the mbuf can't hold */
+        conf.rxmode.max_rx_pkt_len =
+            FASTPATH_MTU_TO_FRAME_LEN(fastpath.port_mtu[port]) + ETHER_CRC_LEN;
+        if (fastpath.port_mtu[port] > ETHER_MTU) {
+            conf.rxmode.jumbo_frame = 1;
+        }
+        if (conf.rxmode.max_rx_pkt_len > fastpath_mbuf_frame_room()) {
+            conf.rxmode.enable_scatter = 1;
+        }
+
+        /* reassembly, fragments and bridge header clones are chains too */
+        txconf.txq_flags &= ~ETH_TXQ_FLAGS_NOMULTSEGS;
+
+        printf("NIC port %u MTU %u max frame %u%s\n",
+            (unsigned) port,
+            (unsigned) fastpath.port_mtu[port],
+            (unsigned) conf.rxmode.max_rx_pkt_len,
+            conf.rxmode.enable_scatter ? " scattered" : "");
+
         /* Init port */
-        printf("Initializing NIC port %u Rx queue %u Tx queue %u...\n", 
-            (unsigned) port, n_rx_queues, n_tx_queues);
+        printf("Initializing NIC port %u Rx queue %u Ctrl queue %u Tx queue %u...\n", 
+            (unsigned) port, n_rx_queues, n_ctrl_queues, n_tx_queues);
         ret = rte_eth_dev_configure(
             port,
-            (uint8_t) n_rx_queues,
+            (uint8_t) (n_rx_queues + n_ctrl_queues),
             (uint8_t) n_tx_queues,
-            &port_conf);
+            &conf);
         if (ret < 0) {
             rte_panic("Cannot init NIC port %u (%d)\n", (unsigned) port, ret);
         }
@@ -377,12 +846,39 @@ fastpath_init_nics(void)
             }
         }
 
+        /* Init ctrl RX queue */
+        if (n_ctrl_queues != 0) {
+            queue = fastpath.ctrl_queue[port];
+
+            fastpath_get_lcore_for_nic_rx(port, 0, &lcore);
+            socket = rte_lcore_to_socket_id(lcore);
+            pool = fastpath.lcore_params[lcore].pktbuf_pool;
+
+            printf("Initializing NIC port %u ctrl RX queue %u ...\n",
+                (unsigned) port,
+                (unsigned) queue);
+            ret = rte_eth_rx_queue_setup(
+                port,
+                queue,
+                (uint16_t) fastpath.nic_rx_ring_size,
+                socket,
+                NULL,
+                pool);
+            if (ret < 0) {
+                rte_panic("Cannot init ctrl RX queue %u for port %u (%d)\n",
+                    (unsigned) queue,
+                    (unsigned) port,
+                    ret);
+            }
+        }
+
         /* Init TX queues */
         for (lcore = 0; lcore < FASTPATH_MAX_LCORES; lcore++) {
             struct fastpath_params_worker *lp_worker;
 
             if (fastpath.lcore_params[lcore].type != e_FASTPATH_LCORE_WORKER &&
-                fastpath.lcore_params[lcore].type != e_FASTPATH_LCORE_RX_WORKER) {
+                fastpath.lcore_params[lcore].type != e_FASTPATH_LCORE_RX_WORKER &&
+                fastpath.lcore_params[lcore].type != e_FASTPATH_LCORE_STAGE) {
                 continue;
             }
 
@@ -396,7 +892,7 @@ fastpath_init_nics(void)
                 queue,
                 (uint16_t) fastpath.nic_tx_ring_size,
                 socket,
-                NULL);
+                &txconf);
             if (ret < 0) {
                 rte_panic("Cannot init TX queue 0 for port %d (%d)\n",
                     port,
@@ -404,11 +900,30 @@ fastpath_init_nics(void)
             }
         }
 
+        /* Init the exception path TX queue */
+        queue = (uint8_t) exception_get_tx_queue();
+        socket = rte_lcore_to_socket_id(exception_get_lcore());
+        printf("Initializing NIC port %u exception TX queue %u ...\n",
+            (unsigned) port, (unsigned) queue);
+        ret = rte_eth_tx_queue_setup(
+            port,
+            queue,
+            (uint16_t) fastpath.nic_tx_ring_size,
+            socket,
+            &txconf);
+        if (ret < 0) {
+            rte_panic("Cannot init exception TX queue for port %d (%d)\n",
+                port,
+                ret);
+        }
+
         /* Start port */
         ret = rte_eth_dev_start(port);
         if (ret < 0) {
             rte_panic("Cannot start port %d (%d)\n", port, ret);
         }
+
+        fastpath_init_ctrl_filters(port, n_rx_queues);
     }
 }
 
@@ -417,40 +932,33 @@ static int
 kni_change_mtu(uint8_t port_id, unsigned new_mtu)
 {
     int ret;
-    struct rte_eth_conf conf;
 
-    if (port_id >= rte_eth_dev_count()) {
+    if (port_id >= rte_eth_dev_count() || port_id >= FASTPATH_MAX_NIC_PORTS) {
         fastpath_log_error("Invalid port id %d\n", port_id);
         return -EINVAL;
     }
 
-    fastpath_log_info("Change MTU of port %d to %u\n", port_id, new_mtu);
+    if (new_mtu < ETHER_MIN_MTU || new_mtu > FASTPATH_MAX_MTU) {
+        fastpath_log_error("Invalid MTU %u for port %d, max %u\n",
+            new_mtu, port_id, FASTPATH_MAX_MTU);
+        return -EINVAL;
+    }
 
-    /* Stop specific port */
-    rte_eth_dev_stop(port_id);
+    fastpath_log_info("Change MTU of port %d to %u\n", port_id, new_mtu);
 
-    memcpy(&conf, &port_conf, sizeof(conf));
-    /* Set new MTU */
-    if (new_mtu > ETHER_MAX_LEN)
-        conf.rxmode.jumbo_frame = 1;
-    else
-        conf.rxmode.jumbo_frame = 0;
-
-    /* mtu + length of header + length of FCS = max pkt length */
-    conf.rxmode.max_rx_pkt_len = new_mtu + KNI_ENET_HEADER_SIZE +
-                            KNI_ENET_FCS_SIZE;
-    ret = rte_eth_dev_configure(port_id, 1, 1, &conf);
+    /*
+     * Reconfiguring the port would drop its queues, the PMD can change
+     * the MTU in place. Jumbo frames need the port started with
+     * scattered RX, i.e. a large enough --mtu.
+     */
+    ret = rte_eth_dev_set_mtu(port_id, (uint16_t) new_mtu);
     if (ret < 0) {
-        fastpath_log_error("Fail to reconfigure port %d\n", port_id);
+        fastpath_log_error("Fail to set MTU %u on port %d (%d)\n",
+            new_mtu, port_id, ret);
         return ret;
     }
 
-    /* Restart specific port */
-    ret = rte_eth_dev_start(port_id);
-    if (ret < 0) {
-        fastpath_log_error("Fail to restart port %d\n", port_id);
-        return ret;
-    }
+    fastpath.port_mtu[port_id] = (uint16_t) new_mtu;
 
     return 0;
 }
@@ -497,8 +1005,6 @@ static int kni_alloc(uint8_t port_id)
 
     printf("Initialising kni port %u ...\n", (unsigned)port_id);
 
-    rte_spinlock_init(&fastpath.kni_lock[port_id]);
-
     /* Clear conf at first */
     memset(&conf, 0, sizeof(conf));
     snprintf(conf.name, RTE_KNI_NAMESIZE, "vEth%u", port_id);
@@ -543,13 +1049,22 @@ static void
 fastpath_init_knis(void)
 {
     uint8_t nb_sys_ports, port;
-    uint32_t n_rx_queues;
+    uint32_t n_rx_queues, n_knis = 0;
+    char name[IFNAMSIZ];
 
-    /* Initialize KNI subsystem */
     nb_sys_ports = rte_eth_dev_count();
+    for (port = 0; port < nb_sys_ports && port < FASTPATH_MAX_NIC_PORTS; port++) {
+        if (fastpath_get_nic_rx_queues_per_port(port) > 0 &&
+            fastpath.exc_type[port] == e_FASTPATH_EXC_KNI) {
+            n_knis++;
+        }
+    }
 
-    /* Invoke rte KNI init to preallocate the ports */
-    rte_kni_init(nb_sys_ports);
+    /* Initialize KNI subsystem, the module is only needed when a port uses it */
+    if (n_knis > 0) {
+        /* Invoke rte KNI init to preallocate the ports */
+        rte_kni_init(nb_sys_ports);
+    }
 
     /* Initialise each port */
     for (port = 0; port < nb_sys_ports; port++) {
@@ -563,6 +1078,16 @@ fastpath_init_knis(void)
             rte_exit(EXIT_FAILURE, "Can not use more than "
                 "%d ports for kni\n", FASTPATH_MAX_NIC_PORTS);
 
+        if (fastpath.exc_type[port] == e_FASTPATH_EXC_TAP) {
+            printf("Initialising tap port %u ...\n", (unsigned)port);
+            snprintf(name, sizeof(name), "vEth%u", port);
+            if (tap_open(port, name, fastpath.exc_queues[port]) < 0)
+                rte_exit(EXIT_FAILURE, "Fail to create tap for port: %d\n", port);
+            if (fastpath.exc_gro[port] && gro_enable(port) < 0)
+                rte_exit(EXIT_FAILURE, "Fail to enable gro for port: %d\n", port);
+            continue;
+        }
+
         kni_alloc(port);
     }
 }
@@ -581,16 +1106,33 @@ static void fastpath_init_threads(void)
     if (route_thread_add() < 0) {
         fastpath_log_error("fastpath_init_threads: Can not create neigh thread\n");
     }
+
+    if (mgmt_thread_add() < 0) {
+        fastpath_log_error("fastpath_init_threads: Can not create management thread\n");
+    }
 }
 
 void fastpath_init(void)
 {
+    fastpath_load_pipeline();
+    fastpath_load_exception();
+    fastpath_load_fdb();
     fastpath_assign_worker_ids();
     fastpath_init_threads();
     fastpath_init_frag_tables();
     fastpath_init_mbuf_pools();
     fastpath_init_indirect_mbuf_pools();
+    fastpath_init_header_mbuf_pools();
+    fastpath_load_ring_classes();
     fastpath_init_rings();
+    pipeline_init_rings();
+    fastpath_init_lcore_runtime();
+    fastpath_timer_init_lcores();
+    exception_init_rings();
+    bridge_init_learning();
+    control_init_rings();
+    fastpath_load_ctrl_filters();
+    fastpath_init_ctrl_queues();
     fastpath_init_nics();
     fastpath_init_knis();
 
@@ -609,6 +1151,8 @@ void fastpath_cleanup(void)
     
     for (port = 0; port < FASTPATH_MAX_NIC_PORTS; port++) {
         kni_free_kni(port);
+        gro_disable(port);
+        tap_close(port);
     }
 }
 
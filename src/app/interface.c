@@ -1,7 +1,7 @@
 
 #include "include/fastpath.h"
 
-#define INTERFACE_INDEX_MAX     VLAN_VID_MAX
+#define INTERFACE_INDEX_MAX     FASTPATH_MAX_INTERFACES
 
 #define INTERFACE_LINK_DOWN     0
 #define INTERFACE_LINK_UP       1
@@ -10,15 +10,24 @@ struct interface_private {
     uint16_t ifindex;
     uint8_t state;
     uint8_t reserved;
+    uint16_t mtu;           /* of the kernel device, set by the manager thread */
+    uint32_t addr;          /* IPv4, network order, source of ICMP errors */
+    uint8_t addr6[16];      /* IPv6 global, source of ICMPv6 errors */
     struct module *ipv4;
     struct module *ipv6;
     struct module *lower;
 };
 
+/* ICMP token bucket of an lcore */
+struct interface_lcore_private {
+    uint64_t icmp_tsc;
+    uint32_t icmp_tokens;
+};
+
 struct module *interface_modules[INTERFACE_INDEX_MAX];
 
 static inline int
-is_valid_ipv4_pkt(struct ipv4_hdr *pkt, uint32_t link_len)
+is_valid_ipv4_pkt(struct rte_mbuf *m, struct ipv4_hdr *pkt, uint32_t link_len)
 {
     /* From http://www.rfc-editor.org/rfc/rfc1812.txt section 5.2.2 */
     /*
@@ -29,7 +38,8 @@ is_valid_ipv4_pkt(struct ipv4_hdr *pkt, uint32_t link_len)
         return -1;
 
     /* 2. The IP checksum must be correct. */
-    /* this is checked in H/W */
+    if (m->ol_flags & PKT_RX_IP_CKSUM_BAD)
+        return -2;
 
     /*
      * 3. The IP version number must be 4. If the version number is not 4
@@ -53,12 +63,22 @@ is_valid_ipv4_pkt(struct ipv4_hdr *pkt, uint32_t link_len)
     if (rte_cpu_to_be_16(pkt->total_length) < sizeof(struct ipv4_hdr))
         return -5;
 
+    /* 2. again, in software when the NIC does not verify the checksum */
+    if (!(fastpath.rx_offload[m->port] & DEV_RX_OFFLOAD_IPV4_CKSUM)) {
+        uint32_t ihl = (pkt->version_ihl & 0xf) * 4;
+
+        /* the header is in the first segment of a chain */
+        if (link_len < ihl || rte_pktmbuf_data_len(m) < ihl ||
+            rte_raw_cksum(pkt, ihl) != 0xffff)
+            return -2;
+    }
+
     return 0;
 }
 
 void interface_receive(struct rte_mbuf *m, struct module *peer, struct module *iface)
 {
-    uint64_t cur_tsc = rte_rdtsc();
+    uint64_t cur_tsc = fastpath_clock();
     unsigned lcore = rte_lcore_id();
     struct ipv4_hdr *ipv4_hdr;
     struct ipv6_hdr *ipv6_hdr;
@@ -70,8 +90,6 @@ void interface_receive(struct rte_mbuf *m, struct module *peer, struct module *i
 
     RTE_SET_USED(peer);
 
-    c->network_header = rte_pktmbuf_mtod(m, uint8_t *);
-
     private = (struct interface_private *)iface->private;
 
     if (c->protocol == ETHER_TYPE_IPv4) {
@@ -80,7 +98,7 @@ void interface_receive(struct rte_mbuf *m, struct module *peer, struct module *i
         fastpath_log_debug("interface %s receive packet\n", iface->name);
 
         /* Check to make sure the packet is valid (RFC1812) */
-        if (is_valid_ipv4_pkt(ipv4_hdr, m->pkt_len) < 0) {
+        if (is_valid_ipv4_pkt(m, ipv4_hdr, m->pkt_len) < 0) {
             fastpath_log_debug("invalid ipv4 pkt, drop\n");
             rte_pktmbuf_free(m);
             return;
@@ -88,7 +106,7 @@ void interface_receive(struct rte_mbuf *m, struct module *peer, struct module *i
 
         if (IS_IPV4_MCAST(rte_be_to_cpu_32(ipv4_hdr->dst_addr))) {
             fastpath_log_debug("multicast pkt, send to kni %d\n", m->port);
-            rte_pktmbuf_prepend(m, c->network_header - c->mac_header);
+            rte_pktmbuf_prepend(m, c->l3_off - c->l2_off);
             kni_ingress(m);
             return;
         }
@@ -97,7 +115,7 @@ void interface_receive(struct rte_mbuf *m, struct module *peer, struct module *i
             struct rte_mbuf *mo;
 
             tbl = fastpath.frag_tbl;
-            dr = &fastpath.death_row[lcore];
+            dr = &fastpath.runtime[lcore]->death_row;
 
             /* prepare mbuf: setup l2_len/l3_len. */
             m->l2_len = 0;
@@ -114,9 +132,15 @@ void interface_receive(struct rte_mbuf *m, struct module *peer, struct module *i
                 m = mo;
                 ipv4_hdr = rte_pktmbuf_mtod(m, struct ipv4_hdr *);
             }
+
+            /* reassembly clears the header checksum, redo it on TX */
+            m->ol_flags |= PKT_TX_IPV4 | PKT_TX_IP_CKSUM;
+            m->l2_len = sizeof(struct ether_hdr);
+            m->l3_len = (ipv4_hdr->version_ihl & 0xf) * 4;
         }
 
-        SEND_PKT(m, iface, private->ipv4, PKT_DIR_RECV);
+        SEND_PKT_DIRECT(m, iface, private->ipv4, PKT_DIR_RECV,
+            MODULE_TYPE_ROUTE, route_receive);
     } else if (c->protocol == ETHER_TYPE_IPv6) {
         struct ipv6_extension_fragment *frag_hdr;
 
@@ -127,7 +151,7 @@ void interface_receive(struct rte_mbuf *m, struct module *peer, struct module *i
             struct rte_mbuf *mo;
 
             tbl = fastpath.frag_tbl;
-            dr  = &fastpath.death_row[lcore];
+            dr  = &fastpath.runtime[lcore]->death_row;
 
             /* prepare mbuf: setup l2_len/l3_len. */
             m->l2_len = 0;
@@ -143,15 +167,81 @@ void interface_receive(struct rte_mbuf *m, struct module *peer, struct module *i
             }
         }
 
-        SEND_PKT(m, iface, private->ipv6, PKT_DIR_RECV);
+        SEND_PKT_DIRECT(m, iface, private->ipv6, PKT_DIR_RECV,
+            MODULE_TYPE_ROUTE, route_receive);
     } else {
         fastpath_log_debug("interface receive protocol %04x packet, send to kni %d\n",
             c->protocol, m->port);
-        rte_pktmbuf_prepend(m, c->network_header - c->mac_header);
+        rte_pktmbuf_prepend(m, c->l3_off - c->l2_off);
         kni_ingress(m);
     }
 }
 
+static inline int
+interface_icmp_allow(struct module *iface)
+{
+    unsigned lcore = rte_lcore_id();
+    struct interface_lcore_private *lcp;
+    uint64_t now, period, n;
+
+    if (lcore >= FASTPATH_MAX_LCORES || (lcp = iface->lcore_private[lcore]) == NULL) {
+        return 0;
+    }
+
+    now = fastpath_clock();
+    period = rte_get_tsc_hz() / FASTPATH_ICMP_RATE;
+    n = (now - lcp->icmp_tsc) / period;
+    if (n > 0) {
+        lcp->icmp_tokens = RTE_MIN(lcp->icmp_tokens + n, (uint64_t)FASTPATH_ICMP_BURST);
+        lcp->icmp_tsc += n * period;
+    }
+
+    if (lcp->icmp_tokens == 0) {
+        return 0;
+    }
+    lcp->icmp_tokens--;
+
+    return 1;
+}
+
+/* DF set and too big: drop, tell the sender the MTU when the rate allows */
+static void
+interface_frag_needed(struct rte_mbuf *m, struct module *iface,
+    struct interface_private *private)
+{
+    struct rte_mbuf *r = NULL;
+
+    if (private->addr != 0 && interface_icmp_allow(iface)) {
+        r = frag_icmp_need_frag(m, private->addr, private->mtu,
+            fastpath.pktbuf_pools[rte_socket_id()]);
+    }
+    rte_pktmbuf_free(m);
+
+    if (r != NULL) {
+        SEND_PKT_DIRECT(r, iface, private->ipv4, PKT_DIR_RECV,
+            MODULE_TYPE_ROUTE, route_receive);
+    }
+}
+
+/* IPv6 too big, never fragmented in transit: drop, tell the sender the MTU */
+static void
+interface_too_big(struct rte_mbuf *m, struct module *iface,
+    struct interface_private *private)
+{
+    struct rte_mbuf *r = NULL;
+
+    if (private->addr6[0] != 0 && interface_icmp_allow(iface)) {
+        r = frag_icmp6_too_big(m, private->addr6, private->mtu,
+            fastpath.pktbuf_pools[rte_socket_id()]);
+    }
+    rte_pktmbuf_free(m);
+
+    if (r != NULL) {
+        SEND_PKT_DIRECT(r, iface, private->ipv6, PKT_DIR_RECV,
+            MODULE_TYPE_ROUTE, route_receive);
+    }
+}
+
 void interface_xmit(struct rte_mbuf *m, struct module *peer, struct module *iface)
 {
     int32_t i, n_frags;
@@ -175,16 +265,17 @@ void interface_xmit(struct rte_mbuf *m, struct module *peer, struct module *ifac
         fastpath_log_debug("interface %s receive ipv4 packet\n", iface->name);
         
         /* if we don't need to do any fragmentation */
-        if (likely (IPV4_MTU_DEFAULT >= m->pkt_len)) {
-            SEND_PKT(m, iface, private->lower, PKT_DIR_XMIT);
+        if (likely (private->mtu >= m->pkt_len)) {
+            SEND_PKT_DIRECT(m, iface, private->lower, PKT_DIR_XMIT,
+                MODULE_TYPE_BRIDGE, bridge_xmit);
+        } else if (rte_pktmbuf_mtod(m, struct ipv4_hdr *)->fragment_offset &
+            rte_cpu_to_be_16(IPV4_HDR_DF_FLAG)) {
+            interface_frag_needed(m, iface, private);
         } else {
-            n_frags = rte_ipv4_fragment_packet(m,
-                &pkts_out[0],
-                MAX_FRAG_NUM,
-                IPV4_MTU_DEFAULT,
-                fastpath.pktbuf_pools[socketid], fastpath.indirect_pools[socketid]);
+            n_frags = frag_ipv4(m, &pkts_out[0], MAX_FRAG_NUM, private->mtu,
+                fastpath.header_pools[socketid], fastpath.indirect_pools[socketid]);
 
-            /* Free input packet */
+            /* Free input packet, the fragments hold its payload */
             rte_pktmbuf_free(m);
 
             /* If we fail to fragment the packet */
@@ -192,32 +283,18 @@ void interface_xmit(struct rte_mbuf *m, struct module *peer, struct module *ifac
                 return;
 
             for (i = 0; i < n_frags; i++) {
-                SEND_PKT(pkts_out[i], iface, private->lower, PKT_DIR_XMIT);
+                SEND_PKT_DIRECT(pkts_out[i], iface, private->lower, PKT_DIR_XMIT,
+                    MODULE_TYPE_BRIDGE, bridge_xmit);
             }
         }
     } else if (c->protocol == ETHER_TYPE_IPv6) {
         fastpath_log_debug("interface %d receive ipv6 packet\n", iface->name);
         
-        /* if we don't need to do any fragmentation */
-        if (likely (IPV6_MTU_DEFAULT >= m->pkt_len)) {
-            SEND_PKT(m, iface, private->lower, PKT_DIR_XMIT);
+        if (likely (private->mtu >= m->pkt_len)) {
+            SEND_PKT_DIRECT(m, iface, private->lower, PKT_DIR_XMIT,
+                MODULE_TYPE_BRIDGE, bridge_xmit);
         } else {
-            n_frags = rte_ipv6_fragment_packet(m,
-                &pkts_out[0],
-                MAX_FRAG_NUM,
-                IPV6_MTU_DEFAULT,
-                fastpath.pktbuf_pools[socketid], fastpath.indirect_pools[socketid]);
-
-            /* Free input packet */
-            rte_pktmbuf_free(m);
-
-            /* If we fail to fragment the packet */
-            if (unlikely (n_frags < 0))
-                return;
-
-            for (i = 0; i < n_frags; i++) {
-                SEND_PKT(pkts_out[i], iface, private->lower, PKT_DIR_XMIT);
-            }
+            interface_too_big(m, iface, private);
         }
     } else {
         fastpath_log_error("interface_xmit: unknown protocol %d, drop packet\n", c->protocol);
@@ -258,6 +335,85 @@ int interface_connect(struct module *local, struct module *peer, void *param)
     return 0;
 }
 
+static struct interface_private *
+interface_get(uint32_t ifidx)
+{
+    if (ifidx >= INTERFACE_INDEX_MAX || interface_modules[ifidx] == NULL) {
+        return NULL;
+    }
+
+    return (struct interface_private *)interface_modules[ifidx]->private;
+}
+
+/* Control plane, from the kernel device of the interface */
+int interface_set_mtu(uint32_t ifidx, uint16_t mtu)
+{
+    struct interface_private *private = interface_get(ifidx);
+
+    if (private == NULL) {
+        return -ENOENT;
+    }
+
+    if (mtu < ETHER_MIN_MTU) {
+        fastpath_log_error("interface_set_mtu: eif%u invalid mtu %u\n", ifidx, mtu);
+        return -EINVAL;
+    }
+
+    if (private->mtu != mtu) {
+        fastpath_log_info("interface eif%u mtu %u\n", ifidx, mtu);
+        private->mtu = mtu;
+    }
+
+    return 0;
+}
+
+/* addr in network order, the one deleted when del */
+int interface_set_addr(uint32_t ifidx, uint32_t addr, int del)
+{
+    struct interface_private *private = interface_get(ifidx);
+
+    if (private == NULL) {
+        return -ENOENT;
+    }
+
+    if (!del) {
+        private->addr = addr;
+    } else if (private->addr == addr) {
+        private->addr = 0;
+    }
+
+    return 0;
+}
+
+/* A global IPv6 addr of the interface, the one deleted when del */
+int interface_set_addr6(uint32_t ifidx, const uint8_t *addr, int del)
+{
+    struct interface_private *private = interface_get(ifidx);
+
+    if (private == NULL) {
+        return -ENOENT;
+    }
+
+    if (!del) {
+        memcpy(private->addr6, addr, sizeof(private->addr6));
+    } else if (memcmp(private->addr6, addr, sizeof(private->addr6)) == 0) {
+        memset(private->addr6, 0, sizeof(private->addr6));
+    }
+
+    return 0;
+}
+
+static void
+interface_lcore_init(struct module *iface, void *priv, unsigned lcore)
+{
+    struct interface_lcore_private *lcp = (struct interface_lcore_private *)priv;
+
+    RTE_SET_USED(iface);
+    RTE_SET_USED(lcore);
+
+    lcp->icmp_tsc = rte_rdtsc();
+    lcp->icmp_tokens = FASTPATH_ICMP_BURST;
+}
 
 struct module * interface_init(uint16_t ifidx)
 {
@@ -291,9 +447,19 @@ struct module * interface_init(uint16_t ifidx)
 
     private->ifindex = ifidx;
     private->state = INTERFACE_LINK_UP;
+    private->mtu = IPV4_MTU_DEFAULT;
 
     iface->private = (void *)private;
 
+    if (module_lcore_private_alloc(iface, sizeof(struct interface_lcore_private),
+            interface_lcore_init) < 0) {
+        rte_free(private);
+        rte_free(iface);
+
+        fastpath_log_error("interface_init: malloc lcore private failed\n");
+        return NULL;
+    }
+
     interface_modules[ifidx] = iface;
 
     return iface;    
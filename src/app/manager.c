@@ -100,6 +100,7 @@ static int neigh_update(struct nlmsghdr *nlh)
 
     if (ndm->ndm_state & NUD_FAILED || (ci && (ci->ndm_refcnt == 0))) {
         hdr->cmd = ROUTE_MSG_DEL_NEIGH;
+        hdr->len = sizeof(struct arp_del);
         arp_del = (struct arp_del *)hdr->data;
         arp_del->nh_iface = rte_cpu_to_be_32(index);
         memcpy(&arp_del->nh_ip, RTA_DATA(tb[NDA_DST]), RTA_PAYLOAD(tb[NDA_DST]));
@@ -109,6 +110,7 @@ static int neigh_update(struct nlmsghdr *nlh)
         }
 
         hdr->cmd = ROUTE_MSG_DEL_NH;
+        hdr->len = sizeof(struct route_del);
         rt_del = (struct route_del *)hdr->data;
         memcpy(&rt_del->ip, RTA_DATA(tb[NDA_DST]), RTA_PAYLOAD(tb[NDA_DST]));
         rt_del->depth = 32;
@@ -119,6 +121,7 @@ static int neigh_update(struct nlmsghdr *nlh)
         
     } else /* if (ndm->ndm_state & (NUD_REACHABLE | NUD_PERMANENT)) */ {
         hdr->cmd = ROUTE_MSG_ADD_NEIGH;
+        hdr->len = sizeof(struct arp_add);
         arp_add = (struct arp_add *)hdr->data;
         arp_add->nh_iface = rte_cpu_to_be_32(index);
         memcpy(&arp_add->nh_ip, RTA_DATA(tb[NDA_DST]), RTA_PAYLOAD(tb[NDA_DST]));
@@ -132,6 +135,7 @@ static int neigh_update(struct nlmsghdr *nlh)
         }
 
         hdr->cmd = ROUTE_MSG_ADD_NH;
+        hdr->len = sizeof(struct route_add);
         rt_add = (struct route_add *)hdr->data;
         memcpy(&rt_add->ip, RTA_DATA(tb[NDA_DST]), RTA_PAYLOAD(tb[NDA_DST]));
         rt_add->depth = 32;
@@ -199,6 +203,7 @@ static int nh_update(struct nlmsghdr *nlh)
 
     if (nlh->nlmsg_type == RTM_NEWROUTE) {
         hdr->cmd = ROUTE_MSG_ADD_NH;
+        hdr->len = sizeof(struct route_add);
         rt_add = (struct route_add *)hdr->data;
         if (tb[RTA_DST])
             memcpy(&rt_add->ip, RTA_DATA(tb[RTA_DST]), RTA_PAYLOAD(tb[RTA_DST]));
@@ -210,6 +215,7 @@ static int nh_update(struct nlmsghdr *nlh)
         rt_add->nh_iface= rte_cpu_to_be_32(index);
     } else {
         hdr->cmd = ROUTE_MSG_DEL_NH;
+        hdr->len = sizeof(struct route_del);
         rt_del = (struct route_del *)hdr->data;
         if (tb[RTA_DST])
             memcpy(&rt_del->ip, RTA_DATA(tb[RTA_DST]), RTA_PAYLOAD(tb[RTA_DST]));
@@ -248,10 +254,7 @@ static int ifa_update(struct nlmsghdr *nlh)
     fastpath_log_debug("ifa_update family %d prefixlen %d flag 0x%x scope 0x%x\n",
         ifm->ifa_family, ifm->ifa_prefixlen, ifm->ifa_flags, ifm->ifa_scope);
 
-    if (AF_INET == ifm->ifa_family) {
-    } else if (AF_INET6 == ifm->ifa_family) {
-        return 0;
-    } else {
+    if (AF_INET != ifm->ifa_family && AF_INET6 != ifm->ifa_family) {
         return 0;
     }
 
@@ -268,8 +271,22 @@ static int ifa_update(struct nlmsghdr *nlh)
         return 0;
     }
 
+    /* IPv6 only sources the ICMPv6 errors, a global address */
+    if (AF_INET6 == ifm->ifa_family) {
+        if (RT_SCOPE_UNIVERSE == ifm->ifa_scope &&
+            RTA_PAYLOAD(tb[IFA_ADDRESS]) >= sizeof(struct in6_addr)) {
+            interface_set_addr6(index, RTA_DATA(tb[IFA_ADDRESS]),
+                RTM_DELADDR == nlh->nlmsg_type);
+        }
+        return 0;
+    }
+
+    interface_set_addr(index, *(uint32_t *)RTA_DATA(tb[IFA_ADDRESS]),
+        RTM_DELADDR == nlh->nlmsg_type);
+
     if (RTM_DELADDR == nlh->nlmsg_type) {
         hdr->cmd = ROUTE_MSG_DEL_NEIGH;
+        hdr->len = sizeof(struct arp_del);
         arp_del = (struct arp_del *)hdr->data;
         arp_del->nh_iface = rte_cpu_to_be_32(index);
         memcpy(&arp_del->nh_ip, RTA_DATA(tb[IFA_ADDRESS]), RTA_PAYLOAD(tb[IFA_ADDRESS]));
@@ -280,6 +297,7 @@ static int ifa_update(struct nlmsghdr *nlh)
         }
         
         hdr->cmd = ROUTE_MSG_DEL_NH;
+        hdr->len = sizeof(struct route_del);
         rt_del = (struct route_del *)hdr->data;
         memcpy(&rt_del->ip, RTA_DATA(tb[IFA_ADDRESS]), RTA_PAYLOAD(tb[IFA_ADDRESS]));
         rt_del->depth = 32;
@@ -290,6 +308,7 @@ static int ifa_update(struct nlmsghdr *nlh)
         }
     } else {
         hdr->cmd = ROUTE_MSG_ADD_NEIGH;
+        hdr->len = sizeof(struct arp_add);
         arp_add = (struct arp_add *)hdr->data;
         arp_add->nh_iface = rte_cpu_to_be_32(index);
         memcpy(&arp_add->nh_ip, RTA_DATA(tb[IFA_ADDRESS]), RTA_PAYLOAD(tb[IFA_ADDRESS]));
@@ -301,6 +320,7 @@ static int ifa_update(struct nlmsghdr *nlh)
         }
         
         hdr->cmd = ROUTE_MSG_ADD_NH;
+        hdr->len = sizeof(struct route_add);
         rt_add = (struct route_add *)hdr->data;
         memcpy(&rt_add->ip, RTA_DATA(tb[IFA_ADDRESS]), RTA_PAYLOAD(tb[IFA_ADDRESS]));
         rt_add->depth = 32;
@@ -316,11 +336,47 @@ static int ifa_update(struct nlmsghdr *nlh)
     return err;
 }
 
+static int link_update(struct nlmsghdr *nlh)
+{
+    int len = nlh->nlmsg_len;
+    uint32_t index;
+    struct rtattr *tb[IFLA_MAX+1];
+    struct ifinfomsg *ifi;
+
+    len -= NLMSG_LENGTH(sizeof(*ifi));
+    if (len < 0)
+        return -1;
+
+    ifi = NLMSG_DATA(nlh);
+
+    index = get_port_map(ifi->ifi_index);
+    if (index >= ROUTE_MAX_LINK) {
+        fastpath_log_debug("ifidx %d not concerned\n", ifi->ifi_index);
+        return 0;
+    }
+
+    rtattr_parse(tb, IFLA_MAX, IFLA_RTA(ifi), len);
+
+    if (NULL != tb[IFLA_MTU]) {
+        interface_set_mtu(index, RTE_MIN(*(uint32_t *)RTA_DATA(tb[IFLA_MTU]), (uint32_t)UINT16_MAX));
+    }
+
+    return 0;
+}
+
 static int route_dispatch(struct nlmsghdr *hdr)
 {
     int ret = -1;
     
     switch (hdr->nlmsg_type) {
+        case RTM_NEWLINK:
+            ret = link_update(hdr);
+            break;
+
+        case RTM_DELLINK:
+            ret = 0;
+            break;
+
         case RTM_NEWADDR:
         case RTM_DELADDR:
             ret = ifa_update(hdr);
@@ -422,7 +478,7 @@ static int neigh_socket_init(void)
 
     memset(&rtnl_local, 0, sizeof(rtnl_local));
     rtnl_local.nl_family = AF_NETLINK;
-    rtnl_local.nl_groups = RTMGRP_NEIGH | RTMGRP_IPV4_ROUTE | RTMGRP_IPV4_IFADDR;
+    rtnl_local.nl_groups = RTMGRP_LINK | RTMGRP_NEIGH | RTMGRP_IPV4_ROUTE | RTMGRP_IPV4_IFADDR;
     
     if (bind(rtnl_fd, (struct sockaddr *) &rtnl_local, addrlen) < 0) {
         fastpath_log_error( "%s: unable to bind rtnetlink socket\n", __func__);
@@ -500,6 +556,12 @@ static int manager_socket_receive(struct thread *thread)
     }
 
     msg = (struct msg_hdr *)req;
+    if ((size_t)length < sizeof(struct msg_hdr) ||
+        (size_t)length < sizeof(struct msg_hdr) + msg->len) {
+        fastpath_log_error("[%s]: short message, %d bytes\n", __func__, length);
+        goto rtn;
+    }
+
     module = module_get_by_name((const char *)msg->path);
     if (module == NULL) {
         fastpath_log_error("invalid message, path %s\n", msg->path);
@@ -0,0 +1,447 @@
+
+#include "include/fastpath.h"
+
+#include <sys/un.h>
+
+extern struct thread_master *mgr_master;
+
+/*
+ * Server of the bulk management protocol, see include/mgmt.h, run by
+ * the manager thread next to the UDP one. A connection reads whole
+ * messages into its buffer and applies each batch through the message
+ * handlers of the modules, then queues the ack. Acks go out when the
+ * socket takes them; while MGMT_ACKS of them wait, the connection is not
+ * read, so a client not reading its acks only stalls itself.
+ *
+ * An atomic batch is checked before anything is applied, then each
+ * request is applied after its module built the request reverting it;
+ * on a failure the reverts run backwards. The datapath sees the
+ * requests as they are applied, all or nothing is for the outcome.
+ */
+#define MGMT_MAX_CONNS      16
+#define MGMT_BUF_SIZE       (64 << 10)
+#define MGMT_ACKS           256
+#define MGMT_UNDO_SIZE      128
+#define MGMT_RESP_SIZE      1472    /* as the UDP manager */
+
+struct mgmt_conn {
+    int fd;
+    struct thread *t_read;
+    struct thread *t_write;
+    uint8_t *buf;
+    uint32_t size;
+    uint32_t len;
+    struct mgmt_ack acks[MGMT_ACKS];
+    uint32_t n_acks;
+    uint32_t ack_off;       /* bytes of the acks sent */
+};
+
+static int mgmt_sockfd = -1;
+static struct mgmt_conn *mgmt_conns[MGMT_MAX_CONNS];
+
+/* MGMT_UNDO_SIZE per operation of the largest atomic batch so far */
+static uint8_t *mgmt_undo;
+static uint32_t mgmt_undo_ops;
+
+static int mgmt_conn_read(struct thread *thread);
+static int mgmt_conn_write(struct thread *thread);
+
+/* The request of the TLV at off, NULL when it is not a valid one */
+static struct msg_hdr *
+mgmt_tlv_msg(uint8_t *msg, uint32_t len, uint32_t *off)
+{
+    struct mgmt_tlv *tlv;
+    struct msg_hdr *req;
+    uint32_t vlen;
+
+    if (*off + sizeof(struct mgmt_tlv) > len) {
+        return NULL;
+    }
+
+    tlv = (struct mgmt_tlv *)(msg + *off);
+    vlen = ntohs(tlv->len);
+    if (ntohs(tlv->type) != MGMT_TLV_MSG || vlen < sizeof(struct msg_hdr) ||
+        *off + sizeof(struct mgmt_tlv) + vlen > len) {
+        return NULL;
+    }
+
+    req = (struct msg_hdr *)(tlv + 1);
+    if (sizeof(struct msg_hdr) + req->len > vlen ||
+        memchr(req->path, '\0', sizeof(req->path)) == NULL) {
+        return NULL;
+    }
+
+    *off += sizeof(struct mgmt_tlv) + MGMT_TLV_ALIGN(vlen);
+
+    return req;
+}
+
+static int
+mgmt_undo_reserve(uint32_t count)
+{
+    uint8_t *undo;
+
+    if (count <= mgmt_undo_ops) {
+        return 0;
+    }
+
+    undo = rte_realloc(mgmt_undo, (size_t)count * MGMT_UNDO_SIZE, 0);
+    if (undo == NULL) {
+        return -ENOMEM;
+    }
+
+    mgmt_undo = undo;
+    mgmt_undo_ops = count;
+
+    return 0;
+}
+
+static void
+mgmt_revert(uint32_t n)
+{
+    char resp[MGMT_RESP_SIZE];
+    struct msg_hdr *undo;
+    struct module *module;
+
+    while (n-- > 0) {
+        undo = (struct msg_hdr *)(mgmt_undo + (size_t)n * MGMT_UNDO_SIZE);
+        if (undo->path[0] == '\0') {
+            continue;
+        }
+
+        module = module_get_by_name(undo->path);
+        memset(resp, 0, sizeof(struct msg_hdr));
+        if (module == NULL || module->message(module, undo, (struct msg_hdr *)resp) != 0 ||
+            ((struct msg_hdr *)resp)->flag == FASTPATH_MSG_FAILED) {
+            fastpath_log_error("mgmt_revert: %s cmd %d failed\n", undo->path, undo->cmd);
+        }
+    }
+}
+
+/* 0 or -errno, with the operations in effect and the first failed one */
+static int
+mgmt_apply(uint8_t *msg, uint32_t len, uint32_t count, int atomic,
+    uint32_t *applied, uint32_t *failed)
+{
+    char resp[MGMT_RESP_SIZE];
+    struct msg_hdr *req, *undo;
+    struct module *module;
+    uint32_t i, off;
+    int ret, status = 0;
+
+    *applied = 0;
+    *failed = 0;
+
+    /* the whole batch is checked first, nothing applied when it is bad */
+    for (i = 0, off = sizeof(struct mgmt_hdr); i < count; i++) {
+        req = mgmt_tlv_msg(msg, len, &off);
+        if (req == NULL) {
+            *failed = i;
+            return -EINVAL;
+        }
+
+        module = module_get_by_name(req->path);
+        if (module == NULL || module->message == NULL) {
+            *failed = i;
+            return -ENOENT;
+        }
+
+        if (atomic && module->undo == NULL) {
+            *failed = i;
+            return -ENOTSUP;
+        }
+
+        if (module->check != NULL) {
+            ret = module->check(module, req);
+            if (ret < 0) {
+                *failed = i;
+                return ret;
+            }
+        }
+    }
+
+    if (off != len) {
+        *failed = count;
+        return -EINVAL;
+    }
+
+    if (atomic && mgmt_undo_reserve(count) < 0) {
+        return -ENOMEM;
+    }
+
+    for (i = 0, off = sizeof(struct mgmt_hdr); i < count; i++) {
+        req = mgmt_tlv_msg(msg, len, &off);
+        module = module_get_by_name(req->path);
+
+        if (atomic) {
+            undo = (struct msg_hdr *)(mgmt_undo + (size_t)i * MGMT_UNDO_SIZE);
+            ret = module->undo(module, req, undo);
+            if (ret < 0) {
+                goto failed;
+            }
+        }
+
+        memset(resp, 0, sizeof(struct msg_hdr));
+        strncpy(((struct msg_hdr *)resp)->path, req->path, sizeof(req->path));
+        ret = module->message(module, req, (struct msg_hdr *)resp);
+        if (ret == 0 && ((struct msg_hdr *)resp)->flag == FASTPATH_MSG_FAILED) {
+            ret = -EIO;
+        }
+
+        if (ret == 0) {
+            (*applied)++;
+            continue;
+        }
+
+failed:
+        if (status == 0) {
+            status = ret < 0 ? ret : -EIO;
+            *failed = i;
+        }
+
+        if (atomic) {
+            mgmt_revert(i);
+            *applied = 0;
+            break;
+        }
+    }
+
+    return status;
+}
+
+static void
+mgmt_batch(struct mgmt_conn *conn, struct mgmt_hdr *hdr)
+{
+    struct mgmt_ack *ack = &conn->acks[conn->n_acks++];
+    uint32_t len = ntohl(hdr->len);
+    uint32_t applied = 0, failed = 0;
+    int status;
+
+    if (ntohs(hdr->type) != MGMT_MSG_BATCH) {
+        status = -EINVAL;
+    } else {
+        status = mgmt_apply((uint8_t *)hdr, len, ntohl(hdr->count),
+            (ntohs(hdr->flags) & MGMT_F_ATOMIC) != 0, &applied, &failed);
+    }
+
+    if (status != 0) {
+        fastpath_log_info("mgmt: batch %u failed at %u: %d\n", ntohl(hdr->seq), failed, status);
+    }
+
+    memset(ack, 0, sizeof(struct mgmt_ack));
+    ack->hdr.len = htonl(sizeof(struct mgmt_ack));
+    ack->hdr.seq = hdr->seq;
+    ack->hdr.type = htons(MGMT_MSG_ACK);
+    ack->status = htonl((uint32_t)status);
+    ack->applied = htonl(applied);
+    ack->failed = htonl(failed);
+}
+
+static void
+mgmt_conn_close(struct mgmt_conn *conn)
+{
+    uint32_t i;
+
+    THREAD_OFF(conn->t_read);
+    THREAD_OFF(conn->t_write);
+    close(conn->fd);
+
+    for (i = 0; i < MGMT_MAX_CONNS; i++) {
+        if (mgmt_conns[i] == conn) {
+            mgmt_conns[i] = NULL;
+        }
+    }
+
+    rte_free(conn->buf);
+    rte_free(conn);
+}
+
+/* Apply the whole messages read, as long as their acks can be queued */
+static int
+mgmt_conn_process(struct mgmt_conn *conn)
+{
+    struct mgmt_hdr *hdr;
+    uint32_t len, off = 0;
+
+    while (conn->len - off >= sizeof(struct mgmt_hdr) && conn->n_acks < MGMT_ACKS) {
+        hdr = (struct mgmt_hdr *)(conn->buf + off);
+        len = ntohl(hdr->len);
+        if (len < sizeof(struct mgmt_hdr) || len > MGMT_MAX_MSG) {
+            fastpath_log_error("mgmt: invalid message length %u\n", len);
+            return -EINVAL;
+        }
+
+        if (len > conn->size) {
+            uint8_t *buf;
+
+            /* keep what is read, the message may start it */
+            memmove(conn->buf, conn->buf + off, conn->len - off);
+            conn->len -= off;
+            off = 0;
+
+            buf = rte_realloc(conn->buf, len, 0);
+            if (buf == NULL) {
+                return -ENOMEM;
+            }
+            conn->buf = buf;
+            conn->size = len;
+            break;
+        }
+
+        if (conn->len - off < len) {
+            break;
+        }
+
+        mgmt_batch(conn, hdr);
+        off += len;
+    }
+
+    memmove(conn->buf, conn->buf + off, conn->len - off);
+    conn->len -= off;
+
+    return 0;
+}
+
+/* Write while acks wait, read while they may be queued */
+static void
+mgmt_conn_arm(struct mgmt_conn *conn)
+{
+    if (conn->n_acks > 0 && conn->t_write == NULL) {
+        conn->t_write = thread_add_write(mgr_master, mgmt_conn_write, conn, conn->fd);
+    }
+
+    if (conn->n_acks < MGMT_ACKS && conn->t_read == NULL) {
+        conn->t_read = thread_add_read(mgr_master, mgmt_conn_read, conn, conn->fd);
+    }
+}
+
+static int
+mgmt_conn_read(struct thread *thread)
+{
+    struct mgmt_conn *conn = THREAD_ARG(thread);
+    ssize_t n;
+
+    conn->t_read = NULL;
+
+    n = recv(conn->fd, conn->buf + conn->len, conn->size - conn->len, 0);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+        mgmt_conn_close(conn);
+        return 0;
+    }
+
+    if (n > 0) {
+        conn->len += n;
+        if (mgmt_conn_process(conn) < 0) {
+            mgmt_conn_close(conn);
+            return 0;
+        }
+    }
+
+    mgmt_conn_arm(conn);
+
+    return 0;
+}
+
+static int
+mgmt_conn_write(struct thread *thread)
+{
+    struct mgmt_conn *conn = THREAD_ARG(thread);
+    uint32_t total = conn->n_acks * sizeof(struct mgmt_ack);
+    ssize_t n;
+
+    conn->t_write = NULL;
+
+    n = send(conn->fd, (uint8_t *)conn->acks + conn->ack_off, total - conn->ack_off,
+        MSG_NOSIGNAL);
+    if (n < 0 && errno != EAGAIN && errno != EINTR) {
+        mgmt_conn_close(conn);
+        return 0;
+    }
+
+    if (n > 0) {
+        conn->ack_off += n;
+        if (conn->ack_off == total) {
+            conn->n_acks = 0;
+            conn->ack_off = 0;
+
+            /* what waited for room for its ack */
+            if (mgmt_conn_process(conn) < 0) {
+                mgmt_conn_close(conn);
+                return 0;
+            }
+        }
+    }
+
+    mgmt_conn_arm(conn);
+
+    return 0;
+}
+
+static int
+mgmt_accept(struct thread *thread)
+{
+    struct mgmt_conn *conn;
+    uint32_t i;
+    int fd;
+
+    thread_add_read(mgr_master, mgmt_accept, NULL, THREAD_FD(thread));
+
+    fd = accept(THREAD_FD(thread), NULL, NULL);
+    if (fd < 0) {
+        return 0;
+    }
+
+    for (i = 0; i < MGMT_MAX_CONNS && mgmt_conns[i] != NULL; i++) {
+    }
+
+    conn = rte_zmalloc(NULL, sizeof(struct mgmt_conn), 0);
+    if (i == MGMT_MAX_CONNS || conn == NULL ||
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) < 0 ||
+        (conn->buf = rte_malloc(NULL, MGMT_BUF_SIZE, 0)) == NULL) {
+        fastpath_log_error("mgmt_accept: connection refused\n");
+        rte_free(conn);
+        close(fd);
+        return 0;
+    }
+
+    conn->fd = fd;
+    conn->size = MGMT_BUF_SIZE;
+    mgmt_conns[i] = conn;
+
+    mgmt_conn_arm(conn);
+
+    return 0;
+}
+
+int mgmt_thread_add(void)
+{
+    struct sockaddr_un addr;
+    struct thread *thread;
+
+    mgmt_sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (mgmt_sockfd < 0) {
+        fastpath_log_error("mgmt_thread_add: create socket failed\n");
+        return -EIO;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", MGMT_SOCKET_PATH);
+    unlink(addr.sun_path);
+
+    if (bind(mgmt_sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(mgmt_sockfd, MGMT_MAX_CONNS) < 0 ||
+        fcntl(mgmt_sockfd, F_SETFL, fcntl(mgmt_sockfd, F_GETFL, 0) | O_NONBLOCK) < 0) {
+        fastpath_log_error("mgmt_thread_add: listen on %s failed\n", MGMT_SOCKET_PATH);
+        close(mgmt_sockfd);
+        return -EIO;
+    }
+
+    thread = thread_add_read(mgr_master, mgmt_accept, NULL, mgmt_sockfd);
+    if (thread == NULL) {
+        fastpath_log_error("mgmt_thread_add: add thread error\n");
+        return -EPERM;
+    }
+
+    return 0;
+}
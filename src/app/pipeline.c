@@ -0,0 +1,305 @@
+
+#include "include/fastpath.h"
+
+/*
+ * A pipeline stage moves everything a module does on receive, and all
+ * the modules it feeds, to a dedicated lcore. The module receive hook
+ * is replaced once the stack is connected; packets reaching it from
+ * other lcores are buffered per producer lcore and handed over in bursts
+ * through one SP/SC ring per producer.
+ */
+struct pipeline_stage {
+    char name[NAME_SIZE];
+    uint32_t lcore;
+
+    /* resolved when the stack is connected */
+    struct module *module;
+    void (*receive)(struct rte_mbuf *m, struct module *peer, struct module *local);
+
+    /* one ring and output buffer per producer lcore */
+    struct rte_ring *rings[FASTPATH_MAX_LCORES];
+    struct mbuf_array *mbuf_out[FASTPATH_MAX_LCORES];
+    uint32_t producers[FASTPATH_MAX_LCORES];
+    uint32_t n_producers;
+
+    /* stats */
+    uint64_t drops[FASTPATH_MAX_LCORES];
+    uint64_t pkts;
+} __rte_cache_aligned;
+
+static struct pipeline_stage pipeline_stages[FASTPATH_MAX_STAGES];
+static uint32_t n_pipeline_stages;
+
+static inline struct pipeline_stage *
+pipeline_stage_get(struct module *module)
+{
+    uint32_t i;
+
+    for (i = 0; i < n_pipeline_stages; i++) {
+        if (pipeline_stages[i].module == module) {
+            return &pipeline_stages[i];
+        }
+    }
+
+    return NULL;
+}
+
+static int
+pipeline_lcore_is_producer(uint32_t lcore)
+{
+    enum fastpath_lcore_type type = fastpath.lcore_params[lcore].type;
+
+    return (type == e_FASTPATH_LCORE_WORKER ||
+            type == e_FASTPATH_LCORE_RX_WORKER ||
+            type == e_FASTPATH_LCORE_STAGE);
+}
+
+int pipeline_stage_add(const char *name, uint32_t lcore)
+{
+    struct pipeline_stage *stage;
+
+    if (n_pipeline_stages >= FASTPATH_MAX_STAGES) {
+        fastpath_log_error("pipeline_stage_add: too many stages, max %d\n",
+            FASTPATH_MAX_STAGES);
+        return -ENOSPC;
+    }
+
+    if (lcore >= FASTPATH_MAX_LCORES || !rte_lcore_is_enabled(lcore) ||
+        lcore == rte_get_master_lcore()) {
+        fastpath_log_error("pipeline_stage_add: lcore %u not available for %s\n",
+            lcore, name);
+        return -EINVAL;
+    }
+
+    if (fastpath.lcore_params[lcore].type != e_FASTPATH_LCORE_DISABLED &&
+        fastpath.lcore_params[lcore].type != e_FASTPATH_LCORE_STAGE) {
+        fastpath_log_error("pipeline_stage_add: lcore %u already used, stage %s\n",
+            lcore, name);
+        return -EBUSY;
+    }
+
+    stage = &pipeline_stages[n_pipeline_stages];
+    memset(stage, 0, sizeof(struct pipeline_stage));
+    snprintf(stage->name, sizeof(stage->name), "%s", name);
+    stage->lcore = lcore;
+
+    fastpath.lcore_params[lcore].type = e_FASTPATH_LCORE_STAGE;
+    n_pipeline_stages++;
+
+    return 0;
+}
+
+uint32_t pipeline_get_stages(void)
+{
+    return n_pipeline_stages;
+}
+
+void pipeline_init_rings(void)
+{
+    uint32_t i, lcore;
+
+    for (i = 0; i < n_pipeline_stages; i++) {
+        struct pipeline_stage *stage = &pipeline_stages[i];
+        unsigned socket = rte_lcore_to_socket_id(stage->lcore);
+
+        for (lcore = 0; lcore < FASTPATH_MAX_LCORES; lcore++) {
+            char name[32];
+
+            if (lcore == stage->lcore || !pipeline_lcore_is_producer(lcore)) {
+                continue;
+            }
+
+            printf("Creating ring to connect lcore %u with stage %s lcore %u ...\n",
+                lcore,
+                stage->name,
+                stage->lcore);
+            snprintf(name, sizeof(name), "fastpath_stage%u_l%u", i, lcore);
+            stage->rings[lcore] = rte_ring_create(
+                name,
+                fastpath.ring_size,
+                socket,
+                RING_F_SP_ENQ | RING_F_SC_DEQ);
+            if (stage->rings[lcore] == NULL) {
+                rte_panic("Cannot create ring to connect lcore %u with stage %s\n",
+                    lcore,
+                    stage->name);
+            }
+
+            stage->mbuf_out[lcore] = rte_zmalloc_socket(NULL,
+                sizeof(struct mbuf_array), RTE_CACHE_LINE_SIZE,
+                rte_lcore_to_socket_id(lcore));
+            if (stage->mbuf_out[lcore] == NULL) {
+                rte_panic("Cannot allocate stage %s buffer for lcore %u\n",
+                    stage->name,
+                    lcore);
+            }
+
+            stage->producers[stage->n_producers++] = lcore;
+        }
+    }
+}
+
+void pipeline_bind_stages(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < n_pipeline_stages; i++) {
+        struct pipeline_stage *stage = &pipeline_stages[i];
+        struct module *module;
+
+        module = module_get_by_name(stage->name);
+        if (module == NULL || module->receive == NULL) {
+            fastpath_log_error("pipeline_bind_stages: module %s not found, stage ignored\n",
+                stage->name);
+            continue;
+        }
+
+        stage->receive = module->receive;
+        stage->module = module;
+        rte_wmb();
+        module->receive = pipeline_stage_receive;
+
+        fastpath_log_info("pipeline stage %s bound to lcore %u\n",
+            stage->name, stage->lcore);
+    }
+}
+
+static void
+pipeline_stage_send(struct pipeline_stage *stage, uint32_t lcore)
+{
+    struct mbuf_array *mbuf_out = stage->mbuf_out[lcore];
+    uint32_t n_sent = 0, retry;
+
+    /* Backpressure: give the stage lcore a chance to drain before dropping */
+    for (retry = 0; retry < FASTPATH_STAGE_ENQUEUE_RETRY; retry++) {
+        n_sent += rte_ring_sp_enqueue_burst(
+            stage->rings[lcore],
+            (void **) &mbuf_out->array[n_sent],
+            mbuf_out->n_mbufs - n_sent);
+        if (likely(n_sent == mbuf_out->n_mbufs)) {
+            break;
+        }
+
+        rte_pause();
+    }
+
+    if (unlikely(n_sent < mbuf_out->n_mbufs)) {
+        uint32_t k;
+        for (k = n_sent; k < mbuf_out->n_mbufs; k ++) {
+            rte_pktmbuf_free(mbuf_out->array[k]);
+        }
+
+        stage->drops[lcore] += mbuf_out->n_mbufs - n_sent;
+    }
+
+    mbuf_out->n_mbufs = 0;
+}
+
+void pipeline_stage_receive(struct rte_mbuf *m, struct module *peer, struct module *local)
+{
+    uint32_t lcore = rte_lcore_id();
+    struct pipeline_stage *stage;
+    struct mbuf_array *mbuf_out;
+
+    stage = pipeline_stage_get(local);
+    if (unlikely(stage == NULL)) {
+        fastpath_log_error("pipeline_stage_receive: no stage for %s\n", local->name);
+        rte_pktmbuf_free(m);
+        return;
+    }
+
+    if (lcore == stage->lcore) {
+        stage->receive(m, peer, local);
+        return;
+    }
+
+    mbuf_out = stage->mbuf_out[lcore];
+    if (unlikely(mbuf_out == NULL)) {
+        rte_pktmbuf_free(m);
+        return;
+    }
+
+    m->userdata = peer;
+    mbuf_out->array[mbuf_out->n_mbufs++] = m;
+    if (mbuf_out->n_mbufs >= FASTPATH_DEFAULT_BURST_SIZE_STAGE) {
+        pipeline_stage_send(stage, lcore);
+    }
+}
+
+void pipeline_flush(uint32_t lcore)
+{
+    uint32_t i;
+
+    for (i = 0; i < n_pipeline_stages; i++) {
+        struct pipeline_stage *stage = &pipeline_stages[i];
+
+        if (stage->mbuf_out[lcore] == NULL || stage->mbuf_out[lcore]->n_mbufs == 0) {
+            continue;
+        }
+
+        pipeline_stage_send(stage, lcore);
+    }
+}
+
+uint32_t pipeline_stage_poll(uint32_t lcore)
+{
+    struct rte_mbuf *pkts[FASTPATH_DEFAULT_BURST_SIZE_STAGE];
+    uint32_t i, j, k, n_pkts = 0;
+
+    for (i = 0; i < n_pipeline_stages; i++) {
+        struct pipeline_stage *stage = &pipeline_stages[i];
+
+        if (stage->lcore != lcore || stage->module == NULL) {
+            continue;
+        }
+
+        for (j = 0; j < stage->n_producers; j++) {
+            uint32_t n_mbufs;
+
+            n_mbufs = rte_ring_sc_dequeue_burst(
+                stage->rings[stage->producers[j]],
+                (void **) pkts,
+                FASTPATH_DEFAULT_BURST_SIZE_STAGE);
+            if (n_mbufs == 0) {
+                continue;
+            }
+
+            for (k = 0; k < n_mbufs; k++) {
+                if (k + 1 < n_mbufs) {
+                    rte_prefetch0(rte_pktmbuf_mtod(pkts[k + 1], void *));
+                }
+
+                stage->receive(pkts[k], (struct module *) pkts[k]->userdata, stage->module);
+            }
+
+            stage->pkts += n_mbufs;
+            n_pkts += n_mbufs;
+        }
+    }
+
+    return n_pkts;
+}
+
+void pipeline_print_stats(uint32_t lcore)
+{
+    uint32_t i, j;
+
+    for (i = 0; i < n_pipeline_stages; i++) {
+        struct pipeline_stage *stage = &pipeline_stages[i];
+        uint64_t drops = 0;
+
+        if (stage->lcore != lcore) {
+            continue;
+        }
+
+        for (j = 0; j < stage->n_producers; j++) {
+            drops += stage->drops[stage->producers[j]];
+        }
+
+        printf("Stage %s lcore %u: pkts = %"PRIu64" drops = %"PRIu64"\n",
+            stage->name,
+            lcore,
+            stage->pkts,
+            drops);
+    }
+}
@@ -38,8 +38,8 @@ struct nh6_table {
 } __rte_cache_aligned;
 
 struct route_private {
-    struct ether_addr eth_addr[ROUTE_MAX_LINK];
-    struct module *link[ROUTE_MAX_LINK];
+    struct ether_addr *eth_addr;    /* ROUTE_MAX_LINK, by ifidx */
+    struct module **link;
     struct rte_lpm *lpm_tbl;
     struct rte_lpm6 *lpm6_tbl;
     struct nh_table *nh_tbl;
@@ -183,7 +183,7 @@ int nh_add(struct module *route, struct lpm_key *key, struct nh_entry *nh)
 
     if (nht_find_existing(private->nh_tbl, nh, &nht_pos) == 0) {
         if (nht_find_free(private->nh_tbl, &nht_pos) == 0) {
-            fastpath_log_error("nh_add: NHT full\n");
+            fastpath_log_error("nh_add: NHT full, %u next hops\n", FASTPATH_LPM_MAX_NEXT_HOPS);
             return -1;
         }
 
@@ -194,9 +194,11 @@ int nh_add(struct module *route, struct lpm_key *key, struct nh_entry *nh)
         HIPQUAD(key->ip), key->depth, HIPQUAD(nh->nh_ip), nh->nh_iface, nht_pos);
     
     /* Add rule to low level LPM table */
-    if (rte_lpm_add(private->lpm_tbl, key->ip, key->depth, (uint8_t)nht_pos) < 0) {
-        fastpath_log_error("nh_add: LPM rule add failed\n");
-        return -1;
+    status = rte_lpm_add(private->lpm_tbl, key->ip, key->depth, (uint8_t)nht_pos);
+    if (status < 0) {
+        fastpath_log_error("nh_add: LPM rule add failed (%d), %u rules\n",
+            status, FASTPATH_MAX_LPM_RULES);
+        return status;
     }
 
     /* Commit NHT changes */
@@ -260,17 +262,19 @@ int nh6_add(struct module *route, struct lpm6_key *key, struct nh6_entry *nh)
 
     if (nht6_find_existing(private->nh6_tbl, nh, &nht_pos) == 0) {
         if (nht6_find_free(private->nh6_tbl, &nht_pos) == 0) {
-            fastpath_log_error("nh6_add: NHT full\n");
+            fastpath_log_error("nh6_add: NHT full, %u next hops\n", FASTPATH_LPM_MAX_NEXT_HOPS);
             return -1;
         }
 
-        memcpy(&private->nh6_tbl[nht_pos], nh, sizeof(struct nh6_entry));
+        memcpy(&private->nh6_tbl->nht[nht_pos], nh, sizeof(struct nh6_entry));
     }
 
     /* Add rule to low level LPM table */
-    if (rte_lpm6_add(private->lpm6_tbl, key->ip, key->depth, (uint8_t)nht_pos) < 0) {
-        fastpath_log_error("nh6_add: LPM6 rule add failed\n");
-        return -1;
+    status = rte_lpm6_add(private->lpm6_tbl, key->ip, key->depth, (uint8_t)nht_pos);
+    if (status < 0) {
+        fastpath_log_error("nh6_add: LPM6 rule add failed (%d), %u rules %u tbl8s\n",
+            status, FASTPATH_MAX_LPM6_RULES, FASTPATH_LPM6_NUMBER_TBL8S);
+        return status;
     }
 
     /* Commit NHT changes */
@@ -312,6 +316,26 @@ int nh6_del(struct module *route, struct lpm6_key *key)
     return 0;
 }
 
+/*
+ * Decrement the TTL and patch the header checksum in place (RFC 1624,
+ * eqn. 3): only the TTL/protocol word changes, by -0x0100.
+ */
+static inline void
+route_ipv4_dec_ttl(struct rte_mbuf *m, struct ipv4_hdr *ipv4_hdr)
+{
+    uint32_t sum;
+
+    ipv4_hdr->time_to_live--;
+
+    /* the checksum is computed in full on TX anyway */
+    if (m->ol_flags & PKT_TX_IP_CKSUM)
+        return;
+
+    sum = (~rte_be_to_cpu_16(ipv4_hdr->hdr_checksum) & 0xffff) + 0xfeff;
+    sum = (sum & 0xffff) + (sum >> 16);
+    ipv4_hdr->hdr_checksum = rte_cpu_to_be_16((uint16_t)~sum);
+}
+
 void route_receive(struct rte_mbuf *m, struct module *peer, struct module *route)
 {
     uint8_t next_hop;
@@ -364,17 +388,26 @@ void route_receive(struct rte_mbuf *m, struct module *peer, struct module *route
         switch (neigh->type) {
         case NEIGH_TYPE_LOCAL:
             fastpath_log_debug("local pkt, send to kni %d\n", m->port);
-            rte_pktmbuf_prepend(m, c->network_header - c->mac_header);
+            rte_pktmbuf_prepend(m, c->l3_off - c->l2_off);
             kni_ingress(m);
             break;
 
         case NEIGH_TYPE_REACHABLE:
-            c->mac_header = rte_pktmbuf_mtod(m, uint8_t *) - sizeof(struct ether_hdr);
-            eth_hdr = (struct ether_hdr *)c->mac_header;
+            if (unlikely(ipv4_hdr->time_to_live <= 1)) {
+                fastpath_log_debug("ttl exceeded, send to kni %d\n", m->port);
+                rte_pktmbuf_prepend(m, c->l3_off - c->l2_off);
+                kni_ingress(m);
+                break;
+            }
+            route_ipv4_dec_ttl(m, ipv4_hdr);
+
+            c->l2_off = m->data_off - sizeof(struct ether_hdr);
+            eth_hdr = (struct ether_hdr *)FASTPATH_PKT_HDR(m, c->l2_off);
             rte_memcpy(&eth_hdr->s_addr, &private->eth_addr[nh->nh_iface], sizeof(struct ether_addr));
-            rte_memcpy(&eth_hdr->d_addr, &neigh->nh_arp, sizeof(struct ether_hdr));
+            rte_memcpy(&eth_hdr->d_addr, &neigh->nh_arp, sizeof(struct ether_addr));
             eth_hdr->ether_type = rte_cpu_to_be_16(ETHER_TYPE_IPv4);
-            SEND_PKT(m, route, private->link[nh->nh_iface], PKT_DIR_XMIT);
+            SEND_PKT_DIRECT(m, route, private->link[nh->nh_iface], PKT_DIR_XMIT,
+                MODULE_TYPE_INTERFACE, interface_xmit);
             break;
 
         default:
@@ -415,9 +448,13 @@ void route_receive(struct rte_mbuf *m, struct module *peer, struct module *route
             break;
 
         case NEIGH_TYPE_REACHABLE:
-            c->mac_header = rte_pktmbuf_mtod(m, uint8_t *) - sizeof(struct ether_hdr);
-            rte_memcpy(c->mac_header, &neigh->nh_arp, sizeof(struct ether_hdr));
-            SEND_PKT(m, route, private->link[nh6->nh_iface], PKT_DIR_XMIT);
+            c->l2_off = m->data_off - sizeof(struct ether_hdr);
+            eth_hdr = (struct ether_hdr *)FASTPATH_PKT_HDR(m, c->l2_off);
+            rte_memcpy(&eth_hdr->s_addr, &private->eth_addr[nh6->nh_iface], sizeof(struct ether_addr));
+            rte_memcpy(&eth_hdr->d_addr, &neigh->nh_arp, sizeof(struct ether_addr));
+            eth_hdr->ether_type = rte_cpu_to_be_16(ETHER_TYPE_IPv6);
+            SEND_PKT_DIRECT(m, route, private->link[nh6->nh_iface], PKT_DIR_XMIT,
+                MODULE_TYPE_INTERFACE, interface_xmit);
             break;
 
         default:
@@ -437,6 +474,62 @@ void route_xmit(struct rte_mbuf *m, struct module *peer, struct module *route)
     rte_pktmbuf_free(m);
 }
 
+/*
+ * 0 when req holds the whole request of its command and its interface
+ * indexes the links, checked before it is applied or undone.
+ */
+int route_check_msg(struct module *route, struct msg_hdr *req)
+{
+    uint32_t len, nh_iface = 0;
+
+    RTE_SET_USED(route);
+
+    switch (req->cmd) {
+    case ROUTE_MSG_ADD_NEIGH:
+        len = sizeof(struct arp_add);
+        break;
+    case ROUTE_MSG_DEL_NEIGH:
+        len = sizeof(struct arp_del);
+        break;
+    case ROUTE_MSG_ADD_NH:
+        len = sizeof(struct route_add);
+        break;
+    case ROUTE_MSG_DEL_NH:
+        len = sizeof(struct route_del);
+        break;
+    case ROUTE_MSG_ADD_NH6:
+        len = sizeof(struct route6_add);
+        break;
+    case ROUTE_MSG_DEL_NH6:
+        len = sizeof(struct route6_del);
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    if (req->len < len) {
+        fastpath_log_error("route_check_msg: cmd %d len %u, %u needed\n",
+            req->cmd, req->len, len);
+        return -EINVAL;
+    }
+
+    if (req->cmd == ROUTE_MSG_ADD_NEIGH || req->cmd == ROUTE_MSG_DEL_NEIGH) {
+        nh_iface = rte_be_to_cpu_32(((struct arp_del *)req->data)->nh_iface);
+    } else if (req->cmd == ROUTE_MSG_ADD_NH) {
+        nh_iface = rte_be_to_cpu_32(((struct route_add *)req->data)->nh_iface);
+    } else if (req->cmd == ROUTE_MSG_ADD_NH6) {
+        nh_iface = rte_be_to_cpu_32(((struct route6_add *)req->data)->nh_iface);
+    }
+
+    if (nh_iface >= ROUTE_MAX_LINK) {
+        fastpath_log_error("route_check_msg: cmd %d invalid iface %u\n",
+            req->cmd, nh_iface);
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
 int route_handle_msg(struct module *route, 
     struct msg_hdr *req, struct msg_hdr *resp)
 {
@@ -446,6 +539,12 @@ int route_handle_msg(struct module *route,
     resp->cmd = req->cmd;
 
     fastpath_log_debug("route_handle_msg: cmd %d\n", req->cmd);
+
+    ret = route_check_msg(route, req);
+    if (ret < 0) {
+        resp->flag = FASTPATH_MSG_FAILED;
+        return ret;
+    }
     
     switch (req->cmd) {
     case ROUTE_MSG_ADD_NEIGH:
@@ -473,6 +572,11 @@ int route_handle_msg(struct module *route,
             if (neigh.type == NEIGH_TYPE_LOCAL) {
                 rte_memcpy(&private->eth_addr[nh.nh_iface], &neigh.nh_arp, sizeof(struct ether_addr));
             }
+
+            if (req->len >= sizeof(struct arp_add) + sizeof(struct ether_addr)) {
+                rte_memcpy(&private->eth_addr[nh.nh_iface], req->data + sizeof(struct arp_add),
+                    sizeof(struct ether_addr));
+            }
         }
         break;
     case ROUTE_MSG_DEL_NEIGH:
@@ -490,6 +594,11 @@ int route_handle_msg(struct module *route,
                 fastpath_log_error("neigh_del failed\n");
                 resp->flag = FASTPATH_MSG_FAILED;
             }
+
+            if (req->len >= sizeof(struct arp_del) + sizeof(struct ether_addr)) {
+                rte_memcpy(&private->eth_addr[nh.nh_iface], req->data + sizeof(struct arp_del),
+                    sizeof(struct ether_addr));
+            }
         }
         break;
     case ROUTE_MSG_ADD_NH:
@@ -541,7 +650,7 @@ int route_handle_msg(struct module *route,
             memcpy(&key.ip, rt->ip, sizeof(rt->ip));
             key.depth = rt->depth;
             memcpy(&entry.nh_ip, rt->nh_ip, sizeof(rt->nh_ip));
-            entry.nh_iface = rt->nh_iface;
+            entry.nh_iface = rte_be_to_cpu_32(rt->nh_iface);
             
             ret = nh6_add(route, &key, &entry);
         }
@@ -565,6 +674,121 @@ int route_handle_msg(struct module *route,
     return ret;
 }
 
+/*
+ * The request putting back what req is about to change, for all or
+ * nothing management batches; an empty undo path when req changes
+ * nothing. The delete requests are a prefix of the add ones.
+ */
+int route_undo_msg(struct module *route,
+    struct msg_hdr *req, struct msg_hdr *undo)
+{
+    int pos;
+    uint8_t nht_pos;
+    struct route_private *private = (struct route_private *)route->private;
+
+    memset(undo, 0, sizeof(struct msg_hdr));
+
+    switch (req->cmd) {
+    case ROUTE_MSG_ADD_NEIGH:
+    case ROUTE_MSG_DEL_NEIGH:
+        {
+            struct arp_del *del = (struct arp_del *)req->data;
+            struct nh_entry nh = {
+                .nh_ip = rte_be_to_cpu_32(del->nh_ip),
+                .nh_iface = rte_be_to_cpu_32(del->nh_iface),
+            };
+
+            pos = rte_hash_lookup(private->neigh_hash_tbl, (void *)&nh);
+            if (pos >= 0) {
+                struct arp_add *add = (struct arp_add *)undo->data;
+
+                undo->cmd = ROUTE_MSG_ADD_NEIGH;
+                undo->len = sizeof(struct arp_add);
+                add->nh_ip = del->nh_ip;
+                add->nh_iface = del->nh_iface;
+                add->type = rte_cpu_to_be_16(private->neigh_tbl[pos].type);
+                memcpy(&add->nh_arp, &private->neigh_tbl[pos].nh_arp, sizeof(struct ether_addr));
+            } else if (req->cmd == ROUTE_MSG_ADD_NEIGH) {
+                undo->cmd = ROUTE_MSG_DEL_NEIGH;
+                undo->len = sizeof(struct arp_del);
+                memcpy(undo->data, del, sizeof(struct arp_del));
+            } else {
+                return 0;
+            }
+
+            /* a LOCAL add replaces the interface address, put it back too */
+            if (req->cmd == ROUTE_MSG_ADD_NEIGH &&
+                rte_be_to_cpu_16(((struct arp_add *)req->data)->type) == NEIGH_TYPE_LOCAL) {
+                memcpy(undo->data + undo->len, &private->eth_addr[nh.nh_iface],
+                    sizeof(struct ether_addr));
+                undo->len += sizeof(struct ether_addr);
+            }
+        }
+        break;
+    case ROUTE_MSG_ADD_NH:
+    case ROUTE_MSG_DEL_NH:
+        {
+            struct route_del *del = (struct route_del *)req->data;
+            struct route_add *add = (struct route_add *)undo->data;
+            struct nh_entry *nh = NULL;
+
+            if (del->depth == 0) {
+                nh = private->default_nh;
+            } else if (del->depth <= 32 && rte_lpm_is_rule_present(private->lpm_tbl,
+                    rte_be_to_cpu_32(del->ip), del->depth, &nht_pos) > 0) {
+                nh = &private->nh_tbl->nht[nht_pos];
+            }
+
+            if (nh != NULL) {
+                undo->cmd = ROUTE_MSG_ADD_NH;
+                undo->len = sizeof(struct route_add);
+                add->ip = del->ip;
+                add->depth = del->depth;
+                add->nh_ip = rte_cpu_to_be_32(nh->nh_ip);
+                add->nh_iface = rte_cpu_to_be_32(nh->nh_iface);
+            } else if (req->cmd == ROUTE_MSG_ADD_NH) {
+                undo->cmd = ROUTE_MSG_DEL_NH;
+                undo->len = sizeof(struct route_del);
+                memcpy(undo->data, del, sizeof(struct route_del));
+            } else {
+                return 0;
+            }
+        }
+        break;
+    case ROUTE_MSG_ADD_NH6:
+    case ROUTE_MSG_DEL_NH6:
+        {
+            struct route6_del *del = (struct route6_del *)req->data;
+
+            if (del->depth != 0 && del->depth <= 128 &&
+                rte_lpm6_is_rule_present(private->lpm6_tbl, del->ip, del->depth, &nht_pos) > 0) {
+                struct route6_add *add = (struct route6_add *)undo->data;
+                struct nh6_entry *nh = &private->nh6_tbl->nht[nht_pos];
+
+                undo->cmd = ROUTE_MSG_ADD_NH6;
+                undo->len = sizeof(struct route6_add);
+                memcpy(add->ip, del->ip, sizeof(add->ip));
+                add->depth = del->depth;
+                memcpy(add->nh_ip, nh->nh_ip, sizeof(add->nh_ip));
+                add->nh_iface = rte_cpu_to_be_32(nh->nh_iface);
+            } else if (req->cmd == ROUTE_MSG_ADD_NH6) {
+                undo->cmd = ROUTE_MSG_DEL_NH6;
+                undo->len = sizeof(struct route6_del);
+                memcpy(undo->data, del, sizeof(struct route6_del));
+            } else {
+                return 0;
+            }
+        }
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    snprintf(undo->path, sizeof(undo->path), "%s", route->name);
+
+    return 0;
+}
+
 void neigh_init(struct module *route)
 {
     struct route_private *private = (struct route_private *)route->private;
@@ -709,11 +933,25 @@ struct module * route_init(void)
         return NULL;
     }
 
+    private->eth_addr = rte_zmalloc(NULL, ROUTE_MAX_LINK * sizeof(struct ether_addr), 0);
+    private->link = rte_zmalloc(NULL, ROUTE_MAX_LINK * sizeof(struct module *), 0);
+    if (private->eth_addr == NULL || private->link == NULL) {
+        rte_free(private->eth_addr);
+        rte_free(private->link);
+        rte_free(private);
+        rte_free(route);
+
+        fastpath_log_error("route_init: malloc link table failed\n");
+        return NULL;
+    }
+
     route->type = MODULE_TYPE_ROUTE;
     route->receive = route_receive;
     route->transmit = route_xmit;
     route->connect = route_connect;
     route->message = route_handle_msg;
+    route->undo = route_undo_msg;
+    route->check = route_check_msg;
     snprintf(route->name, sizeof(route->name), "route");
 
     route->private = private;
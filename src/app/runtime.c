@@ -41,10 +41,6 @@
 #define FASTPATH_WORKER_FLUSH               10000
 #endif
 
-#ifndef FASTPATH_STATS
-#define FASTPATH_STATS                      1000000
-#endif
-
 #ifndef FASTPATH_RX_PREFETCH_ENABLE
 #define FASTPATH_RX_PREFETCH_ENABLE         1
 #endif
@@ -71,119 +67,147 @@
 
 #define PREFETCH_OFFSET        3
 
-/* Structure type for recording kni interface specific stats */
-struct kni_interface_stats {
-	/* number of pkts received from NIC, and sent to KNI */
-	uint64_t rx_packets;
+static inline uint32_t
+fastpath_txq_count(struct fastpath_tx_queue *txq)
+{
+    return txq->tail - txq->head;
+}
 
-	/* number of pkts received from NIC, but failed to send to KNI */
-	uint64_t rx_dropped;
+/**
+ * Hand the backlog of a port to the NIC, giving up after FASTPATH_TX_RETRY
+ * attempts so a stalled port cannot hold up the others; whatever is left
+ * is retried on the next poll.
+ */
+static void
+fastpath_txq_drain(struct fastpath_params_worker *lp, uint8_t port)
+{
+    struct fastpath_tx_queue *txq = lp->txq[port];
+    uint32_t retry, pos, n, n_sent;
 
-	/* number of pkts received from KNI, and sent to NIC */
-	uint64_t tx_packets;
+    for (retry = 0; retry < FASTPATH_TX_RETRY; retry ++) {
+        if (fastpath_txq_count(txq) == 0) {
+            break;
+        }
 
-	/* number of pkts received from KNI, but failed to send to NIC */
-	uint64_t tx_dropped;
-};
+        /* contiguous part up to the end of the array */
+        pos = txq->head & (FASTPATH_TX_QUEUE_SIZE - 1);
+        n = RTE_MIN(fastpath_txq_count(txq), FASTPATH_TX_QUEUE_SIZE - pos);
 
-/* kni device statistics array */
-static struct kni_interface_stats kni_stats[FASTPATH_MAX_NIC_PORTS];
+        n_sent = rte_eth_tx_burst(
+            port,
+            lp->tx_queue_id[port],
+            &txq->array[pos],
+            (uint16_t) n);
+        txq->head += n_sent;
 
-#define PKT_BURST_SZ    32
+        if (n_sent < n) {
+            txq->retries ++;
+        }
+    }
 
-extern struct thread_master *mgr_master;
+    if (fastpath_txq_count(txq) == 0) {
+        lp->n_tx_backlog --;
+    }
+}
 
-/**
- * Interface to burst rx and enqueue mbufs into rx_q
- */
-void kni_ingress(struct rte_mbuf *m)
+static void
+fastpath_txq_enqueue(struct fastpath_params_worker *lp, uint8_t port,
+    struct rte_mbuf **pkts, uint32_t n_pkts)
 {
-    unsigned lcore = rte_lcore_id();
-    uint32_t n_mbufs, n_pkts, port_id;
-    struct rte_kni *kni;
-    struct mbuf_array *pkts_burst;
-    rte_spinlock_t *kni_lock;
-
-    port_id = m->port;
+    struct fastpath_tx_queue *txq = lp->txq[port];
+    uint32_t i, count, n_free;
 
-    if (port_id >= FASTPATH_MAX_NIC_PORTS) {
-        fastpath_log_error("kni_egress: invalid port %d\n", port_id);
-        rte_pktmbuf_free(m);
-        return;
+    count = fastpath_txq_count(txq);
+    if (count == 0) {
+        lp->n_tx_backlog ++;
     }
 
-    kni = fastpath.kni[port_id];
-    kni_lock = &fastpath.kni_lock[port_id];
-    pkts_burst = &fastpath.kni_mbuf_out[lcore][port_id];
+    n_free = FASTPATH_TX_QUEUE_SIZE - count;
+    if (unlikely(n_pkts > n_free)) {
+        txq->drops += n_pkts - n_free;
 
-    /* Burst tx to kni */
-    n_mbufs = pkts_burst->n_mbufs;
-    pkts_burst->array[n_mbufs] = m;
-    n_mbufs += 1;
-    kni_stats[port_id].rx_packets += 1;
-
-    if (n_mbufs < PKT_BURST_SZ) {
-        pkts_burst->n_mbufs = n_mbufs;
-    } else {
-        rte_spinlock_lock(kni_lock);
-        n_pkts = rte_kni_tx_burst(kni, pkts_burst->array, (uint16_t) n_mbufs);
-        if (unlikely(n_pkts < n_mbufs)) {
-            uint32_t k;
-            fastpath_log_error("kni_ingress: send pkt failed, success %d expected %d",
-                n_pkts, n_mbufs);
-            for (k = n_pkts; k < n_mbufs; k ++) {
-                struct rte_mbuf *pkt_to_free = pkts_burst->array[k];
-                rte_pktmbuf_free(pkt_to_free);
+        if (fastpath.tx_drop == e_FASTPATH_TX_DROP_HEAD) {
+            /* the oldest packets make room for the new ones */
+            for (i = 0; i < n_pkts - n_free; i ++) {
+                rte_pktmbuf_free(txq->array[txq->head & (FASTPATH_TX_QUEUE_SIZE - 1)]);
+                txq->head ++;
             }
-
-            kni_stats[port_id].rx_dropped += n_mbufs - n_pkts;
+        } else {
+            for (i = n_free; i < n_pkts; i ++) {
+                rte_pktmbuf_free(pkts[i]);
+            }
+            n_pkts = n_free;
         }
-        rte_spinlock_unlock(kni_lock);
-        
-        pkts_burst->n_mbufs = 0;
-        fastpath.kni_mbuf_out_flush[lcore][port_id] = 0;
     }
 
-    return;
+    for (i = 0; i < n_pkts; i ++) {
+        txq->array[txq->tail & (FASTPATH_TX_QUEUE_SIZE - 1)] = pkts[i];
+        txq->tail ++;
+    }
+
+    txq->enqueued += n_pkts;
+    if (fastpath_txq_count(txq) > txq->max_occupancy) {
+        txq->max_occupancy = fastpath_txq_count(txq);
+    }
 }
 
 /**
- * Interface to dequeue mbufs from tx_q and burst tx
+ * Send the output buffer of a port. A backlog goes out first so that
+ * packets leave in order, what the NIC does not take is queued instead
+ * of freed.
  */
-void kni_egress(uint32_t port_id)
+void fastpath_tx_send(struct fastpath_params_worker *lp, uint8_t port)
 {
-    uint8_t i;
-    unsigned nb_tx, num;
-    struct rte_kni *kni;
-    struct rte_mbuf *pkts_burst[PKT_BURST_SZ];
+    struct mbuf_array *mbuf_out = lp->mbuf_out[port];
+    struct fastpath_tx_queue *txq = lp->txq[port];
+    uint32_t n_pkts = 0;
 
-    if (port_id >= FASTPATH_MAX_NIC_PORTS) {
-        fastpath_log_error("kni_egress: invalid port %d\n", port_id);
-        return;
+    if (unlikely(fastpath_txq_count(txq) != 0)) {
+        fastpath_txq_drain(lp, port);
     }
 
-    kni = fastpath.kni[port_id];
+    if (likely(fastpath_txq_count(txq) == 0)) {
+        n_pkts = rte_eth_tx_burst(
+            port,
+            lp->tx_queue_id[port],
+            mbuf_out->array,
+            (uint16_t) mbuf_out->n_mbufs);
+    }
 
-    /* Burst rx from kni */
-    num = rte_kni_rx_burst(kni, pkts_burst, PKT_BURST_SZ);
-    if (unlikely(num > PKT_BURST_SZ)) {
-        fastpath_log_error("Error receiving from KNI\n");
-        return;
+    if (unlikely(n_pkts < mbuf_out->n_mbufs)) {
+        fastpath_txq_enqueue(lp, port, &mbuf_out->array[n_pkts], mbuf_out->n_mbufs - n_pkts);
     }
-    
-    /* Burst tx to eth */
-    nb_tx = rte_eth_tx_burst(port_id, 0, pkts_burst, (uint16_t)num);
-    kni_stats[port_id].tx_packets += nb_tx;
-    if (unlikely(nb_tx < num)) {
-        /* Free mbufs not tx to NIC */
-        for (i = nb_tx; i < num; i++) {
-            rte_pktmbuf_free(pkts_burst[i]);
-        }
 
-        kni_stats[port_id].tx_dropped += num - nb_tx;
+    mbuf_out->n_mbufs = 0;
+
+#if FASTPATH_STATS
+    if (unlikely(++txq->iters == FASTPATH_STATS)) {
+        printf("Worker %u out (NIC port %u): backlog = %u max = %u enq = %"PRIu64" retries = %"PRIu64" drops = %"PRIu64"\n",
+            rte_lcore_id(),
+            (unsigned) port,
+            fastpath_txq_count(txq),
+            txq->max_occupancy,
+            txq->enqueued,
+            txq->retries,
+            txq->drops);
+        txq->iters = 0;
+        txq->max_occupancy = 0;
     }
+#endif
+}
+
+static inline void
+fastpath_tx_drain_backlog(struct fastpath_params_worker *lp)
+{
+    uint32_t port;
+
+    for (port = 0; port < FASTPATH_MAX_NIC_PORTS; port ++) {
+        if (lp->txq[port] == NULL || fastpath_txq_count(lp->txq[port]) == 0) {
+            continue;
+        }
 
-    rte_kni_handle_request(kni);
+        fastpath_txq_drain(lp, port);
+    }
 }
 
 static __inline__ void
@@ -204,59 +228,144 @@ fastpath_process_packet_bulk(struct rte_mbuf ** pkts, int nb_rx)
     /* Handle remaining prefetched packets */
     for (; j < nb_rx; j++)
         ethernet_input(pkts[j]);
+
+    /* Finish the bridged packets, then hand over what was queued for pipeline stages */
+    bridge_flush(rte_lcore_id());
+    pipeline_flush(rte_lcore_id());
+}
+
+/**
+ * Map a frame to its ring class from the 802.1p priority and the
+ * IP DSCP, whichever gives the higher priority.
+ */
+static inline uint32_t
+fastpath_rx_classify(uint8_t *data)
+{
+    uint16_t ether_type;
+    uint32_t offset = sizeof(struct ether_hdr);
+    uint32_t class = fastpath.n_ring_classes - 1;
+    uint32_t dscp;
+
+    ether_type = ((struct ether_hdr *) data)->ether_type;
+    if (ether_type == rte_cpu_to_be_16(ETHER_TYPE_VLAN)) {
+        struct vlan_hdr *vh = (struct vlan_hdr *) (data + offset);
+
+        class = fastpath.pcp_class[rte_be_to_cpu_16(vh->vlan_tci) >> 13];
+        ether_type = vh->eth_proto;
+        offset += sizeof(struct vlan_hdr);
+    }
+
+    if (ether_type == rte_cpu_to_be_16(ETHER_TYPE_IPv4)) {
+        struct ipv4_hdr *iph = (struct ipv4_hdr *) (data + offset);
+
+        dscp = iph->type_of_service >> 2;
+    } else if (ether_type == rte_cpu_to_be_16(ETHER_TYPE_IPv6)) {
+        struct ipv6_hdr *ip6h = (struct ipv6_hdr *) (data + offset);
+
+        dscp = (rte_be_to_cpu_32(ip6h->vtc_flow) >> 22) & 0x3F;
+    } else {
+        return class;
+    }
+
+    return RTE_MIN(class, (uint32_t) fastpath.dscp_class[dscp]);
 }
 
 static inline void
 fastpath_rx_buffer_to_send (
     struct fastpath_params_rx *lp,
+    uint32_t class,
     uint32_t worker,
     struct rte_mbuf *mbuf,
     uint32_t bsz)
 {
+    struct mbuf_array *mbuf_out = lp->mbuf_out[class][worker];
     uint32_t pos;
     int ret;
 
-    pos = lp->mbuf_out[worker].n_mbufs;
-    lp->mbuf_out[worker].array[pos ++] = mbuf;
+    pos = mbuf_out->n_mbufs;
+    mbuf_out->array[pos ++] = mbuf;
     if (likely(pos < bsz)) {
-        lp->mbuf_out[worker].n_mbufs = pos;
+        mbuf_out->n_mbufs = pos;
         return;
     }
 
     ret = rte_ring_sp_enqueue_bulk(
-        lp->rings[worker],
-        (void **) lp->mbuf_out[worker].array,
+        lp->rings[class][worker],
+        (void **) mbuf_out->array,
         bsz);
 
     if (unlikely(ret == -ENOBUFS)) {
         uint32_t k;
         for (k = 0; k < bsz; k ++) {
-            struct rte_mbuf *m = lp->mbuf_out[worker].array[k];
+            struct rte_mbuf *m = mbuf_out->array[k];
             rte_pktmbuf_free(m);
         }
+
+        lp->rings_drops[class][worker] += bsz;
     }
 
-    lp->mbuf_out[worker].n_mbufs = 0;
-    lp->mbuf_out_flush[worker] = 0;
+    mbuf_out->n_mbufs = 0;
+    lp->mbuf_out_flush[class][worker] = 0;
 
 #if FASTPATH_STATS
-    lp->rings_iters[worker] ++;
+    lp->rings_iters[class][worker] ++;
     if (likely(ret == 0)) {
-        lp->rings_count[worker] ++;
+        lp->rings_count[class][worker] ++;
     }
-    if (unlikely(lp->rings_iters[worker] == FASTPATH_STATS)) {
+    if (unlikely(lp->rings_iters[class][worker] == FASTPATH_STATS)) {
         unsigned lcore = rte_lcore_id();
 
-        printf("\tI/O RX %u out (worker %u): enq success rate = %.2f\n",
+        printf("\tI/O RX %u out (worker %u class %u): enq success rate = %.2f drops = %"PRIu64"\n",
             lcore,
             (unsigned)worker,
-            ((double) lp->rings_count[worker]) / ((double) lp->rings_iters[worker]));
-        lp->rings_iters[worker] = 0;
-        lp->rings_count[worker] = 0;
+            (unsigned)class,
+            ((double) lp->rings_count[class][worker]) / ((double) lp->rings_iters[class][worker]),
+            lp->rings_drops[class][worker]);
+        lp->rings_iters[class][worker] = 0;
+        lp->rings_count[class][worker] = 0;
     }
 #endif
 }
 
+static inline void
+fastpath_rx_flush_class(
+    struct fastpath_params_rx *lp,
+    uint32_t class,
+    uint32_t n_workers,
+    int force)
+{
+    uint32_t worker;
+
+    for (worker = 0; worker < n_workers; worker ++) {
+        struct mbuf_array *mbuf_out = lp->mbuf_out[class][worker];
+        int ret;
+
+        if (likely(((force == 0) && (lp->mbuf_out_flush[class][worker] == 0)) ||
+                   (mbuf_out->n_mbufs == 0))) {
+            lp->mbuf_out_flush[class][worker] = 1;
+            continue;
+        }
+
+        ret = rte_ring_sp_enqueue_bulk(
+            lp->rings[class][worker],
+            (void **) mbuf_out->array,
+            mbuf_out->n_mbufs);
+
+        if (unlikely(ret < 0)) {
+            uint32_t k;
+            for (k = 0; k < mbuf_out->n_mbufs; k ++) {
+                struct rte_mbuf *pkt_to_free = mbuf_out->array[k];
+                rte_pktmbuf_free(pkt_to_free);
+            }
+
+            lp->rings_drops[class][worker] += mbuf_out->n_mbufs;
+        }
+
+        mbuf_out->n_mbufs = 0;
+        lp->mbuf_out_flush[class][worker] = 1;
+    }
+}
+
 static inline void
 fastpath_rx(
     struct fastpath_params_rx *lp,
@@ -268,20 +377,17 @@ fastpath_rx(
     struct rte_mbuf *mbuf_1_0, *mbuf_1_1, *mbuf_2_0, *mbuf_2_1;
     uint8_t *data_1_0, *data_1_1 = NULL;
     uint32_t i;
+    int classify = (fastpath.n_ring_classes > 1);
 
     for (i = 0; i < lp->n_nic_queues; i ++) {
         uint8_t port = lp->nic_queues[i].port;
         uint8_t queue = lp->nic_queues[i].queue;
         uint32_t n_mbufs, j;
 
-        if (queue == 0) {
-            kni_egress(port);
-        }
-
         n_mbufs = rte_eth_rx_burst(
             port,
             queue,
-            lp->mbuf_in.array,
+            lp->mbuf_in->array,
             (uint16_t) bsz_rd);
 
         if (unlikely(n_mbufs == 0)) {
@@ -307,15 +413,15 @@ fastpath_rx(
         }
 #endif
 
-        mbuf_1_0 = lp->mbuf_in.array[0];
-        mbuf_1_1 = lp->mbuf_in.array[1];
+        mbuf_1_0 = lp->mbuf_in->array[0];
+        mbuf_1_1 = lp->mbuf_in->array[1];
         data_1_0 = rte_pktmbuf_mtod(mbuf_1_0, uint8_t *);
         if (likely(n_mbufs > 1)) {
             data_1_1 = rte_pktmbuf_mtod(mbuf_1_1, uint8_t *);
         }
 
-        mbuf_2_0 = lp->mbuf_in.array[2];
-        mbuf_2_1 = lp->mbuf_in.array[3];
+        mbuf_2_0 = lp->mbuf_in->array[2];
+        mbuf_2_1 = lp->mbuf_in->array[3];
         FASTPATH_RX_PREFETCH0(mbuf_2_0);
         FASTPATH_RX_PREFETCH0(mbuf_2_1);
 
@@ -323,6 +429,7 @@ fastpath_rx(
             struct rte_mbuf *mbuf_0_0, *mbuf_0_1;
             uint8_t *data_0_0, *data_0_1;
             uint32_t worker_0, worker_1;
+            uint32_t class_0 = 0, class_1 = 0;
 
             mbuf_0_0 = mbuf_1_0;
             mbuf_0_1 = mbuf_1_1;
@@ -336,16 +443,21 @@ fastpath_rx(
             FASTPATH_RX_PREFETCH0(data_1_0);
             FASTPATH_RX_PREFETCH0(data_1_1);
 
-            mbuf_2_0 = lp->mbuf_in.array[j+4];
-            mbuf_2_1 = lp->mbuf_in.array[j+5];
+            mbuf_2_0 = lp->mbuf_in->array[j+4];
+            mbuf_2_1 = lp->mbuf_in->array[j+5];
             FASTPATH_RX_PREFETCH0(mbuf_2_0);
             FASTPATH_RX_PREFETCH0(mbuf_2_1);
 
             worker_0 = data_0_0[pos_lb] & (n_workers - 1);
             worker_1 = data_0_1[pos_lb] & (n_workers - 1);
 
-            fastpath_rx_buffer_to_send(lp, worker_0, mbuf_0_0, bsz_wr);
-            fastpath_rx_buffer_to_send(lp, worker_1, mbuf_0_1, bsz_wr);
+            if (classify) {
+                class_0 = fastpath_rx_classify(data_0_0);
+                class_1 = fastpath_rx_classify(data_0_1);
+            }
+
+            fastpath_rx_buffer_to_send(lp, class_0, worker_0, mbuf_0_0, bsz_wr);
+            fastpath_rx_buffer_to_send(lp, class_1, worker_1, mbuf_0_1, bsz_wr);
         }
 
         /* Handle the last 1, 2 (when n_mbufs is even) or 3 (when n_mbufs is odd) packets  */
@@ -353,6 +465,7 @@ fastpath_rx(
             struct rte_mbuf *mbuf;
             uint8_t *data;
             uint32_t worker;
+            uint32_t class = 0;
 
             mbuf = mbuf_1_0;
             mbuf_1_0 = mbuf_1_1;
@@ -365,43 +478,76 @@ fastpath_rx(
 
             worker = data[pos_lb] & (n_workers - 1);
 
-            fastpath_rx_buffer_to_send(lp, worker, mbuf, bsz_wr);
+            if (classify) {
+                class = fastpath_rx_classify(data);
+            }
+
+            fastpath_rx_buffer_to_send(lp, class, worker, mbuf, bsz_wr);
         }
 
-        
+        /* High priority frames do not wait for a full burst */
+        if (classify) {
+            fastpath_rx_flush_class(lp, 0, n_workers, 1);
+        }
     }
 }
 
 static inline void
 fastpath_rx_flush(struct fastpath_params_rx *lp, uint32_t n_workers)
 {
-    uint32_t worker;
+    uint32_t class;
 
-    for (worker = 0; worker < n_workers; worker ++) {
-        int ret;
+    for (class = 0; class < fastpath.n_ring_classes; class ++) {
+        fastpath_rx_flush_class(lp, class, n_workers, 0);
+    }
+}
+
+/**
+ * Drain the ctrl queues steered by the NIC filters straight to KNI,
+ * ahead of the data queues so protocol traffic never waits behind them.
+ * Returns the packets received, the caller flushes them to the exception
+ * ring.
+ */
+static inline uint32_t
+fastpath_rx_ctrl(struct fastpath_params_rx *lp)
+{
+    struct rte_mbuf *pkts[FASTPATH_DEFAULT_BURST_SIZE_CTRL_READ];
+    uint32_t i, k, n = 0;
 
-        if (likely((lp->mbuf_out_flush[worker] == 0) ||
-                   (lp->mbuf_out[worker].n_mbufs == 0))) {
-            lp->mbuf_out_flush[worker] = 1;
+    for (i = 0; i < lp->n_ctrl_queues; i ++) {
+        uint8_t port = lp->ctrl_queues[i].port;
+        uint8_t queue = lp->ctrl_queues[i].queue;
+        uint32_t n_mbufs;
+
+        n_mbufs = rte_eth_rx_burst(
+            port,
+            queue,
+            pkts,
+            FASTPATH_DEFAULT_BURST_SIZE_CTRL_READ);
+
+        if (n_mbufs == 0) {
             continue;
         }
 
-        ret = rte_ring_sp_enqueue_bulk(
-            lp->rings[worker],
-            (void **) lp->mbuf_out[worker].array,
-            lp->mbuf_out[worker].n_mbufs);
+#if FASTPATH_STATS
+        lp->ctrl_queues_count[i] += n_mbufs;
+#endif
 
-        if (unlikely(ret < 0)) {
-            uint32_t k;
-            for (k = 0; k < lp->mbuf_out[worker].n_mbufs; k ++) {
-                struct rte_mbuf *pkt_to_free = lp->mbuf_out[worker].array[k];
-                rte_pktmbuf_free(pkt_to_free);
+        /* fresh RX mbufs always have headroom for the stripped tag */
+        if (fastpath.rx_offload[port] & DEV_RX_OFFLOAD_VLAN_STRIP) {
+            for (k = 0; k < n_mbufs; k ++) {
+                if (pkts[k]->ol_flags & PKT_RX_VLAN_PKT) {
+                    pkts[k]->ol_flags &= ~PKT_RX_VLAN_PKT;
+                    vlan_tag_insert(pkts[k], pkts[k]->vlan_tci);
+                }
             }
         }
 
-        lp->mbuf_out[worker].n_mbufs = 0;
-        lp->mbuf_out_flush[worker] = 1;
+        kni_ingress_burst(port, pkts, n_mbufs);
+        n += n_mbufs;
     }
+
+    return n;
 }
 
 static void
@@ -418,14 +564,22 @@ fastpath_main_loop_rx(void)
     uint8_t pos_lb = fastpath.pos_lb;
 
     for ( ; ; ) {
+        fastpath_timer_manage(lcore);
+
         if (FASTPATH_RX_FLUSH && (unlikely(i == FASTPATH_RX_FLUSH))) {
             if (likely(lp->n_nic_queues > 0)) {
                 fastpath_rx_flush(lp, n_workers);
             }
 
+            exception_flush(lcore);
+            control_cmd_poll(lcore);
             i = 0;
         }
 
+        if (unlikely(lp->n_ctrl_queues > 0) && fastpath_rx_ctrl(lp) > 0) {
+            exception_flush(lcore);
+        }
+
         if (likely(lp->n_nic_queues > 0)) {
             fastpath_rx(lp, n_workers, bsz_rx_rd, bsz_rx_wr, pos_lb);
         }
@@ -434,102 +588,119 @@ fastpath_main_loop_rx(void)
     }
 }
 
-static inline void
-fastpath_worker(
+static inline uint32_t
+fastpath_worker_class(
     struct fastpath_params_worker *lp,
+    uint32_t class,
     uint32_t bsz_rd)
 {
-    uint32_t i;
+    uint32_t i, n_pkts = 0;
     unsigned lcore = rte_lcore_id();
+    int burst = (class == 0 && fastpath.n_ring_classes > 1);
+#if FASTPATH_STATS
+    uint64_t start;
+#endif
 
     for (i = 0; i < lp->n_rings; i ++) {
-        struct rte_ring *ring_in = lp->rings[i];
-        int ret;
+        struct rte_ring *ring_in = lp->rings[class][i];
+        uint32_t n_mbufs;
 
-        ret = rte_ring_sc_dequeue_bulk(
-            ring_in,
-            (void **) lp->mbuf_in.array,
-            bsz_rd);
+        /* High priority rings are drained as soon as anything is queued */
+        if (burst) {
+            n_mbufs = rte_ring_sc_dequeue_burst(
+                ring_in,
+                (void **) lp->mbuf_in->array,
+                bsz_rd);
+        } else {
+            n_mbufs = rte_ring_sc_dequeue_bulk(
+                ring_in,
+                (void **) lp->mbuf_in->array,
+                bsz_rd) == 0 ? bsz_rd : 0;
+        }
 
-        if (unlikely(ret == -ENOENT)) {
+        if (n_mbufs == 0) {
             continue;
         }
 
-        fastpath_process_packet_bulk(lp->mbuf_in.array, bsz_rd);
+#if FASTPATH_STATS
+        start = rte_rdtsc();
+#endif
 
-        rte_ip_frag_free_death_row(&fastpath.death_row[lcore], PREFETCH_OFFSET);
+        fastpath_process_packet_bulk(lp->mbuf_in->array, n_mbufs);
+
+#if FASTPATH_STATS
+        lp->proc_cycles += rte_rdtsc() - start;
+        lp->proc_pkts += n_mbufs;
+        if (unlikely(++lp->proc_iters == FASTPATH_STATS)) {
+            printf("Worker %u: %.2f cycles/pkt through the stack (%s dispatch)\n",
+                lcore,
+                ((double) lp->proc_cycles) / ((double) lp->proc_pkts),
+                fastpath.stack_direct ? "direct" : "generic");
+            lp->proc_iters = 0;
+            lp->proc_cycles = 0;
+            lp->proc_pkts = 0;
+        }
+#endif
+
+        rte_ip_frag_free_death_row(&fastpath.runtime[lcore]->death_row, PREFETCH_OFFSET);
+
+        n_pkts += n_mbufs;
     }
+
+    return n_pkts;
 }
 
 static inline void
-fastpath_worker_flush(struct fastpath_params_worker *lp)
+fastpath_worker(
+    struct fastpath_params_worker *lp,
+    uint32_t bsz_rd)
 {
-    uint32_t port;
-    unsigned lcore = rte_lcore_id();
-    uint8_t *kni_mbuf_out_flush;
-    struct mbuf_array *pkts_burst;
-    struct rte_kni *kni;
-    rte_spinlock_t *kni_lock;
+    uint32_t class, k;
 
-    for (port = 0; port < FASTPATH_MAX_NIC_PORTS; port ++) {
-        uint32_t n_pkts;
-
-        if (likely((lp->mbuf_out_flush[port] == 0) ||
-                   (lp->mbuf_out[port].n_mbufs == 0))) {
-            lp->mbuf_out_flush[port] = 1;
-            continue;
-        }
-
-        n_pkts = rte_eth_tx_burst(
-            port, 
-            lp->tx_queue_id[port], 
-            lp->mbuf_out[port].array,
-            lp->mbuf_out[port].n_mbufs);
-        
-        if (unlikely(n_pkts < lp->mbuf_out[port].n_mbufs)) {
-            uint32_t k;
-            for (k = 0; k < lp->mbuf_out[port].n_mbufs; k ++) {
-                struct rte_mbuf *pkt_to_free = lp->mbuf_out[port].array[k];
-                rte_pktmbuf_free(pkt_to_free);
+    if (fastpath.ring_sched == e_FASTPATH_RING_SCHED_STRICT) {
+        /* A lower class is only served when all higher classes are empty */
+        for (class = 0; class < fastpath.n_ring_classes; class ++) {
+            if (fastpath_worker_class(lp, class, bsz_rd) != 0) {
+                break;
             }
         }
 
-        lp->mbuf_out[port].n_mbufs = 0;
-        lp->mbuf_out_flush[port] = 1;
+        return;
     }
 
-    for (port = 0; port < FASTPATH_MAX_NIC_PORTS; port ++) {
-        uint32_t n_pkts;
+    /* Weighted round robin, up to weight bursts per class and round */
+    for (class = 0; class < fastpath.n_ring_classes; class ++) {
+        for (k = 0; k < fastpath.ring_weight[class]; k ++) {
+            if (fastpath_worker_class(lp, class, bsz_rd) == 0) {
+                break;
+            }
+        }
+    }
+}
 
-        kni = fastpath.kni[port];
-        kni_lock = &fastpath.kni_lock[port];
-        pkts_burst = &fastpath.kni_mbuf_out[lcore][port];
-        kni_mbuf_out_flush = &fastpath.kni_mbuf_out_flush[lcore][port];
+static inline void
+fastpath_worker_flush(struct fastpath_params_worker *lp)
+{
+    uint32_t port;
+    struct mbuf_array *mbuf_out;
 
-        if (likely((*kni_mbuf_out_flush == 0) ||
-                   (pkts_burst->n_mbufs == 0))) {
-            *kni_mbuf_out_flush = 1;
+    for (port = 0; port < FASTPATH_MAX_NIC_PORTS; port ++) {
+        mbuf_out = lp->mbuf_out[port];
+        if (mbuf_out == NULL) {
             continue;
         }
 
-        rte_spinlock_lock(kni_lock);
-        n_pkts = rte_kni_tx_burst(kni, pkts_burst->array, (uint16_t) pkts_burst->n_mbufs);
-        if (unlikely(n_pkts < pkts_burst->n_mbufs)) {
-            uint32_t k;
-            fastpath_log_error("kni_ingress: send pkt failed, success %d expected %d",
-                n_pkts, pkts_burst->n_mbufs);
-            for (k = n_pkts; k < pkts_burst->n_mbufs; k ++) {
-                struct rte_mbuf *pkt_to_free = pkts_burst->array[k];
-                rte_pktmbuf_free(pkt_to_free);
-            }
-
-            kni_stats[port].rx_dropped += pkts_burst->n_mbufs - n_pkts;
+        if (likely((lp->mbuf_out_flush[port] == 0) ||
+                   (mbuf_out->n_mbufs == 0))) {
+            lp->mbuf_out_flush[port] = 1;
+            continue;
         }
-        rte_spinlock_unlock(kni_lock);
-        
-        pkts_burst->n_mbufs = 0;
-        *kni_mbuf_out_flush = 1;
+
+        fastpath_tx_send(lp, (uint8_t) port);
+        lp->mbuf_out_flush[port] = 1;
     }
+
+    exception_flush(rte_lcore_id());
 }
 
 static void
@@ -537,17 +708,29 @@ fastpath_main_loop_worker(void) {
     uint32_t lcore = rte_lcore_id();
     struct fastpath_params_worker *lp = &fastpath.lcore_params[lcore].worker;
     uint64_t i = 0;
+    int exc = (exception_get_lcore() == lcore);
 
     uint32_t bsz_rd = fastpath.burst_size_worker_read;
 
     for ( ; ; ) {
+        fastpath_timer_manage(lcore);
+
         if (FASTPATH_WORKER_FLUSH && (unlikely(i == FASTPATH_WORKER_FLUSH))) {
             fastpath_worker_flush(lp);
+            control_cmd_poll(lcore);
             i = 0;
         }
 
+        if (unlikely(lp->n_tx_backlog != 0)) {
+            fastpath_tx_drain_backlog(lp);
+        }
+
         fastpath_worker(lp, bsz_rd);
 
+        if (unlikely(exc)) {
+            exception_poll();
+        }
+
         i ++;
     }
 }
@@ -565,14 +748,10 @@ fastpath_rx_worker(
         uint8_t queue = lp->nic_queues[i].queue;
         uint32_t n_mbufs;
 
-        if (queue == 0) {
-            kni_egress(port);
-        }
-
         n_mbufs = rte_eth_rx_burst(
             port,
             queue,
-            lp->mbuf_in.array,
+            lp->mbuf_in->array,
             (uint16_t) bsz_rd);
 
         if (unlikely(n_mbufs == 0)) {
@@ -597,9 +776,9 @@ fastpath_rx_worker(
         }
 #endif
 
-        fastpath_process_packet_bulk(lp->mbuf_in.array, n_mbufs);
+        fastpath_process_packet_bulk(lp->mbuf_in->array, n_mbufs);
 
-        rte_ip_frag_free_death_row(&fastpath.death_row[lcore], PREFETCH_OFFSET);
+        rte_ip_frag_free_death_row(&fastpath.runtime[lcore]->death_row, PREFETCH_OFFSET);
     }
 }
 
@@ -610,32 +789,104 @@ fastpath_main_loop_rx_worker(void)
     struct fastpath_params_rx *lp_rx = &fastpath.lcore_params[lcore].rx;
     struct fastpath_params_worker *lp_worker = &fastpath.lcore_params[lcore].worker;
     uint64_t i = 0;
+    int exc = (exception_get_lcore() == lcore);
 
     uint32_t bsz_rx_rd = fastpath.burst_size_rx_read;
 
     for ( ; ; ) {
+        fastpath_timer_manage(lcore);
+
         if (FASTPATH_WORKER_FLUSH && (unlikely(i == FASTPATH_WORKER_FLUSH))) {
             fastpath_worker_flush(lp_worker);
+            control_cmd_poll(lcore);
             i = 0;
         }
 
+        if (unlikely(lp_rx->n_ctrl_queues > 0) && fastpath_rx_ctrl(lp_rx) > 0) {
+            exception_flush(lcore);
+        }
+
+        if (unlikely(lp_worker->n_tx_backlog != 0)) {
+            fastpath_tx_drain_backlog(lp_worker);
+        }
+
         if (likely(lp_rx->n_nic_queues > 0)) {
             fastpath_rx_worker(lp_rx, bsz_rx_rd);
         }
 
+        if (unlikely(exc)) {
+            exception_poll();
+        }
+
+        i ++;
+    }
+}
+
+static void
+fastpath_main_loop_stage(void)
+{
+    uint32_t lcore = rte_lcore_id();
+    struct fastpath_params_worker *lp = &fastpath.lcore_params[lcore].worker;
+    uint64_t i = 0;
+    int exc = (exception_get_lcore() == lcore);
+#if FASTPATH_STATS
+    uint64_t iters = 0;
+#endif
+
+    for ( ; ; ) {
+        fastpath_timer_manage(lcore);
+
+        if (FASTPATH_WORKER_FLUSH && (unlikely(i == FASTPATH_WORKER_FLUSH))) {
+            fastpath_worker_flush(lp);
+            control_cmd_poll(lcore);
+            i = 0;
+        }
+
+        if (unlikely(lp->n_tx_backlog != 0)) {
+            fastpath_tx_drain_backlog(lp);
+        }
+
+        if (pipeline_stage_poll(lcore) != 0) {
+            bridge_flush(lcore);
+            pipeline_flush(lcore);
+            rte_ip_frag_free_death_row(&fastpath.runtime[lcore]->death_row, PREFETCH_OFFSET);
+
+#if FASTPATH_STATS
+            if (unlikely(++iters == FASTPATH_STATS)) {
+                pipeline_print_stats(lcore);
+                iters = 0;
+            }
+#endif
+        }
+
+        if (unlikely(exc)) {
+            exception_poll();
+        }
+
         i ++;
     }
 }
 
 static void
-fastpath_main_loop_mgr(void)
+fastpath_main_loop_exception(void)
 {
-    struct thread thread;
+    uint32_t lcore = rte_lcore_id();
+#if FASTPATH_STATS
+    uint64_t iters = 0;
+#endif
+
+    for ( ; ; ) {
+        fastpath_timer_manage(lcore);
 
-    fastpath_init_stack();
-    
-    while (thread_fetch(mgr_master, &thread)) {
-        thread_call(&thread);
+        if (exception_poll() != 0) {
+#if FASTPATH_STATS
+            if (unlikely(++iters == FASTPATH_STATS)) {
+                exception_print_stats();
+                bridge_print_stats();
+                iters = 0;
+            }
+#endif
+        }
     }
 }
 
@@ -649,8 +900,14 @@ fastpath_main_loop(__attribute__((unused)) void *arg)
     lp = &fastpath.lcore_params[lcore];
 
     if (lcore == rte_get_master_lcore()) {
-        printf("Master core %u mgr loop.\n", lcore);
-        fastpath_main_loop_mgr();
+        if (fastpath.ctrl_thread) {
+            if (control_thread_start() < 0) {
+                rte_panic("Cannot start the control plane thread\n");
+            }
+        } else {
+            printf("Master core %u mgr loop.\n", lcore);
+            control_main_loop();
+        }
     }
 
     if (lp->type == e_FASTPATH_LCORE_RX) {
@@ -672,5 +929,15 @@ fastpath_main_loop(__attribute__((unused)) void *arg)
         fastpath_main_loop_rx_worker();
     }
 
+    if (lp->type == e_FASTPATH_LCORE_STAGE) {
+        printf("Logical core %u (Stage) main loop.\n", lcore);
+        fastpath_main_loop_stage();
+    }
+
+    if (lp->type == e_FASTPATH_LCORE_EXCEPTION) {
+        printf("Logical core %u (Exception) main loop.\n", lcore);
+        fastpath_main_loop_exception();
+    }
+
     return 0;
 }
@@ -0,0 +1,756 @@
+
+#include "include/fastpath.h"
+
+/*
+ * ARP/ND suppression and IGMP/MLD snooping for the bridges that ask for
+ * them. Two tables are shared by all bridges, keyed by bridge VID and IP
+ * address: the neighbours learned from ARP and ND, which answer requests
+ * in place of a flood, and the multicast groups with the ports that
+ * reported them. The zero address of a family holds the ports a querier
+ * was heard on; they get every group. Snooping only filters while a
+ * querier is present, hosts stop reporting without one.
+ *
+ * Entries are open addressed within SNOOP_PROBES slots, the slots are
+ * read lock free with a sequence count against a concurrent update, and
+ * updated under snoop_lock by whichever lcore saw the packet: control
+ * traffic is rare next to what it spares. An entry past its expiry is
+ * free for another key. Membership is per group, not per source, and a
+ * leave drops the port at once, right for a port with a single host.
+ */
+#define SNOOP_PROBES                8
+
+#define SNOOP_FAMILY_IPV4           4
+#define SNOOP_FAMILY_IPV6           6
+
+#define SNOOP_IGMP_QUERY            0x11
+#define SNOOP_IGMP_V1_REPORT        0x12
+#define SNOOP_IGMP_V2_REPORT        0x16
+#define SNOOP_IGMP_LEAVE            0x17
+#define SNOOP_IGMP_V3_REPORT        0x22
+
+#define SNOOP_MLD_QUERY             130
+#define SNOOP_MLD_REPORT            131
+#define SNOOP_MLD_DONE              132
+#define SNOOP_ND_NS                 135
+#define SNOOP_ND_NA                 136
+#define SNOOP_MLD2_REPORT           143
+
+/* group record types of IGMPv3 and MLDv2 reports */
+#define SNOOP_MODE_IS_INCLUDE       1
+#define SNOOP_MODE_IS_EXCLUDE       2
+#define SNOOP_CHANGE_TO_INCLUDE     3
+#define SNOOP_CHANGE_TO_EXCLUDE     4
+#define SNOOP_ALLOW_NEW_SOURCES     5
+
+#define SNOOP_ND_OPT_SLLA           1
+#define SNOOP_ND_OPT_TLLA           2
+#define SNOOP_ND_NA_FLAGS           0x60000000  /* solicited, override */
+
+/* 224.0.0.0/24, link local control reaching every port */
+#define SNOOP_IPV4_LOCAL_MASK       0xFFFFFF00
+#define SNOOP_IPV4_LOCAL            0xE0000000
+
+/* IPv6 multicast scope above link local */
+#define SNOOP_IPV6_SCOPE_LINK       2
+
+struct snoop_key {
+    uint8_t addr[16];       /* IPv4 as ::ffff:a.b.c.d */
+    uint16_t vid;
+    uint8_t family;
+    uint8_t pad;
+};
+
+/* head of every entry, the data follows */
+struct snoop_slot {
+    volatile uint32_t seq;  /* odd while the writer changes the entry */
+    uint32_t expire;        /* free for another key once the clock reaches it */
+    struct snoop_key key;
+};
+
+struct snoop_neigh {
+    struct snoop_slot slot;
+    struct ether_addr mac;
+};
+
+/* a port stays in members until it leaves, its expire tells if it still is */
+struct snoop_group {
+    struct snoop_slot slot;
+    struct snoop_ports members;
+    uint32_t expire[BRIDGE_MAX_PORTS];
+};
+
+/* NS and NA */
+struct snoop_nd_msg {
+    uint8_t type;
+    uint8_t code;
+    uint16_t cksum;
+    uint32_t flags;
+    uint8_t target[16];
+} __attribute__((__packed__));
+
+struct snoop_nd_opt_lla {
+    uint8_t type;
+    uint8_t len;            /* in units of 8 bytes */
+    struct ether_addr mac;
+} __attribute__((__packed__));
+
+struct snoop_table {
+    uint8_t *slots;
+    uint32_t slot_size;
+    uint32_t mask;
+
+    /* stats, writer only */
+    uint64_t added;
+    uint64_t full;
+};
+
+#define SNOOP_SLOT(t, i) \
+    ((struct snoop_slot *)((t)->slots + (size_t)((i) & (t)->mask) * (t)->slot_size))
+
+static struct snoop_table snoop_neighs;
+static struct snoop_table snoop_groups;
+static rte_spinlock_t snoop_lock = RTE_SPINLOCK_INITIALIZER;
+
+static inline void
+snoop_key_set(struct snoop_key *key, uint16_t vid, uint8_t family, const uint8_t *addr)
+{
+    memset(key, 0, sizeof(*key));
+    key->vid = vid;
+    key->family = family;
+
+    if (addr == NULL) {
+        return;
+    }
+
+    if (family == SNOOP_FAMILY_IPV4) {
+        key->addr[10] = 0xff;
+        key->addr[11] = 0xff;
+        memcpy(&key->addr[12], addr, 4);
+    } else {
+        memcpy(key->addr, addr, 16);
+    }
+}
+
+static inline uint32_t
+snoop_hash(const struct snoop_key *key)
+{
+    return rte_hash_crc(key, sizeof(*key), 0);
+}
+
+static inline int
+snoop_addr_is_zero(const uint8_t *addr, uint32_t len)
+{
+    uint32_t i;
+
+    for (i = 0; i < len; i++) {
+        if (addr[i] != 0) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* Any lcore, lock free: the live entry of a key, read it then snoop_read_done */
+static const struct snoop_slot *
+snoop_read_begin(const struct snoop_table *t, const struct snoop_key *key, uint32_t now,
+    uint32_t *seq)
+{
+    uint32_t hash = snoop_hash(key);
+    uint32_t i;
+
+    for (i = 0; i < SNOOP_PROBES; i++) {
+        const struct snoop_slot *slot = SNOOP_SLOT(t, hash + i);
+
+        *seq = slot->seq;
+        rte_rmb();
+        if ((*seq & 1) || slot->expire <= now ||
+            memcmp(&slot->key, key, sizeof(*key)) != 0) {
+            continue;
+        }
+
+        return slot;
+    }
+
+    return NULL;
+}
+
+/* 0 when what was read is consistent, else a miss this time */
+static inline int
+snoop_read_done(const struct snoop_slot *slot, uint32_t seq)
+{
+    rte_rmb();
+    return slot->seq == seq ? 0 : -EAGAIN;
+}
+
+/* Any lcore, lock free: copy the data of the live entry of a key */
+static int
+snoop_lookup(const struct snoop_table *t, const struct snoop_key *key, uint32_t now,
+    void *data, uint32_t len, uint32_t *expire)
+{
+    const struct snoop_slot *slot;
+    uint32_t seq;
+
+    slot = snoop_read_begin(t, key, now, &seq);
+    if (slot == NULL) {
+        return -ENOENT;
+    }
+
+    memcpy(data, (const uint8_t *)slot + sizeof(struct snoop_slot), len);
+    if (expire != NULL) {
+        *expire = slot->expire;
+    }
+
+    return snoop_read_done(slot, seq);
+}
+
+static inline void
+snoop_write_begin(struct snoop_slot *slot)
+{
+    slot->seq++;
+    rte_wmb();
+}
+
+static inline void
+snoop_write_end(struct snoop_slot *slot)
+{
+    rte_wmb();
+    slot->seq++;
+}
+
+/* Under snoop_lock: the live entry of a key, being written to, or a new one */
+static struct snoop_slot *
+snoop_slot_get(struct snoop_table *t, const struct snoop_key *key, uint32_t now, int create)
+{
+    uint32_t hash = snoop_hash(key);
+    struct snoop_slot *slot, *free_slot = NULL;
+    uint32_t i;
+
+    for (i = 0; i < SNOOP_PROBES; i++) {
+        slot = SNOOP_SLOT(t, hash + i);
+        if (slot->expire > now) {
+            if (memcmp(&slot->key, key, sizeof(*key)) == 0) {
+                snoop_write_begin(slot);
+                return slot;
+            }
+        } else if (free_slot == NULL) {
+            free_slot = slot;
+        }
+    }
+
+    if (!create) {
+        return NULL;
+    }
+
+    if (free_slot == NULL) {
+        t->full++;
+        return NULL;
+    }
+
+    snoop_write_begin(free_slot);
+    free_slot->key = *key;
+    memset((uint8_t *)free_slot + sizeof(struct snoop_slot), 0,
+        t->slot_size - sizeof(struct snoop_slot));
+    t->added++;
+
+    return free_slot;
+}
+
+static void
+snoop_neigh_learn(uint16_t vid, uint8_t family, const uint8_t *addr,
+    const struct ether_addr *mac, uint32_t now)
+{
+    struct snoop_key key;
+    struct snoop_slot *slot;
+    struct ether_addr known;
+    uint32_t expire;
+
+    if (is_multicast_ether_addr(mac) || is_zero_ether_addr(mac)) {
+        return;
+    }
+
+    snoop_key_set(&key, vid, family, addr);
+
+    /* most are what is known already, and recently */
+    if (snoop_lookup(&snoop_neighs, &key, now, &known, sizeof(known), &expire) == 0 &&
+        is_same_ether_addr(&known, mac) &&
+        expire - now > FASTPATH_BRIDGE_NEIGH_AGING / 2) {
+        return;
+    }
+
+    rte_spinlock_lock(&snoop_lock);
+    slot = snoop_slot_get(&snoop_neighs, &key, now, 1);
+    if (slot != NULL) {
+        ether_addr_copy(mac, &((struct snoop_neigh *)slot)->mac);
+        slot->expire = now + FASTPATH_BRIDGE_NEIGH_AGING;
+        snoop_write_end(slot);
+    }
+    rte_spinlock_unlock(&snoop_lock);
+}
+
+static int
+snoop_neigh_lookup(uint16_t vid, uint8_t family, const uint8_t *addr,
+    struct ether_addr *mac, uint32_t now)
+{
+    struct snoop_key key;
+
+    snoop_key_set(&key, vid, family, addr);
+    return snoop_lookup(&snoop_neighs, &key, now, mac, sizeof(*mac), NULL);
+}
+
+/**
+ * Learn the sender of an ARP packet, and turn a request for an address
+ * known into its reply, 1 when it should go back out where it came from
+ */
+int
+snoop_arp(struct rte_mbuf *m, struct ether_hdr *eth_hdr, uint16_t vid, uint32_t now)
+{
+    struct arp_hdr *arp = rte_pktmbuf_mtod(m, struct arp_hdr *);
+    struct arp_ipv4 *body = &arp->arp_data.arp_ip;
+    struct ether_addr mac;
+    uint8_t sip[4];
+
+    if (rte_pktmbuf_data_len(m) < sizeof(struct arp_hdr) ||
+        arp->arp_hrd != rte_cpu_to_be_16(ARP_HRD_ETHER) ||
+        arp->arp_pro != rte_cpu_to_be_16(ETHER_TYPE_IPv4) ||
+        arp->arp_hln != ETHER_ADDR_LEN || arp->arp_pln != sizeof(sip)) {
+        return 0;
+    }
+
+    /* a probe has no sender address yet */
+    if (snoop_addr_is_zero(body->arp_sip, sizeof(sip))) {
+        return 0;
+    }
+
+    snoop_neigh_learn(vid, SNOOP_FAMILY_IPV4, body->arp_sip,
+        (struct ether_addr *)body->arp_sha, now);
+
+    /* announcements are for everybody to hear */
+    if (arp->arp_op != rte_cpu_to_be_16(ARP_OP_REQUEST) ||
+        memcmp(body->arp_sip, body->arp_tip, sizeof(sip)) == 0) {
+        return 0;
+    }
+
+    if (snoop_neigh_lookup(vid, SNOOP_FAMILY_IPV4, body->arp_tip, &mac, now) < 0 ||
+        is_same_ether_addr(&mac, (struct ether_addr *)body->arp_sha)) {
+        return 0;
+    }
+
+    arp->arp_op = rte_cpu_to_be_16(ARP_OP_REPLY);
+    memcpy(sip, body->arp_sip, sizeof(sip));
+    memcpy(body->arp_tha, body->arp_sha, ETHER_ADDR_LEN);
+    memcpy(body->arp_sip, body->arp_tip, sizeof(sip));
+    memcpy(body->arp_tip, sip, sizeof(sip));
+    memcpy(body->arp_sha, &mac, ETHER_ADDR_LEN);
+
+    ether_addr_copy(&eth_hdr->s_addr, &eth_hdr->d_addr);
+    ether_addr_copy(&mac, &eth_hdr->s_addr);
+
+    return 1;
+}
+
+/**
+ * ARP for IPv6: learn from neighbour solicitations and advertisements,
+ * and turn a solicitation for an address known into the advertisement
+ */
+int
+snoop_nd(struct rte_mbuf *m, struct ether_hdr *eth_hdr, uint16_t vid, uint32_t now)
+{
+    struct ipv6_hdr *ipv6_hdr = rte_pktmbuf_mtod(m, struct ipv6_hdr *);
+    struct snoop_nd_msg *nd = (struct snoop_nd_msg *)(ipv6_hdr + 1);
+    struct snoop_nd_opt_lla *opt, *lla = NULL;
+    struct ether_addr mac;
+    uint32_t len, off;
+
+    /* ND never crosses a router, a smaller hop limit is forged */
+    if (m->nb_segs != 1 || rte_pktmbuf_data_len(m) < sizeof(*ipv6_hdr) + sizeof(*nd) ||
+        ipv6_hdr->proto != IPPROTO_ICMPV6 || ipv6_hdr->hop_limits != 255) {
+        return 0;
+    }
+
+    len = rte_be_to_cpu_16(ipv6_hdr->payload_len);
+    if (len < sizeof(*nd) || sizeof(*ipv6_hdr) + len > rte_pktmbuf_data_len(m) ||
+        nd->code != 0 || (nd->type != SNOOP_ND_NS && nd->type != SNOOP_ND_NA)) {
+        return 0;
+    }
+
+    /* the source link layer address of a NS, the target one of a NA */
+    for (off = sizeof(*nd); off + sizeof(*opt) <= len; off += opt->len * 8) {
+        opt = (struct snoop_nd_opt_lla *)((uint8_t *)nd + off);
+        if (opt->len == 0) {
+            return 0;
+        }
+
+        if (opt->len == 1 && opt->type ==
+            (nd->type == SNOOP_ND_NS ? SNOOP_ND_OPT_SLLA : SNOOP_ND_OPT_TLLA)) {
+            lla = opt;
+            break;
+        }
+    }
+
+    if (nd->type == SNOOP_ND_NA) {
+        if (lla != NULL) {
+            snoop_neigh_learn(vid, SNOOP_FAMILY_IPV6, nd->target, &lla->mac, now);
+        }
+        return 0;
+    }
+
+    /* duplicate address detection has no source yet, the owner must answer */
+    if (lla == NULL || snoop_addr_is_zero(ipv6_hdr->src_addr, sizeof(ipv6_hdr->src_addr))) {
+        return 0;
+    }
+
+    snoop_neigh_learn(vid, SNOOP_FAMILY_IPV6, ipv6_hdr->src_addr, &lla->mac, now);
+
+    if (snoop_neigh_lookup(vid, SNOOP_FAMILY_IPV6, nd->target, &mac, now) < 0 ||
+        is_same_ether_addr(&mac, &lla->mac)) {
+        return 0;
+    }
+
+    /* the NA is no longer than the NS with its option */
+    memcpy(ipv6_hdr->dst_addr, ipv6_hdr->src_addr, sizeof(ipv6_hdr->dst_addr));
+    memcpy(ipv6_hdr->src_addr, nd->target, sizeof(ipv6_hdr->src_addr));
+    ipv6_hdr->payload_len = rte_cpu_to_be_16(sizeof(*nd) + sizeof(*opt));
+
+    nd->type = SNOOP_ND_NA;
+    nd->flags = rte_cpu_to_be_32(SNOOP_ND_NA_FLAGS);
+    opt = (struct snoop_nd_opt_lla *)(nd + 1);
+    opt->type = SNOOP_ND_OPT_TLLA;
+    opt->len = 1;
+    ether_addr_copy(&mac, &opt->mac);
+
+    rte_pktmbuf_trim(m, (uint16_t)(rte_pktmbuf_data_len(m) -
+        (sizeof(*ipv6_hdr) + sizeof(*nd) + sizeof(*opt))));
+
+    nd->cksum = 0;
+    nd->cksum = rte_ipv6_udptcp_cksum(ipv6_hdr, nd);
+
+    ether_addr_copy(&eth_hdr->s_addr, &eth_hdr->d_addr);
+    ether_addr_copy(&mac, &eth_hdr->s_addr);
+
+    return 1;
+}
+
+static int
+snoop_group_is_routable(uint8_t family, const uint8_t *group)
+{
+    if (family == SNOOP_FAMILY_IPV4) {
+        uint32_t addr;
+
+        memcpy(&addr, group, sizeof(addr));
+        addr = rte_be_to_cpu_32(addr);
+        return IS_IPV4_MCAST(addr) &&
+            (addr & SNOOP_IPV4_LOCAL_MASK) != SNOOP_IPV4_LOCAL;
+    }
+
+    return group[0] == 0xff && (group[1] & 0xf) > SNOOP_IPV6_SCOPE_LINK;
+}
+
+/* Refresh the port in a group, or with expire 0 drop it, NULL for the queriers */
+static void
+snoop_group_update(uint16_t vid, uint8_t family, const uint8_t *group,
+    uint32_t port, uint32_t expire, uint32_t now)
+{
+    struct snoop_key key;
+    struct snoop_slot *slot;
+
+    if (port >= BRIDGE_MAX_PORTS ||
+        (group != NULL && !snoop_group_is_routable(family, group))) {
+        return;
+    }
+
+    snoop_key_set(&key, vid, family, group);
+
+    rte_spinlock_lock(&snoop_lock);
+    slot = snoop_slot_get(&snoop_groups, &key, now, expire != 0);
+    if (slot != NULL) {
+        struct snoop_group *g = (struct snoop_group *)slot;
+
+        if (expire != 0) {
+            g->members.bits[port / 32] |= 1U << (port % 32);
+        } else {
+            g->members.bits[port / 32] &= ~(1U << (port % 32));
+        }
+        g->expire[port] = expire;
+        if (expire > slot->expire) {
+            slot->expire = expire;
+        }
+        snoop_write_end(slot);
+    }
+    rte_spinlock_unlock(&snoop_lock);
+}
+
+static inline void
+snoop_group_join(uint16_t vid, uint8_t family, const uint8_t *group, uint32_t port, uint32_t now)
+{
+    snoop_group_update(vid, family, group, port, now + FASTPATH_BRIDGE_MCAST_AGING, now);
+}
+
+static inline void
+snoop_group_leave(uint16_t vid, uint8_t family, const uint8_t *group, uint32_t port, uint32_t now)
+{
+    snoop_group_update(vid, family, group, port, 0, now);
+}
+
+/* IGMPv3 and MLDv2 group record: a source of interest joins the group */
+static void
+snoop_group_record(uint16_t vid, uint8_t family, uint8_t type, uint16_t n_sources,
+    const uint8_t *group, uint32_t port, uint32_t now)
+{
+    switch (type) {
+    case SNOOP_MODE_IS_EXCLUDE:
+    case SNOOP_CHANGE_TO_EXCLUDE:
+        snoop_group_join(vid, family, group, port, now);
+        break;
+    case SNOOP_MODE_IS_INCLUDE:
+    case SNOOP_CHANGE_TO_INCLUDE:
+        if (n_sources == 0) {
+            snoop_group_leave(vid, family, group, port, now);
+        } else {
+            snoop_group_join(vid, family, group, port, now);
+        }
+        break;
+    case SNOOP_ALLOW_NEW_SOURCES:
+        if (n_sources != 0) {
+            snoop_group_join(vid, family, group, port, now);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/* Add the ports of a group, or with NULL of the queriers, -ENOENT when unknown */
+static int
+snoop_group_ports(uint16_t vid, uint8_t family, const uint8_t *group, uint32_t now,
+    struct snoop_ports *ports)
+{
+    struct snoop_key key;
+    struct snoop_ports found;
+    const struct snoop_group *g;
+    uint32_t i, bits, seq;
+
+    snoop_key_set(&key, vid, family, group);
+    g = (const struct snoop_group *)snoop_read_begin(&snoop_groups, &key, now, &seq);
+    if (g == NULL) {
+        return -ENOENT;
+    }
+
+    /* the expiry of the few members only */
+    for (i = 0; i < SNOOP_PORT_WORDS; i++) {
+        found.bits[i] = 0;
+        for (bits = g->members.bits[i]; bits != 0; bits &= bits - 1) {
+            uint32_t port = i * 32 + __builtin_ctz(bits);
+
+            if (g->expire[port] > now) {
+                found.bits[i] |= 1U << (port % 32);
+            }
+        }
+    }
+
+    if (snoop_read_done(&g->slot, seq) < 0) {
+        return -ENOENT;
+    }
+
+    for (i = 0; i < SNOOP_PORT_WORDS; i++) {
+        ports->bits[i] |= found.bits[i];
+    }
+
+    return 0;
+}
+
+static void
+snoop_igmp(const struct ipv4_hdr *ipv4_hdr, uint32_t len, uint16_t vid,
+    uint32_t port, uint32_t now)
+{
+    uint32_t hlen = (ipv4_hdr->version_ihl & 0xf) * 4;
+    const uint8_t *igmp = (const uint8_t *)ipv4_hdr + hlen;
+    uint32_t i, n_records, off;
+
+    if (rte_be_to_cpu_16(ipv4_hdr->total_length) < len) {
+        len = rte_be_to_cpu_16(ipv4_hdr->total_length);
+    }
+
+    if (len < hlen + 8) {
+        return;
+    }
+    len -= hlen;
+
+    switch (igmp[0]) {
+    case SNOOP_IGMP_QUERY:
+        snoop_group_update(vid, SNOOP_FAMILY_IPV4, NULL, port,
+            now + FASTPATH_BRIDGE_MROUTER_AGING, now);
+        break;
+    case SNOOP_IGMP_V1_REPORT:
+    case SNOOP_IGMP_V2_REPORT:
+        snoop_group_join(vid, SNOOP_FAMILY_IPV4, &igmp[4], port, now);
+        break;
+    case SNOOP_IGMP_LEAVE:
+        snoop_group_leave(vid, SNOOP_FAMILY_IPV4, &igmp[4], port, now);
+        break;
+    case SNOOP_IGMP_V3_REPORT:
+        n_records = (igmp[6] << 8) | igmp[7];
+        for (i = 0, off = 8; i < n_records && off + 8 <= len; i++) {
+            const uint8_t *record = &igmp[off];
+            uint16_t n_sources = (record[2] << 8) | record[3];
+
+            snoop_group_record(vid, SNOOP_FAMILY_IPV4, record[0], n_sources,
+                &record[4], port, now);
+            off += 8 + n_sources * 4 + record[1] * 4;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/* 1 when the packet is MLD */
+static int
+snoop_mld(const struct ipv6_hdr *ipv6_hdr, uint32_t len, uint16_t vid,
+    uint32_t port, uint32_t now)
+{
+    const uint8_t *mld;
+    uint32_t i, n_records, off = sizeof(*ipv6_hdr);
+    uint8_t proto = ipv6_hdr->proto;
+
+    if (off + rte_be_to_cpu_16(ipv6_hdr->payload_len) < len) {
+        len = off + rte_be_to_cpu_16(ipv6_hdr->payload_len);
+    }
+
+    /* MLD comes after the router alert */
+    if (proto == IPPROTO_HOPOPTS) {
+        const uint8_t *hbh = (const uint8_t *)ipv6_hdr + off;
+
+        if (off + 8 > len) {
+            return 0;
+        }
+        proto = hbh[0];
+        off += (hbh[1] + 1) * 8;
+    }
+
+    if (proto != IPPROTO_ICMPV6 || off + 24 > len) {
+        return 0;
+    }
+
+    mld = (const uint8_t *)ipv6_hdr + off;
+    len -= off;
+
+    switch (mld[0]) {
+    case SNOOP_MLD_QUERY:
+        snoop_group_update(vid, SNOOP_FAMILY_IPV6, NULL, port,
+            now + FASTPATH_BRIDGE_MROUTER_AGING, now);
+        break;
+    case SNOOP_MLD_REPORT:
+        snoop_group_join(vid, SNOOP_FAMILY_IPV6, &mld[8], port, now);
+        break;
+    case SNOOP_MLD_DONE:
+        snoop_group_leave(vid, SNOOP_FAMILY_IPV6, &mld[8], port, now);
+        break;
+    case SNOOP_MLD2_REPORT:
+        n_records = (mld[6] << 8) | mld[7];
+        for (i = 0, off = 8; i < n_records && off + 20 <= len; i++) {
+            const uint8_t *record = &mld[off];
+            uint16_t n_sources = (record[2] << 8) | record[3];
+
+            snoop_group_record(vid, SNOOP_FAMILY_IPV6, record[0], n_sources,
+                &record[4], port, now);
+            off += 20 + n_sources * 16 + record[1] * 4;
+        }
+        break;
+    default:
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * Snoop the IGMP/MLD of a multicast packet from port, or find the ports
+ * of its group, SNOOP_FILTER when it goes to these only
+ */
+int
+snoop_mcast(struct rte_mbuf *m, uint16_t protocol, uint16_t vid, uint32_t port,
+    uint32_t now, struct snoop_ports *ports)
+{
+    const uint8_t *group;
+    uint32_t len = rte_pktmbuf_data_len(m);
+    uint8_t family;
+
+    if (protocol == ETHER_TYPE_IPv4) {
+        const struct ipv4_hdr *ipv4_hdr = rte_pktmbuf_mtod(m, struct ipv4_hdr *);
+
+        if (len < sizeof(*ipv4_hdr)) {
+            return SNOOP_FLOOD;
+        }
+
+        if (ipv4_hdr->next_proto_id == IPPROTO_IGMP) {
+            snoop_igmp(ipv4_hdr, len, vid, port, now);
+            return SNOOP_FLOOD;
+        }
+
+        family = SNOOP_FAMILY_IPV4;
+        group = (const uint8_t *)&ipv4_hdr->dst_addr;
+    } else if (protocol == ETHER_TYPE_IPv6) {
+        const struct ipv6_hdr *ipv6_hdr = rte_pktmbuf_mtod(m, struct ipv6_hdr *);
+
+        if (len < sizeof(*ipv6_hdr) || snoop_mld(ipv6_hdr, len, vid, port, now)) {
+            return SNOOP_FLOOD;
+        }
+
+        family = SNOOP_FAMILY_IPV6;
+        group = ipv6_hdr->dst_addr;
+    } else {
+        return SNOOP_FLOOD;
+    }
+
+    if (!snoop_group_is_routable(family, group)) {
+        return SNOOP_FLOOD;
+    }
+
+    memset(ports, 0, sizeof(*ports));
+
+    /* no querier, no reports to rely on */
+    if (snoop_group_ports(vid, family, NULL, now, ports) < 0) {
+        return SNOOP_FLOOD;
+    }
+
+    snoop_group_ports(vid, family, group, now, ports);
+
+    return SNOOP_FILTER;
+}
+
+static void
+snoop_table_init(struct snoop_table *t, const char *name, uint32_t n_entries,
+    uint32_t slot_size)
+{
+    /* at most half full, a key rarely misses its probe window */
+    uint32_t n_slots = rte_align32pow2(2 * n_entries);
+
+    t->slots = rte_zmalloc(name, (size_t) n_slots * slot_size, RTE_CACHE_LINE_SIZE);
+    if (t->slots == NULL) {
+        rte_panic("Cannot allocate %s\n", name);
+    }
+
+    t->slot_size = slot_size;
+    t->mask = n_slots - 1;
+}
+
+void snoop_init(uint32_t n_neighs, uint32_t n_groups)
+{
+    snoop_table_init(&snoop_neighs, "snoop_neighs", n_neighs, sizeof(struct snoop_neigh));
+    snoop_table_init(&snoop_groups, "snoop_groups", n_groups, sizeof(struct snoop_group));
+}
+
+void snoop_print_stats(void)
+{
+    if (snoop_neighs.slots == NULL) {
+        return;
+    }
+
+    printf("Bridge snooping: neighbours learned = %"PRIu64" full = %"PRIu64
+        ", groups joined = %"PRIu64" full = %"PRIu64"\n",
+        snoop_neighs.added,
+        snoop_neighs.full,
+        snoop_groups.added,
+        snoop_groups.full);
+}
@@ -12,7 +12,13 @@ struct module_entry {
 
 LIST_HEAD(, module_entry) module_list;
 
-uint32_t port_map[ROUTE_MAX_LINK] = {0};
+/* kernel ifindex to ifidx, netlink events look it up */
+static struct rte_hash *port_map_hash;
+static uint32_t *port_map;
+
+/* module name to entry, both sized FASTPATH_MAX_MODULES */
+static struct rte_hash *module_hash;
+static struct module_entry **module_entries;
 
 void module_add(struct module *module, uint32_t param1, uint32_t param2);
 void print_modules(void);
@@ -37,8 +43,24 @@ static int execute_cmd(char *cmd)
 
 static void init_port_map(uint32_t ifidx, const char *name)
 {
-    int fd, err;
+    int fd, err, pos, ifindex = 0;
     struct ifreq ifr;
+    struct rte_hash_parameters params = {
+        .name = "port_map",
+        .entries = ROUTE_MAX_LINK,
+        .bucket_entries = 8,
+        .key_len = sizeof(uint32_t),
+        .hash_func_init_val = 0,
+        .socket_id = rte_socket_id(),
+    };
+
+    if (port_map_hash == NULL) {
+        port_map_hash = rte_hash_create(&params);
+        port_map = rte_zmalloc(NULL, ROUTE_MAX_LINK * sizeof(uint32_t), 0);
+        if (port_map_hash == NULL || port_map == NULL) {
+            rte_panic("init_port_map: Unable to create the port map\n");
+        }
+    }
     
     memset(&ifr, 0, sizeof(ifr));
 
@@ -46,6 +68,14 @@ static void init_port_map(uint32_t ifidx, const char *name)
     
     fd = socket(AF_INET, SOCK_DGRAM, 0);
     err = ioctl(fd, SIOCGIFINDEX, &ifr);
+    if (err == 0) {
+        ifindex = ifr.ifr_ifindex;
+
+        /* the interface starts with the MTU of the device, netlink follows it */
+        if (ioctl(fd, SIOCGIFMTU, &ifr) == 0) {
+            interface_set_mtu(ifidx, ifr.ifr_mtu);
+        }
+    }
     close(fd);
     
     if (err) {
@@ -53,22 +83,43 @@ static void init_port_map(uint32_t ifidx, const char *name)
         return;
     }
     
-    port_map[ifidx] = ifr.ifr_ifindex;
+    pos = rte_hash_add_key(port_map_hash, &ifindex);
+    if (pos < 0) {
+        fastpath_log_error("map %s ifidx failed\n", name);
+        return;
+    }
+    port_map[pos] = ifidx;
 
-    fastpath_log_debug("interface %d ifidx %d\n", ifidx, port_map[ifidx]);
+    fastpath_log_debug("interface %d ifidx %d\n", ifidx, ifindex);
 }
 
+/* ROUTE_MAX_LINK when the kernel ifindex is none of ours */
 uint32_t get_port_map(uint32_t ifidx)
 {
-    uint32_t i;
+    int pos;
 
-    for (i = 0; i < ROUTE_MAX_LINK; i++) {
-        if (port_map[i] == ifidx) {
-            break;
-        }
+    if (port_map_hash == NULL) {
+        return ROUTE_MAX_LINK;
+    }
+
+    pos = rte_hash_lookup(port_map_hash, &ifidx);
+    if (pos < 0) {
+        return ROUTE_MAX_LINK;
     }
 
-    return i;
+    return port_map[pos];
+}
+
+static int module_name_key(const char *name, char *key)
+{
+    if (strlen(name) >= NAME_SIZE) {
+        return -EINVAL;
+    }
+
+    memset(key, 0, NAME_SIZE);
+    strcpy(key, name);
+
+    return 0;
 }
 
 xmlNodePtr xml_get_child(xmlNodePtr node, const char *name)
@@ -152,12 +203,36 @@ xmlNodePtr xml_get_node(xmlXPathContextPtr context, const char *path, int *dup)
 void module_add(struct module *module, uint32_t param1, uint32_t param2)
 {
     struct module_entry *entry;
+    char key[NAME_SIZE];
+    int pos;
+    struct rte_hash_parameters params = {
+        .name = "module_names",
+        .entries = FASTPATH_MAX_MODULES,
+        .bucket_entries = 8,
+        .key_len = NAME_SIZE,
+        .hash_func_init_val = 0,
+        .socket_id = rte_socket_id(),
+    };
 
     if (module == NULL) {
         fastpath_log_error("module_add: invalid module\n");
         return;
     }
 
+    if (module_hash == NULL) {
+        module_hash = rte_hash_create(&params);
+        module_entries = rte_zmalloc(NULL,
+            FASTPATH_MAX_MODULES * sizeof(struct module_entry *), 0);
+        if (module_hash == NULL || module_entries == NULL) {
+            rte_panic("module_add: Unable to create the module hash\n");
+        }
+    }
+
+    if (module_name_key(module->name, key) < 0) {
+        fastpath_log_error("module_add: invalid name %s\n", module->name);
+        return;
+    }
+
     entry = rte_malloc(NULL, sizeof(struct module_entry), 0);
     if (entry == NULL) {
         fastpath_log_error("module_add: malloc failed\n");
@@ -168,6 +243,15 @@ void module_add(struct module *module, uint32_t param1, uint32_t param2)
     entry->param1 = param1;
     entry->param2 = param2;
 
+    pos = rte_hash_add_key(module_hash, key);
+    if (pos < 0) {
+        rte_free(entry);
+
+        fastpath_log_error("module_add: too many modules, %s\n", module->name);
+        return;
+    }
+    module_entries[pos] = entry;
+
     LIST_INSERT_HEAD(&module_list, entry, entry);
 }
 
@@ -185,27 +269,579 @@ void print_modules(void)
 struct module *module_get_by_name(const char *name)
 {
     struct module_entry *entry;
-    
-    LIST_FOREACH(entry, &module_list, entry) {
-        if (strcmp(entry->module->name, name) == 0) {
-            return entry->module;
+
+    entry = module_find(name);
+
+    return entry != NULL ? entry->module : NULL;
+}
+
+/*
+ * Give the module one zeroed, cache aligned block of state per enabled
+ * lcore, allocated on the socket of that lcore. The datapath reaches its
+ * own block with module_lcore_private(), so per-packet writes never
+ * cross lcores; the control plane aggregates with
+ * MODULE_FOREACH_LCORE_PRIVATE.
+ */
+int module_lcore_private_alloc(struct module *module, size_t size,
+    void (*init)(struct module *module, void *priv, unsigned lcore))
+{
+    unsigned lcore;
+    void *priv;
+
+    if (module == NULL || size == 0) {
+        return -EINVAL;
+    }
+
+    RTE_LCORE_FOREACH(lcore) {
+        priv = rte_zmalloc_socket(NULL, size, RTE_CACHE_LINE_SIZE, 
+            rte_lcore_to_socket_id(lcore));
+        if (priv == NULL) {
+            fastpath_log_error("module_lcore_private_alloc: %s lcore %u malloc failed\n",
+                module->name, lcore);
+            module_lcore_private_free(module);
+            return -ENOMEM;
+        }
+
+        if (init) {
+            init(module, priv, lcore);
         }
+
+        module->lcore_private[lcore] = priv;
     }
 
-    return NULL;
+    return 0;
+}
+
+void module_lcore_private_free(struct module *module)
+{
+    unsigned lcore;
+
+    for (lcore = 0; lcore < FASTPATH_MAX_LCORES; lcore++) {
+        if (module->lcore_private[lcore] != NULL) {
+            rte_free(module->lcore_private[lcore]);
+            module->lcore_private[lcore] = NULL;
+        }
+    }
 }
 
 struct module_entry *module_find(const char *name)
 {
+    char key[NAME_SIZE];
+    int pos;
+
+    if (module_hash == NULL || module_name_key(name, key) < 0) {
+        return NULL;
+    }
+
+    pos = rte_hash_lookup(module_hash, key);
+    if (pos < 0) {
+        return NULL;
+    }
+
+    return module_entries[pos];
+}
+
+static int ctrl_filter_parse(xmlNodePtr node, struct fastpath_ctrl_filter *filter)
+{
+    const char *str;
+    struct in_addr addr;
+
+    memset(filter, 0, sizeof(struct fastpath_ctrl_filter));
+
+    str = xml_get_param(node, "type", NULL);
+    if (str == NULL) {
+        return -EINVAL;
+    }
+
+    if (strcmp(str, "ethertype") == 0) {
+        filter->type = e_FASTPATH_CTRL_FILTER_ETHERTYPE;
+        str = xml_get_param(node, "ethertype", NULL);
+        if (str == NULL) {
+            return -EINVAL;
+        }
+        filter->ether_type = strtoul(str, NULL, 0);
+        return 0;
+    }
+
+    if (strcmp(str, "tcp") == 0) {
+        filter->type = e_FASTPATH_CTRL_FILTER_TCPV4;
+    } else if (strcmp(str, "udp") == 0) {
+        filter->type = e_FASTPATH_CTRL_FILTER_UDPV4;
+    } else if (strcmp(str, "ip") == 0) {
+        filter->type = e_FASTPATH_CTRL_FILTER_IPV4;
+    } else {
+        return -EINVAL;
+    }
+
+    str = xml_get_param(node, "port", NULL);
+    if (str != NULL) {
+        filter->dst_port = strtoul(str, NULL, 0);
+    }
+
+    str = xml_get_param(node, "src-port", NULL);
+    if (str != NULL) {
+        filter->src_port = strtoul(str, NULL, 0);
+    }
+
+    str = xml_get_param(node, "address", NULL);
+    if (str != NULL) {
+        if (inet_pton(AF_INET, str, &addr) != 1) {
+            return -EINVAL;
+        }
+        filter->dst_ip = rte_be_to_cpu_32(addr.s_addr);
+    }
+
+    if (filter->type == e_FASTPATH_CTRL_FILTER_IPV4 &&
+        (filter->dst_ip == 0 || filter->dst_port != 0 || filter->src_port != 0)) {
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+void fastpath_load_ctrl_filters(void)
+{
+    int i;
+    xmlDocPtr   doc = NULL; 
+    xmlNodePtr  node;
+    xmlXPathObjectPtr nodeset;
+    xmlXPathContextPtr context = NULL;
+
+    fastpath.n_ctrl_filters = 0;
+
+    doc = xmlReadFile(FASTPATH_STACK_CONFIG, NULL, XML_PARSE_NOBLANKS);
+    if (doc == NULL) {
+        fastpath_log_error("ctrl_filters: read config file failed\n");
+        goto err_out;
+    }
+
+    context = xmlXPathNewContext(doc);
+    if (context == NULL) {
+        fastpath_log_error("ctrl_filters: get context failed\n");
+        goto err_out;
+    }
+
+    nodeset = xml_get_nodeset(context, "//ctrl-filter-list/filter");
+    if (nodeset == NULL) {
+        goto err_out;
+    }
+
+    for (i = 0; i < nodeset->nodesetval->nodeNr; i++) {
+        struct fastpath_ctrl_filter *filter;
+
+        if (fastpath.n_ctrl_filters >= FASTPATH_MAX_CTRL_FILTERS) {
+            fastpath_log_error("ctrl_filters: too many filters, max %d\n", 
+                FASTPATH_MAX_CTRL_FILTERS);
+            break;
+        }
+
+        node = nodeset->nodesetval->nodeTab[i];
+        filter = &fastpath.ctrl_filters[fastpath.n_ctrl_filters];
+
+        if (ctrl_filter_parse(node, filter) < 0) {
+            fastpath_log_error("ctrl_filters: invalid filter %d, ignored\n", i);
+            continue;
+        }
+
+        fastpath.n_ctrl_filters++;
+    }
+
+    xmlXPathFreeObject(nodeset);
+
+err_out:
+    if (context) {
+        xmlXPathFreeContext(context);
+    }
+
+    if (doc) {
+        xmlFreeDoc(doc);
+    }
+
+    return;
+}
+
+static int ring_class_parse(xmlNodePtr node, uint32_t class)
+{
+    const char *str;
+    xmlNodePtr member;
+    uint32_t val;
+
+    str = xml_get_param(node, "weight", NULL);
+    if (str != NULL) {
+        val = strtoul(str, NULL, 0);
+        if (val == 0) {
+            return -EINVAL;
+        }
+        fastpath.ring_weight[class] = val;
+    }
+
+    for (member = node->children; member; member = member->next) {
+        if (member->children == NULL || member->children->content == NULL) {
+            continue;
+        }
+
+        val = strtoul((const char *)member->children->content, NULL, 0);
+        if (!strcmp((const char *)member->name, "dscp")) {
+            if (val >= RTE_DIM(fastpath.dscp_class)) {
+                return -EINVAL;
+            }
+            fastpath.dscp_class[val] = class;
+        } else if (!strcmp((const char *)member->name, "pcp")) {
+            if (val >= RTE_DIM(fastpath.pcp_class)) {
+                return -EINVAL;
+            }
+            fastpath.pcp_class[val] = class;
+        }
+    }
+
+    return 0;
+}
+
+void fastpath_load_ring_classes(void)
+{
+    int i;
+    uint32_t class;
+    xmlDocPtr   doc = NULL; 
+    xmlNodePtr  node;
+    xmlXPathObjectPtr nodeset = NULL;
+    xmlXPathContextPtr context = NULL;
+
+    fastpath.n_ring_classes = 1;
+    fastpath.ring_sched = e_FASTPATH_RING_SCHED_STRICT;
+    for (class = 0; class < FASTPATH_MAX_RING_CLASSES; class++) {
+        fastpath.ring_weight[class] = FASTPATH_DEFAULT_RING_WEIGHT;
+    }
+    memset(fastpath.dscp_class, FASTPATH_RING_CLASS_NONE, sizeof(fastpath.dscp_class));
+    memset(fastpath.pcp_class, FASTPATH_RING_CLASS_NONE, sizeof(fastpath.pcp_class));
+
+    doc = xmlReadFile(FASTPATH_STACK_CONFIG, NULL, XML_PARSE_NOBLANKS);
+    if (doc == NULL) {
+        fastpath_log_error("ring_classes: read config file failed\n");
+        goto out;
+    }
+
+    context = xmlXPathNewContext(doc);
+    if (context == NULL) {
+        fastpath_log_error("ring_classes: get context failed\n");
+        goto out;
+    }
+
+    node = xml_get_node(context, "//ring-class-list/scheduler", NULL);
+    if (node != NULL && node->children != NULL && 
+        strcmp((const char *)node->children->content, "wrr") == 0) {
+        fastpath.ring_sched = e_FASTPATH_RING_SCHED_WRR;
+    }
+
+    nodeset = xml_get_nodeset(context, "//ring-class-list/class");
+    if (nodeset == NULL) {
+        goto out;
+    }
+
+    if (nodeset->nodesetval->nodeNr > FASTPATH_MAX_RING_CLASSES) {
+        fastpath_log_error("ring_classes: too many classes, max %d\n", 
+            FASTPATH_MAX_RING_CLASSES);
+        goto out;
+    }
+
+    for (i = 0; i < nodeset->nodesetval->nodeNr; i++) {
+        node = nodeset->nodesetval->nodeTab[i];
+        if (ring_class_parse(node, i) < 0) {
+            fastpath_log_error("ring_classes: invalid class %d\n", i);
+            goto out;
+        }
+    }
+
+    fastpath.n_ring_classes = nodeset->nodesetval->nodeNr;
+
+out:
+    /* unmapped code points fall into the lowest priority class */
+    for (i = 0; i < (int) RTE_DIM(fastpath.dscp_class); i++) {
+        if (fastpath.dscp_class[i] >= fastpath.n_ring_classes) {
+            fastpath.dscp_class[i] = fastpath.n_ring_classes - 1;
+        }
+    }
+
+    for (i = 0; i < (int) RTE_DIM(fastpath.pcp_class); i++) {
+        if (fastpath.pcp_class[i] >= fastpath.n_ring_classes) {
+            fastpath.pcp_class[i] = fastpath.n_ring_classes - 1;
+        }
+    }
+
+    if (nodeset) {
+        xmlXPathFreeObject(nodeset);
+    }
+
+    if (context) {
+        xmlXPathFreeContext(context);
+    }
+
+    if (doc) {
+        xmlFreeDoc(doc);
+    }
+
+    return;
+}
+
+void fastpath_load_pipeline(void)
+{
+    int i;
+    const char *name, *str;
+    xmlDocPtr   doc = NULL; 
+    xmlNodePtr  node;
+    xmlXPathObjectPtr nodeset;
+    xmlXPathContextPtr context = NULL;
+
+    doc = xmlReadFile(FASTPATH_STACK_CONFIG, NULL, XML_PARSE_NOBLANKS);
+    if (doc == NULL) {
+        fastpath_log_error("pipeline: read config file failed\n");
+        goto err_out;
+    }
+
+    context = xmlXPathNewContext(doc);
+    if (context == NULL) {
+        fastpath_log_error("pipeline: get context failed\n");
+        goto err_out;
+    }
+
+    /* no stage configured, run to completion */
+    nodeset = xml_get_nodeset(context, "//pipeline-list/stage");
+    if (nodeset == NULL) {
+        goto err_out;
+    }
+
+    for (i = 0; i < nodeset->nodesetval->nodeNr; i++) {
+        node = nodeset->nodesetval->nodeTab[i];
+
+        name = xml_get_param(node, "module", NULL);
+        str = xml_get_param(node, "lcore", NULL);
+        if (name == NULL || str == NULL) {
+            fastpath_log_error("pipeline: invalid stage %d, ignored\n", i);
+            continue;
+        }
+
+        if (pipeline_stage_add(name, strtoul(str, NULL, 0)) < 0) {
+            rte_panic("Cannot add pipeline stage %s\n", name);
+        }
+    }
+
+    xmlXPathFreeObject(nodeset);
+
+err_out:
+    if (context) {
+        xmlXPathFreeContext(context);
+    }
+
+    if (doc) {
+        xmlFreeDoc(doc);
+    }
+
+    return;
+}
+
+/* Size and aging time of the FDB all bridges share */
+void fastpath_load_fdb(void)
+{
+    const char *str;
+    xmlDocPtr   doc = NULL; 
+    xmlXPathContextPtr context = NULL;
+
+    fastpath.fdb_size = FASTPATH_BRIDGE_FDB_SIZE;
+    fastpath.fdb_aging = FASTPATH_BRIDGE_FDB_AGING;
+
+    doc = xmlReadFile(FASTPATH_STACK_CONFIG, NULL, XML_PARSE_NOBLANKS);
+    if (doc == NULL) {
+        fastpath_log_error("fdb: read config file failed\n");
+        goto err_out;
+    }
+
+    context = xmlXPathNewContext(doc);
+    if (context == NULL) {
+        fastpath_log_error("fdb: get context failed\n");
+        goto err_out;
+    }
+
+    str = xml_get_param(xml_get_node(context, "/config", NULL), "fdb-size", NULL);
+    if (str != NULL) {
+        fastpath.fdb_size = strtoul(str, NULL, 0);
+        if (fastpath.fdb_size == 0 || fastpath.fdb_size > FASTPATH_BRIDGE_FDB_MAX_SIZE) {
+            fastpath_log_error("fdb: invalid size %s, max %d\n",
+                str, FASTPATH_BRIDGE_FDB_MAX_SIZE);
+            fastpath.fdb_size = FASTPATH_BRIDGE_FDB_SIZE;
+        }
+    }
+
+    str = xml_get_param(xml_get_node(context, "/config", NULL), "fdb-aging", NULL);
+    if (str != NULL) {
+        fastpath.fdb_aging = strtoul(str, NULL, 0);
+    }
+
+err_out:
+    if (context) {
+        xmlXPathFreeContext(context);
+    }
+
+    if (doc) {
+        xmlFreeDoc(doc);
+    }
+
+    return;
+}
+
+/* Exception interface of each port, KNI unless <exception> says tap */
+void fastpath_load_exception(void)
+{
+    int i;
+    uint32_t port;
+    const char *name, *str;
+    xmlDocPtr   doc = NULL; 
+    xmlNodePtr  node;
+    xmlXPathObjectPtr nodeset;
+    xmlXPathContextPtr context = NULL;
+
+    for (port = 0; port < FASTPATH_MAX_NIC_PORTS; port++) {
+        fastpath.exc_type[port] = e_FASTPATH_EXC_KNI;
+        fastpath.exc_queues[port] = 1;
+        fastpath.exc_gro[port] = 0;
+    }
+
+    doc = xmlReadFile(FASTPATH_STACK_CONFIG, NULL, XML_PARSE_NOBLANKS);
+    if (doc == NULL) {
+        fastpath_log_error("exception: read config file failed\n");
+        goto err_out;
+    }
+
+    context = xmlXPathNewContext(doc);
+    if (context == NULL) {
+        fastpath_log_error("exception: get context failed\n");
+        goto err_out;
+    }
+
+    nodeset = xml_get_nodeset(context, "//port-list/ethernet");
+    if (nodeset == NULL) {
+        goto err_out;
+    }
+
+    for (i = 0; i < nodeset->nodesetval->nodeNr; i++) {
+        node = nodeset->nodesetval->nodeTab[i];
+
+        name = xml_get_param(node, "name", NULL);
+        if (name == NULL || strlen(name) <= 4) {
+            fastpath_log_error("exception: invalid port %d, ignored\n", i);
+            continue;
+        }
+
+        port = strtoul(&name[4], NULL, 0);
+        if (port >= FASTPATH_MAX_NIC_PORTS) {
+            fastpath_log_error("exception: invalid port %s, ignored\n", name);
+            continue;
+        }
+
+        str = xml_get_param(node, "exception", "kni");
+        if (strcmp(str, "tap") == 0) {
+            fastpath.exc_type[port] = e_FASTPATH_EXC_TAP;
+        } else if (strcmp(str, "kni") != 0) {
+            fastpath_log_error("exception: unknown type %s for %s, kni used\n",
+                str, name);
+        }
+
+        str = xml_get_param(node, "exception-queues", "1");
+        fastpath.exc_queues[port] = strtoul(str, NULL, 0);
+        if (fastpath.exc_queues[port] == 0 ||
+            fastpath.exc_queues[port] > FASTPATH_TAP_MAX_QUEUES) {
+            fastpath_log_error("exception: invalid queues %s for %s, max %d\n",
+                str, name, FASTPATH_TAP_MAX_QUEUES);
+            fastpath.exc_queues[port] = 1;
+        }
+
+        /* KNI passes the first segment of a chain only, no coalescing */
+        str = xml_get_param(node, "exception-gro", "off");
+        if (strcmp(str, "on") == 0) {
+            if (fastpath.exc_type[port] == e_FASTPATH_EXC_TAP) {
+                fastpath.exc_gro[port] = 1;
+            } else {
+                fastpath_log_error("exception: gro needs a tap for %s, ignored\n",
+                    name);
+            }
+        }
+    }
+
+    xmlXPathFreeObject(nodeset);
+
+err_out:
+    if (context) {
+        xmlXPathFreeContext(context);
+    }
+
+    if (doc) {
+        xmlFreeDoc(doc);
+    }
+
+    return;
+}
+
+/*
+ * Specialize the module graph once it is connected: a hop whose peer is
+ * always of one type may call that type's handler directly when every
+ * module of the type still uses the stock receive/xmit, i.e. no pipeline
+ * stage or other hook is interposed on it.
+ */
+void fastpath_compile_stack(int enable)
+{
+    uint32_t type, dir, direct = 0;
     struct module_entry *entry;
-    
+    struct module *module;
+    static const struct {
+        void (*receive)(struct rte_mbuf *m, struct module *peer, struct module *local);
+        void (*transmit)(struct rte_mbuf *m, struct module *peer, struct module *local);
+    } stock[MODULE_TYPE_MAX] = {
+        [MODULE_TYPE_ETHERNET]  = {ethernet_receive, ethernet_xmit},
+        [MODULE_TYPE_VLAN]      = {vlan_receive, vlan_xmit},
+        [MODULE_TYPE_BRIDGE]    = {bridge_receive, bridge_xmit},
+        [MODULE_TYPE_INTERFACE] = {interface_receive, interface_xmit},
+        [MODULE_TYPE_ACL]       = {acl_receive, acl_xmit},
+        [MODULE_TYPE_TCM]       = {tcm_receive, tcm_xmit},
+        [MODULE_TYPE_ROUTE]     = {route_receive, route_xmit},
+    };
+
+    fastpath.stack_direct = 0;
+    if (!enable) {
+        fastpath_log_info("stack compile disabled, generic dispatch\n");
+        return;
+    }
+
+    for (type = 0; type < MODULE_TYPE_MAX; type++) {
+        direct |= STACK_DIRECT_BIT(type, PKT_DIR_RECV) | STACK_DIRECT_BIT(type, PKT_DIR_XMIT);
+    }
+
     LIST_FOREACH(entry, &module_list, entry) {
-        if (strcmp(entry->module->name, name) == 0) {
-            return entry;
+        module = entry->module;
+        if (module->type >= MODULE_TYPE_MAX) {
+            continue;
+        }
+
+        if (module->receive != stock[module->type].receive) {
+            direct &= ~STACK_DIRECT_BIT(module->type, PKT_DIR_RECV);
+        }
+        if (module->transmit != stock[module->type].transmit) {
+            direct &= ~STACK_DIRECT_BIT(module->type, PKT_DIR_XMIT);
+        }
+
+        /* acl/tcm sit between interface and route, those hops are mixed */
+        if (module->type == MODULE_TYPE_ACL || module->type == MODULE_TYPE_TCM) {
+            direct &= ~STACK_DIRECT_BIT(MODULE_TYPE_ROUTE, PKT_DIR_RECV);
+            direct &= ~STACK_DIRECT_BIT(MODULE_TYPE_INTERFACE, PKT_DIR_XMIT);
         }
     }
 
-    return NULL;
+    fastpath.stack_direct = direct;
+
+    for (type = 0; type < MODULE_TYPE_MAX; type++) {
+        for (dir = PKT_DIR_RECV; dir <= PKT_DIR_XMIT; dir++) {
+            fastpath_log_info("stack compile: type %u %s %s\n", type,
+                dir == PKT_DIR_RECV ? "recv" : "xmit",
+                (direct & STACK_DIRECT_BIT(type, dir)) ? "direct" : "generic");
+        }
+    }
 }
 
 void fastpath_init_stack(void)
@@ -277,7 +913,9 @@ void fastpath_init_stack(void)
         goto err_out;
     }
     for (i = 0; i < nodeset->nodesetval->nodeNr; i++) {
-        uint16_t pid, vid;
+        uint16_t pid, vid, svid;
+        uint32_t mac_limit, flags;
+        char lower[32];
         xmlNodePtr member;
         
         node = nodeset->nodesetval->nodeTab[i];
@@ -296,6 +934,35 @@ void fastpath_init_stack(void)
         str = xml_get_param(node, "vlan", NULL);
         vid = strtoul(str, NULL, 0);
 
+        /* QinQ: <vlan> is the C-VLAN inside <outer-vlan> on every port */
+        str = xml_get_param(node, "outer-vlan", NULL);
+        svid = str ? strtoul(str, NULL, 0) : 0;
+
+        str = xml_get_param(node, "mac-limit", NULL);
+        mac_limit = FASTPATH_BRIDGE_MAC_LIMIT;
+        if (str != NULL) {
+            char *end;
+
+            /* 0 would stop learning altogether */
+            mac_limit = strtoul(str, &end, 0);
+            if (end == str || *end != '\0' || mac_limit == 0) {
+                fastpath_log_error("bridge %s: invalid mac-limit %s\n",
+                    xml_get_param(node, "name", NULL), str);
+                goto err_out;
+            }
+        }
+
+        flags = 0;
+        str = xml_get_param(node, "arp-suppress", "off");
+        if (strcmp(str, "on") == 0) {
+            flags |= BRIDGE_F_ARP_SUPPRESS;
+        }
+
+        str = xml_get_param(node, "mcast-snooping", "off");
+        if (strcmp(str, "on") == 0) {
+            flags |= BRIDGE_F_MCAST_SNOOPING;
+        }
+
         for (member = node->children; member; member = member->next) {
             if (!strcmp((const char *)member->name, "port")) {
                 pid = strtoul((const char *)&member->children->content[4], NULL, 0);
@@ -303,21 +970,53 @@ void fastpath_init_stack(void)
                 snprintf(expr, sizeof(expr), "//port-list/ethernet[name='%s']/native", 
                     member->children->content);
                 node = xml_get_node(context, expr, NULL);
-                if (strtoul((const char *)node->children->content, NULL, 0) == vid) {
+                if (svid == 0 &&
+                    strtoul((const char *)node->children->content, NULL, 0) == vid) {
                     continue;
                 }
+
+                if (svid != 0) {
+                    snprintf(lower, sizeof(lower), "%s.%d", member->children->content, svid);
+                } else {
+                    snprintf(lower, sizeof(lower), "%s", member->children->content);
+                }
                 
-                snprintf(expr, sizeof(expr), "%s.%d", member->children->content, vid);
+                snprintf(expr, sizeof(expr), "%s.%d", lower, vid);
+                if (strlen(expr) >= IFNAMSIZ) {
+                    fastpath_log_error("bridge vlan device name %s too long\n", expr);
+                    goto err_out;
+                }
+
                 if (module_find(expr) == NULL) {
-                    module = vlan_init(pid, vid);
+                    if (svid != 0) {
+                        module = vlan_init(pid, svid, vid);
+                    } else {
+                        module = vlan_init(pid, vid, 0);
+                    }
+                    if (module == NULL) {
+                        goto err_out;
+                    }
                     module_add(module, vid, 0);
 
-                    snprintf(expr, sizeof(expr), "vconfig add %s %d", member->children->content, vid);
+                    /* the kernel nests the C-VLAN device in the S-VLAN one */
+                    if (svid != 0 && if_nametoindex(lower) == 0) {
+                        snprintf(expr, sizeof(expr), "vconfig add %s %d", member->children->content, svid);
+                        if (execute_cmd(expr) < 0) {
+                            goto err_out;
+                        }
+
+                        snprintf(expr, sizeof(expr), "ifconfig %s up", lower);
+                        if (execute_cmd(expr) < 0) {
+                            goto err_out;
+                        }
+                    }
+
+                    snprintf(expr, sizeof(expr), "vconfig add %s %d", lower, vid);
                     if (execute_cmd(expr) < 0) {
                         goto err_out;
                     }
 
-                    snprintf(expr, sizeof(expr), "ifconfig %s.%d up", member->children->content, vid);
+                    snprintf(expr, sizeof(expr), "ifconfig %s.%d up", lower, vid);
                     if (execute_cmd(expr) < 0) {
                         goto err_out;
                     }
@@ -325,7 +1024,10 @@ void fastpath_init_stack(void)
             }
         }
 
-        module = bridge_init(vid);
+        module = bridge_init(vid, mac_limit, flags);
+        if (module == NULL) {
+            goto err_out;
+        }
         module_add(module, vid, 0);
     }
 
@@ -500,7 +1202,7 @@ void fastpath_init_stack(void)
 
     nodeset = xml_get_nodeset(context, "//bridge-list/bridge");
     for (i = 0; i < nodeset->nodesetval->nodeNr; i++) {
-        uint32_t vid, pid = 0;
+        uint32_t vid, svid, pid = 0;
         xmlNodePtr member;
         struct module *br, *vlan, *eth;
         
@@ -513,12 +1215,16 @@ void fastpath_init_stack(void)
         str = xml_get_param(node, "vlan", NULL);
         vid = strtoul(str, NULL, 0);
 
+        str = xml_get_param(node, "outer-vlan", NULL);
+        svid = str ? strtoul(str, NULL, 0) : 0;
+
         for (member = node->children; member; member = member->next) {
             if (!strcmp((const char *)member->name, "port")) {
                 snprintf(expr, sizeof(expr), "//port-list/ethernet[name='%s']/native", 
                     member->children->content);
                 node = xml_get_node(context, expr, NULL);
-                if (strtoul((const char *)node->children->content, NULL, 0) == vid) {
+                if (svid == 0 &&
+                    strtoul((const char *)node->children->content, NULL, 0) == vid) {
                     entry = module_find((const char *)member->children->content);
                     eth = entry->module;
 
@@ -530,11 +1236,23 @@ void fastpath_init_stack(void)
                         goto err_out;
                     }
                 } else {
-                    snprintf(expr, sizeof(expr), "%s.%d", member->children->content, vid);
+                    if (svid != 0) {
+                        snprintf(expr, sizeof(expr), "%s.%d.%d",
+                            member->children->content, svid, vid);
+                    } else {
+                        snprintf(expr, sizeof(expr), "%s.%d", member->children->content, vid);
+                    }
                     entry = module_find(expr);
+                    if (entry == NULL) {
+                        fastpath_log_error("bridge %s: no vlan device %s\n", br->name, expr);
+                        goto err_out;
+                    }
                     vlan = entry->module;
 
                     entry = module_find((const char *)member->children->content);
+                    if (entry == NULL) {
+                        goto err_out;
+                    }
                     eth = entry->module;
                     
                     br->connect(br, vlan, &pid);
@@ -545,11 +1263,18 @@ void fastpath_init_stack(void)
                         goto err_out;
                     }
 
-                    vlan->connect(vlan, eth, &vid);
+                    vlan->connect(vlan, eth, NULL);
                 }
             }
         }
     }
+
+    pipeline_bind_stages();
+
+    /* A/B switch, <stack-compile>off</stack-compile> keeps generic dispatch */
+    node = xml_get_node(context, "//stack-compile", NULL);
+    fastpath_compile_stack(node == NULL || node->children == NULL ||
+        strcmp((const char *)node->children->content, "off") != 0);
     
 err_out:      
     if (context) {
@@ -599,8 +1324,9 @@ void fastpath_cleanup_stack(void)
         goto err_out;
     }
     for (i = 0; i < nodeset->nodesetval->nodeNr; i++) {
-        uint16_t pid, vid;
+        uint16_t pid, vid, svid;
         xmlNodePtr member;
+        char lower[256], name[256];
         
         node = nodeset->nodesetval->nodeTab[i];
         str = xml_get_param(node, "name", NULL);
@@ -618,6 +1344,9 @@ void fastpath_cleanup_stack(void)
         str = xml_get_param(node, "vlan", NULL);
         vid = strtoul(str, NULL, 0);
 
+        str = xml_get_param(node, "outer-vlan", NULL);
+        svid = str ? strtoul(str, NULL, 0) : 0;
+
         for (member = node->children; member; member = member->next) {
             if (!strcmp((const char *)member->name, "port")) {
                 pid = strtoul((const char *)&member->children->content[4], NULL, 0);
@@ -625,20 +1354,38 @@ void fastpath_cleanup_stack(void)
                 snprintf(expr, sizeof(expr), "//port-list/ethernet[name='%s']/native", 
                     member->children->content);
                 node = xml_get_node(context, expr, NULL);
-                if (strtoul((const char *)node->children->content, NULL, 0) == vid) {
+                if (svid == 0 &&
+                    strtoul((const char *)node->children->content, NULL, 0) == vid) {
                     continue;
                 }
-                
-                snprintf(expr, sizeof(expr), "%s.%d", member->children->content, vid);
-                if (module_find(expr) == NULL) {
+
+                /* the names fastpath_init_stack gives, vEthN.<svid>.<cvid> for QinQ */
+                if (svid != 0) {
+                    snprintf(lower, sizeof(lower), "%s.%d", member->children->content, svid);
+                } else {
+                    snprintf(lower, sizeof(lower), "%s", member->children->content);
+                }
+                snprintf(name, sizeof(name), "%s.%d", lower, vid);
+
+                if (module_find(name) == NULL) {
                     snprintf(expr, sizeof(expr), "ifconfig %s down", member->children->content);
                     if (execute_cmd(expr) < 0) {
                         goto err_out;
                     }
-                    
-                    snprintf(expr, sizeof(expr), "vconfig rem %s.%d", member->children->content, vid);
-                    if (execute_cmd(expr) < 0) {
-                        goto err_out;
+
+                    /* the inner device first, an S-VLAN one may be shared and gone */
+                    if (if_nametoindex(name) != 0) {
+                        snprintf(expr, sizeof(expr), "vconfig rem %s", name);
+                        if (execute_cmd(expr) < 0) {
+                            goto err_out;
+                        }
+                    }
+
+                    if (svid != 0 && if_nametoindex(lower) != 0) {
+                        snprintf(expr, sizeof(expr), "vconfig rem %s", lower);
+                        if (execute_cmd(expr) < 0) {
+                            goto err_out;
+                        }
                     }
                 }
             }
@@ -0,0 +1,403 @@
+
+#include <stddef.h>
+#include <sys/uio.h>
+#include <net/if_arp.h>
+#include <linux/virtio_net.h>
+
+#include "include/fastpath.h"
+
+#include <rte_udp.h>
+
+/*
+ * TAP exception interface, an alternative to KNI that needs no out of
+ * tree module. Each queue is a file descriptor on the same multiqueue
+ * tap device; packets are moved with one readv/writev each, a virtio-net
+ * header in front and the mbuf segments behind it, so chains need no
+ * copy. The kernel may hand over TCP/UDP packets with a partial checksum
+ * (TUN_F_CSUM), finished by the NIC when it can and in software otherwise.
+ * Chains marked PKT_TX_TCP_SEG by GRO go to the kernel as GSO packets.
+ */
+#define TAP_SEG_ROOM \
+    (FASTPATH_DEFAULT_MBUF_SIZE - sizeof(struct rte_mbuf) - RTE_PKTMBUF_HEADROOM)
+#define TAP_MAX_SEGS \
+    ((FASTPATH_MTU_TO_FRAME_LEN(FASTPATH_MAX_MTU) + TAP_SEG_ROOM - 1) / TAP_SEG_ROOM)
+
+struct tap_queue {
+    int fd;
+
+    /* mbufs readv fills next, kept when nothing was read */
+    struct rte_mbuf *spare[TAP_MAX_SEGS];
+    uint32_t n_spare;
+};
+
+struct tap_port {
+    char name[IFNAMSIZ];
+    struct tap_queue queues[FASTPATH_TAP_MAX_QUEUES];
+    uint32_t n_queues;
+    uint32_t rx_queue;
+};
+
+static struct tap_port *tap_ports[FASTPATH_MAX_NIC_PORTS];
+
+static int
+tap_set_link(const char *name, uint8_t port)
+{
+    struct ifreq ifr;
+    struct ether_addr addr;
+    int sock, ret = 0;
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        return -errno;
+    }
+
+    /* the kernel answers ARP for the NIC, give it the NIC address */
+    rte_eth_macaddr_get(port, &addr);
+    memset(&ifr, 0, sizeof(ifr));
+    snprintf(ifr.ifr_name, IFNAMSIZ, "%s", name);
+    ifr.ifr_hwaddr.sa_family = ARPHRD_ETHER;
+    memcpy(ifr.ifr_hwaddr.sa_data, &addr, ETHER_ADDR_LEN);
+    if (ioctl(sock, SIOCSIFHWADDR, &ifr) < 0) {
+        ret = -errno;
+        goto out;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    snprintf(ifr.ifr_name, IFNAMSIZ, "%s", name);
+    ifr.ifr_mtu = fastpath.port_mtu[port];
+    if (ioctl(sock, SIOCSIFMTU, &ifr) < 0) {
+        ret = -errno;
+    }
+
+out:
+    close(sock);
+    return ret;
+}
+
+static int
+tap_open_queue(const char *name, uint32_t n_queues)
+{
+    struct ifreq ifr;
+    int fd, hdr_len = sizeof(struct virtio_net_hdr);
+
+    fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    snprintf(ifr.ifr_name, IFNAMSIZ, "%s", name);
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI | IFF_VNET_HDR;
+    if (n_queues > 1) {
+        ifr.ifr_flags |= IFF_MULTI_QUEUE;
+    }
+
+    if (ioctl(fd, TUNSETIFF, &ifr) < 0 ||
+        ioctl(fd, TUNSETVNETHDRSZ, &hdr_len) < 0 ||
+        ioctl(fd, TUNSETOFFLOAD, TUN_F_CSUM) < 0) {
+        int ret = -errno;
+
+        close(fd);
+        return ret;
+    }
+
+    return fd;
+}
+
+int tap_open(uint8_t port, const char *name, uint32_t n_queues)
+{
+    struct tap_port *tap;
+    uint32_t q;
+    int fd, ret;
+
+    if (port >= FASTPATH_MAX_NIC_PORTS || tap_ports[port] != NULL) {
+        return -EINVAL;
+    }
+
+    if (n_queues == 0 || n_queues > FASTPATH_TAP_MAX_QUEUES) {
+        return -EINVAL;
+    }
+
+    tap = rte_zmalloc(NULL, sizeof(struct tap_port), RTE_CACHE_LINE_SIZE);
+    if (tap == NULL) {
+        return -ENOMEM;
+    }
+
+    snprintf(tap->name, sizeof(tap->name), "%s", name);
+    for (q = 0; q < n_queues; q++) {
+        fd = tap_open_queue(name, n_queues);
+        if (fd < 0) {
+            fastpath_log_error("tap_open: %s queue %u failed (%s)\n",
+                name, q, strerror(-fd));
+            ret = fd;
+            goto err_out;
+        }
+
+        tap->queues[q].fd = fd;
+        tap->n_queues++;
+    }
+
+    ret = tap_set_link(name, port);
+    if (ret < 0) {
+        fastpath_log_error("tap_open: %s link setup failed (%s)\n",
+            name, strerror(-ret));
+        goto err_out;
+    }
+
+    tap_ports[port] = tap;
+    fastpath_log_info("tap_open: port %u exception interface %s, %u queues\n",
+        port, name, n_queues);
+
+    return 0;
+
+err_out:
+    for (q = 0; q < tap->n_queues; q++) {
+        close(tap->queues[q].fd);
+    }
+    rte_free(tap);
+    return ret;
+}
+
+void tap_close(uint8_t port)
+{
+    struct tap_port *tap;
+    uint32_t q, k;
+
+    if (port >= FASTPATH_MAX_NIC_PORTS || tap_ports[port] == NULL) {
+        return;
+    }
+
+    tap = tap_ports[port];
+    tap_ports[port] = NULL;
+
+    for (q = 0; q < tap->n_queues; q++) {
+        for (k = 0; k < tap->queues[q].n_spare; k++) {
+            rte_pktmbuf_free(tap->queues[q].spare[k]);
+        }
+        close(tap->queues[q].fd);
+    }
+
+    rte_free(tap);
+}
+
+/**
+ * Write packets to the kernel, every packet is consumed
+ */
+uint32_t tap_tx_burst(uint8_t port, struct rte_mbuf **pkts, uint32_t n_pkts)
+{
+    struct tap_port *tap = tap_ports[port];
+    struct virtio_net_hdr vnet_hdr;
+    struct iovec iov[TAP_MAX_IOV];
+    uint32_t i, n_sent = 0;
+
+    for (i = 0; i < n_pkts; i++) {
+        struct rte_mbuf *m = pkts[i], *seg;
+        struct tap_queue *txq;
+        uint32_t n_iov = 1;
+
+        memset(&vnet_hdr, 0, sizeof(vnet_hdr));
+        if (m->ol_flags & PKT_TX_TCP_SEG) {
+            /* coalesced, the TCP checksum holds the pseudo header sum */
+            vnet_hdr.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+            vnet_hdr.gso_type = (m->ol_flags & PKT_TX_IPV6) ?
+                VIRTIO_NET_HDR_GSO_TCPV6 : VIRTIO_NET_HDR_GSO_TCPV4;
+            vnet_hdr.hdr_len = m->l2_len + m->l3_len + m->l4_len;
+            vnet_hdr.gso_size = m->tso_segsz;
+            vnet_hdr.csum_start = m->l2_len + m->l3_len;
+            vnet_hdr.csum_offset = offsetof(struct tcp_hdr, cksum);
+        }
+
+        /* keep a flow on one queue, the kernel processes each on its own */
+        txq = &tap->queues[(m->ol_flags & PKT_RX_RSS_HASH) ?
+            m->hash.rss % tap->n_queues : 0];
+
+        iov[0].iov_base = &vnet_hdr;
+        iov[0].iov_len = sizeof(vnet_hdr);
+        for (seg = m; seg != NULL && n_iov < RTE_DIM(iov); seg = seg->next) {
+            iov[n_iov].iov_base = rte_pktmbuf_mtod(seg, void *);
+            iov[n_iov].iov_len = seg->data_len;
+            n_iov++;
+        }
+
+        if (likely(seg == NULL) && likely(writev(txq->fd, iov, n_iov) > 0)) {
+            n_sent++;
+        }
+
+        rte_pktmbuf_free(m);
+    }
+
+    return n_sent;
+}
+
+/* Finish a partial checksum over a chain, as virtio-net defines it */
+static void
+tap_complete_cksum(struct rte_mbuf *m, uint16_t start, uint16_t offset)
+{
+    struct rte_mbuf *seg;
+    uint32_t sum = 0, off = 0;
+    uint16_t *field;
+
+    for (seg = m; seg != NULL; seg = seg->next) {
+        uint32_t from = 0, seg_sum;
+
+        if (off + seg->data_len <= start) {
+            off += seg->data_len;
+            continue;
+        }
+
+        if (off < start) {
+            from = start - off;
+        }
+
+        seg_sum = rte_raw_cksum(rte_pktmbuf_mtod(seg, char *) + from,
+            seg->data_len - from);
+
+        /* a segment starting at an odd offset contributes swapped bytes */
+        if ((off + from - start) & 1) {
+            seg_sum = rte_bswap16((uint16_t) seg_sum);
+        }
+
+        sum += seg_sum;
+        off += seg->data_len;
+    }
+
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+
+    /* the field lies in the first segment, after the headers */
+    field = (uint16_t *)(rte_pktmbuf_mtod(m, char *) + start + offset);
+    *field = (uint16_t) ~sum;
+    if (*field == 0 && offset == offsetof(struct udp_hdr, dgram_cksum)) {
+        *field = 0xffff;
+    }
+}
+
+static void
+tap_rx_offload(struct rte_mbuf *m, const struct virtio_net_hdr *vnet_hdr)
+{
+    uint16_t start = vnet_hdr->csum_start, offset = vnet_hdr->csum_offset;
+    uint64_t flag = 0;
+    uint16_t ether_type, l2_len;
+    struct ether_hdr *eth_hdr;
+
+    if (!(vnet_hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM)) {
+        return;
+    }
+
+    if (unlikely((uint32_t) start + offset + sizeof(uint16_t) > m->data_len)) {
+        return;
+    }
+
+    eth_hdr = rte_pktmbuf_mtod(m, struct ether_hdr *);
+    ether_type = rte_be_to_cpu_16(eth_hdr->ether_type);
+    l2_len = sizeof(struct ether_hdr);
+    while ((ether_type == ETHER_TYPE_VLAN || ether_type == ETHER_TYPE_QINQ) &&
+           l2_len + sizeof(struct vlan_hdr) <= start) {
+        struct vlan_hdr *vlan_hdr = (struct vlan_hdr *)((char *) eth_hdr + l2_len);
+
+        ether_type = rte_be_to_cpu_16(vlan_hdr->eth_proto);
+        l2_len += sizeof(struct vlan_hdr);
+    }
+
+    if (offset == offsetof(struct tcp_hdr, cksum)) {
+        flag = PKT_TX_TCP_CKSUM;
+    } else if (offset == offsetof(struct udp_hdr, dgram_cksum)) {
+        flag = PKT_TX_UDP_CKSUM;
+    }
+
+    /* the kernel left the pseudo header sum in place, as the NIC expects */
+    if (flag != 0 && start > l2_len &&
+        (ether_type == ETHER_TYPE_IPv4 || ether_type == ETHER_TYPE_IPv6) &&
+        (fastpath.tx_offload[m->port] &
+            (flag == PKT_TX_TCP_CKSUM ? DEV_TX_OFFLOAD_TCP_CKSUM : DEV_TX_OFFLOAD_UDP_CKSUM))) {
+        m->ol_flags |= flag |
+            (ether_type == ETHER_TYPE_IPv4 ? PKT_TX_IPV4 : PKT_TX_IPV6);
+        m->l2_len = l2_len;
+        m->l3_len = start - l2_len;
+        return;
+    }
+
+    tap_complete_cksum(m, start, offset);
+}
+
+/**
+ * Read packets the kernel sent, a packet may span several mbufs
+ */
+uint32_t tap_rx_burst(uint8_t port, struct rte_mbuf **pkts, uint32_t n_pkts,
+    struct rte_mempool *mp)
+{
+    struct tap_port *tap = tap_ports[port];
+    struct virtio_net_hdr vnet_hdr;
+    struct iovec iov[TAP_MAX_SEGS + 1];
+    uint32_t max_len, n_segs, q, n_rx = 0;
+
+    /* enough mbufs for the largest frame of the port */
+    max_len = FASTPATH_MTU_TO_FRAME_LEN(fastpath.port_mtu[port]);
+    n_segs = RTE_MIN((max_len + TAP_SEG_ROOM - 1) / TAP_SEG_ROOM, TAP_MAX_SEGS);
+
+    for (q = 0; q < tap->n_queues && n_rx < n_pkts; q++) {
+        struct tap_queue *rxq = &tap->queues[(tap->rx_queue + q) % tap->n_queues];
+
+        while (n_rx < n_pkts) {
+            struct rte_mbuf *m, *prev = NULL;
+            uint32_t k, used;
+            ssize_t len;
+
+            for ( ; rxq->n_spare < n_segs; rxq->n_spare++) {
+                rxq->spare[rxq->n_spare] = rte_pktmbuf_alloc(mp);
+                if (unlikely(rxq->spare[rxq->n_spare] == NULL)) {
+                    break;
+                }
+            }
+            if (unlikely(rxq->n_spare < n_segs)) {
+                goto out;
+            }
+
+            iov[0].iov_base = &vnet_hdr;
+            iov[0].iov_len = sizeof(vnet_hdr);
+            for (k = 0; k < n_segs; k++) {
+                iov[k + 1].iov_base = rte_pktmbuf_mtod(rxq->spare[k], void *);
+                iov[k + 1].iov_len = rte_pktmbuf_tailroom(rxq->spare[k]);
+            }
+
+            len = readv(rxq->fd, iov, n_segs + 1);
+            if (len <= (ssize_t) sizeof(vnet_hdr)) {
+                break;
+            }
+            len -= sizeof(vnet_hdr);
+
+            /* chain the segments readv filled */
+            m = rxq->spare[0];
+            m->pkt_len = len;
+            for (used = 0; len > 0; used++) {
+                struct rte_mbuf *seg = rxq->spare[used];
+
+                seg->data_len = RTE_MIN((uint32_t) len, (uint32_t) iov[used + 1].iov_len);
+                len -= seg->data_len;
+                if (prev != NULL) {
+                    prev->next = seg;
+                }
+                prev = seg;
+            }
+            m->nb_segs = used;
+            m->port = port;
+
+            for (k = used; k < rxq->n_spare; k++) {
+                rxq->spare[k - used] = rxq->spare[k];
+            }
+            rxq->n_spare -= used;
+
+            tap_rx_offload(m, &vnet_hdr);
+            pkts[n_rx++] = m;
+        }
+    }
+
+out:
+    tap->rx_queue++;
+    return n_rx;
+}
+
+int tap_is_open(uint8_t port)
+{
+    return port < FASTPATH_MAX_NIC_PORTS && tap_ports[port] != NULL;
+}
@@ -47,11 +47,16 @@ union ipv4_5tuple_host {
 };
 
 struct tcm_private {
-    void *flows;
     struct module *lower;
     struct module *upper;
 };
 
+/* Meters and counters of one lcore, flows keep hitting the same worker */
+struct tcm_lcore_private {
+    uint64_t actions[DROP + 1];
+    uint8_t flows[0] __rte_cache_aligned;
+};
+
 static uint32_t tcm_mode;
 static __m128i mask0;
 
@@ -90,16 +95,18 @@ ipv4_hash_crc(const void *data, __rte_unused uint32_t data_len,
 }
 
 static void
-tcm_configure_flow_table(struct tcm_private *private)
+tcm_configure_flow_table(__rte_unused struct module *tcm, void *priv, 
+    __rte_unused unsigned lcore)
 {
     uint32_t i, j;
+    struct tcm_lcore_private *lcp = (struct tcm_lcore_private *)priv;
     struct rte_meter_srtcm *srtcm_flow;
     struct rte_meter_trtcm *trtcm_flow;
 
     switch (tcm_mode) {
     case TCM_MODE_SRTCM_COLOR_BLIND:
     case TCM_MODE_SRTCM_COLOR_AWARE:
-        srtcm_flow = (struct rte_meter_srtcm *)private->flows;
+        srtcm_flow = (struct rte_meter_srtcm *)lcp->flows;
         for (i = 0, j = 0; i < TCM_FLOWS_MAX; i ++, j = (j + 1) % RTE_DIM(app_srtcm_params)){
             rte_meter_srtcm_config(&srtcm_flow[i], &app_srtcm_params[j]);
         }
@@ -107,7 +114,7 @@ tcm_configure_flow_table(struct tcm_private *private)
 
     case TCM_MODE_TRTCM_COLOR_BLIND:
     case TCM_MODE_TRTCM_COLOR_AWARE:
-        trtcm_flow = (struct rte_meter_trtcm *)private->flows;
+        trtcm_flow = (struct rte_meter_trtcm *)lcp->flows;
         for (i = 0, j = 0; i < TCM_FLOWS_MAX; i ++, j = (j + 1) % RTE_DIM(app_trtcm_params)){
             rte_meter_trtcm_config(&trtcm_flow[i], &app_trtcm_params[j]);
         }
@@ -126,7 +133,7 @@ tcm_set_pkt_color(uint8_t *pkt_data, enum policer_action color)
 }
 
 static inline int
-tcm_pkt_handle(struct tcm_private *private, struct rte_mbuf *pkt, uint64_t time)
+tcm_pkt_handle(struct tcm_lcore_private *lcp, struct rte_mbuf *pkt, uint64_t time)
 {
     uint8_t input_color, output_color;
     uint8_t flow_id;
@@ -151,23 +158,23 @@ tcm_pkt_handle(struct tcm_private *private, struct rte_mbuf *pkt, uint64_t time)
     /* color input is not used for blind modes */
     switch (tcm_mode) {
     case TCM_MODE_SRTCM_COLOR_BLIND:
-        srtcm_flow = (struct rte_meter_srtcm *)private->flows;
+        srtcm_flow = (struct rte_meter_srtcm *)lcp->flows;
         output_color = (uint8_t) rte_meter_srtcm_color_blind_check(
             &srtcm_flow[flow_id], time, pkt_len);
         break;
     case TCM_MODE_SRTCM_COLOR_AWARE:
-        srtcm_flow = (struct rte_meter_srtcm *)private->flows;
+        srtcm_flow = (struct rte_meter_srtcm *)lcp->flows;
         output_color = (uint8_t) rte_meter_srtcm_color_aware_check(
             &srtcm_flow[flow_id], time, pkt_len,
             (enum rte_meter_color) input_color);
         break;
     case TCM_MODE_TRTCM_COLOR_BLIND:
-        trtcm_flow = (struct rte_meter_trtcm *)private->flows;
+        trtcm_flow = (struct rte_meter_trtcm *)lcp->flows;
         output_color = (uint8_t) rte_meter_trtcm_color_blind_check(
             &trtcm_flow[flow_id], time, pkt_len);
         break;
     case TCM_MODE_TRTCM_COLOR_AWARE:
-        trtcm_flow = (struct rte_meter_trtcm *)private->flows;
+        trtcm_flow = (struct rte_meter_trtcm *)lcp->flows;
         output_color = (uint8_t) rte_meter_trtcm_color_aware_check(
             &trtcm_flow[flow_id], time, pkt_len,
             (enum rte_meter_color) input_color);
@@ -181,18 +188,20 @@ tcm_pkt_handle(struct tcm_private *private, struct rte_mbuf *pkt, uint64_t time)
     /* Apply policing and set the output color */
     action = policer_table[input_color][output_color];
     tcm_set_pkt_color(pkt_data, action);
+    lcp->actions[action]++;
 
     return action;
 }
 
 void tcm_receive(struct rte_mbuf *m, struct module *peer, struct module *tcm)
 {
-    uint64_t current_time = rte_rdtsc();
+    uint64_t current_time = fastpath_clock();
     struct tcm_private *private = (struct tcm_private *)tcm->private;
+    struct tcm_lcore_private *lcp = module_lcore_private(tcm);
 
     RTE_SET_USED(peer);
 
-    if (tcm_pkt_handle(private, m, current_time) == DROP) {
+    if (tcm_pkt_handle(lcp, m, current_time) == DROP) {
         rte_pktmbuf_free(m);
     } else {
         SEND_PKT(m, tcm, private->upper, PKT_DIR_RECV);
@@ -208,17 +217,50 @@ void tcm_xmit(struct rte_mbuf *m, struct module *peer, struct module *tcm)
     SEND_PKT(m, tcm, private->lower, PKT_DIR_XMIT);
 }
 
+/* Runs on each datapath lcore, the counters are only written by their owner */
+static void
+tcm_clear_stats(void *arg, unsigned lcore)
+{
+    struct module *tcm = (struct module *)arg;
+    struct tcm_lcore_private *lcp = tcm->lcore_private[lcore];
+
+    if (lcp != NULL) {
+        memset(lcp->actions, 0, sizeof(lcp->actions));
+    }
+}
+
 int tcm_handle_msg(struct module *tcm, 
     struct msg_hdr *req, struct msg_hdr *resp)
 {
-    int ret;
-    struct tcm_private *private = (struct tcm_private *)tcm->private;
-
-    RTE_SET_USED(private);
+    int ret = 0;
+    unsigned lcore;
+    struct tcm_lcore_private *lcp;
     
     resp->cmd = req->cmd;
 
     switch (req->cmd) {
+    case TCM_MSG_GET_STATS:
+        {
+            struct tcm_stats *stats = (struct tcm_stats *)resp->data;
+
+            memset(stats, 0, sizeof(struct tcm_stats));
+            MODULE_FOREACH_LCORE_PRIVATE(tcm, lcore, lcp) {
+                stats->green += lcp->actions[GREEN];
+                stats->yellow += lcp->actions[YELLOW];
+                stats->red += lcp->actions[RED];
+                stats->drop += lcp->actions[DROP];
+            }
+            resp->len = sizeof(struct tcm_stats);
+        }
+        break;
+    case TCM_MSG_CLEAR_STATS:
+        ret = control_cmd_post_all(tcm_clear_stats, tcm);
+        if (ret < 0) {
+            resp->flag = FASTPATH_MSG_FAILED;
+        } else {
+            ret = 0;
+        }
+        break;
     default:
         ret = -EINVAL;
         break;
@@ -261,6 +303,7 @@ struct module * tcm_init(uint16_t index, uint16_t mode)
 {
     struct module *tcm;
     struct tcm_private *private;
+    size_t flows_size;
 
     if (index >= ROUTE_MAX_LINK) {
         fastpath_log_error("tcm_init: invalid index %d\n", index);
@@ -292,19 +335,20 @@ struct module * tcm_init(uint16_t index, uint16_t mode)
     switch (tcm_mode) {
     case TCM_MODE_SRTCM_COLOR_BLIND:
     case TCM_MODE_SRTCM_COLOR_AWARE:
-        private->flows = rte_malloc(NULL, sizeof(struct rte_meter_srtcm) * TCM_FLOWS_MAX, 0);
+        flows_size = sizeof(struct rte_meter_srtcm) * TCM_FLOWS_MAX;
         break;
     
     case TCM_MODE_TRTCM_COLOR_BLIND:
     case TCM_MODE_TRTCM_COLOR_AWARE:
-        private->flows = rte_malloc(NULL, sizeof(struct rte_meter_trtcm) * TCM_FLOWS_MAX, 0);
-        break;
-        
     default:
+        flows_size = sizeof(struct rte_meter_trtcm) * TCM_FLOWS_MAX;
         break;
     }
 
-    if (private->flows == NULL) {
+    snprintf(tcm->name, sizeof(tcm->name), "tcm%d", index);
+
+    if (module_lcore_private_alloc(tcm, sizeof(struct tcm_lcore_private) + flows_size,
+            tcm_configure_flow_table) < 0) {
         rte_free(private);
         rte_free(tcm);
         
@@ -312,9 +356,6 @@ struct module * tcm_init(uint16_t index, uint16_t mode)
         return NULL;
     }
 
-    tcm_configure_flow_table(private);
-
-    snprintf(tcm->name, sizeof(tcm->name), "tcm%d", index);
     tcm->type = MODULE_TYPE_TCM;
     tcm->receive = tcm_receive;
     tcm->transmit = tcm_xmit;
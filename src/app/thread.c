@@ -21,61 +21,46 @@
 
 #include "include/fastpath.h"
 
+#include <sys/epoll.h>
+#include <time.h>
+
+/*
+ * The file descriptors wait in one epoll set, each with its read and
+ * write thread in m->fds. A thread taken or cancelled only marks its fd
+ * dirty, the epoll set is synced before the next wait: the usual handler
+ * adding itself back costs no system call, and a wakeup only touches the
+ * fds that are ready. Timers sit in a hierarchical wheel of
+ * THREAD_TIMER_TICK_MS ticks, a level ticking THREAD_WHEEL_SLOTS times
+ * slower than the one below; when a level comes round to a slot, its
+ * timers cascade to the levels below.
+ */
+
 /* #define DEBUG */
 
+#define THREAD_WHEEL_MASK       (THREAD_WHEEL_SLOTS - 1)
+#define THREAD_WHEEL_MAX_TICKS  \
+  ((1ULL << (THREAD_WHEEL_BITS * THREAD_WHEEL_LEVELS)) - 1)
+
+#ifdef THREAD_PROFILE
 /* Struct timeval's tv_usec one second value.  */
 #define TIMER_SECOND_MICRO 1000000L
 
-static struct timeval
-timeval_adjust (struct timeval a)
+static unsigned long
+timeval_elapsed (struct timeval a, struct timeval b)
 {
-  while (a.tv_usec >= TIMER_SECOND_MICRO)
-    {
-      a.tv_usec -= TIMER_SECOND_MICRO;
-      a.tv_sec++;
-    }
-
-  while (a.tv_usec < 0)
-    {
-      a.tv_usec += TIMER_SECOND_MICRO;
-      a.tv_sec--;
-    }
-
-  if (a.tv_sec < 0)
-    {
-      a.tv_sec = 0;
-      a.tv_usec = 10;
-    }
-
-  if (a.tv_sec > TIMER_SECOND_MICRO)
-    a.tv_sec = TIMER_SECOND_MICRO;    
-
-  return a;
+  return (((a.tv_sec - b.tv_sec) * TIMER_SECOND_MICRO)
+          + (a.tv_usec - b.tv_usec));
 }
+#endif /* THREAD_PROFILE */
 
-static struct timeval
-timeval_subtract (struct timeval a, struct timeval b)
+static unsigned long long
+thread_clock_ms (void)
 {
-  struct timeval ret;
-
-  ret.tv_usec = a.tv_usec - b.tv_usec;
-  ret.tv_sec = a.tv_sec - b.tv_sec;
-
-  return timeval_adjust (ret);
-}
+  struct timespec ts;
 
-static int
-timeval_cmp (struct timeval a, struct timeval b)
-{
-  return (a.tv_sec == b.tv_sec
-          ? a.tv_usec - b.tv_usec : a.tv_sec - b.tv_sec);
-}
+  clock_gettime (CLOCK_MONOTONIC, &ts);
 
-static unsigned long
-timeval_elapsed (struct timeval a, struct timeval b)
-{
-  return (((a.tv_sec - b.tv_sec) * TIMER_SECOND_MICRO)
-          + (a.tv_usec - b.tv_usec));
+  return (unsigned long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
 #ifdef DEBUG
@@ -92,16 +77,13 @@ static void
 thread_master_debug (struct thread_master *m)
 {
   printf ("-----------\n");
-  printf ("readlist  : ");
-  thread_list_debug (&m->read);
-  printf ("writelist : ");
-  thread_list_debug (&m->write);
-  printf ("timerlist : ");
-  thread_list_debug (&m->timer);
   printf ("eventlist : ");
   thread_list_debug (&m->event);
+  printf ("readylist : ");
+  thread_list_debug (&m->ready);
   printf ("unuselist : ");
   thread_list_debug (&m->unuse);
+  printf ("timers    : [%lu] tick [%llu]\n", m->timers, m->tick);
   printf ("total alloc: [%ld]\n", m->alloc);
   printf ("-----------\n");
 }
@@ -111,7 +93,23 @@ thread_master_debug (struct thread_master *m)
 struct thread_master *
 thread_master_create (void)
 {
-  return (struct thread_master *) rte_malloc (NULL, sizeof (struct thread_master), 0);
+  struct thread_master *m;
+
+  m = rte_zmalloc (NULL, sizeof (struct thread_master), 0);
+  if (m == NULL)
+    return NULL;
+
+  m->epfd = epoll_create1 (EPOLL_CLOEXEC);
+  if (m->epfd < 0)
+    {
+      fastpath_log_error ("epoll_create1() error: %s", strerror (errno));
+      rte_free (m);
+      return NULL;
+    }
+
+  m->base = thread_clock_ms ();
+
+  return m;
 }
 
 /* Add a new thread to the list.  */
@@ -128,22 +126,6 @@ thread_list_add (struct thread_list *list, struct thread *thread)
   list->count++;
 }
 
-/* Add a new thread just before the point.  */
-static void
-thread_list_add_before (struct thread_list *list, 
-                        struct thread *point, 
-                        struct thread *thread)
-{
-  thread->next = point;
-  thread->prev = point->prev;
-  if (point->prev)
-    point->prev->next = thread;
-  else
-    list->head = thread;
-  point->prev = thread;
-  list->count++;
-}
-
 /* Delete a thread from the list. */
 static struct thread *
 thread_list_delete (struct thread_list *list, struct thread *thread)
@@ -192,13 +174,25 @@ thread_list_free (struct thread_master *m, struct thread_list *list)
 void
 thread_master_free (struct thread_master *m)
 {
-  thread_list_free (m, &m->read);
-  thread_list_free (m, &m->write);
-  thread_list_free (m, &m->timer);
+  int i, j;
+
+  for (i = 0; i < m->n_fds; i++)
+    {
+      rte_free (m->fds[i].read);
+      rte_free (m->fds[i].write);
+    }
+
+  for (i = 0; i < THREAD_WHEEL_LEVELS; i++)
+    for (j = 0; j < THREAD_WHEEL_SLOTS; j++)
+      thread_list_free (m, &m->wheel[i][j]);
+
   thread_list_free (m, &m->event);
   thread_list_free (m, &m->ready);
   thread_list_free (m, &m->unuse);
 
+  close (m->epfd);
+  rte_free (m->fds);
+  rte_free (m->dirty);
   rte_free (m);
 }
 
@@ -275,50 +269,172 @@ thread_get (struct thread_master *m, u_char type,
   return thread;
 }
 
-/* Add new read thread. */
-struct thread *
-thread_add_read (struct thread_master *m, 
-                 int (*func) (struct thread *), void *arg, int fd)
+/* Waiting threads of fd, the table grown to hold it. */
+static struct thread_fd *
+thread_fd_get (struct thread_master *m, int fd)
+{
+  struct thread_fd *fds;
+  int *dirty;
+  int n;
+
+  if (fd < 0)
+    return NULL;
+
+  if (fd < m->n_fds)
+    return &m->fds[fd];
+
+  n = m->n_fds ? m->n_fds : 64;
+  while (n <= fd)
+    n *= 2;
+
+  fds = rte_realloc (m->fds, n * sizeof (struct thread_fd), 0);
+  if (fds == NULL)
+    return NULL;
+  m->fds = fds;
+
+  dirty = rte_realloc (m->dirty, n * sizeof (int), 0);
+  if (dirty == NULL)
+    return NULL;
+  m->dirty = dirty;
+
+  memset (&m->fds[m->n_fds], 0, (n - m->n_fds) * sizeof (struct thread_fd));
+  m->n_fds = n;
+
+  return &m->fds[fd];
+}
+
+static void
+thread_fd_dirty (struct thread_master *m, int fd)
+{
+  if (! m->fds[fd].dirty)
+    {
+      m->fds[fd].dirty = 1;
+      m->dirty[m->n_dirty++] = fd;
+    }
+}
+
+/* Bring the epoll set to the threads now waiting. */
+static void
+thread_fd_sync (struct thread_master *m)
+{
+  struct epoll_event ev;
+  struct thread_fd *tf;
+  unsigned int events;
+  int i, fd, op, ret;
+
+  for (i = 0; i < m->n_dirty; i++)
+    {
+      fd = m->dirty[i];
+      tf = &m->fds[fd];
+      tf->dirty = 0;
+
+      /* A closed fd leaves the epoll set unseen and its number may be
+         reused, so the cached events only spare the removal. */
+      events = (tf->read ? EPOLLIN : 0) | (tf->write ? EPOLLOUT : 0);
+      if (events == 0 && tf->events == 0)
+        continue;
+
+      memset (&ev, 0, sizeof (ev));
+      ev.events = events;
+      ev.data.fd = fd;
+
+      op = events == 0 ? EPOLL_CTL_DEL
+        : tf->events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+      ret = epoll_ctl (m->epfd, op, fd, &ev);
+
+      /* the fd was closed and maybe reopened since it was registered */
+      if (ret < 0 && events && errno == ENOENT)
+        ret = epoll_ctl (m->epfd, EPOLL_CTL_ADD, fd, &ev);
+      else if (ret < 0 && events && errno == EEXIST)
+        ret = epoll_ctl (m->epfd, EPOLL_CTL_MOD, fd, &ev);
+
+      if (ret < 0 && events)
+        {
+          fastpath_log_warning ("epoll_ctl() fd [%d] error: %s",
+                                fd, strerror (errno));
+          tf->events = 0;
+          continue;
+        }
+
+      tf->events = events;
+    }
+
+  m->n_dirty = 0;
+}
+
+static struct thread *
+thread_add_fd (struct thread_master *m, u_char type,
+               int (*func) (struct thread *), void *arg, int fd)
 {
+  struct thread_fd *tf;
+  struct thread **slot;
   struct thread *thread;
 
   assert (m != NULL);
 
-  if (FD_ISSET (fd, &m->readfd))
+  tf = thread_fd_get (m, fd);
+  if (tf == NULL)
+    {
+      fastpath_log_warning ("Can not wait on fd [%d]", fd);
+      return NULL;
+    }
+
+  slot = type == THREAD_READ ? &tf->read : &tf->write;
+  if (*slot)
     {
-      fastpath_log_warning ("There is already read fd [%d]", fd);
+      fastpath_log_warning ("There is already %s fd [%d]",
+                            type == THREAD_READ ? "read" : "write", fd);
       return NULL;
     }
 
-  thread = thread_get (m, THREAD_READ, func, arg);
-  FD_SET (fd, &m->readfd);
+  thread = thread_get (m, type, func, arg);
   thread->u.fd = fd;
-  thread_list_add (&m->read, thread);
+  *slot = thread;
+  thread_fd_dirty (m, fd);
 
   return thread;
 }
 
+/* Add new read thread. */
+struct thread *
+thread_add_read (struct thread_master *m, 
+                 int (*func) (struct thread *), void *arg, int fd)
+{
+  return thread_add_fd (m, THREAD_READ, func, arg, fd);
+}
+
 /* Add new write thread. */
 struct thread *
 thread_add_write (struct thread_master *m,
                  int (*func) (struct thread *), void *arg, int fd)
 {
-  struct thread *thread;
+  return thread_add_fd (m, THREAD_WRITE, func, arg, fd);
+}
 
-  assert (m != NULL);
+/* Put a timer in the lowest level whose span holds its delay. */
+static void
+thread_wheel_insert (struct thread_master *m, struct thread *thread)
+{
+  unsigned long long delta;
+  int level;
+
+  if (thread->expire < m->tick)
+    thread->expire = m->tick;
 
-  if (FD_ISSET (fd, &m->writefd))
+  delta = thread->expire - m->tick;
+  if (delta > THREAD_WHEEL_MAX_TICKS)
     {
-      fastpath_log_warning ("There is already write fd [%d]", fd);
-      return NULL;
+      delta = THREAD_WHEEL_MAX_TICKS;
+      thread->expire = m->tick + delta;
     }
 
-  thread = thread_get (m, THREAD_WRITE, func, arg);
-  FD_SET (fd, &m->writefd);
-  thread->u.fd = fd;
-  thread_list_add (&m->write, thread);
+  for (level = 0; level < THREAD_WHEEL_LEVELS - 1; level++)
+    if (delta < (1ULL << (THREAD_WHEEL_BITS * (level + 1))))
+      break;
 
-  return thread;
+  thread->slot = &m->wheel[level][(thread->expire >> (THREAD_WHEEL_BITS * level))
+                                  & THREAD_WHEEL_MASK];
+  thread_list_add (thread->slot, thread);
 }
 
 /* Add timer event thread. */
@@ -328,9 +444,7 @@ thread_add_timer (struct thread_master *m,
 {
   struct timeval timer_now;
   struct thread *thread;
-#ifndef TIMER_NO_SORT
-  struct thread *tt;
-#endif /* TIMER_NO_SORT */
+  unsigned long long now;
 
   assert (m != NULL);
 
@@ -341,19 +455,17 @@ thread_add_timer (struct thread_master *m,
   timer_now.tv_sec += timer;
   thread->u.sands = timer_now;
 
-  /* Sort by timeval. */
-#ifdef TIMER_NO_SORT
-  thread_list_add (&m->timer, thread);
-#else
-  for (tt = m->timer.head; tt; tt = tt->next)
-    if (timeval_cmp (thread->u.sands, tt->u.sands) <= 0)
-      break;
+  /* the wheel does not run while empty, catch it up */
+  now = thread_clock_ms () - m->base;
+  if (m->timers == 0)
+    m->tick = now / THREAD_TIMER_TICK_MS;
 
-  if (tt)
-    thread_list_add_before (&m->timer, tt, thread);
-  else
-    thread_list_add (&m->timer, thread);
-#endif /* TIMER_NO_SORT */
+  /* the first tick starting at or after the expiry */
+  if (timer > 0)
+    now += (unsigned long long) timer * 1000;
+  thread->expire = (now + THREAD_TIMER_TICK_MS - 1) / THREAD_TIMER_TICK_MS;
+  thread_wheel_insert (m, thread);
+  m->timers++;
 
   return thread;
 }
@@ -378,32 +490,35 @@ thread_add_event (struct thread_master *m,
 void
 thread_cancel (struct thread *thread)
 {
+  struct thread_master *m = thread->master;
+
   switch (thread->type)
     {
     case THREAD_READ:
-      assert (FD_ISSET (thread->u.fd, &thread->master->readfd));
-      FD_CLR (thread->u.fd, &thread->master->readfd);
-      thread_list_delete (&thread->master->read, thread);
+      assert (m->fds[thread->u.fd].read == thread);
+      m->fds[thread->u.fd].read = NULL;
+      thread_fd_dirty (m, thread->u.fd);
       break;
     case THREAD_WRITE:
-      assert (FD_ISSET (thread->u.fd, &thread->master->writefd));
-      FD_CLR (thread->u.fd, &thread->master->writefd);
-      thread_list_delete (&thread->master->write, thread);
+      assert (m->fds[thread->u.fd].write == thread);
+      m->fds[thread->u.fd].write = NULL;
+      thread_fd_dirty (m, thread->u.fd);
       break;
     case THREAD_TIMER:
-      thread_list_delete (&thread->master->timer, thread);
+      thread_list_delete (thread->slot, thread);
+      m->timers--;
       break;
     case THREAD_EVENT:
-      thread_list_delete (&thread->master->event, thread);
+      thread_list_delete (&m->event, thread);
       break;
     case THREAD_READY:
-      thread_list_delete (&thread->master->ready, thread);
+      thread_list_delete (&m->ready, thread);
       break;
     default:
       break;
     }
   thread->type = THREAD_UNUSED;
-  thread_add_unuse (thread->master, thread);
+  thread_add_unuse (m, thread);
 }
 
 /* Delete all events which has argument value arg. */
@@ -429,69 +544,70 @@ thread_cancel_event (struct thread_master *m, void *arg)
     }
 }
 
-#ifdef TIMER_NO_SORT
-static struct timeval *
-thread_timer_wait (struct thread_master *m, struct timeval *timer_val)
+static void
+thread_ready (struct thread_master *m, struct thread *thread)
 {
-  struct timeval timer_now;
-  struct timeval timer_min;
-  struct timeval *timer_wait;
+  thread->type = THREAD_READY;
+  thread_list_add (&m->ready, thread);
+}
 
-  gettimeofday (&timer_now, NULL);
+/* Run the wheel up to now, the expired timers made ready. */
+static void
+thread_timer_process (struct thread_master *m)
+{
+  struct thread_list *slot;
+  struct thread *thread;
+  unsigned long long now;
+  int level;
 
-  timer_wait = NULL;
-  for (thread = m->timer.head; thread; thread = thread->next)
-    {
-      if (! timer_wait)
-        timer_wait = &thread->u.sands;
-      else if (timeval_cmp (thread->u.sands, *timer_wait) < 0)
-        timer_wait = &thread->u.sands;
-    }
+  now = (thread_clock_ms () - m->base) / THREAD_TIMER_TICK_MS;
 
-  if (m->timer.head)
+  while (m->timers && m->tick <= now)
     {
-      timer_min = *timer_wait;
-      timer_min = timeval_subtract (timer_min, timer_now);
-      if (timer_min.tv_sec < 0)
+      /* the levels that come round on this tick, top down */
+      for (level = 1; level < THREAD_WHEEL_LEVELS; level++)
+        if ((m->tick & ((1ULL << (THREAD_WHEEL_BITS * level)) - 1)) != 0)
+          break;
+      while (--level > 0)
         {
-          timer_min.tv_sec = 0;
-          timer_min.tv_usec = 10;
+          slot = &m->wheel[level][(m->tick >> (THREAD_WHEEL_BITS * level))
+                                  & THREAD_WHEEL_MASK];
+          while ((thread = thread_trim_head (slot)) != NULL)
+            thread_wheel_insert (m, thread);
         }
-      timer_wait = &timer_min;
-    }
-  else
-    timer_wait = NULL;
 
-  if (timer_wait)
-    {
-      *timer_val = timer_wait;
-      return timer_val;
+      slot = &m->wheel[0][m->tick & THREAD_WHEEL_MASK];
+      while ((thread = thread_trim_head (slot)) != NULL)
+        {
+          m->timers--;
+          thread_ready (m, thread);
+        }
+
+      m->tick++;
     }
-  return NULL;
 }
-#else /* ! TIMER_NO_SORT */
-static struct timeval *
-thread_timer_wait (struct thread_master *m, struct timeval *timer_val)
+
+/* Milliseconds epoll may wait before the wheel has to run. */
+static int
+thread_timer_wait (struct thread_master *m)
 {
-  struct timeval timer_now;
-  struct timeval timer_min;
+  unsigned long long tick, end, now;
 
-  if (m->timer.head)
-    {
-      gettimeofday (&timer_now, NULL);
-      timer_min = m->timer.head->u.sands;
-      timer_min = timeval_subtract (timer_min, timer_now);
-      if (timer_min.tv_sec < 0)
-        {
-          timer_min.tv_sec = 0;
-          timer_min.tv_usec = 10;
-        }
-      *timer_val = timer_min;
-      return timer_val;
-    }
-  return NULL;
+  if (m->timers == 0)
+    return -1;
+
+  /* the next timer in level 0, else where the levels above cascade */
+  end = (m->tick | THREAD_WHEEL_MASK) + 1;
+  for (tick = m->tick; tick < end; tick++)
+    if (m->wheel[0][tick & THREAD_WHEEL_MASK].head)
+      break;
+
+  now = thread_clock_ms ();
+  if (m->base + tick * THREAD_TIMER_TICK_MS <= now)
+    return 0;
+
+  return m->base + tick * THREAD_TIMER_TICK_MS - now;
 }
-#endif /* TIMER_NO_SORT */
 
 static struct thread *
 thread_run (struct thread_master *m, struct thread *thread,
@@ -503,29 +619,33 @@ thread_run (struct thread_master *m, struct thread *thread,
   return fetch;
 }
 
-static int
-thread_process_fd (struct thread_master *m, struct thread_list *list,
-                   fd_set *fdset, fd_set *mfdset)
+/* Make the threads of the ready fds ready. */
+static void
+thread_process_fd (struct thread_master *m, struct epoll_event *events,
+                   int num)
 {
-  struct thread *thread;
-  struct thread *next;
-  int ready = 0;
+  struct thread_fd *tf;
+  int i, fd;
 
-  for (thread = list->head; thread; thread = next)
+  for (i = 0; i < num; i++)
     {
-      next = thread->next;
+      fd = events[i].data.fd;
+      tf = &m->fds[fd];
+
+      if (tf->read && (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+        {
+          thread_ready (m, tf->read);
+          tf->read = NULL;
+          thread_fd_dirty (m, fd);
+        }
 
-      if (FD_ISSET (THREAD_FD (thread), fdset))
+      if (tf->write && (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
         {
-          assert (FD_ISSET (THREAD_FD (thread), mfdset));
-          FD_CLR(THREAD_FD (thread), mfdset);
-          thread_list_delete (list, thread);
-          thread_list_add (&m->ready, thread);
-          thread->type = THREAD_READY;
-          ready++;
+          thread_ready (m, tf->write);
+          tf->write = NULL;
+          thread_fd_dirty (m, fd);
         }
     }
-  return ready;
 }
 
 /* Fetch next ready thread. */
@@ -533,18 +653,8 @@ struct thread *
 thread_fetch (struct thread_master *m, struct thread *fetch)
 {
   int num;
-  int ready;
   struct thread *thread;
-  fd_set readfd;
-  fd_set writefd;
-  fd_set exceptfd;
-  struct timeval timer_now;
-  struct timeval timer_val;
-  struct timeval *timer_wait;
-  struct timeval timer_nowait;
-
-  timer_nowait.tv_sec = 0;
-  timer_nowait.tv_usec = 0;
+  struct epoll_event events[THREAD_EPOLL_EVENTS];
 
   while (1)
     {
@@ -553,52 +663,31 @@ thread_fetch (struct thread_master *m, struct thread *fetch)
         return thread_run (m, thread, fetch);
 
       /* Execute timer.  */
-      gettimeofday (&timer_now, NULL);
-
-      for (thread = m->timer.head; thread; thread = thread->next)
-        if (timeval_cmp (timer_now, thread->u.sands) >= 0)
-          {
-            thread_list_delete (&m->timer, thread);
-            return thread_run (m, thread, fetch);
-          }
+      thread_timer_process (m);
 
       /* If there are any ready threads, process top of them.  */
       if ((thread = thread_trim_head (&m->ready)) != NULL)
         return thread_run (m, thread, fetch);
 
-      /* Structure copy.  */
-      readfd = m->readfd;
-      writefd = m->writefd;
-      exceptfd = m->exceptfd;
-
-      /* Calculate select wait timer. */
-      timer_wait = thread_timer_wait (m, &timer_val);
-
-      num = select (FD_SETSIZE, &readfd, &writefd, &exceptfd, timer_wait);
+      thread_fd_sync (m);
 
-      if (num == 0)
-        continue;
+      num = epoll_wait (m->epfd, events, THREAD_EPOLL_EVENTS,
+                        thread_timer_wait (m));
 
       if (num < 0)
         {
           if (errno == EINTR)
             continue;
 
-          fastpath_log_warning ("select() error: %s", strerror (errno));
+          fastpath_log_warning ("epoll_wait() error: %s", strerror (errno));
           return NULL;
         }
 
-      /* Normal priority read thead. */
-      ready = thread_process_fd (m, &m->read, &readfd, &m->readfd);
-
-      /* Write thead. */
-      ready = thread_process_fd (m, &m->write, &writefd, &m->writefd);
-
-      if ((thread = thread_trim_head (&m->ready)) != NULL)
-        return thread_run (m, thread, fetch);
+      thread_process_fd (m, events, num);
     }
 }
 
+#ifdef THREAD_PROFILE
 static unsigned long
 thread_consumed_time (RUSAGE_T *now, RUSAGE_T *start)
 {
@@ -615,35 +704,37 @@ thread_consumed_time (RUSAGE_T *now, RUSAGE_T *start)
 
   return thread_time;
 }
+#endif /* THREAD_PROFILE */
 
 /* We should aim to yield after THREAD_YIELD_TIME_SLOT
    milliseconds.  */
 int
 thread_should_yield (struct thread *thread)
 {
-  RUSAGE_T ru;
-
-  GETRUSAGE (&ru);
-
-  if (thread_consumed_time (&ru, &thread->ru) > THREAD_YIELD_TIME_SLOT)
+  if ((thread_clock_ms () - thread->start) * 1000 > THREAD_YIELD_TIME_SLOT)
     return 1;
   else
     return 0;
 }
 
-/* We check thread consumed time. If the system has getrusage, we'll
-   use that to get indepth stats on the performance of the thread.  If
-   not - we'll use gettimeofday for some guestimation.  */
+/* With THREAD_PROFILE, we check thread consumed time. If the system has
+   getrusage, we'll use that to get indepth stats on the performance of
+   the thread.  If not - we'll use gettimeofday for some guestimation.  */
 void
 thread_call (struct thread *thread)
 {
+#ifdef THREAD_PROFILE
   unsigned long thread_time;
   RUSAGE_T ru;
 
   GETRUSAGE (&thread->ru);
+#endif /* THREAD_PROFILE */
+
+  thread->start = thread_clock_ms ();
 
   (*thread->func) (thread);
 
+#ifdef THREAD_PROFILE
   GETRUSAGE (&ru);
 
   thread_time = thread_consumed_time (&ru, &thread->ru);
@@ -660,6 +751,7 @@ thread_call (struct thread *thread)
                 (unsigned long) thread->func,
                 thread_time / 1000L);
     }
+#endif /* THREAD_PROFILE */
 }
 
 /* Execute thread */
@@ -0,0 +1,169 @@
+
+#include "include/fastpath.h"
+
+/*
+ * Hierarchical timer wheel, one per lcore: TIMER_LEVELS wheels of
+ * TIMER_SLOTS slots, a level ticking TIMER_SLOTS times slower than the
+ * one below. A timer goes in the lowest level whose span holds its delay,
+ * in the slot of its expiry; when a level comes round to a slot, its
+ * timers cascade to the levels below, so each is moved at most once per
+ * level. Delays past the top level are clamped to it.
+ */
+#define TIMER_LEVEL_BITS    6
+#define TIMER_SLOTS         (1 << TIMER_LEVEL_BITS)
+#define TIMER_SLOT_MASK     (TIMER_SLOTS - 1)
+#define TIMER_LEVELS        4
+#define TIMER_MAX_TICKS     ((1ULL << (TIMER_LEVEL_BITS * TIMER_LEVELS)) - 1)
+
+LIST_HEAD(fastpath_timer_list, fastpath_timer);
+
+struct timer_wheel {
+    uint64_t tick;          /* the next tick to run */
+    uint64_t next_tsc;      /* when it is due */
+    struct fastpath_timer_list slots[TIMER_LEVELS][TIMER_SLOTS];
+} __rte_cache_aligned;
+
+struct fastpath_clock fastpath_clocks[FASTPATH_MAX_LCORES];
+
+static struct timer_wheel *timer_wheels[FASTPATH_MAX_LCORES];
+static uint64_t timer_tick_tsc;
+
+void fastpath_timer_init_lcores(void)
+{
+    unsigned lcore;
+
+    timer_tick_tsc = rte_get_tsc_hz() / US_PER_S * FASTPATH_TIMER_TICK_US;
+    if (timer_tick_tsc == 0) {
+        timer_tick_tsc = 1;
+    }
+
+    RTE_LCORE_FOREACH(lcore) {
+        timer_wheels[lcore] = rte_zmalloc_socket(NULL, sizeof(struct timer_wheel),
+            RTE_CACHE_LINE_SIZE, rte_lcore_to_socket_id(lcore));
+        if (timer_wheels[lcore] == NULL) {
+            rte_panic("Cannot create timer wheel for lcore %u\n", lcore);
+        }
+
+        fastpath_clocks[lcore].now = rte_rdtsc();
+    }
+}
+
+static void
+timer_wheel_insert(struct timer_wheel *w, struct fastpath_timer *timer)
+{
+    uint64_t delta;
+    uint32_t level;
+
+    if (timer->expire < w->tick) {
+        timer->expire = w->tick;
+    }
+
+    delta = timer->expire - w->tick;
+    if (delta > TIMER_MAX_TICKS) {
+        delta = TIMER_MAX_TICKS;
+        timer->expire = w->tick + delta;
+    }
+
+    for (level = 0; level < TIMER_LEVELS - 1; level++) {
+        if (delta < (1ULL << (TIMER_LEVEL_BITS * (level + 1)))) {
+            break;
+        }
+    }
+
+    LIST_INSERT_HEAD(&w->slots[level][(timer->expire >> (TIMER_LEVEL_BITS * level)) &
+        TIMER_SLOT_MASK], timer, entry);
+}
+
+void fastpath_timer_init(struct fastpath_timer *timer, fastpath_timer_fn fn, void *arg)
+{
+    memset(timer, 0, sizeof(*timer));
+    timer->fn = fn;
+    timer->arg = arg;
+}
+
+/* Fire fn in at least us on the calling lcore, again if already pending */
+void fastpath_timer_add(struct fastpath_timer *timer, uint64_t us)
+{
+    struct timer_wheel *w = timer_wheels[rte_lcore_id()];
+    uint64_t ticks = (us + FASTPATH_TIMER_TICK_US - 1) / FASTPATH_TIMER_TICK_US;
+
+    if (timer->pending) {
+        LIST_REMOVE(timer, entry);
+    }
+
+    /* never the tick being run, a timer adding itself would loop */
+    timer->expire = w->tick + (ticks != 0 ? ticks : 1);
+    timer->pending = 1;
+    timer_wheel_insert(w, timer);
+}
+
+/* On the lcore it was added on */
+void fastpath_timer_del(struct fastpath_timer *timer)
+{
+    if (timer->pending) {
+        LIST_REMOVE(timer, entry);
+        timer->pending = 0;
+    }
+}
+
+static void
+timer_wheel_cascade(struct timer_wheel *w, uint32_t level)
+{
+    struct fastpath_timer_list *slot;
+    struct fastpath_timer *timer;
+
+    slot = &w->slots[level][(w->tick >> (TIMER_LEVEL_BITS * level)) & TIMER_SLOT_MASK];
+    while ((timer = LIST_FIRST(slot)) != NULL) {
+        LIST_REMOVE(timer, entry);
+        timer_wheel_insert(w, timer);
+    }
+}
+
+static void
+timer_wheel_run(struct timer_wheel *w)
+{
+    struct fastpath_timer_list *slot;
+    struct fastpath_timer *timer;
+    uint32_t level;
+
+    /* the levels that come round on this tick, top down */
+    for (level = 1; level < TIMER_LEVELS; level++) {
+        if ((w->tick & ((1ULL << (TIMER_LEVEL_BITS * level)) - 1)) != 0) {
+            break;
+        }
+    }
+    while (--level > 0) {
+        timer_wheel_cascade(w, level);
+    }
+
+    slot = &w->slots[0][w->tick & TIMER_SLOT_MASK];
+    while ((timer = LIST_FIRST(slot)) != NULL) {
+        LIST_REMOVE(timer, entry);
+        timer->pending = 0;
+        timer->fn(timer, timer->arg);
+    }
+
+    w->tick++;
+}
+
+/* Once per loop of a datapath lcore: refresh its clock, fire what expired */
+void fastpath_timer_manage(unsigned lcore)
+{
+    struct timer_wheel *w = timer_wheels[lcore];
+    uint64_t now = rte_rdtsc();
+
+    fastpath_clocks[lcore].now = now;
+
+    if (likely(now < w->next_tsc)) {
+        return;
+    }
+
+    if (unlikely(w->next_tsc == 0)) {
+        w->next_tsc = now;
+    }
+
+    while (w->next_tsc <= now) {
+        timer_wheel_run(w);
+        w->next_tsc += timer_tick_tsc;
+    }
+}
@@ -3,16 +3,93 @@
 
 struct vlan_private {
     uint16_t vid;
+    uint16_t inner_vid;     /* C-VID of a QinQ sub-interface, 0 if none */
+    uint16_t port;
     uint16_t reserved;
     struct module *lower;
     struct module *upper;
 };
 
-struct module *vlan_modules[VLAN_VID_MAX];
+struct vlan_demux *vlan_demux_create(int socket)
+{
+    struct vlan_demux *demux;
+
+    demux = rte_zmalloc_socket(NULL, sizeof(struct vlan_demux),
+        RTE_CACHE_LINE_SIZE, socket);
+    if (demux == NULL) {
+        return NULL;
+    }
+
+    demux->socket = socket;
+
+    return demux;
+}
+
+static struct vlan_demux_block *
+vlan_demux_block_get(struct vlan_demux *demux, uint16_t vid)
+{
+    struct vlan_demux_block *block;
+
+    block = demux->blocks[vid >> VLAN_DEMUX_BLOCK_BITS];
+    if (block != NULL) {
+        return block;
+    }
+
+    block = rte_zmalloc_socket(NULL, sizeof(struct vlan_demux_block),
+        RTE_CACHE_LINE_SIZE, demux->socket);
+    if (block == NULL) {
+        return NULL;
+    }
+
+    /* publish the block only once it is zeroed */
+    rte_wmb();
+    demux->blocks[vid >> VLAN_DEMUX_BLOCK_BITS] = block;
+
+    return block;
+}
+
+int vlan_demux_add(struct vlan_demux *demux, uint16_t vid, uint16_t inner_vid,
+    struct module *sub)
+{
+    struct vlan_demux_block *block;
+    uint16_t idx = vid & (VLAN_DEMUX_BLOCK_SIZE - 1);
+
+    if (vid > VLAN_VID_MASK || inner_vid > VLAN_VID_MASK) {
+        return -EINVAL;
+    }
+
+    block = vlan_demux_block_get(demux, vid);
+    if (block == NULL) {
+        return -ENOMEM;
+    }
+
+    if (inner_vid != 0) {
+        if (block->inner[idx] == NULL) {
+            struct vlan_demux *inner = vlan_demux_create(demux->socket);
+            if (inner == NULL) {
+                return -ENOMEM;
+            }
+
+            rte_wmb();
+            block->inner[idx] = inner;
+        }
+
+        return vlan_demux_add(block->inner[idx], inner_vid, 0, sub);
+    }
+
+    if (block->sub[idx] != NULL) {
+        return -EEXIST;
+    }
+
+    block->sub[idx] = sub;
+
+    return 0;
+}
 
 void vlan_receive(struct rte_mbuf *m, struct module *peer, struct module *vlan)
 {
-    struct vlan_hdr  *vlan_hdr;
+    uint8_t *mac_header;
+    uint16_t strip;
     struct vlan_private *private = (struct vlan_private *)vlan->private;
     struct fastpath_pkt_metadata *c =
         (struct fastpath_pkt_metadata *)RTE_MBUF_METADATA_UINT8_PTR(m, 0);
@@ -21,43 +98,120 @@ void vlan_receive(struct rte_mbuf *m, struct module *peer, struct module *vlan)
 
     fastpath_log_debug("vlan %s receive packet\n", vlan->name);
 
-    vlan_hdr = rte_pktmbuf_mtod(m, struct vlan_hdr *);
-    c->protocol = rte_be_to_cpu_16(vlan_hdr->eth_proto);
+    /*
+     * Strip the tags the NIC did not, leaving the packet as hardware
+     * stripping would: untagged header, outer tci in vlan_tci. The
+     * parser already took the tcis and the inner ether type.
+     */
+    strip = 0;
+    if (!(m->ol_flags & PKT_RX_VLAN_PKT)) {
+        m->ol_flags |= PKT_RX_VLAN_PKT;
+        strip += sizeof(struct vlan_hdr);
+    }
+    if (c->flags & FASTPATH_PKT_F_QINQ) {
+        strip += sizeof(struct vlan_hdr);
+    }
 
-    rte_pktmbuf_adj(m, (uint16_t)sizeof(struct vlan_hdr));
-#if 0
-    memmove(rte_pktmbuf_mtod(m, char *) - sizeof(struct ether_hdr), 
-        rte_pktmbuf_mtod(m, char *) - sizeof(struct ether_hdr) - sizeof(struct vlan_hdr), 
-        2 * sizeof(struct ether_addr));
-#endif
+    if (strip != 0) {
+        mac_header = FASTPATH_PKT_HDR(m, c->l2_off);
+        rte_pktmbuf_adj(m, strip);
+        memmove(mac_header + strip, mac_header, 2 * sizeof(struct ether_addr));
+        c->l2_off += strip;
+    }
+    c->flags |= FASTPATH_PKT_F_STRIPPED;
 
-    SEND_PKT(m, vlan, private->upper, PKT_DIR_RECV);
+    SEND_PKT_DIRECT(m, vlan, private->upper, PKT_DIR_RECV,
+        MODULE_TYPE_BRIDGE, bridge_receive);
     
     return;
 }
 
 void vlan_xmit(struct rte_mbuf *m, struct module *peer, struct module *vlan)
 {
-    struct ether_hdr *eth_hdr;
-    struct vlan_hdr  *vlan_hdr;
     struct vlan_private *private = (struct vlan_private *)vlan->private;
 
     RTE_SET_USED(peer);
 
     fastpath_log_debug("vlan %s add 8021q tag %d to packet\n", vlan->name, private->vid);
+
+    /* the C-tag always goes in first, the outer tag may be offloaded */
+    if (private->inner_vid != 0 && vlan_tag_insert(m, private->inner_vid) < 0) {
+        fastpath_log_debug("vlan %s no headroom for tag, drop\n", vlan->name);
+        rte_pktmbuf_free(m);
+        return;
+    }
+
+    if (fastpath.tx_offload[private->port] & DEV_TX_OFFLOAD_VLAN_INSERT) {
+        m->ol_flags |= PKT_TX_VLAN_PKT;
+        m->vlan_tci = private->vid;
+    } else if (vlan_tag_insert(m, private->vid) < 0) {
+        fastpath_log_debug("vlan %s no headroom for tag, drop\n", vlan->name);
+        rte_pktmbuf_free(m);
+        return;
+    }
+
+    SEND_PKT_DIRECT(m, vlan, private->lower, PKT_DIR_XMIT,
+        MODULE_TYPE_ETHERNET, ethernet_xmit);
     
-    rte_pktmbuf_prepend(m, (uint16_t)sizeof(struct vlan_hdr));
-    memmove(rte_pktmbuf_mtod(m, void *), 
-        rte_pktmbuf_mtod(m, char *) + sizeof(struct vlan_hdr), 
+    return;
+}
+
+int vlan_tag_insert(struct rte_mbuf *m, uint16_t tci)
+{
+    struct ether_hdr *eth_hdr;
+    struct vlan_hdr  *vlan_hdr;
+
+    if (rte_pktmbuf_prepend(m, (uint16_t)sizeof(struct vlan_hdr)) == NULL) {
+        return -ENOSPC;
+    }
+
+    memmove(rte_pktmbuf_mtod(m, void *),
+        rte_pktmbuf_mtod(m, char *) + sizeof(struct vlan_hdr),
         2 * sizeof(struct ether_addr));
     eth_hdr = rte_pktmbuf_mtod(m, struct ether_hdr *);
     eth_hdr->ether_type = rte_cpu_to_be_16(ETHER_TYPE_VLAN);
     vlan_hdr = (struct vlan_hdr *)(eth_hdr + 1);
-    vlan_hdr->vlan_tci = rte_cpu_to_be_16(private->vid);
-    
-    SEND_PKT(m, vlan, private->lower, PKT_DIR_XMIT);
-    
-    return;
+    vlan_hdr->vlan_tci = rte_cpu_to_be_16(tci);
+
+    /* keep the TX checksum offsets pointing at the network header */
+    if (m->ol_flags & PKT_TX_IP_CKSUM) {
+        m->l2_len += sizeof(struct vlan_hdr);
+    }
+
+    return 0;
+}
+
+/*
+ * Put back a tag stripped on receive before the packet leaves the
+ * datapath for the kernel, which expects the frame as it was received.
+ */
+int vlan_tag_restore(struct rte_mbuf *m)
+{
+    struct fastpath_pkt_metadata *c =
+        (struct fastpath_pkt_metadata *)RTE_MBUF_METADATA_UINT8_PTR(m, 0);
+
+    if (!(m->ol_flags & PKT_RX_VLAN_PKT)) {
+        return 0;
+    }
+
+    m->ol_flags &= ~PKT_RX_VLAN_PKT;
+
+    /* the C-tag is still in the frame unless vlan_receive took it */
+    if ((c->flags & (FASTPATH_PKT_F_QINQ | FASTPATH_PKT_F_STRIPPED)) ==
+        (FASTPATH_PKT_F_QINQ | FASTPATH_PKT_F_STRIPPED) &&
+        vlan_tag_insert(m, c->inner_vlan_tci) < 0) {
+        return -ENOSPC;
+    }
+
+    return vlan_tag_insert(m, m->vlan_tci);
+}
+
+void vlan_get_key(struct module *vlan, uint16_t *vid, uint16_t *inner_vid)
+{
+    struct vlan_private *private = (struct vlan_private *)vlan->private;
+
+    *vid = private->vid;
+    *inner_vid = private->inner_vid;
 }
 
 int vlan_connect(struct module *local, struct module *peer, void *param)
@@ -78,10 +232,9 @@ int vlan_connect(struct module *local, struct module *peer, void *param)
     if (peer->type == MODULE_TYPE_BRIDGE) {
         private->upper = peer;
     } else if (peer->type == MODULE_TYPE_ETHERNET) {
-        uint16_t vid = *(uint16_t *)param;
         private->lower = peer;
 
-        peer->connect(peer, local, &vid);
+        return peer->connect(peer, local, NULL);
     } else {
         fastpath_log_error("vlan_connect: invalid peer type %d\n", peer->type);
         return -ENOENT;
@@ -90,17 +243,18 @@ int vlan_connect(struct module *local, struct module *peer, void *param)
     return 0;
 }
 
-struct module* vlan_init(uint16_t port, uint16_t vid)
+struct module* vlan_init(uint16_t port, uint16_t vid, uint16_t inner_vid)
 {
     struct module *vlan;
     struct vlan_private *private;
+    int len;
 
-    if (vid > VLAN_VID_MASK) {
-        fastpath_log_error("vlan_init: invalid vid %d\n", vid);
+    if (vid > VLAN_VID_MASK || inner_vid > VLAN_VID_MASK) {
+        fastpath_log_error("vlan_init: invalid vid %d.%d\n", vid, inner_vid);
         return NULL;
     }
 
-    fastpath_log_info("vlan_init: vlan %d\n", vid);
+    fastpath_log_info("vlan_init: port %d vlan %d inner %d\n", port, vid, inner_vid);
     
     vlan = rte_zmalloc(NULL, sizeof(struct module), 0);
     if (vlan == NULL) {
@@ -120,14 +274,28 @@ struct module* vlan_init(uint16_t port, uint16_t vid)
     vlan->transmit = vlan_xmit;
     vlan->connect = vlan_connect;
     vlan->type = MODULE_TYPE_VLAN;
-    snprintf(vlan->name, sizeof(vlan->name), "vEth%d.%d", port, vid);
+    if (inner_vid != 0) {
+        len = snprintf(vlan->name, sizeof(vlan->name), "vEth%d.%d.%d", port, vid, inner_vid);
+    } else {
+        len = snprintf(vlan->name, sizeof(vlan->name), "vEth%d.%d", port, vid);
+    }
+
+    /* the name of the kernel device too, it must not be cut */
+    if (len >= (int)sizeof(vlan->name)) {
+        rte_free(private);
+        rte_free(vlan);
+
+        fastpath_log_error("vlan_init: name of port %d vlan %d.%d too long\n",
+            port, vid, inner_vid);
+        return NULL;
+    }
     
     private->vid = vid;
+    private->inner_vid = inner_vid;
+    private->port = port;
     
     vlan->private = (void *)private;
 
-    vlan_modules[vid] = vlan;
-
     return vlan;
 }
 
@@ -1,26 +1,39 @@
-#include <sys/types.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <unistd.h>
-#include <string.h>
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-
-#define IPv4(a,b,c,d) ((uint32_t)(((a) & 0xff) << 24) | \
-					   (((b) & 0xff) << 16) | \
-					   (((c) & 0xff) << 8)  | \
-					   ((d) & 0xff))
-					   
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "mgmt.h"
+
+/*
+ * Route table benchmark of the bulk management protocol: installs n /24
+ * routes from 1.0.0.0 in batches, keeping up to window batches unacked,
+ * and reports the rate; with -d removes them the same way after. The
+ * fastpath holds FASTPATH_MAX_LPM_RULES routes, 1M by default, so larger
+ * runs need it raised; a run short of n applied fails.
+ */
+
+#define IPv4(a,b,c,d) ((uint32_t)(((a) & 0xff) << 24) | \
+                       (((b) & 0xff) << 16) | \
+                       (((c) & 0xff) << 8)  | \
+                       ((d) & 0xff))
+
 struct msg_hdr {
     char path[32];
     uint8_t flag;
     uint8_t cmd;
     uint16_t len;
     uint8_t data[0];
-};
-
+};
+
 enum {
     ROUTE_MSG_ADD_NEIGH,
     ROUTE_MSG_DEL_NEIGH,
@@ -28,12 +41,8 @@ enum {
     ROUTE_MSG_DEL_NH,
     ROUTE_MSG_ADD_NH6,
     ROUTE_MSG_DEL_NH6,
-};
-
-#define NEIGH_TYPE_LOCAL        1
-#define NEIGH_TYPE_REACHABLE    2
-#define NEIGH_TYPE_UNRESOLVED   3
-
+};
+
 struct route_add {
     uint32_t ip;
     uint8_t depth;
@@ -46,145 +55,288 @@ struct route_del {
     uint8_t depth;
 };
 
-struct route6_add {
-    uint8_t ip[16];
-    uint8_t depth;
-    uint8_t nh_ip[16];
+#define BENCH_MAX_ROUTES    (1 << 23)
+
+struct bench {
+    int fd;
+    uint32_t n;
+    uint32_t batch;
+    uint32_t window;
+    uint16_t flags;
+    uint32_t nh_ip;
     uint32_t nh_iface;
+
+    uint8_t *out;           /* the batch being sent */
+    uint32_t out_len;
+    uint32_t out_off;
+    struct mgmt_ack ack;    /* the ack being read */
+    uint32_t ack_len;
 };
 
-struct route6_del {
-    uint8_t ip[16];
-    uint8_t depth;
-};
-
-struct arp_add {
-    uint32_t nh_ip;
-    uint32_t nh_iface;
-    uint16_t type;
-    uint8_t nh_arp[6];
-};
-
-struct arp_del {
-    uint32_t nh_ip;
-    uint32_t nh_iface;
-};
-
-void print_route_cmd()
-{
-    printf("ROUTE_MSG_ADD_NEIGH: %d\n", ROUTE_MSG_ADD_NEIGH);
-    printf("ROUTE_MSG_DEL_NEIGH: %d\n", ROUTE_MSG_DEL_NEIGH);
-    printf("ROUTE_MSG_ADD_NH: %d\n", ROUTE_MSG_ADD_NH);
-    printf("ROUTE_MSG_DEL_NH: %d\n", ROUTE_MSG_DEL_NH);
-    printf("ROUTE_MSG_ADD_NH6: %d\n", ROUTE_MSG_ADD_NH6);
-    printf("ROUTE_MSG_DEL_NH6: %d\n", ROUTE_MSG_DEL_NH6);
-}
-
-int assemble_data(char *data)
-{
-    int length;
-    struct msg_hdr *req;
-
-    req = (struct msg_hdr *)data;
-    
-    length = sizeof(struct msg_hdr);
-
-    printf("dest module\n");
-    scanf("%s", req->path);
-
-    if (strcmp(req->path, "route") == 0) {
-        print_route_cmd();
-        scanf("%d", &req->cmd);
-
-        switch (req->cmd) {
-        case ROUTE_MSG_ADD_NEIGH:
-            {
-                struct arp_add *add = (struct arp_add *)req->data;
-                
-                req->len = sizeof(struct arp_add);
-                length += sizeof(struct arp_add);
-
-                add->nh_ip = htonl(IPv4(192,168,101,100));
-                add->nh_iface = htonl(1);
-
-                add->type = htons(NEIGH_TYPE_REACHABLE);
-                add->nh_arp[0] = 0x00;
-                add->nh_arp[1] = 0x01;
-                add->nh_arp[2] = 0x02;
-                add->nh_arp[3] = 0x03;
-                add->nh_arp[4] = 0x04;
-                add->nh_arp[5] = 0x05;
-            }
-            break;
-            
-        case ROUTE_MSG_ADD_NH:
-            {
-                struct route_add *rt_add = (struct route_add *)req->data;
-                
-                req->len = sizeof(struct route_add);
-                length += sizeof(struct route_add);
-
-                rt_add->ip = htonl(IPv4(0,0,0,0));
-                rt_add->depth = 0;
-                rt_add->nh_ip = htonl(IPv4(192,168,101,100));
-                rt_add->nh_iface = htonl(1);
-            }
-            break;
-
-        default:
-            break;
-        }
-    }
-
-    printf("assemble cmd %d length %d\n", req->cmd, length);
-
-    return length;
-}
-
-int disassemble_data(char *data)
-{
-    struct msg_hdr *resp = (struct msg_hdr *)data;
-
-    printf("rcv msg from %s cmd %d flag %x\n", resp->path, resp->cmd, resp->flag);
-
-    return 0;
-}
-
-int main()
-{
-    int sockfd, length, ret;
-    socklen_t sklen;
-    char req[1024] = {0};
-    struct sockaddr_in serveraddr;
-    
-    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sockfd < 0) {
-        printf("open socket failed\n");
-        exit(1);
-    }
-
-    sklen = sizeof(struct sockaddr_in);
-
-    bzero(&serveraddr, sizeof(serveraddr));
-    serveraddr.sin_family = AF_INET;
-    serveraddr.sin_port = htons(4567);
-    inet_aton("127,0,0,1", &serveraddr.sin_addr.s_addr);
-
-    while (1) {
-        memset(req, 0, sizeof(req));
-        length = assemble_data(req);
-
-        ret = sendto(sockfd, req, length, 0, 
-            (struct sockaddr *)&serveraddr, sklen);
-        if (ret != length) {
-            printf("send to failed\n");
-            exit(1);
-        }
-
-        ret = recvfrom(sockfd, req, 1024, 0, (struct sockaddr *)&serveraddr, &sklen);
-        disassemble_data(req);
-    }
-    
-    return 0;
-}
-
+static uint32_t
+build_batch(struct bench *b, uint8_t cmd, uint32_t seq, uint32_t first, uint32_t count)
+{
+    struct mgmt_hdr *hdr = (struct mgmt_hdr *)b->out;
+    struct mgmt_tlv *tlv;
+    struct msg_hdr *req;
+    uint32_t i, off = sizeof(struct mgmt_hdr);
+    uint16_t vlen;
+
+    for (i = 0; i < count; i++) {
+        uint32_t ip = IPv4(1,0,0,0) + ((first + i) << 8);
+
+        tlv = (struct mgmt_tlv *)(b->out + off);
+        req = (struct msg_hdr *)(tlv + 1);
+        memset(req, 0, sizeof(struct msg_hdr));
+        strcpy(req->path, "route");
+        req->cmd = cmd;
+
+        if (cmd == ROUTE_MSG_ADD_NH) {
+            struct route_add *add = (struct route_add *)req->data;
+
+            memset(add, 0, sizeof(struct route_add));
+            add->ip = htonl(ip);
+            add->depth = 24;
+            add->nh_ip = htonl(b->nh_ip);
+            add->nh_iface = htonl(b->nh_iface);
+            req->len = sizeof(struct route_add);
+        } else {
+            struct route_del *del = (struct route_del *)req->data;
+
+            memset(del, 0, sizeof(struct route_del));
+            del->ip = htonl(ip);
+            del->depth = 24;
+            req->len = sizeof(struct route_del);
+        }
+
+        vlen = sizeof(struct msg_hdr) + req->len;
+        tlv->type = htons(MGMT_TLV_MSG);
+        tlv->len = htons(vlen);
+        off += sizeof(struct mgmt_tlv) + MGMT_TLV_ALIGN(vlen);
+    }
+
+    hdr->len = htonl(off);
+    hdr->seq = htonl(seq);
+    hdr->type = htons(MGMT_MSG_BATCH);
+    hdr->flags = htons(b->flags);
+    hdr->count = htonl(count);
+
+    return off;
+}
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Send every route with cmd, 0 when all the batches were acked */
+static int
+run(struct bench *b, uint8_t cmd, const char *name)
+{
+    uint32_t batches = (b->n + b->batch - 1) / b->batch;
+    uint32_t sent = 0, acked = 0, applied = 0, failed = 0;
+    struct pollfd pfd;
+    double start, elapsed;
+    ssize_t ret;
+
+    b->out_len = 0;
+    b->out_off = 0;
+    b->ack_len = 0;
+
+    start = now_sec();
+
+    while (acked < batches) {
+        int can_send = b->out_off < b->out_len ||
+            (sent < batches && sent - acked < b->window);
+
+        pfd.fd = b->fd;
+        pfd.events = POLLIN | (can_send ? POLLOUT : 0);
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            return -1;
+        }
+
+        if (pfd.revents & (POLLERR | POLLHUP)) {
+            printf("connection closed by the fastpath\n");
+            return -1;
+        }
+
+        if ((pfd.revents & POLLOUT) && can_send) {
+            if (b->out_off == b->out_len) {
+                uint32_t first = sent * b->batch;
+                uint32_t count = b->n - first < b->batch ? b->n - first : b->batch;
+
+                b->out_len = build_batch(b, cmd, sent, first, count);
+                b->out_off = 0;
+                sent++;
+            }
+
+            ret = send(b->fd, b->out + b->out_off, b->out_len - b->out_off,
+                MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (ret < 0 && errno != EAGAIN && errno != EINTR) {
+                perror("send");
+                return -1;
+            }
+            if (ret > 0) {
+                b->out_off += ret;
+            }
+        }
+
+        if (pfd.revents & POLLIN) {
+            ret = recv(b->fd, (uint8_t *)&b->ack + b->ack_len,
+                sizeof(struct mgmt_ack) - b->ack_len, MSG_DONTWAIT);
+            if (ret == 0) {
+                printf("connection closed by the fastpath\n");
+                return -1;
+            }
+            if (ret < 0 && errno != EAGAIN && errno != EINTR) {
+                perror("recv");
+                return -1;
+            }
+            if (ret > 0) {
+                b->ack_len += ret;
+            }
+
+            if (b->ack_len == sizeof(struct mgmt_ack)) {
+                int32_t status = (int32_t)ntohl(b->ack.status);
+
+                if (ntohs(b->ack.hdr.type) != MGMT_MSG_ACK || ntohl(b->ack.hdr.seq) != acked) {
+                    printf("unexpected ack seq %u\n", ntohl(b->ack.hdr.seq));
+                    return -1;
+                }
+
+                if (status != 0) {
+                    if (failed++ < 8) {
+                        printf("batch %u failed at %u: %s\n", acked,
+                            ntohl(b->ack.failed), strerror(-status));
+                    }
+                }
+
+                applied += ntohl(b->ack.applied);
+                acked++;
+                b->ack_len = 0;
+            }
+        }
+    }
+
+    elapsed = now_sec() - start;
+
+    printf("%s: %u routes, %u applied, %u of %u batches failed, %.3f s, %.0f ops/s\n",
+        name, b->n, applied, failed, batches, elapsed,
+        elapsed > 0 ? applied / elapsed : 0);
+
+    if (applied < b->n) {
+        printf("%s: FAILED, %u of %u routes not applied, see the fastpath log "
+            "(FASTPATH_MAX_LPM_RULES)\n", name, b->n - applied, b->n);
+        return 1;
+    }
+
+    return failed ? 1 : 0;
+}
+
+static void
+usage(const char *prog)
+{
+    printf("usage: %s [-s socket] [-n routes] [-b batch] [-w window] [-g gateway] "
+        "[-i iface] [-a] [-d]\n"
+        "  -a  atomic batches\n"
+        "  -d  delete the routes after\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    struct bench b;
+    struct sockaddr_un addr;
+    struct in_addr gw;
+    const char *path = MGMT_SOCKET_PATH;
+    int opt, del = 0, ret;
+
+    memset(&b, 0, sizeof(b));
+    b.n = 100000;
+    b.batch = 1000;
+    b.window = 8;
+    b.nh_ip = IPv4(192,168,101,100);
+    b.nh_iface = 1;
+
+    while ((opt = getopt(argc, argv, "s:n:b:w:g:i:adh")) != -1) {
+        switch (opt) {
+        case 's':
+            path = optarg;
+            break;
+        case 'n':
+            b.n = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            b.batch = strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            b.window = strtoul(optarg, NULL, 0);
+            break;
+        case 'g':
+            if (inet_aton(optarg, &gw) == 0) {
+                usage(argv[0]);
+                exit(1);
+            }
+            b.nh_ip = ntohl(gw.s_addr);
+            break;
+        case 'i':
+            b.nh_iface = strtoul(optarg, NULL, 0);
+            break;
+        case 'a':
+            b.flags |= MGMT_F_ATOMIC;
+            break;
+        case 'd':
+            del = 1;
+            break;
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    if (b.n == 0 || b.n > BENCH_MAX_ROUTES || b.batch == 0 || b.window == 0 ||
+        sizeof(struct mgmt_hdr) + (uint64_t)b.batch * 64 > MGMT_MAX_MSG) {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    /* the largest operation, an add, rounded up */
+    b.out = malloc(sizeof(struct mgmt_hdr) + (size_t)b.batch * 64);
+    if (b.out == NULL) {
+        printf("out of memory\n");
+        exit(1);
+    }
+
+    b.fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (b.fd < 0) {
+        printf("open socket failed\n");
+        exit(1);
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+    if (connect(b.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        printf("connect to %s failed: %s\n", path, strerror(errno));
+        exit(1);
+    }
+
+    ret = run(&b, ROUTE_MSG_ADD_NH, "add");
+    if (ret >= 0 && del) {
+        ret = run(&b, ROUTE_MSG_DEL_NH, "del");
+    }
+
+    close(b.fd);
+    free(b.out);
+
+    return ret == 0 ? 0 : 1;
+}